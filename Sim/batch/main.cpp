@@ -0,0 +1,385 @@
+// Headless batch runner
+//
+// Reads netlists from files or stdin (several per stream, each closed by .end, see sim/Netlist.h)
+// and runs them on a work stealing thread pool while the input is still being read. Every worker
+// keeps its own Circuit, reader and result writer and reuses them job after job. A result is written
+// as one JSON line the moment its job finishes, so the output is in completion order; "job" is the
+// position of the netlist in the input. Circuits failing the structural check (sim/Structure.h) are
+// reported with the offending elements and nodes, nothing is factored for them.
+//
+// SchemeBatch [--threads N] [--max-pending N] [file ...]      (no file or "-" reads stdin)
+//
+// N threads run jobs, the reading thread among them : a pool of N - 1 workers, none for N = 1, where
+// every job runs on the reading thread as it is read. Exit code is 1 if any job failed or an input
+// couldn't be opened.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <complex>
+#include <cstring>
+#include <cstdio>
+#include <numbers>
+
+#include "base/Timer.h"
+#include "base/ThreadPool.h"
+#include "sim/Scheme.h"
+#include "sim/Netlist.h"
+#include "sim/Structure.h"
+#include "sim/ACAnalysis.h"
+#include "helpers/JsonWriter.h"
+
+
+struct Job
+{
+	size_t index;
+	std::string source;	// File name and netlist number, when there is no .title
+	std::string text;
+};
+
+
+// Reused job after job by the thread that owns it
+struct WorkerState
+{
+	Circuit circuit;
+	NetlistReader reader;
+	JsonWriter json{ false };
+	std::vector<double> minimum;
+	std::vector<double> maximum;
+};
+
+
+class BatchRunner
+{
+	std::unique_ptr<ThreadPool> m_Pool;						// None when the submitting thread runs every job
+	std::vector<std::unique_ptr<WorkerState>> m_Workers;	// Pool workers, then the submitting thread
+
+	std::mutex m_OutputLock;
+	std::atomic<size_t> m_Pending = 0;
+	std::atomic<size_t> m_NumFailed = 0;
+	size_t m_NumJobs = 0;
+	size_t m_MaxPending;
+
+	void RunJob(const Job& job, WorkerState& state);
+	void WriteOp(WorkerState& state);
+	void WriteTran(WorkerState& state);
+	void WriteAC(WorkerState& state);
+	void WriteStructure(WorkerState& state);
+
+public:
+
+	BatchRunner(size_t numThreads, size_t maxPending);
+
+	void Submit(Job job);
+	void Finish()
+	{
+		if (m_Pool)
+			m_Pool->Wait();
+	}
+
+	// The submitting thread included
+	size_t GetNumThreads() const { return m_Workers.size(); }
+	size_t GetNumJobs() const { return m_NumJobs; }
+	size_t GetNumFailed() const { return m_NumFailed; }
+};
+
+
+BatchRunner::BatchRunner(size_t numThreads, size_t maxPending)
+	: m_MaxPending(maxPending)
+{
+	// The submitting thread runs jobs too, so the pool gets one thread less
+	if (numThreads > 1)
+		m_Pool = std::make_unique<ThreadPool>(numThreads - 1);
+
+	for (size_t i = 0; i < std::max<size_t>(numThreads, 1); i++)
+		m_Workers.push_back(std::make_unique<WorkerState>());
+}
+
+
+void BatchRunner::Submit(Job job)
+{
+	if (!m_Pool)
+	{
+		m_NumJobs++;
+		RunJob(job, *m_Workers[0]);
+		return;
+	}
+
+	// Bounds the netlists held in memory, the reading thread works off the queue meanwhile
+	while (m_Pending.load() >= m_MaxPending)
+	{
+		if (!m_Pool->RunPendingTask())
+			std::this_thread::yield();
+	}
+
+	m_Pending++;
+	m_NumJobs++;
+
+	m_Pool->Submit([this, job = std::move(job)]()
+	{
+		RunJob(job, *m_Workers[m_Pool->GetCurrentWorker()]);
+		m_Pending--;
+	});
+}
+
+
+void BatchRunner::WriteOp(WorkerState& state)
+{
+	state.circuit.UpdateSolution();
+
+	JsonWriter& json = state.json;
+	json.Key("voltages").BeginObject();
+	for (const auto& [name, node] : state.reader.GetProbes())
+		json.Key(name).Value(node->GetVoltage());
+	json.EndObject();
+}
+
+
+void BatchRunner::WriteTran(WorkerState& state)
+{
+	const NetlistAnalysis& analysis = state.reader.GetAnalysis();
+	const auto& probes = state.reader.GetProbes();
+
+	// Starts from the operating point
+	state.circuit.UpdateSolution();
+	state.circuit.SetStep(analysis.step);
+
+	state.minimum.assign(probes.size(), std::numeric_limits<double>::infinity());
+	state.maximum.assign(probes.size(), -std::numeric_limits<double>::infinity());
+
+	size_t numSteps = size_t(analysis.stop / analysis.step + 0.5);
+	for (size_t step = 0; step < numSteps; step++)
+	{
+		state.circuit.Step();
+
+		for (size_t p = 0; p < probes.size(); p++)
+		{
+			double voltage = probes[p].second->GetVoltage();
+			state.minimum[p] = std::min(state.minimum[p], voltage);
+			state.maximum[p] = std::max(state.maximum[p], voltage);
+		}
+	}
+
+	JsonWriter& json = state.json;
+	json.Key("steps").Value(u64(numSteps));
+	json.Key("probes").BeginObject();
+	for (size_t p = 0; p < probes.size(); p++)
+	{
+		json.Key(probes[p].first).BeginObject();
+		json.Key("final").Value(probes[p].second->GetVoltage());
+		json.Key("min").Value(state.minimum[p]);
+		json.Key("max").Value(state.maximum[p]);
+		json.EndObject();
+	}
+	json.EndObject();
+}
+
+
+void BatchRunner::WriteAC(WorkerState& state)
+{
+	const NetlistAnalysis& analysis = state.reader.GetAnalysis();
+
+	// Jobs already run in parallel, the sweep of one job stays on its thread
+	ACAnalysis ac(state.circuit);
+	ac.Sweep(ACAnalysis::LogSweep(analysis.startHz, analysis.stopHz, analysis.numPoints));
+
+	JsonWriter& json = state.json;
+	json.Key("frequencies").BeginArray();
+	for (size_t point = 0; point < ac.GetNumPoints(); point++)
+		json.Value(ac.GetFrequency(point));
+	json.EndArray();
+
+	json.Key("probes").BeginObject();
+	for (const auto& [name, node] : state.reader.GetProbes())
+	{
+		json.Key(name).BeginObject();
+
+		json.Key("mag").BeginArray();
+		for (size_t point = 0; point < ac.GetNumPoints(); point++)
+			json.Value(std::abs(ac.GetNodeVoltage(point, node)));
+		json.EndArray();
+
+		json.Key("phase_deg").BeginArray();
+		for (size_t point = 0; point < ac.GetNumPoints(); point++)
+			json.Value(std::arg(ac.GetNodeVoltage(point, node)) * 180.0 / std::numbers::pi);
+		json.EndArray();
+
+		json.EndObject();
+	}
+	json.EndObject();
+}
+
+
+void BatchRunner::WriteStructure(WorkerState& state)
+{
+	JsonWriter& json = state.json;
+	json.Key("error").Value("bad circuit structure");
+	json.Key("issues").BeginArray();
+	for (const StructureIssue& issue : state.circuit.GetStructureCheck()->GetIssues())
+	{
+		json.BeginObject();
+		json.Key("type").Value(StructureCheck::GetIssueName(issue.type));
+
+		json.Key("elements").BeginArray();
+		for (size_t element : issue.elements)
+			json.Value(state.reader.GetElementName(element));
+		json.EndArray();
+
+		json.Key("nodes").BeginArray();
+		for (size_t node : issue.nodes)
+			json.Value(state.reader.GetNodeName(state.circuit.GetNode(node)));
+		json.EndArray();
+
+		json.EndObject();
+	}
+	json.EndArray();
+}
+
+
+void BatchRunner::RunJob(const Job& job, WorkerState& state)
+{
+	Timer timer = Timer::StartNew();
+
+	state.circuit.Clear();
+	state.json.Clear();
+
+	JsonWriter& json = state.json;
+	json.BeginObject();
+	json.Key("job").Value(u64(job.index));
+
+	bool parsed = state.reader.Parse(job.text, state.circuit);
+	json.Key("name").Value(state.reader.GetTitle().empty() ? job.source : state.reader.GetTitle());
+
+	// Fails bad circuits before anything is factored
+	bool ok = parsed && state.circuit.CheckStructure();
+
+	if (ok)
+	{
+		static const char* s_AnalysisNames[] = { "op", "tran", "ac" };
+		const NetlistAnalysis& analysis = state.reader.GetAnalysis();
+		json.Key("analysis").Value(s_AnalysisNames[size_t(analysis.type)]);
+		json.Key("nodes").Value(u64(state.circuit.GetNumNodes()));
+		json.Key("elements").Value(u64(state.circuit.GetNumElements()));
+
+		switch (analysis.type)
+		{
+		case eAnalysisType::Op:		WriteOp(state); break;
+		case eAnalysisType::Tran:	WriteTran(state); break;
+		case eAnalysisType::AC:		WriteAC(state); break;
+		}
+	}
+	else
+	{
+		if (parsed)
+			WriteStructure(state);
+		else
+			json.Key("error").Value(state.reader.GetError());
+		m_NumFailed++;
+	}
+
+	timer.Stop();
+	json.Key("ok").Value(ok);
+	json.Key("ms").Value(timer.GetElapsedSeconds() * 1e3);
+	json.EndObject();
+
+	std::lock_guard guard(m_OutputLock);
+	std::fwrite(json.GetString().data(), 1, json.GetString().size(), stdout);
+	std::fputc('\n', stdout);
+	std::fflush(stdout);
+}
+
+
+// Splits the stream on .end lines and submits every netlist as soon as it is complete
+static void ReadJobs(std::istream& in, const std::string& name, BatchRunner& runner, size_t& index)
+{
+	std::string line;
+	std::string text;
+	size_t numInStream = 0;
+
+	auto submit = [&]()
+	{
+		runner.Submit({ index++, name + ":" + std::to_string(++numInStream), std::move(text) });
+		text.clear();
+	};
+
+	while (std::getline(in, line))
+	{
+		text += line;
+		text += '\n';
+
+		if (NetlistReader::IsEndLine(line))
+			submit();
+	}
+
+	// Last netlist without .end
+	if (text.find_first_not_of(" \t\r\n") != std::string::npos)
+		submit();
+}
+
+
+int main(int argc, char** argv)
+{
+	size_t numThreads = 0;
+	size_t maxPending = 0;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!std::strcmp(argv[i], "--threads") && i + 1 < argc)
+			numThreads = size_t(std::max(1, std::atoi(argv[++i])));
+		else if (!std::strcmp(argv[i], "--max-pending") && i + 1 < argc)
+			maxPending = size_t(std::max(1, std::atoi(argv[++i])));
+		else if (argv[i][0] == '-' && argv[i][1] == '-')
+		{
+			std::cerr << "usage : " << argv[0] << " [--threads N] [--max-pending N] [file ...]" << std::endl;
+			return 1;
+		}
+		else
+			inputs.push_back(argv[i]);
+	}
+
+	if (inputs.empty())
+		inputs.push_back("-");
+
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	BatchRunner runner(numThreads, maxPending ? maxPending : numThreads * 16);
+	Timer timer = Timer::StartNew();
+
+	size_t index = 0;
+	size_t numUnread = 0;
+	for (const std::string& input : inputs)
+	{
+		if (input == "-")
+		{
+			ReadJobs(std::cin, "stdin", runner, index);
+			continue;
+		}
+
+		std::ifstream file(input);
+		if (!file)
+		{
+			std::cerr << "Can't open " << input << std::endl;
+			numUnread++;
+			continue;
+		}
+		ReadJobs(file, input, runner, index);
+	}
+
+	runner.Finish();
+	timer.Stop();
+
+	double seconds = timer.GetElapsedSeconds();
+	std::cerr << runner.GetNumJobs() << " jobs, " << runner.GetNumFailed() << " failed, " << seconds * 1e3 << " ms, "
+		<< double(runner.GetNumJobs()) / std::max(seconds, 1e-9) << " jobs/s on " << runner.GetNumThreads() << " threads" << std::endl;
+	if (numUnread)
+		std::cerr << numUnread << " of " << inputs.size() << " inputs couldn't be opened" << std::endl;
+
+	return runner.GetNumFailed() || numUnread ? 1 : 0;
+}
@@ -0,0 +1,1581 @@
+// Headless benchmark of the simulation core
+// 
+// Builds synthetic circuits of growing size and times every phase of a solve:
+// build, assemble, factor, solve, readback and branch currents. The report is written as JSON.
+// The AC sweep of an RLC ladder is timed separately for a growing number of threads (--only ac_sweep).
+// Runs on more threads than the hardware has are not made, "hardware_threads" tells how far a scaling run went.
+// The mixed signal run drives a resistive load from a bank of digital ripple counters (--only digital).
+// Serial and pooled assembly of a random mesh are compared for time and bit identity (--only assembly).
+// A transient run resumed from a checkpoint is compared with the uninterrupted one (--only checkpoint).
+// Scope envelopes of a short and a very long trace are timed against each other (--only waveform).
+// Revisited states of an edited mesh are served by the solution cache and checked against solves (--only solution_cache).
+// Thousands of random edits are recorded, undone and redone, the history is weighed against the circuit (--only history).
+// Diode models are evaluated one device at a time and as a batch, for up to a million junctions (--only nonlinear).
+// Power grid meshes of up to a million nodes are solved by multigrid, against plain CG and the direct solver (--only multigrid).
+// RC meshes are reduced to a few dozen states and stepped against the full mesh under multigrid (--only reduction).
+// Coupled RC blocks are stepped by waveform relaxation on 1, 2, 4 ... threads, against one monolithic solve (--only relaxation).
+// Current flow dots of a lattice of 100k wires are advanced and emitted as quads at a few zoom levels (--only current_flow).
+// 
+// SchemeBench [--quick] [--repeat N] [--only <generator>] [--out <file>] [--trace <file>] [--summary] [--allocs]
+// 
+// --trace writes the recorded phases as Chrome trace JSON, --summary prints the phase table to stderr.
+// Both need a build with SM_PROFILE_ENABLED.
+// --allocs prints heap allocations per phase, needs a build with SM_ALLOC_TRACKING.
+
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <filesystem>
+#include <random>
+
+#include "base/Timer.h"
+#include "base/Profiler.h"
+#include "sim/Scheme.h"
+#include "sim/CircuitGenerators.h"
+#include "sim/ACAnalysis.h"
+#include "sim/Digital.h"
+#include "sim/Checkpoint.h"
+#include "sim/Waveform.h"
+#include "sim/SolutionCache.h"
+#include "sim/History.h"
+#include "sim/Nonlinear.h"
+#include "sim/Multigrid.h"
+#include "sim/Reduction.h"
+#include "sim/Relaxation.h"
+#include "sim/CurrentFlow.h"
+#include "base/ThreadPool.h"
+#include "helpers/JsonWriter.h"
+#include "vendor/Eigen/IterativeLinearSolvers"
+
+
+enum BenchPhase
+{
+	PHASE_BUILD,
+	PHASE_ASSEMBLE,
+	PHASE_FACTOR,
+	PHASE_SOLVE,
+	PHASE_READBACK,
+	PHASE_CURRENTS,
+	PHASE_COUNT
+};
+
+static const char* s_PhaseNames[PHASE_COUNT] = { "build", "assemble", "factor", "solve", "readback", "currents" };
+
+
+struct Workload
+{
+	const char* name;
+	const char* param; // Meaning of the size parameter
+	std::function<void(Circuit&, size_t)> generate;
+	std::vector<size_t> sizes;
+	std::vector<size_t> quickSizes;
+	double step = 0.0; // Transient step, 0 is a DC solve
+};
+
+
+struct PhaseTimes
+{
+	std::vector<double> samples; // Seconds
+
+	double Min() const { return *std::min_element(samples.begin(), samples.end()); }
+
+	double Median() const
+	{
+		std::vector<double> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		return sorted[sorted.size() / 2];
+	}
+};
+
+
+struct RunResult
+{
+	size_t size = 0;
+	size_t numNodes = 0;
+	size_t numElements = 0;
+	size_t numUnknowns = 0;
+	PhaseTimes phases[PHASE_COUNT];
+	SolverStats stats;
+};
+
+
+// Thread counts of a scaling run : 1, 2, 4 ... up to the hardware threads
+static size_t GetHardwareThreads(JsonWriter& json)
+{
+	size_t hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+	json.Key("hardware_threads").Value(u64(hardwareThreads));
+	return hardwareThreads;
+}
+
+
+static RunResult RunWorkload(const Workload& workload, size_t size, int repeat)
+{
+	RunResult result;
+	result.size = size;
+
+	for (int i = 0; i < repeat; i++)
+	{
+		Circuit circuit;
+
+		Timer timer = Timer::StartNew();
+		workload.generate(circuit, size);
+		circuit.SetStep(workload.step);
+		timer.Stop();
+		result.phases[PHASE_BUILD].samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		circuit.AssembleMatrix();
+		timer.Stop();
+		result.phases[PHASE_ASSEMBLE].samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		circuit.FactorMatrix();
+		timer.Stop();
+		result.phases[PHASE_FACTOR].samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		circuit.SolveMatrix();
+		timer.Stop();
+		result.phases[PHASE_SOLVE].samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		circuit.ReadbackVoltages();
+		timer.Stop();
+		result.phases[PHASE_READBACK].samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		circuit.ComputeBranchCurrents();
+		timer.Stop();
+		result.phases[PHASE_CURRENTS].samples.push_back(timer.GetElapsedSeconds());
+
+		result.numNodes = circuit.GetNumNodes();
+		result.numElements = circuit.GetNumElements();
+		result.numUnknowns = circuit.GetMatrix().GetNumNodes();
+		result.stats = circuit.GetMatrix().GetStats();
+	}
+
+	return result;
+}
+
+
+// Least squares slope of log(time) over log(unknowns), e.g. ~3 for a dense factorization
+static double ScalingExponent(const std::vector<RunResult>& runs, int phase)
+{
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	int n = 0;
+
+	for (const RunResult& run : runs)
+	{
+		double t = run.phases[phase].Median();
+		if (run.numUnknowns < 2 || t <= 0.0)
+			continue;
+
+		double x = std::log(double(run.numUnknowns));
+		double y = std::log(t);
+		sx += x; sy += y; sxx += x * x; sxy += x * y;
+		n++;
+	}
+
+	double denom = n * sxx - sx * sx;
+	if (n < 2 || denom == 0.0)
+		return NAN;
+
+	return (n * sxy - sx * sy) / denom;
+}
+
+
+static void WriteRun(JsonWriter& json, const RunResult& run)
+{
+	json.BeginObject();
+	json.Key("size").Value(u64(run.size));
+	json.Key("nodes").Value(u64(run.numNodes));
+	json.Key("elements").Value(u64(run.numElements));
+	json.Key("unknowns").Value(u64(run.numUnknowns));
+
+	double total = 0.0;
+	json.Key("phases").BeginObject();
+	for (int phase = 0; phase < PHASE_COUNT; phase++)
+	{
+		const PhaseTimes& times = run.phases[phase];
+		total += times.Median();
+
+		json.Key(s_PhaseNames[phase]).BeginObject();
+		json.Key("min_ms").Value(times.Min() * 1e3);
+		json.Key("median_ms").Value(times.Median() * 1e3);
+		json.EndObject();
+	}
+	json.EndObject();
+
+	double solveTime = run.phases[PHASE_FACTOR].Median() + run.phases[PHASE_SOLVE].Median();
+
+	json.Key("total_ms").Value(total * 1e3);
+	json.Key("throughput").BeginObject();
+	json.Key("elements_per_sec_build").Value(run.numElements / run.phases[PHASE_BUILD].Median());
+	json.Key("elements_per_sec_assemble").Value(run.numElements / run.phases[PHASE_ASSEMBLE].Median());
+	json.Key("unknowns_per_sec_solve").Value(run.numUnknowns / solveTime);
+	json.Key("solves_per_sec").Value(1.0 / total);
+	json.EndObject();
+
+	json.Key("solver").BeginObject();
+	json.Key("nnz").Value(run.stats.nnz);
+	json.Key("factor_nnz").Value(run.stats.factorNnz);
+	json.Key("fill_in").Value(run.stats.fillIn);
+	json.Key("rank").Value(run.stats.rank);
+	json.Key("pivot_growth").Value(run.stats.pivotGrowth);
+	json.Key("condition_estimate").Value(run.stats.conditionEstimate);
+	json.Key("iterations").Value(u64(run.stats.iterations));
+	json.EndObject();
+
+	json.EndObject();
+}
+
+
+// Same sweep with 1, 2, 4 ... threads, the speedup shows how well the points spread over the cores
+static void WriteACSweep(JsonWriter& json, bool quick, int repeat)
+{
+	size_t numSections = quick ? 64 : 500;
+	size_t numPoints = quick ? 50 : 1000;
+
+	Circuit circuit;
+	CircuitGen::RlcLadder(circuit, numSections);
+
+	ACAnalysis analysis(circuit);
+	analysis.Analyze();
+	std::vector<double> frequencies = ACAnalysis::LogSweep(10.0, 1e6, numPoints);
+
+	json.Key("ac_sweep").BeginObject();
+
+	std::vector<size_t> threadCounts;
+	size_t maxThreads = GetHardwareThreads(json);
+	for (size_t n = 1; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	json.Key("sections").Value(u64(numSections));
+	json.Key("points").Value(u64(numPoints));
+	json.Key("unknowns").Value(u64(analysis.GetNumUnknowns()));
+	json.Key("nnz").Value(u64(analysis.GetPatternNnz()));
+	json.Key("runs").BeginArray();
+
+	double serialTime = 0.0;
+	for (size_t numThreads : threadCounts)
+	{
+		// The caller helps too, so a pool of n - 1 workers runs on n threads
+		std::unique_ptr<ThreadPool> pool = numThreads > 1 ? std::make_unique<ThreadPool>(numThreads - 1) : nullptr;
+
+		PhaseTimes times;
+		for (int i = 0; i < repeat; i++)
+		{
+			Timer timer = Timer::StartNew();
+			analysis.Sweep(frequencies, pool.get());
+			timer.Stop();
+			times.samples.push_back(timer.GetElapsedSeconds());
+		}
+
+		double median = times.Median();
+		if (numThreads == 1)
+			serialTime = median;
+
+		json.BeginObject();
+		json.Key("threads").Value(u64(numThreads));
+		json.Key("median_ms").Value(median * 1e3);
+		json.Key("points_per_sec").Value(double(numPoints) / median);
+		json.Key("speedup").Value(serialTime / median);
+		json.EndObject();
+
+		std::cerr << "ac_sweep " << numThreads << " threads : " << median * 1e3 << " ms" << std::endl;
+	}
+
+	json.EndArray();
+	json.EndObject();
+}
+
+
+// Counters of 2 gates per bit (flip-flop, inverter), the top bit of each one drives a divider that a
+// logic input reads back. Analog solves only happen when a top bit flips
+static void WriteDigital(JsonWriter& json, bool quick)
+{
+	size_t numCounters = quick ? 50 : 500;
+	size_t numBits = 12;
+	size_t numCycles = quick ? 1000 : 10000;
+	u32 halfPeriod = 5000; // Ticks of 1 ns, 100 kHz
+
+	DigitalEngine engine;
+	Circuit circuit;
+	MixedSignalSim mixed(circuit, engine);
+	eNode* ground = circuit.CreateNode();
+
+	NetId clock = engine.AddNet();
+	engine.AddClock(clock, halfPeriod);
+
+	for (size_t k = 0; k < numCounters; k++)
+	{
+		NetId bitClock = clock;
+		NetId q = 0;
+		for (size_t b = 0; b < numBits; b++)
+		{
+			q = engine.AddNet();
+			NetId qn = engine.AddNet();
+			engine.AddGate(eGateType::DFlipFlop, { qn, bitClock }, q, 2);
+			engine.AddGate(eGateType::Not, { q }, qn, 1);
+			bitClock = qn;
+		}
+
+		eNode* out = circuit.CreateNode();
+		eNode* mid = circuit.CreateNode();
+
+		eLogicOutput* driver = mixed.AddOutput(q, 0.0, 5.0, 100.0);
+		circuit.Connect(driver->GetEpin(0), out);
+		circuit.Connect(driver->GetEpin(1), ground);
+
+		eResistor* top = circuit.AddResistor(1000.0);
+		circuit.Connect(top->GetEpin(0), out);
+		circuit.Connect(top->GetEpin(1), mid);
+
+		eResistor* bottom = circuit.AddResistor(1000.0);
+		circuit.Connect(bottom->GetEpin(0), mid);
+		circuit.Connect(bottom->GetEpin(1), ground);
+
+		eLogicInput* input = mixed.AddInput(engine.AddNet(), 1.0, 1.5);
+		circuit.Connect(input->GetEpin(0), mid);
+		circuit.Connect(input->GetEpin(1), ground);
+	}
+
+	engine.Finalize();
+	mixed.Initialize();
+
+	Timer timer = Timer::StartNew();
+	mixed.Advance(double(numCycles) * 2.0 * halfPeriod * engine.GetTickSeconds());
+	timer.Stop();
+
+	double seconds = timer.GetElapsedSeconds();
+
+	json.Key("digital").BeginObject();
+	json.Key("gates").Value(u64(engine.GetNumGates()));
+	json.Key("nets").Value(u64(engine.GetNumNets()));
+	json.Key("analog_unknowns").Value(u64(circuit.GetMatrix().GetNumNodes()));
+	json.Key("clock_cycles").Value(u64(numCycles));
+	json.Key("events").Value(engine.GetNumEvents());
+	json.Key("evaluations").Value(engine.GetNumEvaluations());
+	json.Key("analog_solves").Value(mixed.GetNumAnalogSolves());
+	json.Key("ms").Value(seconds * 1e3);
+	json.Key("events_per_sec").Value(double(engine.GetNumEvents()) / seconds);
+	json.EndObject();
+
+	std::cerr << "digital : " << engine.GetNumEvents() << " events, " << mixed.GetNumAnalogSolves() << " analog solves, "
+		<< seconds * 1e3 << " ms" << std::endl;
+}
+
+
+// The pooled assembly has to reproduce the serial matrix bit for bit, random values make the summation
+// order of every slot matter
+static void WriteAssembly(JsonWriter& json, bool quick, int repeat)
+{
+	size_t numNodes = quick ? 2000 : 4000;
+
+	json.Key("assembly").BeginObject();
+	size_t numThreads = GetHardwareThreads(json);
+	ThreadPool pool(std::max<size_t>(numThreads, 2) - 1);
+
+	Circuit serial;
+	Circuit pooled;
+	CircuitGen::RandomMesh(serial, numNodes, 4);
+	CircuitGen::RandomMesh(pooled, numNodes, 4);
+	pooled.SetThreadPool(&pool);
+
+	PhaseTimes serialTimes;
+	PhaseTimes pooledTimes;
+	for (int i = 0; i < repeat; i++)
+	{
+		Timer timer = Timer::StartNew();
+		serial.AssembleMatrix();
+		timer.Stop();
+		serialTimes.samples.push_back(timer.GetElapsedSeconds());
+
+		timer.Restart();
+		pooled.AssembleMatrix();
+		timer.Stop();
+		pooledTimes.samples.push_back(timer.GetElapsedSeconds());
+	}
+
+	CircuitMtx& a = serial.GetMatrix();
+	CircuitMtx& b = pooled.GetMatrix();
+	bool identical = a.GetMatrix().size() == b.GetMatrix().size() &&
+		!std::memcmp(a.GetMatrix().data(), b.GetMatrix().data(), sizeof(double) * a.GetMatrix().size()) &&
+		!std::memcmp(a.GetVector().data(), b.GetVector().data(), sizeof(double) * a.GetVector().size());
+
+	json.Key("nodes").Value(u64(numNodes));
+	json.Key("elements").Value(u64(serial.GetNumElements()));
+	json.Key("unknowns").Value(u64(a.GetNumNodes()));
+	json.Key("threads").Value(u64(pool.GetNumThreads() + 1));
+	json.Key("parallel").Value(pooled.UsesParallelAssembly());
+	json.Key("serial_ms").Value(serialTimes.Median() * 1e3);
+	json.Key("pooled_ms").Value(pooledTimes.Median() * 1e3);
+	json.Key("speedup").Value(serialTimes.Median() / pooledTimes.Median());
+	json.Key("bit_identical").Value(identical);
+	json.EndObject();
+
+	std::cerr << "assembly " << serial.GetNumElements() << " elements : serial " << serialTimes.Median() * 1e3 << " ms, "
+		<< pool.GetNumThreads() + 1 << " threads " << pooledTimes.Median() * 1e3 << " ms, " << (identical ? "identical" : "MISMATCH") << std::endl;
+}
+
+
+// Runs an RLC ladder, checkpoints it halfway and resumes the checkpoint in a second circuit built the
+// same way. Both halves have to end on the same voltages, bit for bit
+static void WriteCheckpoint(JsonWriter& json, bool quick)
+{
+	size_t numSections = quick ? 64 : 400;
+	size_t numSteps = quick ? 200 : 1000;
+
+	Circuit original;
+	Circuit resumed;
+	CircuitGen::RlcLadder(original, numSections);
+	CircuitGen::RlcLadder(resumed, numSections);
+
+	Simulation simulation(original);
+	simulation.SetStep(1e-6);
+	simulation.RunSteps(numSteps);
+
+	std::vector<u8> blob;
+	Timer timer = Timer::StartNew();
+	Checkpoint::Capture(simulation, blob);
+	timer.Stop();
+	double captureTime = timer.GetElapsedSeconds();
+
+	// Background write, the capture is all the solver waits for
+	std::string path = std::filesystem::path(std::filesystem::temp_directory_path() / "schemebench.ckpt").string();
+	CheckpointThread writer;
+	timer.Restart();
+	writer.Save(simulation, path);
+	timer.Stop();
+	double saveTime = timer.GetElapsedSeconds();
+
+	simulation.RunSteps(numSteps);
+	writer.Wait();
+
+	std::vector<u8> fromFile;
+	bool fileOk = writer.GetNumWritten() == 1 && Checkpoint::ReadFile(path, fromFile) && fromFile == blob;
+	std::filesystem::remove(path);
+
+	Simulation restarted(resumed);
+	timer.Restart();
+	bool restored = Checkpoint::Restore(restarted, fromFile);
+	timer.Stop();
+	double restoreTime = timer.GetElapsedSeconds();
+	restarted.RunSteps(numSteps);
+
+	bool identical = restored && restarted.GetTime() == simulation.GetTime();
+	for (size_t i = 0; identical && i < original.GetNumNodes(); i++)
+		identical = original.GetNode(i)->GetVoltage() == resumed.GetNode(i)->GetVoltage();
+
+	json.Key("checkpoint").BeginObject();
+	json.Key("sections").Value(u64(numSections));
+	json.Key("unknowns").Value(u64(original.GetMatrix().GetNumNodes()));
+	json.Key("bytes").Value(u64(blob.size()));
+	json.Key("capture_ms").Value(captureTime * 1e3);
+	json.Key("async_save_ms").Value(saveTime * 1e3);
+	json.Key("restore_ms").Value(restoreTime * 1e3);
+	json.Key("file_ok").Value(fileOk);
+	json.Key("bit_identical").Value(identical);
+	json.EndObject();
+
+	std::cerr << "checkpoint " << blob.size() << " bytes : capture " << captureTime * 1e3 << " ms, restore "
+		<< restoreTime * 1e3 << " ms, " << (identical ? "identical" : "MISMATCH") << std::endl;
+}
+
+
+// A frame of the scope is one envelope per pixel column, it should cost the same for a thousand samples
+// as for a hundred million. Spot checked against a plain scan of the samples
+static void WriteWaveform(JsonWriter& json, bool quick, int repeat)
+{
+	constexpr size_t NumColumns = 1920;
+	const u64 sizes[] = { 1000, quick ? u64(1) << 20 : u64(100'000'000) };
+
+	json.Key("waveform").BeginArray();
+	std::vector<Waveform::Extent> columns(NumColumns);
+
+	for (u64 numSamples : sizes)
+	{
+		Waveform waveform(1e-6);
+		u32 seed = 12345;
+		Timer timer = Timer::StartNew();
+		for (u64 i = 0; i < numSamples; i++)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			waveform.Append(float(std::sin(double(i) * 1e-3)) + float(seed >> 8) * 1e-8f);
+		}
+		timer.Stop();
+		double appendTime = timer.GetElapsedSeconds();
+
+		// The whole trace, then a window of a hundredth of it in the middle
+		double duration = waveform.GetEndTime();
+		double windows[2][2] = { { 0.0, duration }, { duration * 0.495, duration * 0.01 } };
+		PhaseTimes times[2];
+		for (int w = 0; w < 2; w++)
+		{
+			for (int i = 0; i < repeat; i++)
+			{
+				timer.Restart();
+				waveform.GetEnvelope(windows[w][0], windows[w][1], NumColumns, columns.data());
+				timer.Stop();
+				times[w].samples.push_back(timer.GetElapsedSeconds());
+			}
+		}
+
+		bool exact = true;
+		for (u64 c = 0; c < NumColumns; c += NumColumns / 8)
+		{
+			u64 begin = c * numSamples / NumColumns;
+			u64 end = std::min(numSamples, begin + 100000);
+			Waveform::Extent range = waveform.GetRange(begin, end);
+			float min = waveform.GetSample(begin);
+			float max = min;
+			for (u64 i = begin; i < end; i++)
+			{
+				min = std::min(min, waveform.GetSample(i));
+				max = std::max(max, waveform.GetSample(i));
+			}
+			exact = exact && range.min == min && range.max == max;
+		}
+
+		json.BeginObject();
+		json.Key("samples").Value(numSamples);
+		json.Key("levels").Value(u64(waveform.GetNumLevels()));
+		json.Key("append_ns_per_sample").Value(appendTime * 1e9 / double(numSamples));
+		json.Key("columns").Value(u64(NumColumns));
+		json.Key("full_view_us").Value(times[0].Median() * 1e6);
+		json.Key("zoomed_view_us").Value(times[1].Median() * 1e6);
+		json.Key("exact").Value(exact);
+		json.EndObject();
+
+		std::cerr << "waveform " << numSamples << " samples : full view " << times[0].Median() * 1e6 << " us, zoomed "
+			<< times[1].Median() * 1e6 << " us, " << (exact ? "exact" : "MISMATCH") << std::endl;
+	}
+
+	json.EndArray();
+}
+
+
+// Rewires a resistor back and forth, then sweeps its value over the same points a few times. The
+// cached circuit has to end every update on the voltages of an uncached twin, bit for bit after a
+// rewiring (both factor), to rounding in the sweep (the twin stacks more low rank terms)
+static void WriteSolutionCache(JsonWriter& json, bool quick)
+{
+	size_t numNodes = quick ? 300 : 1000;
+	int numToggles = quick ? 20 : 40;
+	int numPasses = 3;
+	const double sweep[] = { 10.0, 20.0, 50.0, 100.0, 200.0, 500.0 };
+
+	Circuit cached;
+	Circuit plain;
+	CircuitGen::RandomMesh(cached, numNodes, 4);
+	CircuitGen::RandomMesh(plain, numNodes, 4);
+
+	SolutionCache cache;
+	cached.SetSolutionCache(&cache);
+	cached.UpdateSolution();
+	plain.UpdateSolution();
+
+	double maxDifference = 0.0;
+	auto compare = [&]()
+	{
+		for (size_t i = 0; i < cached.GetNumNodes(); i++)
+			maxDifference = std::max(maxDifference, std::abs(cached.GetNode(i)->GetVoltage() - plain.GetNode(i)->GetVoltage()));
+	};
+
+	PhaseTimes missTimes;
+	PhaseTimes hitTimes;
+	auto update = [&]()
+	{
+		u64 hits = cache.GetNumHits();
+		Timer timer = Timer::StartNew();
+		cached.UpdateSolution();
+		timer.Stop();
+		(cache.GetNumHits() > hits ? hitTimes : missTimes).samples.push_back(timer.GetElapsedSeconds());
+
+		plain.UpdateSolution();
+		compare();
+	};
+
+	// Topology : every edit assembles and factors without the cache
+	for (int i = 0; i < numToggles; i++)
+	{
+		size_t node = i % 2 ? 1 : numNodes;
+		cached.Connect(cached.GetElement(0)->GetEpin(1), cached.GetNode(node));
+		plain.Connect(plain.GetElement(0)->GetEpin(1), plain.GetNode(node));
+		update();
+	}
+	bool identical = maxDifference == 0.0;
+	double topologyHitRate = cache.GetHitRate();
+	PhaseTimes topologyHits = hitTimes;
+	PhaseTimes topologyMisses = missTimes;
+
+	// Values : low rank updates the first time, the cache afterwards
+	cache.ResetCounters();
+	hitTimes.samples.clear();
+	missTimes.samples.clear();
+	for (int pass = 0; pass < numPasses; pass++)
+	{
+		for (double resistance : sweep)
+		{
+			static_cast<eResistor*>(cached.GetElement(1))->SetResistance(resistance);
+			static_cast<eResistor*>(plain.GetElement(1))->SetResistance(resistance);
+			update();
+		}
+	}
+
+	json.Key("solution_cache").BeginObject();
+	json.Key("nodes").Value(u64(numNodes));
+	json.Key("unknowns").Value(u64(cached.GetMatrix().GetNumNodes()));
+	json.Key("topology_hit_rate").Value(topologyHitRate);
+	json.Key("topology_miss_ms").Value(topologyMisses.Median() * 1e3);
+	json.Key("topology_hit_us").Value(topologyHits.Median() * 1e6);
+	json.Key("sweep_hit_rate").Value(cache.GetHitRate());
+	json.Key("sweep_miss_us").Value(missTimes.Median() * 1e6);
+	json.Key("sweep_hit_us").Value(hitTimes.Median() * 1e6);
+	json.Key("entries").Value(u64(cache.GetNumEntries()));
+	json.Key("bytes").Value(u64(cache.GetBytes()));
+	json.Key("topology_bit_identical").Value(identical);
+	json.Key("sweep_max_difference").Value(maxDifference);
+	json.EndObject();
+
+	std::cerr << "solution cache " << cached.GetMatrix().GetNumNodes() << " unknowns : topology miss " << topologyMisses.Median() * 1e3
+		<< " ms, hit " << topologyHits.Median() * 1e6 << " us (" << topologyHitRate * 100.0 << "%), sweep miss "
+		<< missTimes.Median() * 1e6 << " us, hit " << hitTimes.Median() * 1e6 << " us (" << cache.GetHitRate() * 100.0 << "%), "
+		<< (identical ? "identical" : "MISMATCH") << ", sweep within " << maxDifference << " V" << std::endl;
+}
+
+
+// Element and node graph of a circuit, roughly : the objects, their pins and the node pin sets
+static size_t EstimateCircuitBytes(Circuit& circuit)
+{
+	constexpr size_t SetEntryBytes = 40;
+	size_t bytes = circuit.GetNumNodes() * (sizeof(eNode) + sizeof(void*));
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+		bytes += sizeof(eResistor) + sizeof(void*) + 2 * (sizeof(ePin) + SetEntryBytes);
+	return bytes;
+}
+
+
+// Random value edits, rewirings, added and removed resistors on a mesh, solved only at both ends.
+// Undoing everything has to give back the first circuit (its hash, and its solution from the cache),
+// redoing everything the last one
+static void WriteHistory(JsonWriter& json, bool quick)
+{
+	size_t numNodes = quick ? 500 : 2000;
+	size_t numSteps = quick ? 2000 : 10000;
+
+	Circuit circuit;
+	CircuitGen::RandomMesh(circuit, numNodes, 4);
+
+	SolutionCache cache;
+	circuit.SetSolutionCache(&cache);
+	circuit.UpdateSolution();
+
+	auto voltages = [&]()
+	{
+		std::vector<double> result;
+		for (size_t i = 0; i < circuit.GetNumNodes(); i++)
+			result.push_back(circuit.GetNode(i)->GetVoltage());
+		return result;
+	};
+
+	u64 firstHash = circuit.GetHash();
+	std::vector<double> firstVoltages = voltages();
+	size_t circuitBytes = EstimateCircuitBytes(circuit);
+
+	CircuitHistory history(circuit);
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	auto pickNode = [&]() { return circuit.GetNode(1 + size_t(unit(rng) * double(numNodes - 1))); };
+	auto pickResistor = [&]() -> eResistor*
+	{
+		for (;;)
+		{
+			eElement* element = circuit.GetElement(size_t(unit(rng) * double(circuit.GetNumElements() - 1)));
+			if (auto* resistor = dynamic_cast<eResistor*>(element))
+				return resistor;
+		}
+	};
+
+	Timer timer = Timer::StartNew();
+	for (size_t i = 0; i < numSteps; i++)
+	{
+		double kind = unit(rng);
+		if (kind < 0.7)
+		{
+			history.SetValue(pickResistor(), 1.0 + unit(rng) * 999.0);
+		}
+		else if (kind < 0.85)
+		{
+			history.Connect(pickResistor()->GetEpin(1), pickNode());
+		}
+		else if (kind < 0.95)
+		{
+			history.BeginStep();
+			eResistor* resistor = history.AddElement<eResistor>(1.0 + unit(rng) * 999.0);
+			history.Connect(resistor->GetEpin(0), pickNode());
+			history.Connect(resistor->GetEpin(1), pickNode());
+			history.EndStep();
+		}
+		else
+		{
+			history.RemoveElement(pickResistor());
+		}
+	}
+	timer.Stop();
+	double editTime = timer.GetElapsedSeconds() / double(numSteps);
+	size_t historyBytes = history.GetMemoryBytes();
+	size_t numRecorded = history.GetNumUndoSteps();
+
+	circuit.UpdateSolution();
+	u64 lastHash = circuit.GetHash();
+	std::vector<double> lastVoltages = voltages();
+
+	timer.Restart();
+	while (history.Undo()) { }
+	timer.Stop();
+	double undoTime = timer.GetElapsedSeconds() / double(numRecorded);
+
+	timer.Restart();
+	circuit.UpdateSolution();
+	timer.Stop();
+	double undoneSolveTime = timer.GetElapsedSeconds();
+	bool undoneOk = circuit.GetHash() == firstHash && voltages() == firstVoltages;
+
+	timer.Restart();
+	while (history.Redo()) { }
+	timer.Stop();
+	double redoTime = timer.GetElapsedSeconds() / double(numRecorded);
+
+	circuit.UpdateSolution();
+	bool redoneOk = circuit.GetHash() == lastHash && voltages() == lastVoltages;
+
+	json.Key("history").BeginObject();
+	json.Key("nodes").Value(u64(numNodes));
+	json.Key("steps").Value(u64(numRecorded));
+	json.Key("edit_us").Value(editTime * 1e6);
+	json.Key("undo_us").Value(undoTime * 1e6);
+	json.Key("redo_us").Value(redoTime * 1e6);
+	json.Key("undone_solve_us").Value(undoneSolveTime * 1e6);
+	json.Key("cache_hits").Value(cache.GetNumHits());
+	json.Key("history_bytes").Value(u64(historyBytes));
+	json.Key("circuit_bytes_estimate").Value(u64(circuitBytes));
+	json.Key("history_to_circuit").Value(double(historyBytes) / double(circuitBytes));
+	json.Key("undo_restores_first").Value(undoneOk);
+	json.Key("redo_restores_last").Value(redoneOk);
+	json.EndObject();
+
+	std::cerr << "history " << numRecorded << " steps : " << historyBytes / 1024 << " KiB (circuit ~" << circuitBytes / 1024 << " KiB), undo "
+		<< undoTime * 1e6 << " us, redo " << redoTime * 1e6 << " us, solve after undoing all " << undoneSolveTime * 1e6 << " us, "
+		<< (undoneOk && redoneOk ? "restored" : "MISMATCH") << std::endl;
+}
+
+
+// Random junctions between random nodes with voltages around the knee, the same solution for both
+// paths and every device back at the same operating point before each run. Only the evaluation is
+// timed, the system of a million junctions is not solved
+static void WriteNonlinear(JsonWriter& json, bool quick, int repeat)
+{
+	std::vector<size_t> sizes = quick ? std::vector<size_t>{ 10000, 100000 } : std::vector<size_t>{ 10000, 100000, 1000000 };
+
+	json.Key("nonlinear").BeginObject();
+	json.Key("simd").Value(Eigen::SimdInstructionSetsInUse());
+	json.Key("runs").BeginArray();
+
+	for (size_t numJunctions : sizes)
+	{
+		size_t numNodes = numJunctions / 4 + 1;
+
+		Circuit circuit;
+		for (size_t i = 0; i < numNodes; i++)
+			circuit.CreateNode();
+
+		std::mt19937 rng(11);
+		std::uniform_int_distribution<size_t> pick(0, numNodes - 1);
+		std::uniform_real_distribution<double> voltage(0.0, 0.9);
+		std::vector<eElement*> diodes;
+		for (size_t i = 0; i < numJunctions; i++)
+		{
+			size_t anode = pick(rng);
+			size_t cathode = pick(rng);
+			if (anode == cathode)
+				cathode = (cathode + 1) % numNodes;
+
+			eDiode* diode = circuit.AddElement<eDiode>(1e-14 * (1.0 + voltage(rng)), 1.0 + voltage(rng));
+			circuit.Connect(diode->GetEpin(0), circuit.GetNode(anode));
+			circuit.Connect(diode->GetEpin(1), circuit.GetNode(cathode));
+			diodes.push_back(diode);
+		}
+
+		// Node 0 is the ground, the last padded entry
+		Eigen::VectorXd solution(numNodes);
+		for (size_t i = 1; i < numNodes; i++)
+		{
+			solution(Eigen::Index(i - 1)) = voltage(rng);
+			circuit.GetNode(i)->SetVoltage(solution(Eigen::Index(i - 1)));
+		}
+		solution(Eigen::Index(numNodes - 1)) = 0.0;
+
+		// Cold : every junction at 0 V, the first iteration, most blocks limit. Warm : 1 mV off the
+		// voltages, the last iterations, nothing limits
+		auto reset = [&](bool warm)
+		{
+			for (eElement* element : diodes)
+			{
+				eDiode* diode = static_cast<eDiode*>(element);
+				double v = diode->GetEpin(0)->GetVoltage() - diode->GetEpin(1)->GetVoltage();
+				diode->SetOperatingPoint(warm ? v + 1e-3 : 0.0);
+			}
+		};
+
+		json.BeginObject();
+		json.Key("junctions").Value(u64(numJunctions));
+		json.Key("nodes").Value(u64(numNodes));
+
+		for (bool warm : { false, true })
+		{
+			DiodeBatch batch;
+			reset(warm);
+			batch.Build(diodes, circuit.GetGroundNode(), numNodes - 1);
+
+			PhaseTimes scalarTimes;
+			PhaseTimes batchTimes;
+			size_t scalarMoving = 0;
+			size_t batchMoving = 0;
+			for (int i = 0; i < repeat; i++)
+			{
+				reset(warm);
+				Timer timer = Timer::StartNew();
+				scalarMoving = 0;
+				for (eElement* element : diodes)
+					scalarMoving += size_t(!element->Linearize());
+				timer.Stop();
+				scalarTimes.samples.push_back(timer.GetElapsedSeconds());
+
+				timer.Restart();
+				batchMoving = batch.Evaluate(solution);
+				timer.Stop();
+				batchTimes.samples.push_back(timer.GetElapsedSeconds());
+			}
+
+			// The scalar path left its companion models in the devices
+			double maxDifference = 0.0;
+			for (size_t k = 0; k < diodes.size(); k++)
+			{
+				eBranchModel model = diodes[k]->GetBranchModel();
+				double G = batch.GetNextConductances()(Eigen::Index(k));
+				double Ieq = batch.GetNextCurrents()(Eigen::Index(k));
+				maxDifference = std::max(maxDifference, std::abs(G - model.G) / std::abs(model.G));
+				maxDifference = std::max(maxDifference, std::abs(Ieq - model.Ieq) / std::max(std::abs(model.Ieq), 1e-30));
+			}
+
+			json.Key(warm ? "warm" : "cold").BeginObject();
+			json.Key("scalar_ms").Value(scalarTimes.Median() * 1e3);
+			json.Key("batch_ms").Value(batchTimes.Median() * 1e3);
+			json.Key("speedup").Value(scalarTimes.Median() / batchTimes.Median());
+			json.Key("scalar_ns_per_junction").Value(scalarTimes.Median() * 1e9 / double(numJunctions));
+			json.Key("batch_ns_per_junction").Value(batchTimes.Median() * 1e9 / double(numJunctions));
+			json.Key("moving").Value(u64(batchMoving));
+			json.Key("same_moving").Value(scalarMoving == batchMoving);
+			json.Key("max_relative_difference").Value(maxDifference);
+			json.EndObject();
+
+			std::cerr << "nonlinear " << numJunctions << " junctions, " << (warm ? "warm" : "cold") << " : scalar " << scalarTimes.Median() * 1e3
+				<< " ms, batch " << batchTimes.Median() * 1e3 << " ms (" << scalarTimes.Median() / batchTimes.Median() << "x), max relative difference "
+				<< maxDifference << (scalarMoving == batchMoving ? "" : ", MISMATCH in converged junctions") << std::endl;
+		}
+
+		json.EndObject();
+	}
+
+	json.EndArray();
+	json.EndObject();
+}
+
+
+// IR drop of power grids by multigrid. Every size is solved from scratch (setup and solve), then again
+// after a few resistors changed, on the same setup. Plain Jacobi preconditioned CG takes the same
+// reduced system up to a quarter million nodes, the direct solver checks the voltages on a small grid
+static void WriteMultigrid(JsonWriter& json, bool quick)
+{
+	struct Grid
+	{
+		size_t size;
+		size_t numLayers;
+	};
+
+	std::vector<Grid> grids = quick ? std::vector<Grid>{ { 128, 1 }, { 256, 1 }, { 48, 8 } }
+		: std::vector<Grid>{ { 256, 1 }, { 512, 1 }, { 1024, 1 }, { 100, 8 }, { 200, 8 } };
+	constexpr size_t MaxCGNodes = 300000;
+	constexpr int NumEdits = 10;
+
+	json.Key("multigrid").BeginObject();
+
+	// Accuracy against the direct solver
+	{
+		Circuit direct;
+		Circuit iterative;
+		CircuitGen::PowerGrid(direct, 48, 2, 16);
+		CircuitGen::PowerGrid(iterative, 48, 2, 16);
+		iterative.SetSolverMode(eSolverMode::Multigrid);
+		direct.UpdateSolution();
+		iterative.UpdateSolution();
+
+		double maxDifference = 0.0;
+		for (size_t i = 0; i < direct.GetNumNodes(); i++)
+			maxDifference = std::max(maxDifference, std::abs(direct.GetNode(i)->GetVoltage() - iterative.GetNode(i)->GetVoltage()));
+
+		json.Key("direct_nodes").Value(u64(direct.GetNumNodes()));
+		json.Key("direct_max_difference").Value(maxDifference);
+		std::cerr << "multigrid against direct, " << direct.GetNumNodes() << " nodes : within " << maxDifference << " V" << std::endl;
+	}
+
+	json.Key("runs").BeginArray();
+
+	double firstSeconds = 0.0;
+	double firstNodes = 0.0;
+	double lastSeconds = 0.0;
+	double lastNodes = 0.0;
+
+	for (const Grid& grid : grids)
+	{
+		Circuit circuit;
+		CircuitGen::PowerGrid(circuit, grid.size, grid.numLayers);
+		circuit.SetSolverMode(eSolverMode::Multigrid);
+
+		Timer timer = Timer::StartNew();
+		circuit.UpdateSolution();
+		timer.Stop();
+		double totalSeconds = timer.GetElapsedSeconds();
+
+		const MultigridSolver* multigrid = circuit.GetMultigrid();
+		double setupSeconds = multigrid->GetSetupSeconds();
+		double solveSeconds = multigrid->GetSolveSeconds();
+		u32 iterations = multigrid->GetIterations();
+		size_t numUnknowns = multigrid->GetNumFreeUnknowns();
+
+		double minVoltage = 1.0;
+		for (size_t i = 1; i < circuit.GetNumNodes(); i++)
+			minVoltage = std::min(minVoltage, circuit.GetNode(i)->GetVoltage());
+
+		double cgSeconds = 0.0;
+		int cgIterations = 0;
+		if (numUnknowns <= MaxCGNodes)
+		{
+			Eigen::ConjugateGradient<MultigridSolver::SparseMatrix, Eigen::Lower | Eigen::Upper> cg;
+			cg.setTolerance(1e-10);
+			cg.setMaxIterations(100000);
+			timer.Restart();
+			cg.compute(multigrid->GetMatrix());
+			Eigen::VectorXd x = cg.solve(multigrid->GetRhs());
+			timer.Stop();
+			cgSeconds = timer.GetElapsedSeconds();
+			cgIterations = int(cg.iterations());
+		}
+
+		// Resistors in the middle of the mesh, the setup stays
+		u32 numSetups = multigrid->GetNumSetups();
+		for (int k = 0; k < NumEdits; k++)
+		{
+			eElement* element = circuit.GetElement(circuit.GetNumElements() / 2 + size_t(k) * 7);
+			element->SetValue(element->GetValue() * 1.5);
+		}
+
+		timer.Restart();
+		circuit.UpdateSolution();
+		timer.Stop();
+		double editSeconds = timer.GetElapsedSeconds();
+
+		if (grid.numLayers == 1)
+		{
+			if (firstNodes == 0.0)
+			{
+				firstNodes = double(numUnknowns);
+				firstSeconds = totalSeconds;
+			}
+			lastNodes = double(numUnknowns);
+			lastSeconds = totalSeconds;
+		}
+
+		json.BeginObject();
+		json.Key("size").Value(u64(grid.size));
+		json.Key("layers").Value(u64(grid.numLayers));
+		json.Key("unknowns").Value(u64(numUnknowns));
+		json.Key("levels").Value(u64(multigrid->GetNumLevels()));
+		json.Key("operator_complexity").Value(multigrid->GetOperatorComplexity());
+		json.Key("total_ms").Value(totalSeconds * 1e3);
+		json.Key("setup_ms").Value(setupSeconds * 1e3);
+		json.Key("solve_ms").Value(solveSeconds * 1e3);
+		json.Key("iterations").Value(u64(iterations));
+		json.Key("worst_ir_drop").Value(1.0 - minVoltage);
+		json.Key("edit_ms").Value(editSeconds * 1e3);
+		json.Key("edit_iterations").Value(u64(multigrid->GetIterations()));
+		json.Key("edit_setup_reused").Value(multigrid->GetNumSetups() == numSetups);
+		if (cgIterations)
+		{
+			json.Key("cg_ms").Value(cgSeconds * 1e3);
+			json.Key("cg_iterations").Value(cgIterations);
+		}
+		json.EndObject();
+
+		std::cerr << "multigrid " << grid.size << "x" << grid.size << "x" << grid.numLayers << ", " << numUnknowns << " unknowns : "
+			<< totalSeconds * 1e3 << " ms (setup " << setupSeconds * 1e3 << ", solve " << solveSeconds * 1e3 << ", "
+			<< iterations << " it, " << multigrid->GetNumLevels() << " levels, complexity " << multigrid->GetOperatorComplexity()
+			<< "), edit " << editSeconds * 1e3 << " ms " << multigrid->GetIterations() << " it";
+		if (cgIterations)
+			std::cerr << ", CG " << cgSeconds * 1e3 << " ms " << cgIterations << " it";
+		std::cerr << std::endl;
+	}
+
+	json.EndArray();
+
+	// Time against unknowns on a log scale, 1 is linear
+	double exponent = lastNodes > firstNodes ? std::log(lastSeconds / firstSeconds) / std::log(lastNodes / firstNodes) : 0.0;
+	json.Key("scaling_exponent").Value(exponent);
+	json.EndObject();
+
+	std::cerr << "multigrid scaling exponent " << exponent << std::endl;
+}
+
+
+// The mesh of CircuitGen::RcMesh, after the source, the driver and the 3 loads
+static std::vector<eElement*> RcMeshElements(Circuit& circuit)
+{
+	std::vector<eElement*> elements;
+	for (size_t i = 5; i < circuit.GetNumElements(); i++)
+		elements.push_back(circuit.GetElement(i));
+
+	return elements;
+}
+
+
+// Far corner of CircuitGen::RcMesh, where the last load sits
+static eNode* RcMeshFarNode(Circuit& circuit)
+{
+	return circuit.GetElement(2)->GetEpin(0)->GetConnectedNode();
+}
+
+
+// Step response of RC meshes at rest, the source switched from 0 to 1 V. A small mesh checks the
+// loads of the reduced models of a few orders against the full mesh under the direct solver. Bigger
+// ones are reduced and stepped against the full mesh under multigrid, both for the same steps
+static void WriteReduction(JsonWriter& json, bool quick)
+{
+	constexpr double Step = 1e-10;
+
+	std::vector<size_t> sizes = quick ? std::vector<size_t>{ 64, 128 } : std::vector<size_t>{ 128, 183, 316 };
+	const int numFullSteps = quick ? 10 : 20;
+
+	json.Key("reduction").BeginObject();
+
+	// Accuracy against the direct solver, every load over every step
+	{
+		constexpr size_t Size = 40;
+		constexpr int NumSteps = 200;
+
+		Circuit direct;
+		CircuitGen::RcMesh(direct, Size);
+		direct.GetElement(0)->SetValue(0.0);
+		direct.UpdateSolution();
+		direct.SetStep(Step);
+		direct.GetElement(0)->SetValue(1.0);
+
+		std::vector<double> expected;
+		for (int step = 0; step < NumSteps; step++)
+		{
+			direct.Step();
+			for (size_t k = 2; k < 5; k++)
+				expected.push_back(direct.GetElement(k)->GetEpin(0)->GetVoltage());
+		}
+
+		json.Key("accuracy").BeginArray();
+		for (size_t order : { 4, 8, 16, 24 })
+		{
+			Circuit reduced;
+			CircuitGen::RcMesh(reduced, Size);
+			reduced.GetElement(0)->SetValue(0.0);
+			reduced.UpdateSolution();
+
+			ReductionOptions options;
+			options.maxOrder = order;
+			ReduceSubnetwork(reduced, RcMeshElements(reduced), {}, options);
+
+			reduced.SetStep(Step);
+			reduced.GetElement(0)->SetValue(1.0);
+
+			double maxDifference = 0.0;
+			size_t index = 0;
+			for (int step = 0; step < NumSteps; step++)
+			{
+				reduced.Step();
+				for (size_t k = 2; k < 5; k++)
+					maxDifference = std::max(maxDifference, std::abs(reduced.GetElement(k)->GetEpin(0)->GetVoltage() - expected[index++]));
+			}
+
+			json.BeginObject();
+			json.Key("order").Value(u64(order));
+			json.Key("max_difference").Value(maxDifference);
+			json.EndObject();
+
+			std::cerr << "reduction of a " << Size << "x" << Size << " mesh to order " << order << " : loads within " << maxDifference << " V" << std::endl;
+		}
+		json.EndArray();
+	}
+
+	json.Key("runs").BeginArray();
+
+	for (size_t size : sizes)
+	{
+		Circuit full;
+		Circuit reduced;
+		CircuitGen::RcMesh(full, size);
+		CircuitGen::RcMesh(reduced, size);
+		full.SetSolverMode(eSolverMode::Multigrid);
+		reduced.SetSolverMode(eSolverMode::Multigrid);
+		full.GetElement(0)->SetValue(0.0);
+		reduced.GetElement(0)->SetValue(0.0);
+		full.UpdateSolution();
+		reduced.UpdateSolution();
+
+		std::vector<eElement*> elements = RcMeshElements(reduced);
+		ReductionStats stats;
+		ReduceSubnetwork(reduced, elements, {}, {}, &stats);
+
+		// The model is small and has branch rows, the direct solver takes it
+		reduced.SetSolverMode(eSolverMode::Direct);
+		reduced.UpdateSolution();
+
+		full.SetStep(Step);
+		reduced.SetStep(Step);
+		full.GetElement(0)->SetValue(1.0);
+		reduced.GetElement(0)->SetValue(1.0);
+
+		Timer timer = Timer::StartNew();
+		for (int step = 0; step < numFullSteps; step++)
+			full.Step();
+		timer.Stop();
+		double fullSeconds = timer.GetElapsedSeconds() / numFullSteps;
+
+		timer.Restart();
+		for (int step = 0; step < numFullSteps; step++)
+			reduced.Step();
+		timer.Stop();
+		double reducedSeconds = timer.GetElapsedSeconds() / numFullSteps;
+
+		double farFull = RcMeshFarNode(full)->GetVoltage();
+		double farReduced = RcMeshFarNode(reduced)->GetVoltage();
+
+		json.BeginObject();
+		json.Key("size").Value(u64(size));
+		json.Key("elements").Value(u64(stats.numElements));
+		json.Key("internal_unknowns").Value(u64(stats.numInternal));
+		json.Key("ports").Value(u64(stats.numPorts));
+		json.Key("order").Value(u64(stats.order));
+		json.Key("reduction_ms").Value(stats.seconds * 1e3);
+		json.Key("full_step_ms").Value(fullSeconds * 1e3);
+		json.Key("full_iterations").Value(u64(full.GetMultigrid()->GetIterations()));
+		json.Key("reduced_step_ms").Value(reducedSeconds * 1e3);
+		json.Key("speedup").Value(fullSeconds / reducedSeconds);
+		json.Key("far_load_difference").Value(std::abs(farFull - farReduced));
+		json.EndObject();
+
+		std::cerr << "reduction " << size << "x" << size << ", " << stats.numElements << " elements to order " << stats.order << " in "
+			<< stats.seconds * 1e3 << " ms : step " << fullSeconds * 1e3 << " ms full, " << reducedSeconds * 1e3 << " ms reduced, far load within "
+			<< std::abs(farFull - farReduced) << " V" << std::endl;
+	}
+
+	json.EndArray();
+	json.EndObject();
+}
+
+// Sources of CircuitGen::CoupledBlocks : all off, or on at levels that differ from block to block
+static void SetBlockSources(Circuit& circuit, bool on)
+{
+	size_t block = 0;
+	for (size_t i = 0; i < circuit.GetNumElements(); i++)
+	{
+		if (auto* source = dynamic_cast<eVoltageSource*>(circuit.GetElement(i)))
+			source->SetVoltage(on ? (block++ % 2 ? 1.0 : 0.3) : 0.0);
+	}
+}
+
+
+// Step response of coupled RC blocks, monolithic and split in one partition per block (found by
+// WaveformRelaxation::PartitionNodes). Both schemes, Seidel on a growing number of threads, every
+// run checked against the monolithic voltages at the end
+static void WriteRelaxation(JsonWriter& json, bool quick)
+{
+	constexpr double Step = 1e-10;
+
+	size_t numBlocks = quick ? 4 : 16;
+	size_t blockSize = quick ? 10 : 16;
+	size_t numSteps = quick ? 100 : 400;
+
+	Circuit monolithic;
+	CircuitGen::CoupledBlocks(monolithic, numBlocks, blockSize);
+	SetBlockSources(monolithic, false);
+	monolithic.UpdateSolution();
+	monolithic.SetStep(Step);
+	SetBlockSources(monolithic, true);
+
+	Timer timer = Timer::StartNew();
+	for (size_t step = 0; step < numSteps; step++)
+		monolithic.Step();
+	timer.Stop();
+	double monolithicSeconds = timer.GetElapsedSeconds();
+
+	json.Key("relaxation").BeginObject();
+
+	std::vector<size_t> threadCounts;
+	size_t maxThreads = GetHardwareThreads(json);
+	for (size_t n = 1; n < maxThreads; n *= 2)
+		threadCounts.push_back(n);
+	threadCounts.push_back(maxThreads);
+
+	json.Key("blocks").Value(u64(numBlocks));
+	json.Key("block_size").Value(u64(blockSize));
+	json.Key("nodes").Value(u64(monolithic.GetNumNodes()));
+	json.Key("steps").Value(u64(numSteps));
+	json.Key("monolithic_ms").Value(monolithicSeconds * 1e3);
+	json.Key("runs").BeginArray();
+
+	std::cerr << "relaxation " << numBlocks << " blocks of " << blockSize << "x" << blockSize << ", " << numSteps << " steps : monolithic "
+		<< monolithicSeconds * 1e3 << " ms" << std::endl;
+
+	auto run = [&](WaveformRelaxation::eScheme scheme, size_t numThreads)
+	{
+		Circuit circuit;
+		CircuitGen::CoupledBlocks(circuit, numBlocks, blockSize);
+		SetBlockSources(circuit, false);
+		circuit.UpdateSolution();
+		circuit.SetStep(Step);
+		SetBlockSources(circuit, true);
+
+		WaveformRelaxation relaxation(circuit);
+		WaveformRelaxation::Options options;
+		options.scheme = scheme;
+		relaxation.SetOptions(options);
+		relaxation.Split(numBlocks);
+
+		// The caller helps too, so a pool of n - 1 workers runs on n threads
+		std::unique_ptr<ThreadPool> pool = numThreads > 1 ? std::make_unique<ThreadPool>(numThreads - 1) : nullptr;
+		Timer timer = Timer::StartNew();
+		bool converged = relaxation.Run(numSteps, pool.get());
+		timer.Stop();
+		double seconds = timer.GetElapsedSeconds();
+
+		double maxDifference = 0.0;
+		for (size_t i = 0; i < circuit.GetNumNodes(); i++)
+			maxDifference = std::max(maxDifference, std::abs(relaxation.GetVoltage(circuit.GetNode(i)) - monolithic.GetNode(i)->GetVoltage()));
+
+		const WaveformRelaxation::Stats& stats = relaxation.GetStats();
+		const char* name = scheme == WaveformRelaxation::eScheme::Jacobi ? "jacobi" : "seidel";
+
+		json.BeginObject();
+		json.Key("scheme").Value(name);
+		json.Key("threads").Value(u64(numThreads));
+		json.Key("partitions").Value(u64(relaxation.GetNumPartitions()));
+		json.Key("stages").Value(u64(relaxation.GetNumStages()));
+		json.Key("shared_elements").Value(u64(relaxation.GetNumShared()));
+		json.Key("windows").Value(u64(stats.windows));
+		json.Key("iterations").Value(u64(stats.iterations));
+		json.Key("converged").Value(converged);
+		json.Key("ms").Value(seconds * 1e3);
+		json.Key("speedup").Value(monolithicSeconds / seconds);
+		json.Key("max_difference").Value(maxDifference);
+		json.EndObject();
+
+		std::cerr << "relaxation " << name << " " << numThreads << " threads : " << seconds * 1e3 << " ms, " << stats.iterations << " iterations over "
+			<< stats.windows << " windows, within " << maxDifference << " V" << std::endl;
+	};
+
+	run(WaveformRelaxation::eScheme::Jacobi, maxThreads);
+	for (size_t numThreads : threadCounts)
+		run(WaveformRelaxation::eScheme::Seidel, numThreads);
+
+	json.EndArray();
+	json.EndObject();
+}
+
+static void WriteCurrentFlow(JsonWriter& json, bool quick)
+{
+	constexpr float Cell = 128.0f;
+	constexpr float WindowWidth = 1920.0f;
+	constexpr float WindowHeight = 1080.0f;
+	constexpr float FrameSeconds = 1.0f / 60.0f;
+
+	// Laid out like a schematic : horizontal and vertical wires of a lattice, each on its own branch
+	size_t side = quick ? 72 : 224;
+	size_t numFrames = quick ? 30 : 240;
+
+	CurrentFlow flow;
+	flow.Reserve(2 * side * side);
+	for (size_t y = 0; y < side; y++)
+	{
+		for (size_t x = 0; x < side; x++)
+		{
+			float fx = float(x) * Cell;
+			float fy = float(y) * Cell;
+			flow.AddWire(fx, fy, fx + Cell, fy, u32(flow.GetNumWires()));
+			flow.AddWire(fx, fy, fx, fy + Cell, u32(flow.GetNumWires()));
+		}
+	}
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<double> amperes(-0.5, 0.5);
+	std::vector<double> currents(flow.GetNumWires());
+	for (double& current : currents)
+		current = amperes(rng);
+
+	// Stands for the view : a quad of 4 vertices per dot, position and color as sf::Vertex has them
+	struct Vertex { float x, y; u32 color; float u, v; };
+	std::vector<Vertex> vertices;
+
+	json.Key("current_flow").BeginObject();
+	json.Key("wires").Value(u64(flow.GetNumWires()));
+	json.Key("frames").Value(u64(numFrames));
+	json.Key("scales").BeginArray();
+
+	float center = float(side) * Cell * 0.5f;
+	for (float scale : { 0.25f, 1.0f, 4.0f })
+	{
+		float halfWidth = WindowWidth * 0.5f / scale;
+		float halfHeight = WindowHeight * 0.5f / scale;
+		float half = 2.0f / scale;
+
+		double advanceSeconds = 0.0;
+		double emitSeconds = 0.0;
+		size_t maxDots = 0;
+		Timer timer;
+		for (size_t frame = 0; frame < numFrames; frame++)
+		{
+			timer.Restart();
+			flow.SetViewScale(scale);
+			flow.Advance(currents.data(), currents.size(), FrameSeconds);
+			timer.Stop();
+			advanceSeconds += timer.GetElapsedSeconds();
+
+			timer.Restart();
+			vertices.clear();
+			flow.ForEachDot(center - halfWidth, center - halfHeight, center + halfWidth, center + halfHeight, [&](float x, float y)
+			{
+				vertices.push_back({ x - half, y - half, 0xff00beff, 0.0f, 0.0f });
+				vertices.push_back({ x + half, y - half, 0xff00beff, 0.0f, 0.0f });
+				vertices.push_back({ x + half, y + half, 0xff00beff, 0.0f, 0.0f });
+				vertices.push_back({ x - half, y + half, 0xff00beff, 0.0f, 0.0f });
+			});
+			timer.Stop();
+			emitSeconds += timer.GetElapsedSeconds();
+			maxDots = std::max(maxDots, vertices.size() / 4);
+		}
+
+		double advanceMs = advanceSeconds * 1e3 / double(numFrames);
+		double emitMs = emitSeconds * 1e3 / double(numFrames);
+		double frameMs = advanceMs + emitMs;
+
+		json.BeginObject();
+		json.Key("scale").Value(double(scale));
+		json.Key("spacing").Value(double(flow.GetSpacing()));
+		json.Key("dots").Value(u64(maxDots));
+		json.Key("advance_ms").Value(advanceMs);
+		json.Key("emit_ms").Value(emitMs);
+		json.Key("frame_ms").Value(frameMs);
+		json.Key("budget_60fps").Value(frameMs * 60.0 / 1e3);
+		json.EndObject();
+
+		std::cerr << "current_flow " << flow.GetNumWires() << " wires at scale " << scale << " : " << maxDots << " dots, advance " << advanceMs
+			<< " ms + emit " << emitMs << " ms per frame (" << frameMs * 6.0 << "% of 60 FPS)" << std::endl;
+	}
+
+	json.EndArray();
+	json.EndObject();
+}
+
+static std::vector<Workload> MakeWorkloads()
+{
+	std::vector<Workload> workloads;
+
+	workloads.push_back({ "ladder", "rungs",
+		[](Circuit& c, size_t n) { CircuitGen::ResistorLadder(c, n); },
+		{ 32, 128, 512, 1024 }, { 8, 32, 64 } });
+
+	workloads.push_back({ "grid", "side",
+		[](Circuit& c, size_t n) { CircuitGen::ResistorGrid(c, n); },
+		{ 4, 8, 16, 24, 32 }, { 4, 6, 8 } });
+
+	workloads.push_back({ "random_mesh", "nodes",
+		[](Circuit& c, size_t n) { CircuitGen::RandomMesh(c, n, 4); },
+		{ 64, 256, 512, 1024 }, { 16, 32, 64 } });
+
+	workloads.push_back({ "rc_chain", "stages",
+		[](Circuit& c, size_t n) { CircuitGen::RcChain(c, n); },
+		{ 32, 128, 512, 1024 }, { 8, 32, 64 }, 1e-6 });
+
+	workloads.push_back({ "source_heavy", "sources",
+		[](Circuit& c, size_t n) { CircuitGen::SourceHeavy(c, n); },
+		{ 16, 64, 256, 512 }, { 8, 16, 32 } });
+
+	return workloads;
+}
+
+
+int main(int argc, char** argv)
+{
+	bool quick = false;
+	int repeat = 5;
+	std::string only;
+	std::string outPath;
+	std::string tracePath;
+	bool summary = false;
+	bool allocs = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!std::strcmp(argv[i], "--quick"))
+			quick = true;
+		else if (!std::strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = std::max(1, std::atoi(argv[++i]));
+		else if (!std::strcmp(argv[i], "--only") && i + 1 < argc)
+			only = argv[++i];
+		else if (!std::strcmp(argv[i], "--out") && i + 1 < argc)
+			outPath = argv[++i];
+		else if (!std::strcmp(argv[i], "--trace") && i + 1 < argc)
+			tracePath = argv[++i];
+		else if (!std::strcmp(argv[i], "--summary"))
+			summary = true;
+		else if (!std::strcmp(argv[i], "--allocs"))
+			allocs = true;
+		else
+		{
+			std::cerr << "usage : " << argv[0] << " [--quick] [--repeat N] [--only <generator>] [--out <file>] [--trace <file>] [--summary] [--allocs]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (!SM_PROFILE_ENABLED && (summary || !tracePath.empty()))
+		std::cerr << "Profiling is compiled out (SM_PROFILE_ENABLED 0), the trace and summary will be empty" << std::endl;
+
+	JsonWriter json;
+	json.BeginObject();
+	json.Key("benchmark").Value("SchemeSim core");
+	json.Key("repeat").Value(repeat);
+	json.Key("quick").Value(quick);
+	json.Key("workloads").BeginArray();
+
+	for (const Workload& workload : MakeWorkloads())
+	{
+		if (!only.empty() && only != workload.name)
+			continue;
+
+		std::vector<RunResult> runs;
+		for (size_t size : quick ? workload.quickSizes : workload.sizes)
+		{
+			runs.push_back(RunWorkload(workload, size, repeat));
+			std::cerr << workload.name << " " << size << " : " << runs.back().numUnknowns << " unknowns" << std::endl;
+		}
+
+		json.BeginObject();
+		json.Key("generator").Value(workload.name);
+		json.Key("param").Value(workload.param);
+		json.Key("transient").Value(workload.step > 0.0);
+
+		json.Key("runs").BeginArray();
+		for (const RunResult& run : runs)
+			WriteRun(json, run);
+		json.EndArray();
+
+		// Median time of every phase over the problem size, plus the fitted log-log slope
+		json.Key("scaling").BeginObject();
+		json.Key("unknowns").BeginArray();
+		for (const RunResult& run : runs)
+			json.Value(u64(run.numUnknowns));
+		json.EndArray();
+
+		for (int phase = 0; phase < PHASE_COUNT; phase++)
+		{
+			json.Key(s_PhaseNames[phase]).BeginObject();
+			json.Key("median_ms").BeginArray();
+			for (const RunResult& run : runs)
+				json.Value(run.phases[phase].Median() * 1e3);
+			json.EndArray();
+			json.Key("exponent").Value(ScalingExponent(runs, phase));
+			json.EndObject();
+		}
+		json.EndObject();
+
+		json.EndObject();
+	}
+
+	json.EndArray();
+
+	if (only.empty() || only == "ac_sweep")
+		WriteACSweep(json, quick, std::min(repeat, 3));
+
+	if (only.empty() || only == "digital")
+		WriteDigital(json, quick);
+
+	if (only.empty() || only == "assembly")
+		WriteAssembly(json, quick, repeat);
+
+	if (only.empty() || only == "checkpoint")
+		WriteCheckpoint(json, quick);
+
+	if (only.empty() || only == "waveform")
+		WriteWaveform(json, quick, repeat);
+
+	if (only.empty() || only == "solution_cache")
+		WriteSolutionCache(json, quick);
+
+	if (only.empty() || only == "history")
+		WriteHistory(json, quick);
+
+	if (only.empty() || only == "nonlinear")
+		WriteNonlinear(json, quick, repeat);
+
+	if (only.empty() || only == "multigrid")
+		WriteMultigrid(json, quick);
+
+	if (only.empty() || only == "reduction")
+		WriteReduction(json, quick);
+
+	if (only.empty() || only == "relaxation")
+		WriteRelaxation(json, quick);
+
+	if (only.empty() || only == "current_flow")
+		WriteCurrentFlow(json, quick);
+
+	json.EndObject();
+
+	if (summary)
+		Profiler::PrintSummary(std::cerr);
+
+	if (allocs)
+		AllocTracker::PrintSummary(std::cerr);
+
+	if (!tracePath.empty() && !Profiler::ExportChromeTrace(tracePath))
+		std::cerr << "Couldn't open " << tracePath << std::endl;
+
+	if (outPath.empty())
+	{
+		std::cout << json.GetString() << std::endl;
+	}
+	else
+	{
+		std::ofstream out(outPath);
+		if (!out)
+		{
+			std::cerr << "Couldn't open " << outPath << std::endl;
+			return 1;
+		}
+		out << json.GetString() << std::endl;
+	}
+
+	return 0;
+}
@@ -6,14 +6,6 @@
 #include "base/SFMLRenderer.h"
 #include <windows.h>
 
-//void* operator new(size_t sz) noexcept
-//{
-//	static size_t count = 0;
-//	count++;
-//	std::cout << " i : " << count << " alloc : " << sz << std::endl;
-//	return malloc(sz);
-//}
-
 //int main()
 //{
 //    SFMLRenderer* renderer = SFMLRenderer::Create();
@@ -2,22 +2,21 @@
 #include "base/DrawList.h"
 
 ImageButton::ImageButton(std::string path, bool genMips)
-	: WidgetsBase(path)
+	: WidgetsBase(path, genMips)
 {
-    if (genMips) 
-    {
-        m_texture.generateMipmap();
-		m_sprite.setTexture(m_texture);
-    }
+    InactiveSpriteRect = m_textureRef.rect;
+    ActiveSpriteRect = m_textureRef.rect;
 }
 
 bool ImageButton::ButtonBehavior()
 {
-    dlDrawList::DrawInvoke([this]
-        {
-            dlDrawList::getWindow()->draw(m_sprite);
-        });
-  
+    bool clicked = UpdateState();
+    RecordSprite(); // After the update, so the frame shows the current tint and rect
+    return clicked;
+}
+
+bool ImageButton::UpdateState()
+{
     if (!g_SFMLRenderer.get_sfWindow()->hasFocus())
         return false;
 
@@ -34,6 +33,7 @@ bool ImageButton::ButtonBehavior()
         if (is_hovered_on_this_frame)
         {
             m_sprite.setTextureRect(ActiveSpriteRect);
+            UpdateBounds();
             was_pressed_over_the_button = true;
         }
         else
@@ -45,6 +45,7 @@ bool ImageButton::ButtonBehavior()
     else if (!sf::Mouse::isButtonPressed(sf::Mouse::Left) && was_pressed)
     {
         m_sprite.setTextureRect(InactiveSpriteRect);
+        UpdateBounds();
         was_pressed = false;
 
         if (was_pressed_over_the_button && is_hovered_on_this_frame)
@@ -62,15 +63,17 @@ bool ImageButton::ButtonBehavior()
 
 
 
+// Rects are given in image pixels, the sprite works in atlas pixels
 void ImageButton::SetInactiveImageRectSprite(const sf::IntRect& rect)
 {
-    m_sprite.setTextureRect(rect); 
-    InactiveSpriteRect = rect;
+    InactiveSpriteRect = m_textureRef.ToTextureRect(rect);
+    m_sprite.setTextureRect(InactiveSpriteRect);
+    UpdateBounds();
 }
 
 void ImageButton::SetActiveImageRectSprite(const sf::IntRect& rect)
 {
-    ActiveSpriteRect = rect;
+    ActiveSpriteRect = m_textureRef.ToTextureRect(rect);
 }
 
 void ImageButton::SetHoveredTint(sf::Color col)
@@ -100,11 +103,13 @@ ImageButton::operator bool() { return ButtonBehavior(); }
 
 bool TwoStatesButton::ButtonBehavior()
 {
-    dlDrawList::DrawInvoke([this]
-        {
-            dlDrawList::getWindow()->draw(m_sprite);
-        });
+    bool clicked = UpdateState();
+    RecordSprite();
+    return clicked;
+}
 
+bool TwoStatesButton::UpdateState()
+{
     if (!g_SFMLRenderer.get_sfWindow()->hasFocus())
         return false;
 
@@ -121,6 +126,7 @@ bool TwoStatesButton::ButtonBehavior()
     } else {
         m_sprite.setTextureRect(InactiveSpriteRect);
     }
+    UpdateBounds();
 
     if (sf::Mouse::isButtonPressed(sf::Mouse::Left) && !was_pressed)
     {
@@ -19,6 +19,7 @@ protected:
     int id = -1;  //Can be unused
 
     bool ButtonBehavior();
+    bool UpdateState();
 
 public:
     //using WidgetsBase::WidgetsBase;
@@ -40,6 +41,7 @@ class TwoStatesButton : public ImageButton
     bool m_current_state = false;
     bool m_lock = false;
     bool ButtonBehavior();
+    bool UpdateState();
 
 public:
     using ImageButton::ImageButton;
@@ -0,0 +1,271 @@
+#include "AllocTracker.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <new>
+
+
+namespace
+{
+	struct AtomicStats
+	{
+		std::atomic<u64> count = 0;
+		std::atomic<u64> bytes = 0;
+		std::atomic<u64> frees = 0;
+	};
+
+	struct PhaseSlot
+	{
+		std::atomic<const char*> name = nullptr;
+		AtomicStats stats;
+	};
+
+	// Nothing in here may allocate, it runs inside the allocator
+	AtomicStats s_Total;
+	PhaseSlot s_Phases[AllocTracker::MaxPhases];
+	PhaseSlot s_OtherPhase; // No phase open, or the table is full
+
+	thread_local AllocStats t_Stats;
+	thread_local const char* t_Phase = nullptr;
+
+	PhaseSlot& FindPhase(const char* phase)
+	{
+		if (!phase)
+			return s_OtherPhase;
+
+		for (PhaseSlot& slot : s_Phases)
+		{
+			const char* name = slot.name.load(std::memory_order_acquire);
+			if (!name)
+			{
+				if (slot.name.compare_exchange_strong(name, phase, std::memory_order_acq_rel))
+					return slot;
+			}
+
+			// Same literal can have different addresses in different translation units
+			if (name == phase || !std::strcmp(name, phase))
+				return slot;
+		}
+
+		return s_OtherPhase;
+	}
+}
+
+
+void AllocTracker::OnAlloc(size_t size)
+{
+	s_Total.count.fetch_add(1, std::memory_order_relaxed);
+	s_Total.bytes.fetch_add(size, std::memory_order_relaxed);
+
+	t_Stats.count++;
+	t_Stats.bytes += size;
+
+	PhaseSlot& slot = FindPhase(t_Phase);
+	slot.stats.count.fetch_add(1, std::memory_order_relaxed);
+	slot.stats.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+
+void AllocTracker::OnFree()
+{
+	s_Total.frees.fetch_add(1, std::memory_order_relaxed);
+	t_Stats.frees++;
+	FindPhase(t_Phase).stats.frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+AllocStats AllocTracker::GetTotalStats()
+{
+	return {
+		s_Total.count.load(std::memory_order_relaxed),
+		s_Total.bytes.load(std::memory_order_relaxed),
+		s_Total.frees.load(std::memory_order_relaxed)
+	};
+}
+
+
+AllocStats AllocTracker::GetThreadStats()
+{
+	return t_Stats;
+}
+
+
+void AllocTracker::Reset()
+{
+	auto reset = [](AtomicStats& stats)
+		{
+			stats.count.store(0, std::memory_order_relaxed);
+			stats.bytes.store(0, std::memory_order_relaxed);
+			stats.frees.store(0, std::memory_order_relaxed);
+		};
+
+	reset(s_Total);
+	reset(s_OtherPhase.stats);
+	for (PhaseSlot& slot : s_Phases)
+		reset(slot.stats);
+}
+
+
+const char* AllocTracker::SetThreadPhase(const char* phase)
+{
+	const char* prev = t_Phase;
+	t_Phase = phase;
+	return prev;
+}
+
+
+const char* AllocTracker::GetThreadPhase()
+{
+	return t_Phase;
+}
+
+
+void AllocTracker::PrintSummary(std::ostream& out)
+{
+	if (!IsEnabled())
+	{
+		out << "Allocation tracking is compiled out (SM_ALLOC_TRACKING 0)" << std::endl;
+		return;
+	}
+
+	// Snapshot first, printing allocates
+	struct Row
+	{
+		const char* name;
+		u64 count;
+		u64 bytes;
+		u64 frees;
+	};
+
+	Row rows[MaxPhases + 2];
+	int numRows = 0;
+
+	for (PhaseSlot& slot : s_Phases)
+	{
+		if (const char* name = slot.name.load(std::memory_order_acquire))
+			rows[numRows++] = { name, slot.stats.count.load(), slot.stats.bytes.load(), slot.stats.frees.load() };
+	}
+
+	rows[numRows++] = { "(no phase)", s_OtherPhase.stats.count.load(), s_OtherPhase.stats.bytes.load(), s_OtherPhase.stats.frees.load() };
+	rows[numRows++] = { "total", s_Total.count.load(), s_Total.bytes.load(), s_Total.frees.load() };
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-28s %12s %14s %12s\n", "phase", "allocs", "bytes", "frees");
+	out << line;
+
+	for (int i = 0; i < numRows; i++)
+	{
+		std::snprintf(line, sizeof(line), "%-28s %12llu %14llu %12llu\n",
+			rows[i].name,
+			(unsigned long long)rows[i].count,
+			(unsigned long long)rows[i].bytes,
+			(unsigned long long)rows[i].frees);
+		out << line;
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Allocator hooks
+
+
+
+#if SM_ALLOC_TRACKING
+#if defined(__GLIBC__)
+
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t num, size_t size);
+	void* __libc_realloc(void* ptr, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+	void  __libc_free(void* ptr);
+
+	void* malloc(size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(size);
+		return __libc_malloc(size);
+	}
+
+	void* calloc(size_t num, size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(num * size);
+		return __libc_calloc(num, size);
+	}
+
+	void* realloc(void* ptr, size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(size);
+		if (ptr)
+			AllocTracker::OnFree();
+		return __libc_realloc(ptr, size);
+	}
+
+	void* memalign(size_t alignment, size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	void* aligned_alloc(size_t alignment, size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(size);
+		return __libc_memalign(alignment, size);
+	}
+
+	int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept
+	{
+		AllocTracker::OnAlloc(size);
+		*ptr = __libc_memalign(alignment, size);
+		return *ptr ? 0 : ENOMEM;
+	}
+
+	void free(void* ptr) noexcept
+	{
+		if (ptr)
+			AllocTracker::OnFree();
+		__libc_free(ptr);
+	}
+}
+
+#else
+
+void* operator new(size_t size)
+{
+	AllocTracker::OnAlloc(size);
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	AllocTracker::OnAlloc(size);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (ptr)
+		AllocTracker::OnFree();
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept				{ operator delete(ptr); }
+void operator delete(void* ptr, size_t) noexcept		{ operator delete(ptr); }
+void operator delete[](void* ptr, size_t) noexcept		{ operator delete(ptr); }
+
+#endif
+#endif
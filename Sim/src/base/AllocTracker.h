@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <ostream>
+
+// Heap allocation tracking
+//
+// With SM_ALLOC_TRACKING 1 every heap allocation is counted in total, per thread and per phase.
+// The phase is the innermost SM_ALLOC_PHASE (or SM_PROFILE_SCOPE) open on the allocating thread.
+//
+// On glibc the malloc family is replaced, so allocations of Eigen (which calls std::malloc directly)
+// are seen as well. Elsewhere only the global operator new / delete are replaced.
+
+#ifndef SM_ALLOC_TRACKING
+#define SM_ALLOC_TRACKING 0
+#endif
+
+#define SM_CONCAT_IMPL(a, b) a##b
+#define SM_CONCAT(a, b) SM_CONCAT_IMPL(a, b)
+
+
+struct AllocStats
+{
+	u64 count = 0;
+	u64 bytes = 0;
+	u64 frees = 0;
+};
+
+
+class AllocTracker
+{
+public:
+	static constexpr int MaxPhases = 64;
+
+	static void OnAlloc(size_t size);
+	static void OnFree();
+
+	static AllocStats GetTotalStats();
+	static AllocStats GetThreadStats();	// Of the calling thread
+	static void Reset();				// Phase and total counters, thread counters are never reset
+
+	// Returns the previous phase of the thread
+	static const char* SetThreadPhase(const char* phase);
+	static const char* GetThreadPhase();
+
+	static void PrintSummary(std::ostream& out);
+
+	static constexpr bool IsEnabled() { return SM_ALLOC_TRACKING; }
+};
+
+
+class AllocPhaseScope
+{
+	const char* m_PrevPhase;
+
+public:
+
+	AllocPhaseScope(const char* phase)
+		: m_PrevPhase(AllocTracker::SetThreadPhase(phase))
+	{ }
+
+	~AllocPhaseScope()
+	{
+		AllocTracker::SetThreadPhase(m_PrevPhase);
+	}
+};
+
+
+#if SM_ALLOC_TRACKING
+#define SM_ALLOC_PHASE(name) \
+		AllocPhaseScope SM_CONCAT(_allocPhase, __LINE__)(name)
+#else
+#define SM_ALLOC_PHASE(name)
+#endif
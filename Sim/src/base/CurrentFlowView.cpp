@@ -0,0 +1,32 @@
+#include "CurrentFlowView.h"
+
+
+void CurrentFlowView::Draw(sf::RenderTarget& target, const CurrentFlow& flow, const sf::FloatRect& viewRect, float viewScale)
+{
+	m_Vertices.clear();
+	if (flow.GetNumWires() == 0 || viewScale <= 0.0f)
+		return;
+
+	float half = DotPixels * 0.5f / viewScale;
+	sf::Color color = m_Color;
+	flow.ForEachDot(viewRect.left, viewRect.top, viewRect.left + viewRect.width, viewRect.top + viewRect.height, [&](float x, float y)
+	{
+		m_Vertices.emplace_back(sf::Vector2f(x - half, y - half), color);
+		m_Vertices.emplace_back(sf::Vector2f(x + half, y - half), color);
+		m_Vertices.emplace_back(sf::Vector2f(x + half, y + half), color);
+		m_Vertices.emplace_back(sf::Vector2f(x - half, y + half), color);
+	});
+
+	if (m_Vertices.empty())
+		return;
+
+	if (sf::VertexBuffer::isAvailable())
+	{
+		if (m_Buffer.getVertexCount() < m_Vertices.size())
+			m_Buffer.create(std::max(m_Vertices.size(), m_Buffer.getVertexCount() * 2));
+		m_Buffer.update(m_Vertices.data(), m_Vertices.size(), 0);
+		target.draw(m_Buffer, 0, m_Vertices.size());
+	}
+	else
+		target.draw(m_Vertices.data(), m_Vertices.size(), sf::Quads);
+}
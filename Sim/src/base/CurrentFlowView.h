@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "vendor/SFML/Graphics.hpp"
+#include "sim/CurrentFlow.h"
+
+// Current flow dots over the schematic
+//
+// Every visible dot of the frame is a quad of a fixed screen size in one vertex array, streamed to a
+// vertex buffer that only grows and drawn with a single call, whatever the number of wires. Drawn in
+// the world view, on top of the draw list.
+
+class CurrentFlowView
+{
+	sf::VertexBuffer m_Buffer{ sf::Quads, sf::VertexBuffer::Stream };
+	std::vector<sf::Vertex> m_Vertices;
+	sf::Color m_Color = sf::Color(255, 190, 0);
+
+public:
+
+	static constexpr float DotPixels = 4.0f;
+
+	void SetColor(sf::Color color) { m_Color = color; }
+
+	// viewRect and viewScale of the view the target has, see dlDrawList::SetViewScale
+	void Draw(sf::RenderTarget& target, const CurrentFlow& flow, const sf::FloatRect& viewRect, float viewScale);
+
+	size_t GetLastDotCount() const { return m_Vertices.size() / 4; }
+};
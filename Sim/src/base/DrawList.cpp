@@ -0,0 +1,354 @@
+#include "DrawList.h"
+#include <algorithm>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Recording
+
+
+
+void dlDrawList::SetViewScale(float scale)
+{
+	dlViewScale = scale;
+	dlLod = scale < SimplifyBelowScale ? DrawLod::Simplified : DrawLod::Full;
+}
+
+
+// Outside the cull rect, or simplified and too small to see at the current scale
+bool dlDrawList::IsCulled(const sf::Vector2f* points, int count, u8 layer)
+{
+	if (layer == OverlayLayer)
+		return false;
+
+	sf::Vector2f min = points[0];
+	sf::Vector2f max = points[0];
+	for (int i = 1; i < count; i++)
+	{
+		min.x = std::min(min.x, points[i].x);
+		min.y = std::min(min.y, points[i].y);
+		max.x = std::max(max.x, points[i].x);
+		max.y = std::max(max.y, points[i].y);
+	}
+
+	bool outside = dlCulling && (max.x < dlCullRect.left || max.y < dlCullRect.top ||
+		min.x > dlCullRect.left + dlCullRect.width || min.y > dlCullRect.top + dlCullRect.height);
+
+	// Full detail draws everything in the view, however small
+	float extent = std::max(max.x - min.x, max.y - min.y) * dlViewScale;
+	bool culled = outside || (dlLod == DrawLod::Simplified && extent < MinScreenSize);
+	dlCulled += culled ? 1 : 0;
+	return culled;
+}
+
+
+// Numbered as the frame records them, the sort key then needs no search over the textures
+u32 dlDrawList::GetTextureSlot(const sf::Texture* texture)
+{
+	if (!texture)
+		return 0;
+
+	if (texture != dlLastTexture)
+	{
+		auto [it, inserted] = dlTextureSlots.try_emplace(texture, u32(dlTextureSlots.size() + 1));
+		dlLastTexture = texture;
+		dlLastSlot = it->second;
+	}
+
+	return dlLastSlot;
+}
+
+
+void dlDrawList::AddSprite(const sf::Sprite& sprite, u8 layer, sf::Color lodColor)
+{
+	const sf::IntRect& rect = sprite.getTextureRect();
+	const sf::Transform& transform = sprite.getTransform();
+
+	float width = static_cast<float>(std::abs(rect.width));
+	float height = static_cast<float>(std::abs(rect.height));
+
+	sf::Vector2f points[4] =
+	{
+		transform.transformPoint(0, 0),
+		transform.transformPoint(width, 0),
+		transform.transformPoint(width, height),
+		transform.transformPoint(0, height)
+	};
+
+	if (IsCulled(points, 4, layer))
+		return;
+
+	DrawCmd& cmd = dlDrawCommands.emplace_back();
+	cmd.layer = layer;
+	std::copy(points, points + 4, cmd.points);
+
+	if (dlLod == DrawLod::Simplified && layer != OverlayLayer)
+	{
+		// Untextured, batches with every other simplified sprite of the layer
+		cmd.type = DrawCmdType::Quad;
+		cmd.texture = nullptr;
+		cmd.textureSlot = 0;
+		cmd.color = lodColor * sprite.getColor();
+		return;
+	}
+
+	cmd.type = DrawCmdType::Sprite;
+	cmd.texture = sprite.getTexture();
+	cmd.textureSlot = GetTextureSlot(cmd.texture);
+	cmd.texRect = sf::FloatRect(rect);
+	cmd.color = sprite.getColor();
+}
+
+
+void dlDrawList::AddText(std::string_view str, const sf::Font& font, u32 charSize, sf::Vector2f position, sf::Color color, u8 layer)
+{
+	if (dlLod == DrawLod::Simplified && layer != OverlayLayer)
+	{
+		dlCulled++;
+		return;
+	}
+
+	// Bounds without the layout : no glyph advances past the character size, a tab is four of them
+	if (dlCulling && layer != OverlayLayer)
+	{
+		u32 numLines = 1;
+		u32 lineWidth = 0;
+		u32 maxWidth = 0;
+		for (char c : str)
+		{
+			if (c == '\n')
+			{
+				numLines++;
+				lineWidth = 0;
+				continue;
+			}
+
+			lineWidth += c == '\t' ? 4 : 1;
+			maxWidth = std::max(maxWidth, lineWidth);
+		}
+
+		float lineSpacing = font.getLineSpacing(charSize);
+		sf::Vector2f corners[2] = { position, position + sf::Vector2f(float(maxWidth * charSize), float(charSize) + lineSpacing * float(numLines)) };
+		if (IsCulled(corners, 2, layer))
+			return;
+	}
+
+	DrawCmd& cmd = dlDrawCommands.emplace_back();
+	cmd.type = DrawCmdType::Text;
+	cmd.layer = layer;
+	cmd.texture = &font.getTexture(charSize);
+	cmd.textureSlot = GetTextureSlot(cmd.texture);
+
+	cmd.font = &font;
+	cmd.charSize = charSize;
+	cmd.offset = static_cast<u32>(dlTextArena.size());
+	cmd.length = static_cast<u32>(str.size());
+	cmd.points[0] = position;
+	cmd.color = color;
+
+	dlTextArena.insert(dlTextArena.end(), str.begin(), str.end());
+}
+
+
+void dlDrawList::AddLine(sf::Vector2f from, sf::Vector2f to, sf::Color color, u8 layer)
+{
+	sf::Vector2f points[2] = { from, to };
+	if (IsCulled(points, 2, layer))
+		return;
+
+	DrawCmd& cmd = dlDrawCommands.emplace_back();
+	cmd.type = DrawCmdType::Line;
+	cmd.layer = layer;
+	cmd.texture = nullptr;
+	cmd.textureSlot = 0;
+
+	cmd.points[0] = from;
+	cmd.points[1] = to;
+	cmd.color = color;
+}
+
+
+void dlDrawList::AddQuad(const sf::FloatRect& rect, sf::Color color, u8 layer)
+{
+	sf::Vector2f corners[2] = { { rect.left, rect.top }, { rect.left + rect.width, rect.top + rect.height } };
+	if (IsCulled(corners, 2, layer))
+		return;
+
+	DrawCmd& cmd = dlDrawCommands.emplace_back();
+	cmd.type = DrawCmdType::Quad;
+	cmd.layer = layer;
+	cmd.texture = nullptr;
+	cmd.textureSlot = 0;
+
+	cmd.points[0] = { rect.left, rect.top };
+	cmd.points[1] = { rect.left + rect.width, rect.top };
+	cmd.points[2] = { rect.left + rect.width, rect.top + rect.height };
+	cmd.points[3] = { rect.left, rect.top + rect.height };
+	cmd.color = color;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Execution
+
+
+
+// | layer : 8 | lines : 1 | texture slot : 23 | submission index : 32 |
+// The submission index keeps the order stable inside a batch
+u64 dlDrawList::MakeSortKey(const DrawCmd& cmd, u32 index)
+{
+	u64 isLine = cmd.type == DrawCmdType::Line ? 1 : 0;
+	return (u64(cmd.layer) << 56) | (isLine << 55) | ((u64(cmd.textureSlot) & 0x7FFFFF) << 32) | index;
+}
+
+
+static void AppendQuad(sf::VertexArray& batch, const sf::Vector2f (&corners)[4], const sf::FloatRect& tex, sf::Color color)
+{
+	sf::Vector2f uv[4] =
+	{
+		{ tex.left, tex.top },
+		{ tex.left + tex.width, tex.top },
+		{ tex.left + tex.width, tex.top + tex.height },
+		{ tex.left, tex.top + tex.height }
+	};
+
+	// Two triangles : 0 1 2, 0 2 3
+	static constexpr int order[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i : order)
+		batch.append(sf::Vertex(corners[i], color, uv[i]));
+}
+
+
+void dlDrawList::AppendText(const DrawCmd& cmd)
+{
+	// Same layout as sf::Text, glyphs become quads of the font page texture
+	const sf::Font& font = *cmd.font;
+	u32 charSize = cmd.charSize;
+	float lineSpacing = font.getLineSpacing(charSize);
+
+	float x = 0.f;
+	float y = static_cast<float>(charSize);
+	u32 prev = 0;
+
+	for (u32 i = 0; i < cmd.length; i++)
+	{
+		u32 curr = static_cast<unsigned char>(dlTextArena[cmd.offset + i]);
+		x += font.getKerning(prev, curr, charSize);
+		prev = curr;
+
+		if (curr == '\n')
+		{
+			x = 0.f;
+			y += lineSpacing;
+			continue;
+		}
+
+		const sf::Glyph& glyph = font.getGlyph(curr, charSize, false);
+
+		if (curr != ' ' && curr != '\t')
+		{
+			sf::Vector2f origin = cmd.points[0] + sf::Vector2f(x, y);
+			float left = glyph.bounds.left;
+			float top = glyph.bounds.top;
+			float right = left + glyph.bounds.width;
+			float bottom = top + glyph.bounds.height;
+
+			sf::Vector2f corners[4] =
+			{
+				origin + sf::Vector2f(left, top),
+				origin + sf::Vector2f(right, top),
+				origin + sf::Vector2f(right, bottom),
+				origin + sf::Vector2f(left, bottom)
+			};
+
+			AppendQuad(dlBatch, corners, sf::FloatRect(glyph.textureRect), cmd.color);
+		}
+
+		x += curr == '\t' ? glyph.advance * 4 : glyph.advance;
+	}
+}
+
+
+void dlDrawList::AppendVertices(const DrawCmd& cmd)
+{
+	switch (cmd.type)
+	{
+	case DrawCmdType::Sprite:
+		AppendQuad(dlBatch, cmd.points, cmd.texRect, cmd.color);
+		break;
+
+	case DrawCmdType::Text:
+		AppendText(cmd);
+		break;
+
+	case DrawCmdType::Line:
+		dlBatch.append(sf::Vertex(cmd.points[0], cmd.color));
+		dlBatch.append(sf::Vertex(cmd.points[1], cmd.color));
+		break;
+
+	case DrawCmdType::Quad:
+		AppendQuad(dlBatch, cmd.points, sf::FloatRect(), cmd.color);
+		break;
+	}
+}
+
+
+void dlDrawList::Flush(const sf::Texture* texture)
+{
+	if (dlBatch.getVertexCount() == 0)
+		return;
+
+	sf::RenderStates states;
+	states.texture = texture;
+
+	getWindow()->draw(dlBatch, states);
+	dlBatch.clear(); // Keeps the capacity
+	dlLastDrawCalls++;
+}
+
+
+void dlDrawList::Execute()
+{
+	dlLastDrawCalls = 0;
+	dlLastCulled = dlCulled;
+	dlCulled = 0;
+
+	if (dlDrawCommands.empty())
+		return;
+
+	dlSortKeys.clear();
+
+	for (u32 i = 0; i < dlDrawCommands.size(); i++)
+		dlSortKeys.push_back(MakeSortKey(dlDrawCommands[i], i));
+
+	std::sort(dlSortKeys.begin(), dlSortKeys.end());
+
+	// Everything above the submission index is the batch state
+	constexpr u64 StateMask = ~u64(0xFFFFFFFF);
+
+	u64 batchState = 0;
+	const sf::Texture* batchTexture = nullptr;
+
+	for (size_t i = 0; i < dlSortKeys.size(); i++)
+	{
+		u64 key = dlSortKeys[i];
+		const DrawCmd& cmd = dlDrawCommands[key & 0xFFFFFFFF];
+
+		if (i == 0 || (key & StateMask) != batchState)
+		{
+			Flush(batchTexture);
+			batchState = key & StateMask;
+			batchTexture = cmd.texture;
+			dlBatch.setPrimitiveType(cmd.type == DrawCmdType::Line ? sf::Lines : sf::Triangles);
+		}
+
+		AppendVertices(cmd);
+	}
+
+	Flush(batchTexture);
+
+	dlDrawCommands.clear();
+	dlTextArena.clear();
+	dlTextureSlots.clear();
+	dlLastTexture = nullptr;
+	dlLastSlot = 0;
+}
@@ -1,37 +1,114 @@
 #pragma once
 
-#include <deque>
-#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include "base/SFMLRenderer.h"
 #include "vendor/SFML/Graphics.hpp"
 #include "common/sm_assert.h"
 
+// Frame draw command buffer
+//
+// Widgets push typed commands during the frame, Execute() sorts them by layer, primitive and texture
+// and merges every run with the same state into one vertex array, so a frame costs a draw call per
+// texture / primitive change instead of one per widget.
+// Commands are plain data, the buffers keep their capacity between frames.
+//
+// Level of detail follows the view scale (screen pixels per world unit). Zoomed out, world text is
+// dropped, sprites become flat quads of their average color, and anything smaller than a couple of
+// pixels on screen (pin markers and such) is skipped. The overlay layer is always drawn in full.
+
+enum class DrawCmdType : u8
+{
+	Sprite,
+	Text,
+	Line,
+	Quad
+};
+
+
+enum class DrawLod : u8
+{
+	Full,
+	Simplified
+};
+
+
+struct DrawCmd
+{
+	DrawCmdType type;
+	u8 layer;
+	const sf::Texture* texture;	// Sprite : its texture, Text : glyph page of the font
+	u32 textureSlot;			// Of the texture in the frame, 0 for none, part of the sort key
+
+	// Sprite, Quad : top left, top right, bottom right, bottom left in world space
+	// Line : the two end points, Text : the position
+	sf::Vector2f points[4];
+	sf::FloatRect texRect;		// Sprite
+	sf::Color color;
+
+	const sf::Font* font;		// Text
+	u32 charSize;
+	u32 offset;					// Into the text arena
+	u32 length;
+};
+
+
 class dlDrawList
 {
-    static inline std::vector<std::function<void()>> dlDrawCommands;
+	static inline std::vector<DrawCmd>	dlDrawCommands;
+	static inline std::vector<char>		dlTextArena;
+	static inline std::vector<u64>		dlSortKeys;
+	static inline std::unordered_map<const sf::Texture*, u32> dlTextureSlots; // Of the current frame, from 1
+	static inline const sf::Texture*	dlLastTexture = nullptr;	// Consecutive commands mostly share one
+	static inline u32					dlLastSlot = 0;
+	static inline sf::VertexArray		dlBatch;
+	static inline u32					dlLastDrawCalls = 0;
+	static inline u32					dlLastCulled = 0;
+	static inline u32					dlCulled = 0;	// Since the last Execute()
+	static inline sf::FloatRect			dlCullRect;
+	static inline bool					dlCulling = false;
+	static inline float					dlViewScale = 1.f;
+	static inline DrawLod				dlLod = DrawLod::Full;
+
+	static bool IsCulled(const sf::Vector2f* points, int count, u8 layer);
+	static u32  GetTextureSlot(const sf::Texture* texture);
+
+	static u64  MakeSortKey(const DrawCmd& cmd, u32 index);
+	static void AppendVertices(const DrawCmd& cmd);
+	static void AppendText(const DrawCmd& cmd);
+	static void Flush(const sf::Texture* texture);
+
 public:
 
-    inline static sf::RenderWindow* getWindow()
-    {
-        return g_SFMLRenderer.get_sfWindow();
-    }
-
-    inline static void DrawInvoke(const std::function<void()>& cmd)
-    {
-        dlDrawCommands.emplace_back(cmd);
-    }
-
-    inline static void Execute()
-    {
-        if (dlDrawCommands.empty())
-            return;
-
-		for (auto& call : dlDrawCommands)
-			call();
-    
-        dlDrawCommands.clear();
-    }
-};
+	inline static sf::RenderWindow* getWindow()
+	{
+		return g_SFMLRenderer.get_sfWindow();
+	}
+
+	static constexpr u8 OverlayLayer = 255;		// Not culled, not simplified
+	static constexpr float SimplifyBelowScale = 0.35f;
+	static constexpr float MinScreenSize = 2.f;	// Pixels, smaller sprites and quads are skipped when simplified
+
+	// Higher layers are drawn on top, inside a layer the order is by state
+	// lodColor replaces the texture when simplified
+	static void AddSprite(const sf::Sprite& sprite, u8 layer = 0, sf::Color lodColor = sf::Color(90, 90, 90));
+	static void AddText(std::string_view str, const sf::Font& font, u32 charSize, sf::Vector2f position, sf::Color color, u8 layer = 0);
+	static void AddLine(sf::Vector2f from, sf::Vector2f to, sf::Color color, u8 layer = 0);
+	static void AddQuad(const sf::FloatRect& rect, sf::Color color, u8 layer = 0);
 
+	// Commands outside the rect are dropped when added, text by a bound of its extent
+	static void SetCullRect(const sf::FloatRect& rect) { dlCullRect = rect; dlCulling = true; }
+	static void DisableCulling() { dlCulling = false; }
 
+	// Screen pixels per world unit, before the frame's commands are added
+	static void SetViewScale(float scale);
+	static DrawLod GetLod() { return dlLod; }
+
+	static void Execute();
+
+	// Draw calls issued and commands culled by the last frame
+	static u32 GetLastDrawCalls() { return dlLastDrawCalls; }
+	static u32 GetLastCulled() { return dlLastCulled; }
+};
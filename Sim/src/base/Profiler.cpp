@@ -0,0 +1,277 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+#include "helpers/JsonWriter.h"
+
+
+namespace
+{
+	const std::chrono::time_point<std::chrono::steady_clock> s_Epoch = std::chrono::steady_clock::now();
+
+	// Buffers live until exit, so the export can still read threads that have finished
+	std::mutex s_RegistryMutex;
+	std::vector<std::unique_ptr<ProfileThreadBuffer>> s_Buffers;
+
+	thread_local ProfileThreadBuffer* t_Buffer = nullptr;
+
+	ProfileThreadBuffer* GetThreadBuffer()
+	{
+		if (!t_Buffer)
+		{
+			std::lock_guard lock(s_RegistryMutex);
+			s_Buffers.push_back(std::make_unique<ProfileThreadBuffer>(u32(s_Buffers.size())));
+			t_Buffer = s_Buffers.back().get();
+		}
+
+		return t_Buffer;
+	}
+}
+
+
+ProfileThreadBuffer::ProfileThreadBuffer(u32 id)
+	: events(std::make_unique<ProfileEvent[]>(EventCapacity))
+	, counters(std::make_unique<ProfileCounter[]>(CounterCapacity))
+	, threadId(id)
+{ }
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Recording
+
+
+
+s64 Profiler::GetTimeNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_Epoch).count();
+}
+
+
+void Profiler::RecordScope(const char* name, const Timer& timer)
+{
+	ProfileThreadBuffer* buffer = GetThreadBuffer();
+
+	size_t index = buffer->numEvents.load(std::memory_order_relaxed);
+	if (index >= ProfileThreadBuffer::EventCapacity)
+	{
+		buffer->numDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	ProfileEvent& event = buffer->events[index];
+	event.name = name;
+	event.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(timer.GetStartTime() - s_Epoch).count();
+	event.durationNs = timer.GetElapsedNanoseconds();
+
+	buffer->numEvents.store(index + 1, std::memory_order_release);
+}
+
+
+void Profiler::RecordCounter(const ProfileCounter& counter)
+{
+	ProfileThreadBuffer* buffer = GetThreadBuffer();
+
+	size_t index = buffer->numCounters.load(std::memory_order_relaxed);
+	if (index >= ProfileThreadBuffer::CounterCapacity)
+	{
+		buffer->numDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	buffer->counters[index] = counter;
+	buffer->numCounters.store(index + 1, std::memory_order_release);
+}
+
+
+void Profiler::Clear()
+{
+	std::lock_guard lock(s_RegistryMutex);
+	for (auto& buffer : s_Buffers)
+	{
+		buffer->numEvents.store(0, std::memory_order_relaxed);
+		buffer->numCounters.store(0, std::memory_order_relaxed);
+		buffer->numDropped.store(0, std::memory_order_relaxed);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Export
+
+
+
+void Profiler::WriteChromeTrace(std::ostream& out)
+{
+	std::lock_guard lock(s_RegistryMutex);
+
+	JsonWriter json;
+	json.BeginObject();
+	json.Key("displayTimeUnit").Value("ns");
+	json.Key("traceEvents").BeginArray();
+
+	u64 numDropped = 0;
+	for (auto& buffer : s_Buffers)
+	{
+		size_t numEvents = buffer->numEvents.load(std::memory_order_acquire);
+		size_t numCounters = buffer->numCounters.load(std::memory_order_acquire);
+		numDropped += buffer->numDropped.load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i < numEvents; i++)
+		{
+			const ProfileEvent& event = buffer->events[i];
+			json.BeginObject();
+			json.Key("name").Value(event.name);
+			json.Key("cat").Value("sim");
+			json.Key("ph").Value("X");
+			json.Key("ts").Value(event.startNs * 1e-3);
+			json.Key("dur").Value(event.durationNs * 1e-3);
+			json.Key("pid").Value(1);
+			json.Key("tid").Value(u64(buffer->threadId));
+			json.EndObject();
+		}
+
+		for (size_t i = 0; i < numCounters; i++)
+		{
+			const ProfileCounter& counter = buffer->counters[i];
+			json.BeginObject();
+			json.Key("name").Value(counter.name);
+			json.Key("ph").Value("C");
+			json.Key("ts").Value(counter.timeNs * 1e-3);
+			json.Key("pid").Value(1);
+			json.Key("tid").Value(u64(buffer->threadId));
+			json.Key("args").BeginObject();
+			for (int arg = 0; arg < counter.numArgs; arg++)
+				json.Key(counter.argNames[arg]).Value(counter.argValues[arg]);
+			json.EndObject();
+			json.EndObject();
+		}
+	}
+
+	json.EndArray();
+	json.Key("otherData").BeginObject();
+	json.Key("dropped_records").Value(numDropped);
+	json.EndObject();
+	json.EndObject();
+
+	out << json.GetString() << std::endl;
+}
+
+
+bool Profiler::ExportChromeTrace(const std::string& path)
+{
+	std::ofstream out(path);
+	if (!out)
+		return false;
+
+	WriteChromeTrace(out);
+	return true;
+}
+
+
+void Profiler::PrintSummary(std::ostream& out)
+{
+	struct ScopeSummary
+	{
+		u64 count = 0;
+		s64 totalNs = 0;
+		s64 minNs = INT64_MAX;
+		s64 maxNs = 0;
+	};
+
+	struct ArgSummary
+	{
+		u64 count = 0;
+		double sum = 0.0;
+		double min = INFINITY;
+		double max = -INFINITY;
+		double last = 0.0;
+	};
+
+	std::map<std::string, ScopeSummary> scopes;
+	std::map<std::string, std::map<std::string, ArgSummary>> counters;
+	u64 numDropped = 0;
+
+	{
+		std::lock_guard lock(s_RegistryMutex);
+		for (auto& buffer : s_Buffers)
+		{
+			size_t numEvents = buffer->numEvents.load(std::memory_order_acquire);
+			size_t numCounters = buffer->numCounters.load(std::memory_order_acquire);
+			numDropped += buffer->numDropped.load(std::memory_order_relaxed);
+
+			for (size_t i = 0; i < numEvents; i++)
+			{
+				const ProfileEvent& event = buffer->events[i];
+				ScopeSummary& summary = scopes[event.name];
+				summary.count++;
+				summary.totalNs += event.durationNs;
+				summary.minNs = std::min(summary.minNs, event.durationNs);
+				summary.maxNs = std::max(summary.maxNs, event.durationNs);
+			}
+
+			for (size_t i = 0; i < numCounters; i++)
+			{
+				const ProfileCounter& counter = buffer->counters[i];
+				for (int arg = 0; arg < counter.numArgs; arg++)
+				{
+					ArgSummary& summary = counters[counter.name][counter.argNames[arg]];
+					double value = counter.argValues[arg];
+					summary.count++;
+					summary.sum += value;
+					summary.min = std::min(summary.min, value);
+					summary.max = std::max(summary.max, value);
+					summary.last = value;
+				}
+			}
+		}
+	}
+
+	std::vector<std::pair<std::string, ScopeSummary>> sorted(scopes.begin(), scopes.end());
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+		{
+			return a.second.totalNs > b.second.totalNs;
+		});
+
+	char line[256];
+	std::snprintf(line, sizeof(line), "%-28s %10s %12s %12s %12s %12s\n", "scope", "count", "total ms", "mean us", "min us", "max us");
+	out << line;
+
+	for (const auto& [name, summary] : sorted)
+	{
+		std::snprintf(line, sizeof(line), "%-28s %10llu %12.3f %12.3f %12.3f %12.3f\n",
+			name.c_str(),
+			(unsigned long long)summary.count,
+			summary.totalNs * 1e-6,
+			summary.totalNs * 1e-3 / summary.count,
+			summary.minNs * 1e-3,
+			summary.maxNs * 1e-3);
+		out << line;
+	}
+
+	for (const auto& [name, args] : counters)
+	{
+		std::snprintf(line, sizeof(line), "\n%-28s %10s %12s %12s %12s %12s\n", name.c_str(), "count", "mean", "min", "max", "last");
+		out << line;
+
+		for (const auto& [argName, summary] : args)
+		{
+			std::snprintf(line, sizeof(line), "  %-26s %10llu %12.4g %12.4g %12.4g %12.4g\n",
+				argName.c_str(),
+				(unsigned long long)summary.count,
+				summary.sum / summary.count,
+				summary.min,
+				summary.max,
+				summary.last);
+			out << line;
+		}
+	}
+
+	if (numDropped)
+		out << "\n" << numDropped << " records dropped, thread buffers are full" << std::endl;
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "base/Timer.h"
+#include "base/AllocTracker.h"
+
+// Scoped phase instrumentation
+//
+//	{
+//		SM_PROFILE_SCOPE("AssembleMatrix");
+//		...
+//	}
+//
+// Every thread records into its own fixed size buffer, recording never locks or allocates after the
+// first event of the thread. Buffers can be exported as Chrome trace JSON (chrome://tracing, Perfetto)
+// or as a summary table. With SM_PROFILE_ENABLED 0 the macros compile to nothing.
+// A profile scope is also an allocation phase when SM_ALLOC_TRACKING is on.
+
+#ifndef SM_PROFILE_ENABLED
+#define SM_PROFILE_ENABLED 0
+#endif
+
+
+struct ProfileEvent
+{
+	const char* name;
+	s64 startNs;	// Since Profiler epoch
+	s64 durationNs;
+};
+
+
+// Named set of values at a point of time, shown as a counter track in the trace
+struct ProfileCounter
+{
+	static constexpr int MaxArgs = 8;
+
+	const char* name;
+	s64 timeNs;
+	int numArgs;
+	const char* argNames[MaxArgs];
+	double argValues[MaxArgs];
+};
+
+
+class ProfileThreadBuffer
+{
+public:
+	static constexpr size_t EventCapacity = 1 << 16;
+	static constexpr size_t CounterCapacity = 1 << 12;
+
+	// Single writer (owning thread), readers only see the published part
+	// Buffers don't wrap, once full new records are dropped and counted
+	std::unique_ptr<ProfileEvent[]>		events;
+	std::unique_ptr<ProfileCounter[]>	counters;
+	std::atomic<size_t> numEvents = 0;
+	std::atomic<size_t> numCounters = 0;
+	std::atomic<size_t> numDropped = 0;
+	u32 threadId = 0;
+
+	ProfileThreadBuffer(u32 id);
+};
+
+
+class Profiler
+{
+public:
+
+	static void RecordScope(const char* name, const Timer& timer);
+	static void RecordCounter(const ProfileCounter& counter);
+
+	static s64 GetTimeNs(); // Since Profiler epoch
+
+	// Export and Clear expect the recording threads to be idle
+	static void Clear();
+	static void WriteChromeTrace(std::ostream& out);
+	static bool ExportChromeTrace(const std::string& path);
+	static void PrintSummary(std::ostream& out);
+};
+
+
+class ProfileScope
+{
+	const char* m_Name;
+	Timer m_Timer;
+
+public:
+
+	ProfileScope(const char* name)
+		: m_Name(name)
+	{
+		m_Timer.Start();
+	}
+
+	~ProfileScope()
+	{
+		m_Timer.Stop();
+		Profiler::RecordScope(m_Name, m_Timer);
+	}
+};
+
+
+#if SM_PROFILE_ENABLED
+#define SM_PROFILE_SCOPE(name) \
+		ProfileScope SM_CONCAT(_profileScope, __LINE__)(name); \
+		SM_ALLOC_PHASE(name)
+#define SM_PROFILE_COUNTER(counter) \
+		Profiler::RecordCounter(counter)
+#else
+#define SM_PROFILE_SCOPE(name) \
+		SM_ALLOC_PHASE(name)
+#define SM_PROFILE_COUNTER(counter)
+#endif
@@ -1,5 +1,7 @@
 #include "SFMLRenderer.h"
 #include "base/DrawList.h"
+#include "base/TextureManager.h"
+#include "base/WidgetsBase.h"
 #include <chrono>
 
 
@@ -32,6 +34,15 @@ SFMLRenderer* SFMLRenderer::Get()
 
 #define CREATE_WINDOW 0
 
+static constexpr size_t MaxScopeTraces = 4;
+
+// Strip along the bottom of the window
+static sf::FloatRect ScopeRect(sf::Vector2u windowSize)
+{
+	float height = std::min(260.0f, float(windowSize.y) * 0.3f);
+	return sf::FloatRect(10.0f, float(windowSize.y) - height - 10.0f, float(windowSize.x) - 20.0f, height);
+}
+
 SFMLRenderer* SFMLRenderer::Init()
 {
 #if CREATE_WINDOW
@@ -45,6 +56,7 @@ SFMLRenderer* SFMLRenderer::Init()
 	m_view.setCenter(sf::Vector2f(m_Window->getSize()) / 2.0f);
 	m_view.zoom(1.65);
 	m_Window->setView(m_view);
+	m_Scope.SetRect(ScopeRect(m_Window->getSize()));
 
 	SM_ASSERT(m_font.loadFromFile("c:\\Windows\\Fonts\\calibri.ttf"), "::SFMLRenderer() -> Failed to load font");
 #endif
@@ -67,6 +79,30 @@ SFMLRenderer* SFMLRenderer::OnRender()
 	circuit.Test2();
 	circuit.Reset();
 	
+	Simulation simulation(circuit);
+
+	// Every node is recorded, the scope shows the first few. Started over when the circuit changes
+	// or the simulation goes back in time
+	std::vector<std::unique_ptr<Waveform>> waveforms;
+	simulation.SetOutput([&](double time)
+	{
+		if (waveforms.size() != circuit.GetNumNodes() || (!waveforms.empty() && time < waveforms[0]->GetEndTime() - simulation.GetStep()))
+		{
+			static const sf::Color Colors[MaxScopeTraces] = { sf::Color::Yellow, sf::Color::Cyan, sf::Color::Magenta, sf::Color::Green };
+
+			waveforms.clear();
+			m_Scope.ClearTraces();
+			for (size_t i = 0; i < circuit.GetNumNodes(); i++)
+			{
+				waveforms.push_back(std::make_unique<Waveform>(simulation.GetStep(), time));
+				if (i < MaxScopeTraces)
+					m_Scope.AddTrace(waveforms.back().get(), Colors[i]);
+			}
+		}
+
+		for (size_t i = 0; i < waveforms.size(); i++)
+			waveforms[i]->AppendUntil(time, float(circuit.GetNode(i)->GetVoltage()));
+	});
 
 #if CREATE_WINDOW
 	while (m_Window->isOpen())
@@ -85,29 +121,35 @@ SFMLRenderer* SFMLRenderer::OnRender()
 		}
 
 		handleEvents();
+		simulation.Update(m_frameTime); // All edits of the frame in one go, then the steps it owes
+		dlDrawList::SetCullRect(GetViewRect()); // Before any widget of the frame adds itself
+		WidgetsBase::BeginFrame(GetViewRect());
+		float viewScale = m_Window->getSize().x / m_view.getSize().x;
+		dlDrawList::SetViewScale(viewScale);
+
+		if (m_Flow.GetNumWires())
+		{
+			circuit.ComputeBranchCurrents();
+			const Eigen::ArrayXd& currents = circuit.GetBranchResults().current;
+			m_Flow.SetViewScale(viewScale);
+			m_Flow.Advance(currents.data(), size_t(currents.size()), m_frameTime);
+		}
 		
 		auto start = std::chrono::high_resolution_clock::now();
 		
-		dlDrawList::DrawInvoke([]
-			{
-				char buffer[255];
-				sf::Text text;
-				text.setFont(g_SFMLRenderer.get_font());
-				text.setCharacterSize(20);
-				text.setFillColor(sf::Color::Black);
-				text.setPosition(10, 10);
-
-				auto result = std::format_to_n(buffer, 255, "FPS : {:.2f}", g_SFMLRenderer.m_fps);
-				buffer[result.size] = '\0';
-
-				text.setString(buffer);
-
-				dlDrawList::getWindow()->draw(text);
-			});
+		{
+			char buffer[255];
+			auto result = std::format_to_n(buffer, 255, "FPS : {:.2f}  Draw calls : {}  Culled : {}  Dots : {}  RTF : {:.3g} ({:.0f}%)", m_fps, dlDrawList::GetLastDrawCalls(), dlDrawList::GetLastCulled(),
+				m_FlowView.GetLastDotCount(), simulation.GetRealTimeFactor(), simulation.GetPaceRatio() * 100.0);
+			dlDrawList::AddText(std::string_view(buffer, result.size), m_font, 20, { 10, 10 }, sf::Color::Black, dlDrawList::OverlayLayer);
+		}
 
 		m_Window->setView(m_view);
 		m_Window->clear(sf::Color(200, 200, 200));
+		TextureManager::Commit();
 		dlDrawList::Execute();
+		m_FlowView.Draw(*m_Window, m_Flow, GetViewRect(), viewScale);
+		m_Scope.Draw(*m_Window);
 		
 		m_Window->display();
 
@@ -135,7 +177,11 @@ void SFMLRenderer::handleEvents()
 			float NewAspectRatio = float(m_event.size.width) / float(m_event.size.height);
 			auto CurrSize = m_view.getSize();
 			m_view.setSize(CurrSize.x, CurrSize.x / NewAspectRatio);
+			m_Scope.SetRect(ScopeRect({ m_event.size.width, m_event.size.height }));
 		}
+
+		if (m_Scope.HandleEvent(m_event))
+			continue;
 		
 		if (m_Window->hasFocus())
 		{
@@ -160,8 +206,16 @@ sf::Event*			SFMLRenderer::get_sfEvents()	{ return &m_event;}
 sf::View*			SFMLRenderer::get_sfView()		{ return &m_view;}
 sf::RenderWindow*	SFMLRenderer::get_sfWindow()	{ return m_Window.get();}
 sf::Font&			SFMLRenderer::get_font()		{ return m_font;}
+WaveformView&		SFMLRenderer::GetScope()		{ return m_Scope; }
+CurrentFlow&		SFMLRenderer::GetCurrentFlow()	{ return m_Flow; }
 sf::Vector2f		SFMLRenderer::GetDeltaMouse()	{ return delta_mouse; }
 
+sf::FloatRect SFMLRenderer::GetViewRect()
+{
+	sf::Vector2f size = m_view.getSize();
+	return sf::FloatRect(m_view.getCenter() - size / 2.f, size);
+}
+
 sf::Vector2f SFMLRenderer::GetWorldMousePos()
 {
 	return m_Window->mapPixelToCoords(sf::Mouse::getPosition(*m_Window), m_view);
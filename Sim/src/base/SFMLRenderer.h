@@ -3,6 +3,8 @@
 #include <print>
 
 #include "vendor/SFML/Graphics.hpp"
+#include "base/WaveformView.h"
+#include "base/CurrentFlowView.h"
 //#include "scheme/Scheme.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -21,6 +23,10 @@ class SFMLRenderer
     float       m_fps = 0;
   
     sf::Vector2f delta_mouse;
+
+    WaveformView m_Scope;
+    CurrentFlow m_Flow;         // Wires are added by whoever lays the circuit out
+    CurrentFlowView m_FlowView;
     
     SFMLRenderer() = default;
     void handleEvents();
@@ -38,8 +44,11 @@ public:
     sf::Event*         get_sfEvents();
     sf::View*          get_sfView();
     sf::Font&          get_font();
+    WaveformView&      GetScope();
+    CurrentFlow&       GetCurrentFlow();
     sf::Vector2f       GetDeltaMouse();
     sf::Vector2f       GetWorldMousePos();
+    sf::FloatRect      GetViewRect();
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,159 @@
+#include "SpatialGrid.h"
+#include <algorithm>
+
+
+SpatialGrid::SpatialGrid(float cellSize)
+	: m_CellSize(cellSize)
+{
+}
+
+
+SpatialGrid::Handle SpatialGrid::Insert(const sf::FloatRect& bounds, void* userData)
+{
+	Handle handle;
+	if (!m_FreeList.empty())
+	{
+		handle = m_FreeList.back();
+		m_FreeList.pop_back();
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_Items.size());
+		m_Items.emplace_back();
+	}
+
+	Item& item = m_Items[handle];
+	item = Item();
+	item.bounds = bounds;
+	item.userData = userData;
+	item.alive = true;
+	m_NumAlive++;
+
+	Bin(handle);
+	m_Version++;
+	return handle;
+}
+
+
+void SpatialGrid::Update(Handle handle, const sf::FloatRect& bounds)
+{
+	Item& item = m_Items[handle];
+	if (item.bounds == bounds)
+		return;
+
+	item.bounds = bounds;
+	m_Version++;
+
+	bool sameCells = CellCoord(bounds.left) == item.x0 && CellCoord(bounds.top) == item.y0 &&
+		CellCoord(bounds.left + bounds.width) == item.x1 && CellCoord(bounds.top + bounds.height) == item.y1;
+
+	if (!sameCells)
+	{
+		Unbin(handle);
+		Bin(handle);
+	}
+}
+
+
+void SpatialGrid::Remove(Handle handle)
+{
+	if (handle >= m_Items.size() || !m_Items[handle].alive)
+		return;
+
+	Unbin(handle);
+	m_Items[handle].alive = false;
+	m_NumAlive--;
+	m_Items[handle].userData = nullptr;
+	m_FreeList.push_back(handle);
+	m_Version++;
+}
+
+
+void SpatialGrid::Clear()
+{
+	m_Items.clear();
+	m_FreeList.clear();
+	m_Cells.clear();
+	m_MinX = m_MinY = 0;
+	m_MaxX = m_MaxY = -1;
+	m_NumAlive = 0;
+	m_Version++;
+}
+
+
+void SpatialGrid::Bin(Handle handle)
+{
+	Item& item = m_Items[handle];
+	item.x0 = CellCoord(item.bounds.left);
+	item.y0 = CellCoord(item.bounds.top);
+	item.x1 = CellCoord(item.bounds.left + item.bounds.width);
+	item.y1 = CellCoord(item.bounds.top + item.bounds.height);
+
+	if (m_MaxX < m_MinX)
+	{
+		m_MinX = item.x0;
+		m_MinY = item.y0;
+		m_MaxX = item.x1;
+		m_MaxY = item.y1;
+	}
+	else
+	{
+		m_MinX = std::min(m_MinX, item.x0);
+		m_MinY = std::min(m_MinY, item.y0);
+		m_MaxX = std::max(m_MaxX, item.x1);
+		m_MaxY = std::max(m_MaxY, item.y1);
+	}
+
+	for (int y = item.y0; y <= item.y1; y++)
+		for (int x = item.x0; x <= item.x1; x++)
+			m_Cells[CellKey(x, y)].push_back(handle);
+}
+
+
+void SpatialGrid::Unbin(Handle handle)
+{
+	const Item& item = m_Items[handle];
+
+	for (int y = item.y0; y <= item.y1; y++)
+	{
+		for (int x = item.x0; x <= item.x1; x++)
+		{
+			auto it = m_Cells.find(CellKey(x, y));
+			if (it == m_Cells.end())
+				continue;
+
+			std::vector<Handle>& cell = it->second;
+			auto pos = std::find(cell.begin(), cell.end(), handle);
+			if (pos != cell.end())
+			{
+				*pos = cell.back(); // Order inside a cell doesn't matter
+				cell.pop_back();
+			}
+		}
+	}
+}
+
+
+u32 SpatialGrid::NextStamp()
+{
+	if (++m_QueryStamp == 0)
+	{
+		// Wrapped, old stamps could match again
+		for (Item& item : m_Items)
+			item.queryStamp = 0;
+		m_QueryStamp = 1;
+	}
+	return m_QueryStamp;
+}
+
+
+void SpatialGrid::QueryRect(const sf::FloatRect& rect, std::vector<Handle>& out)
+{
+	QueryRect(rect, [&](Handle handle) { out.push_back(handle); });
+}
+
+
+void SpatialGrid::QueryPoint(sf::Vector2f point, std::vector<Handle>& out) const
+{
+	QueryPoint(point, [&](Handle handle) { out.push_back(handle); });
+}
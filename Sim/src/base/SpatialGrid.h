@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "vendor/SFML/Graphics.hpp"
+
+// Uniform grid over world space
+//
+// Every item is binned into the cells its bounds touch, a query only visits the cells under the query
+// rect, so hit-testing and culling cost depends on what is around the query and not on the item count.
+// Cells live in a hash map, the plane is unbounded. Moving an item inside the same cell range is
+// only a bounds write. Cells stay once created, so items moving back and forth don't reallocate them.
+//
+// A query is clamped to the cells ever used. A rect over more cells than there are items (a zoomed
+// out view) tests the items directly, a query never costs more than a pass over the items.
+
+class SpatialGrid
+{
+public:
+	using Handle = u32;
+	static constexpr Handle InvalidHandle = ~Handle(0);
+
+private:
+	struct Item
+	{
+		sf::FloatRect bounds;
+		void* userData = nullptr;
+		int x0 = 0, y0 = 0, x1 = -1, y1 = -1; // Covered cells, inclusive
+		u32 queryStamp = 0;
+		bool alive = false;
+	};
+
+	float m_CellSize;
+	std::vector<Item> m_Items;
+	std::vector<Handle> m_FreeList;
+	std::unordered_map<u64, std::vector<Handle>> m_Cells;
+	int m_MinX = 0, m_MinY = 0, m_MaxX = -1, m_MaxY = -1;	// Cells ever binned, inclusive
+	size_t m_NumAlive = 0;
+	u32 m_QueryStamp = 0;
+	u32 m_Version = 0;
+
+	static u64 CellKey(int x, int y) { return (u64(u32(x)) << 32) | u32(y); }
+	int CellCoord(float v) const { return static_cast<int>(std::floor(v / m_CellSize)); }
+
+	void Bin(Handle handle);
+	void Unbin(Handle handle);
+	u32 NextStamp();
+
+public:
+
+	explicit SpatialGrid(float cellSize = 128.f);
+
+	Handle Insert(const sf::FloatRect& bounds, void* userData = nullptr);
+	void Update(Handle handle, const sf::FloatRect& bounds);
+	void Remove(Handle handle);
+	void Clear();
+
+	const sf::FloatRect& GetBounds(Handle handle) const { return m_Items[handle].bounds; }
+	void* GetUserData(Handle handle) const { return m_Items[handle].userData; }
+
+	// Changes on every insert, remove and move, for caching query results
+	u32 GetVersion() const { return m_Version; }
+	size_t GetNumCells() const { return m_Cells.size(); }	// Empty ones included
+	size_t GetNumItems() const { return m_NumAlive; }
+
+	// fn(Handle) once for every item whose bounds intersect the rect
+	template<typename Fn>
+	void QueryRect(const sf::FloatRect& rect, Fn&& fn);
+
+	// fn(Handle) for every item whose bounds contain the point
+	template<typename Fn>
+	void QueryPoint(sf::Vector2f point, Fn&& fn) const;
+
+	void QueryRect(const sf::FloatRect& rect, std::vector<Handle>& out);
+	void QueryPoint(sf::Vector2f point, std::vector<Handle>& out) const;
+};
+
+
+template<typename Fn>
+void SpatialGrid::QueryRect(const sf::FloatRect& rect, Fn&& fn)
+{
+	int x0 = std::max(CellCoord(rect.left), m_MinX);
+	int y0 = std::max(CellCoord(rect.top), m_MinY);
+	int x1 = std::min(CellCoord(rect.left + rect.width), m_MaxX);
+	int y1 = std::min(CellCoord(rect.top + rect.height), m_MaxY);
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	// Every item once is cheaper than looking up more cells than that
+	if (u64(x1 - x0 + 1) * u64(y1 - y0 + 1) > m_NumAlive)
+	{
+		for (Handle handle = 0; handle < Handle(m_Items.size()); handle++)
+		{
+			const Item& item = m_Items[handle];
+			if (item.alive && item.bounds.intersects(rect))
+				fn(handle);
+		}
+		return;
+	}
+
+	u32 stamp = NextStamp();
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			auto it = m_Cells.find(CellKey(x, y));
+			if (it == m_Cells.end())
+				continue;
+
+			for (Handle handle : it->second)
+			{
+				Item& item = m_Items[handle];
+				if (item.queryStamp == stamp) // Already seen in another cell
+					continue;
+
+				item.queryStamp = stamp;
+				if (item.bounds.intersects(rect))
+					fn(handle);
+			}
+		}
+	}
+}
+
+
+template<typename Fn>
+void SpatialGrid::QueryPoint(sf::Vector2f point, Fn&& fn) const
+{
+	auto it = m_Cells.find(CellKey(CellCoord(point.x), CellCoord(point.y)));
+	if (it == m_Cells.end())
+		return;
+
+	for (Handle handle : it->second)
+	{
+		if (m_Items[handle].bounds.contains(point))
+			fn(handle);
+	}
+}
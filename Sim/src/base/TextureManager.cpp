@@ -0,0 +1,367 @@
+#include "TextureManager.h"
+#include "helpers/Helpers.h"
+#include <algorithm>
+#include <thread>
+
+
+TextureRef TextureManager::Load(const std::string& path, bool mipmapped)
+{
+	const TextureAsset* asset = LoadAsset(path, mipmapped);
+	return asset ? asset->normal : TextureRef();
+}
+
+
+TextureRef TextureManager::Add(const std::string& key, const sf::Image& image, bool mipmapped)
+{
+	if (TextureRef ref = Find(key))
+		return ref;
+
+	TextureAsset asset;
+	asset.normal = AddImage(image, mipmapped);
+	if (!asset.normal)
+		return {};
+
+	sf::Vector2u size = image.getSize();
+	asset.opaqueRect = Utils::CalcAlphaBounds(image.getPixelsPtr(), size.x, size.y);
+	asset.averageColor = Utils::CalcAverageColor(image.getPixelsPtr(), size_t(size.x) * size.y);
+
+	s_Cache[key] = asset;
+	return asset.normal;
+}
+
+
+TextureRef TextureManager::Find(const std::string& key)
+{
+	auto it = s_Cache.find(key);
+	return it != s_Cache.end() ? it->second.normal : TextureRef();
+}
+
+
+const TextureAsset* TextureManager::LoadAsset(const std::string& path, bool mipmapped, bool inverted)
+{
+	if (DecodeJob* job = FindPending(path))
+	{
+		job->done.wait(false);
+		Upload(*job);
+	}
+
+	auto it = s_Cache.find(path);
+	if (it != s_Cache.end() && (!inverted || it->second.inverted))
+		return &it->second;
+
+	// Not cached, or cached without the inverted variant
+	DecodeJob job;
+	job.path = path;
+	job.mipmapped = mipmapped;
+	job.inverted = inverted;
+
+	Decode(job);
+	Upload(job);
+
+	it = s_Cache.find(path);
+	return it != s_Cache.end() ? &it->second : nullptr;
+}
+
+
+std::optional<sf::IntRect> TextureManager::GetOpaqueRect(const std::string& path)
+{
+	const TextureAsset* asset = LoadAsset(path);
+	return asset ? asset->opaqueRect : std::nullopt;
+}
+
+
+TextureRef TextureManager::AddImage(const sf::Image& image, bool mipmapped)
+{
+	sf::Vector2u size = image.getSize();
+	return (size.x <= MaxAtlasImageSize && size.y <= MaxAtlasImageSize)
+		? AddToAtlas(image, mipmapped)
+		: AddStandalone(image, mipmapped);
+}
+
+
+bool TextureManager::FindSpace(AtlasPage& page, unsigned width, unsigned height, sf::Vector2u& pos)
+{
+	unsigned pageSize = page.texture.getSize().x;
+
+	// Lowest shelf that is tall enough and has room left
+	Shelf* best = nullptr;
+	for (Shelf& shelf : page.shelves)
+	{
+		if (shelf.height >= height && shelf.cursor + width <= pageSize)
+		{
+			if (!best || shelf.height < best->height)
+				best = &shelf;
+		}
+	}
+
+	if (!best)
+	{
+		if (page.usedHeight + height > pageSize)
+			return false;
+
+		page.shelves.push_back({ page.usedHeight, height, 0 });
+		page.usedHeight += height;
+		best = &page.shelves.back();
+	}
+
+	pos = { best->cursor, best->y };
+	best->cursor += width;
+	return true;
+}
+
+
+TextureRef TextureManager::AddToAtlas(const sf::Image& image, bool mipmapped)
+{
+	sf::Vector2u size = image.getSize();
+	unsigned padding = mipmapped ? AtlasMipPadding : AtlasPadding;
+	unsigned width = size.x + padding * 2;
+	unsigned height = size.y + padding * 2;
+
+	// Sizes in whole blocks keep every position on the page aligned to them
+	if (mipmapped)
+	{
+		width = (width + AtlasMipPadding - 1) & ~(AtlasMipPadding - 1);
+		height = (height + AtlasMipPadding - 1) & ~(AtlasMipPadding - 1);
+	}
+
+	AtlasPage* target = nullptr;
+	sf::Vector2u pos;
+
+	for (auto& page : s_Pages)
+	{
+		if (page->mipmapped == mipmapped && FindSpace(*page, width, height, pos))
+		{
+			target = page.get();
+			break;
+		}
+	}
+
+	if (!target)
+	{
+		auto page = std::make_unique<AtlasPage>();
+		unsigned pageSize = std::min(AtlasPageSize, sf::Texture::getMaximumSize());
+
+		// Transparent page, so the padding around the images doesn't bleed color
+		sf::Image blank;
+		blank.create(pageSize, pageSize, sf::Color::Transparent);
+		if (!page->texture.loadFromImage(blank))
+			return {};
+
+		page->texture.setSmooth(true);
+		page->mipmapped = mipmapped;
+
+		if (!FindSpace(*page, width, height, pos))
+			return {};
+
+		s_Pages.push_back(std::move(page));
+		target = s_Pages.back().get();
+	}
+
+	unsigned x = pos.x + padding;
+	unsigned y = pos.y + padding;
+
+	target->texture.update(image, x, y);
+	target->dirty = mipmapped;
+
+	TextureRef ref;
+	ref.texture = &target->texture;
+	ref.rect = sf::IntRect(int(x), int(y), int(size.x), int(size.y));
+	return ref;
+}
+
+
+TextureRef TextureManager::AddStandalone(const sf::Image& image, bool mipmapped)
+{
+	auto texture = std::make_unique<sf::Texture>();
+	if (!texture->loadFromImage(image))
+		return {};
+
+	texture->setSmooth(true);
+	if (mipmapped)
+		texture->generateMipmap();
+
+	sf::Vector2u size = image.getSize();
+
+	TextureRef ref;
+	ref.texture = texture.get();
+	ref.rect = sf::IntRect(0, 0, int(size.x), int(size.y));
+
+	s_Standalone.push_back(std::move(texture));
+	return ref;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Loading
+
+
+
+// Worker side, touches nothing shared
+void TextureManager::Decode(DecodeJob& job)
+{
+	job.loaded = job.image.loadFromFile(job.path);
+
+	if (job.loaded)
+	{
+		sf::Vector2u size = job.image.getSize();
+		job.opaqueRect = Utils::CalcAlphaBounds(job.image.getPixelsPtr(), size.x, size.y);
+		job.averageColor = Utils::CalcAverageColor(job.image.getPixelsPtr(), size_t(size.x) * size.y);
+
+		if (job.inverted)
+		{
+			job.invertedImage = job.image;
+			Utils::InvertColors(job.invertedImage);
+		}
+	}
+
+	job.done.store(true, std::memory_order_release);
+	job.done.notify_all();
+}
+
+
+// Main thread, the texture side
+void TextureManager::Upload(DecodeJob& job)
+{
+	if (job.uploaded)
+		return;
+
+	job.uploaded = true;
+	if (!job.loaded)
+		return;
+
+	TextureAsset& asset = s_Cache[job.path];
+	if (!asset.normal)
+	{
+		asset.normal = AddImage(job.image, job.mipmapped);
+		asset.opaqueRect = job.opaqueRect;
+		asset.averageColor = job.averageColor;
+	}
+
+	if (job.inverted && !asset.inverted)
+		asset.inverted = AddImage(job.invertedImage, job.mipmapped);
+
+	// Pixels live on the GPU now
+	job.image = sf::Image();
+	job.invertedImage = sf::Image();
+}
+
+
+TextureManager::DecodeJob* TextureManager::FindPending(const std::string& path)
+{
+	for (auto& batch : s_Pending)
+	{
+		for (auto& job : batch->jobs)
+		{
+			if (!job->uploaded && job->path == path)
+				return job.get();
+		}
+	}
+	return nullptr;
+}
+
+
+void TextureManager::Preload(const std::vector<std::string>& paths, bool mipmapped, bool inverted)
+{
+	auto batch = std::make_unique<DecodeBatch>();
+
+	for (const std::string& path : paths)
+	{
+		auto it = s_Cache.find(path);
+		if (it != s_Cache.end() && (!inverted || it->second.inverted))
+			continue;
+
+		if (FindPending(path))
+			continue;
+
+		bool queued = std::any_of(batch->jobs.begin(), batch->jobs.end(), [&](const auto& job) { return job->path == path; });
+		if (queued)
+			continue;
+
+		auto job = std::make_unique<DecodeJob>();
+		job->path = path;
+		job->mipmapped = mipmapped;
+		job->inverted = inverted;
+		batch->jobs.push_back(std::move(job));
+	}
+
+	if (batch->jobs.empty())
+		return;
+
+	size_t numWorkers = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), batch->jobs.size());
+	DecodeBatch* raw = batch.get();
+
+	for (size_t i = 0; i < numWorkers; i++)
+	{
+		raw->workers.push_back(std::async(std::launch::async, [raw]()
+		{
+			for (size_t index = raw->next++; index < raw->jobs.size(); index = raw->next++)
+				Decode(*raw->jobs[index]);
+		}));
+	}
+
+	s_Pending.push_back(std::move(batch));
+}
+
+
+void TextureManager::UploadFinished(bool wait)
+{
+	for (auto& batch : s_Pending)
+	{
+		for (auto& job : batch->jobs)
+		{
+			if (job->uploaded)
+				continue;
+
+			if (wait)
+				job->done.wait(false);
+			else if (!job->done.load(std::memory_order_acquire))
+				continue;
+
+			Upload(*job);
+		}
+
+		batch->numUploaded = std::count_if(batch->jobs.begin(), batch->jobs.end(), [](const auto& job) { return job->uploaded; });
+	}
+
+	// Every job is done here, so the workers have nothing left
+	std::erase_if(s_Pending, [](const auto& batch)
+	{
+		if (batch->numUploaded != batch->jobs.size())
+			return false;
+
+		for (auto& worker : batch->workers)
+			worker.wait();
+		return true;
+	});
+}
+
+
+void TextureManager::WaitForPending()
+{
+	UploadFinished(true);
+}
+
+
+void TextureManager::Commit()
+{
+	if (!s_Pending.empty())
+		UploadFinished(false);
+
+	for (auto& page : s_Pages)
+	{
+		if (page->dirty)
+		{
+			page->texture.generateMipmap();
+			page->dirty = false;
+		}
+	}
+}
+
+
+void TextureManager::Clear()
+{
+	WaitForPending();
+	s_Cache.clear();
+	s_Pages.clear();
+	s_Standalone.clear();
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "vendor/SFML/Graphics.hpp"
+
+// Shared textures for the widgets
+//
+// Every image is loaded from disk once per path. Small images are packed into atlas pages, so many
+// different icons end up on one texture and batch into one draw call; big ones get a texture of their own.
+// Widgets keep a TextureRef (texture + sub rect) instead of owning a texture.
+//
+// Preload() decodes images on worker threads, together with the derived data (opaque rect, inverted
+// variant), only the GPU upload is left for the main thread in Commit(). Load() of a path that is still
+// decoding waits for that one image.
+
+struct TextureRef
+{
+	const sf::Texture* texture = nullptr;
+	sf::IntRect rect; // Area of the image inside the texture
+
+	explicit operator bool() const { return texture != nullptr; }
+
+	// Rect given in image pixels -> rect in texture pixels
+	sf::IntRect ToTextureRect(const sf::IntRect& imageRect) const
+	{
+		return sf::IntRect(rect.left + imageRect.left, rect.top + imageRect.top, imageRect.width, imageRect.height);
+	}
+};
+
+
+// An image and what is derived from it
+struct TextureAsset
+{
+	TextureRef normal;
+	TextureRef inverted;					// Only when asked for
+	std::optional<sf::IntRect> opaqueRect;	// Bounds of the non transparent pixels, in image pixels
+	sf::Color averageColor;					// Stand-in color for far zoom levels
+};
+
+
+class TextureManager
+{
+	static constexpr unsigned AtlasPageSize = 2048;
+	static constexpr unsigned MaxAtlasImageSize = 256;	// Bigger images get their own texture
+	static constexpr unsigned AtlasPadding = 2;			// Against bleeding of bilinear filtering, pages without mips
+
+	// A texel of mip level L covers 2^L pixels. On mipmapped pages images are aligned to 2^AtlasMipLevels
+	// and padded by as much, so the levels down to 1/8 scale never mix neighbours, filtering included.
+	// Coarser levels do, sprites are drawn as plain quads well before that (dlDrawList::SimplifyBelowScale)
+	static constexpr unsigned AtlasMipLevels = 3;
+	static constexpr unsigned AtlasMipPadding = 1u << AtlasMipLevels;
+
+	struct Shelf
+	{
+		unsigned y;
+		unsigned height;
+		unsigned cursor; // First free x
+	};
+
+	struct AtlasPage
+	{
+		sf::Texture texture;
+		std::vector<Shelf> shelves;
+		unsigned usedHeight = 0;
+		bool mipmapped = false;
+		bool dirty = false; // Mipmaps have to be rebuilt
+	};
+
+	// Filled by a worker, uploaded by the main thread once done
+	struct DecodeJob
+	{
+		std::string path;
+		bool mipmapped = true;
+		bool inverted = false;
+
+		bool loaded = false;
+		sf::Image image;
+		sf::Image invertedImage;
+		std::optional<sf::IntRect> opaqueRect;
+		sf::Color averageColor;
+
+		std::atomic<bool> done = false;
+		bool uploaded = false;
+	};
+
+	struct DecodeBatch
+	{
+		std::vector<std::unique_ptr<DecodeJob>> jobs;
+		std::atomic<size_t> next = 0;
+		std::vector<std::future<void>> workers;
+		size_t numUploaded = 0;
+	};
+
+	static inline std::unordered_map<std::string, TextureAsset> s_Cache;
+	static inline std::vector<std::unique_ptr<AtlasPage>> s_Pages;
+	static inline std::vector<std::unique_ptr<sf::Texture>> s_Standalone;
+	static inline std::vector<std::unique_ptr<DecodeBatch>> s_Pending;
+
+	static TextureRef AddToAtlas(const sf::Image& image, bool mipmapped);
+	static TextureRef AddStandalone(const sf::Image& image, bool mipmapped);
+	static TextureRef AddImage(const sf::Image& image, bool mipmapped);
+	static bool FindSpace(AtlasPage& page, unsigned width, unsigned height, sf::Vector2u& pos);
+
+	static void Decode(DecodeJob& job);
+	static void Upload(DecodeJob& job);
+	static DecodeJob* FindPending(const std::string& path);
+	static void UploadFinished(bool wait);
+
+public:
+
+	// Cached by path, an empty ref if the file couldn't be loaded
+	static TextureRef Load(const std::string& path, bool mipmapped = true);
+	static TextureRef Add(const std::string& key, const sf::Image& image, bool mipmapped = true);
+	static TextureRef Find(const std::string& key);
+
+	// Like Load, also builds the inverted variant and the opaque rect if they are missing
+	static const TextureAsset* LoadAsset(const std::string& path, bool mipmapped = true, bool inverted = false);
+	static std::optional<sf::IntRect> GetOpaqueRect(const std::string& path);
+
+	// Starts decoding on worker threads and returns, paths already cached or queued are skipped
+	static void Preload(const std::vector<std::string>& paths, bool mipmapped = true, bool inverted = false);
+	static void WaitForPending();
+	static bool IsLoading() { return !s_Pending.empty(); }
+
+	// Uploads finished images, rebuilds the mipmaps of the atlas pages that changed.
+	// Once per frame before drawing
+	static void Commit();
+
+	static size_t GetNumTextures() { return s_Pages.size() + s_Standalone.size(); }
+	static void Clear();
+};
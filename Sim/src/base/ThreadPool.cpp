@@ -0,0 +1,175 @@
+#include "ThreadPool.h"
+
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (size_t i = 0; i < numThreads; i++)
+		m_Workers.push_back(std::make_unique<Worker>());
+
+	for (size_t i = 0; i < numThreads; i++)
+		m_Threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+
+ThreadPool::~ThreadPool()
+{
+	Wait();
+
+	{
+		std::lock_guard guard(m_SleepLock);
+		m_Stop = true;
+	}
+	m_WakeUp.notify_all();
+
+	for (std::thread& thread : m_Threads)
+		thread.join();
+}
+
+
+void ThreadPool::Worker::PushBack(Task&& task)
+{
+	if (count == tasks.size())
+	{
+		// Unwrapped into the front of a ring twice the size
+		std::vector<Task> grown(std::max<size_t>(16, tasks.size() * 2));
+		for (size_t i = 0; i < count; i++)
+			grown[i] = std::move(tasks[(front + i) & (tasks.size() - 1)]);
+		tasks = std::move(grown);
+		front = 0;
+	}
+
+	tasks[(front + count) & (tasks.size() - 1)] = std::move(task);
+	count++;
+}
+
+
+ThreadPool::Task ThreadPool::Worker::PopBack()
+{
+	count--;
+	Task& slot = tasks[(front + count) & (tasks.size() - 1)];
+	Task task = std::move(slot);
+	slot = nullptr;
+	return task;
+}
+
+
+ThreadPool::Task ThreadPool::Worker::PopFront()
+{
+	Task& slot = tasks[front];
+	Task task = std::move(slot);
+	slot = nullptr;
+	front = (front + 1) & (tasks.size() - 1);
+	count--;
+	return task;
+}
+
+
+void ThreadPool::Submit(Task task)
+{
+	// Own deque for tasks spawned by a worker, round robin for the rest
+	size_t target = t_Pool == this ? t_WorkerIndex : m_NextWorker++ % m_Workers.size();
+
+	m_Unfinished++;
+	{
+		std::lock_guard guard(m_Workers[target]->lock);
+		m_Workers[target]->PushBack(std::move(task));
+		m_Queued++;
+	}
+
+	// Taking the lock orders the notify after a sleeper checked m_Queued
+	{
+		std::lock_guard guard(m_SleepLock);
+	}
+	m_WakeUp.notify_one();
+}
+
+
+bool ThreadPool::PopTask(size_t self, Task& task)
+{
+	Worker& worker = *m_Workers[self];
+	std::lock_guard guard(worker.lock);
+	if (worker.count == 0)
+		return false;
+
+	task = worker.PopBack();
+	m_Queued--;
+	return true;
+}
+
+
+bool ThreadPool::StealTask(size_t self, Task& task)
+{
+	size_t numWorkers = m_Workers.size();
+	for (size_t offset = 1; offset <= numWorkers; offset++)
+	{
+		Worker& victim = *m_Workers[(self + offset) % numWorkers];
+		std::lock_guard guard(victim.lock);
+		if (victim.count == 0)
+			continue;
+
+		// Oldest task, the owner works on the other end
+		task = victim.PopFront();
+		m_Queued--;
+		return true;
+	}
+	return false;
+}
+
+
+void ThreadPool::RunTask(Task& task)
+{
+	task();
+	task = nullptr;
+	m_Unfinished--;
+}
+
+
+bool ThreadPool::RunPendingTask()
+{
+	if (m_Queued.load() == 0)
+		return false;
+
+	Task task;
+	size_t self = GetCurrentWorker();
+	bool found = (self < m_Workers.size() && PopTask(self, task)) || StealTask(self % m_Workers.size(), task);
+	if (found)
+		RunTask(task);
+
+	return found;
+}
+
+
+void ThreadPool::Wait()
+{
+	while (m_Unfinished.load() != 0)
+	{
+		if (!RunPendingTask())
+			std::this_thread::yield();
+	}
+}
+
+
+void ThreadPool::WorkerLoop(size_t index)
+{
+	t_Pool = this;
+	t_WorkerIndex = index;
+
+	Task task;
+	while (true)
+	{
+		if (PopTask(index, task) || StealTask(index, task))
+		{
+			RunTask(task);
+			continue;
+		}
+
+		std::unique_lock guard(m_SleepLock);
+		m_WakeUp.wait(guard, [this]() { return m_Stop.load() || m_Queued.load() != 0; });
+
+		if (m_Stop && m_Queued.load() == 0)
+			return;
+	}
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work stealing thread pool
+//
+// Every worker owns a deque. A worker pushes and pops its own tasks at the back (newest first, cache
+// warm) and steals from the front of the others when it runs dry, so uneven tasks even out without a
+// central queue. Threads waiting on the pool run tasks instead of blocking.
+//
+// The deques are rings that keep their capacity, and ParallelFor submits tasks that fit the small
+// buffer of std::function, so a pool in steady use doesn't touch the heap.
+
+class ThreadPool
+{
+public:
+	using Task = std::function<void()>;
+
+private:
+	// Ring of tasks, capacity a power of 2. Grows when full and never shrinks
+	struct Worker
+	{
+		std::mutex lock;
+		std::vector<Task> tasks;
+		size_t front = 0;
+		size_t count = 0;
+
+		void PushBack(Task&& task);
+		Task PopBack();
+		Task PopFront();
+	};
+
+	std::vector<std::unique_ptr<Worker>> m_Workers;
+	std::vector<std::thread> m_Threads;
+
+	std::atomic<size_t> m_Queued = 0;		// In the deques
+	std::atomic<size_t> m_Unfinished = 0;	// Submitted and not done yet
+	std::atomic<size_t> m_NextWorker = 0;	// Round robin for tasks from outside the pool
+	std::atomic<bool> m_Stop = false;
+
+	std::mutex m_SleepLock;
+	std::condition_variable m_WakeUp;
+
+	static inline thread_local ThreadPool* t_Pool = nullptr;
+	static inline thread_local size_t t_WorkerIndex = 0;
+
+	void WorkerLoop(size_t index);
+	bool PopTask(size_t self, Task& task);
+	bool StealTask(size_t self, Task& task);
+	void RunTask(Task& task);
+
+public:
+
+	// 0 threads = one per hardware thread
+	explicit ThreadPool(size_t numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t GetNumThreads() const { return m_Threads.size(); }
+
+	// Index of the calling worker in [0, GetNumThreads()), GetNumThreads() for any other thread
+	size_t GetCurrentWorker() const { return t_Pool == this ? t_WorkerIndex : m_Threads.size(); }
+
+	void Submit(Task task);
+
+	// Runs one queued task on the calling thread, false if there was none
+	bool RunPendingTask();
+
+	// Helps until every submitted task is done
+	void Wait();
+
+	// fn(index) for every index in [0, count), in chunks of at least grain indices.
+	// Returns when all are done, the calling thread takes part
+	template<typename Fn>
+	void ParallelFor(size_t count, Fn&& fn, size_t grain = 1);
+};
+
+
+template<typename Fn>
+void ThreadPool::ParallelFor(size_t count, Fn&& fn, size_t grain)
+{
+	if (count == 0)
+		return;
+
+	// A few chunks per thread, so stealing has something to balance
+	size_t numChunks = std::max<size_t>(1, std::min(count / std::max<size_t>(grain, 1), (GetNumThreads() + 1) * 4));
+	size_t chunkSize = (count + numChunks - 1) / numChunks;
+	numChunks = (count + chunkSize - 1) / chunkSize;
+
+	// The tasks only capture the address of the job and take the next chunk when they run, a task
+	// stays within the small buffer of std::function
+	struct Job
+	{
+		std::remove_reference_t<Fn>* fn;
+		size_t count;
+		size_t chunkSize;
+		std::atomic<size_t> nextChunk;
+		std::atomic<size_t> remaining;
+	};
+
+	Job job;
+	job.fn = &fn;
+	job.count = count;
+	job.chunkSize = chunkSize;
+	job.nextChunk = 0;
+	job.remaining = numChunks;
+
+	for (size_t chunk = 0; chunk < numChunks; chunk++)
+	{
+		Submit([&job]()
+		{
+			size_t begin = job.nextChunk.fetch_add(1, std::memory_order_relaxed) * job.chunkSize;
+			size_t end = std::min(job.count, begin + job.chunkSize);
+			for (size_t i = begin; i < end; i++)
+				(*job.fn)(i);
+
+			job.remaining.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	while (job.remaining.load(std::memory_order_acquire) != 0)
+	{
+		if (!RunPendingTask())
+			std::this_thread::yield();
+	}
+}
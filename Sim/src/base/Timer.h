@@ -61,6 +61,8 @@ public:
 
 	bool GetIsRunning() const { return m_IsRunning; }
 
+	std::chrono::time_point<std::chrono::steady_clock> GetStartTime() const { return m_StartTime; }
+
 	long long GetElapsedTicks() const
 	{
 		return (m_EndTime - m_StartTime).count();
@@ -86,4 +88,9 @@ public:
 	{
 		return std::chrono::duration_cast<std::chrono::microseconds>(m_EndTime - m_StartTime).count();
 	}
+
+	long long GetElapsedNanoseconds() const
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(m_EndTime - m_StartTime).count();
+	}
 };
@@ -0,0 +1,228 @@
+#include "WaveformView.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+WaveformView::WaveformView()
+{
+	m_Background.setFillColor(sf::Color(20, 24, 28, 230));
+	m_Background.setOutlineColor(sf::Color(90, 90, 90));
+	m_Background.setOutlineThickness(1.0f);
+}
+
+
+void WaveformView::SetWindow(double start, double duration)
+{
+	m_Start = start;
+	m_Duration = std::max(duration, 1e-15);
+	m_Follow = false;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// 											Vertices
+
+
+
+// Raw values in y for now, scaled once all traces are in. Down and up the columns alternately, so
+// the strip never crosses the column it is in to get to the next one
+void WaveformView::AddEnvelope(const Waveform& waveform, size_t numColumns, sf::Color color)
+{
+	m_Columns.resize(numColumns);
+	waveform.GetEnvelope(m_Start, m_Duration, numColumns, m_Columns.data());
+
+	bool down = false;
+	for (size_t c = 0; c < numColumns; c++)
+	{
+		const Waveform::Extent& column = m_Columns[c];
+		if (column.IsEmpty())
+			continue;
+
+		float x = float(c) + 0.5f;
+		m_Vertices.emplace_back(sf::Vector2f(x, down ? column.max : column.min), color);
+		m_Vertices.emplace_back(sf::Vector2f(x, down ? column.min : column.max), color);
+		down = !down;
+	}
+}
+
+
+// A sample past either edge too, the view clips the lines to them
+void WaveformView::AddSamples(const Waveform& waveform, sf::Color color)
+{
+	u64 numSamples = waveform.GetNumSamples();
+	if (numSamples == 0)
+		return;
+
+	double interval = waveform.GetSampleInterval();
+	double first = std::floor((m_Start - waveform.GetStartTime()) / interval);
+	double last = std::ceil((m_Start + m_Duration - waveform.GetStartTime()) / interval);
+	if (last < 0.0 || first >= double(numSamples))
+		return;
+
+	u64 begin = u64(std::max(first, 0.0));
+	u64 end = std::min(u64(last) + 1, numSamples);
+	double pixelsPerSecond = double(m_Rect.width) / m_Duration;
+
+	for (u64 i = begin; i < end; i++)
+	{
+		float x = float((waveform.GetSampleTime(i) - m_Start) * pixelsPerSecond);
+		m_Vertices.emplace_back(sf::Vector2f(x, waveform.GetSample(i)), color);
+	}
+}
+
+
+void WaveformView::BuildVertices()
+{
+	m_Vertices.clear();
+	m_TraceStart.clear();
+
+	size_t numColumns = size_t(std::max(m_Rect.width, 1.0f));
+	if (m_Follow)
+	{
+		double end = 0.0;
+		for (const Trace& trace : m_Traces)
+			end = std::max(end, trace.waveform->GetEndTime());
+		m_Start = end - m_Duration;
+	}
+
+	for (const Trace& trace : m_Traces)
+	{
+		m_TraceStart.push_back(m_Vertices.size());
+
+		const Waveform& waveform = *trace.waveform;
+		double samplesPerColumn = m_Duration / (waveform.GetSampleInterval() * double(numColumns));
+		if (samplesPerColumn > 1.0)
+			AddEnvelope(waveform, numColumns, trace.color);
+		else
+			AddSamples(waveform, trace.color);
+	}
+	m_TraceStart.push_back(m_Vertices.size());
+
+	if (m_Vertices.empty())
+		return;
+
+	// One scale for all traces, a little margin above and below
+	float min = m_Vertices[0].position.y;
+	float max = min;
+	for (const sf::Vertex& vertex : m_Vertices)
+	{
+		min = std::min(min, vertex.position.y);
+		max = std::max(max, vertex.position.y);
+	}
+
+	float span = max - min;
+	if (span <= std::abs(max) * 1e-6f)
+		span = std::max(std::abs(max), 1.0f);
+	float margin = span * 0.05f;
+	float scale = m_Rect.height / (span + margin * 2.0f);
+	float top = max + margin + (span - (max - min)) * 0.5f;
+
+	for (sf::Vertex& vertex : m_Vertices)
+		vertex.position.y = (top - vertex.position.y) * scale;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// 											Drawing
+
+
+
+void WaveformView::Draw(sf::RenderTarget& target)
+{
+	if (m_Rect.width < 1.0f || m_Rect.height < 1.0f)
+		return;
+
+	BuildVertices();
+
+	// Window pixels (the default view keeps its size on resize), then panel pixels clipped to the panel
+	sf::View previous = target.getView();
+	sf::Vector2f targetSize(target.getSize());
+	sf::View panel(sf::FloatRect(0.0f, 0.0f, m_Rect.width, m_Rect.height));
+	panel.setViewport(sf::FloatRect(m_Rect.left / targetSize.x, m_Rect.top / targetSize.y,
+		m_Rect.width / targetSize.x, m_Rect.height / targetSize.y));
+
+	target.setView(sf::View(sf::FloatRect(0.0f, 0.0f, targetSize.x, targetSize.y)));
+	m_Background.setPosition(m_Rect.left, m_Rect.top);
+	m_Background.setSize({ m_Rect.width, m_Rect.height });
+	target.draw(m_Background);
+
+	target.setView(panel);
+	if (sf::VertexBuffer::isAvailable())
+	{
+		if (m_Buffer.getVertexCount() < m_Vertices.size())
+			m_Buffer.create(std::max(m_Vertices.size(), m_Buffer.getVertexCount() * 2));
+		m_Buffer.update(m_Vertices.data(), m_Vertices.size(), 0);
+
+		for (size_t t = 0; t + 1 < m_TraceStart.size(); t++)
+			target.draw(m_Buffer, m_TraceStart[t], m_TraceStart[t + 1] - m_TraceStart[t]);
+	}
+	else
+	{
+		for (size_t t = 0; t + 1 < m_TraceStart.size(); t++)
+			target.draw(m_Vertices.data() + m_TraceStart[t], m_TraceStart[t + 1] - m_TraceStart[t], sf::LineStrip);
+	}
+
+	target.setView(previous);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// 											Input
+
+
+
+bool WaveformView::HandleEvent(const sf::Event& event)
+{
+	switch (event.type)
+	{
+	case sf::Event::MouseWheelScrolled:
+	{
+		float x = float(event.mouseWheelScroll.x);
+		float y = float(event.mouseWheelScroll.y);
+		if (!m_Rect.contains(x, y) || event.mouseWheelScroll.delta == 0.0f)
+			return false;
+
+		// The time under the cursor stays there, following keeps the right edge on the newest sample
+		double fraction = double(x - m_Rect.left) / double(m_Rect.width);
+		double cursor = m_Start + m_Duration * fraction;
+		m_Duration = std::max(m_Duration * (event.mouseWheelScroll.delta > 0 ? 0.8 : 1.25), 1e-15);
+		m_Start = cursor - m_Duration * fraction;
+		return true;
+	}
+
+	case sf::Event::MouseButtonPressed:
+		if (event.mouseButton.button != sf::Mouse::Left || !m_Rect.contains(float(event.mouseButton.x), float(event.mouseButton.y)))
+			return false;
+
+		m_Dragging = true;
+		m_DragX = float(event.mouseButton.x);
+		m_DragStart = m_Start;
+		return true;
+
+	case sf::Event::MouseMoved:
+		if (!m_Dragging)
+			return false;
+
+		m_Start = m_DragStart - double(float(event.mouseMove.x) - m_DragX) / double(m_Rect.width) * m_Duration;
+		m_Follow = false;
+		return true;
+
+	case sf::Event::MouseButtonReleased:
+		if (!m_Dragging || event.mouseButton.button != sf::Mouse::Left)
+			return false;
+
+		m_Dragging = false;
+		return true;
+
+	case sf::Event::KeyPressed:
+		if (event.key.code != sf::Keyboard::End)
+			return false;
+
+		m_Follow = true;
+		return true;
+
+	default:
+		return false;
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <vector>
+
+#include "vendor/SFML/Graphics.hpp"
+#include "sim/Waveform.h"
+
+// Oscilloscope panel over recorded waveforms
+//
+// Each frame asks every trace for the min/max envelope of one pixel column (see Waveform.h) and
+// draws it as a single line strip going down and up the columns, so a trace is two vertices per
+// pixel at most whatever the number of samples behind it. Zoomed in past one sample per pixel the
+// samples are drawn as they are. Vertices go through a streaming vertex buffer that only grows.
+//
+// Wheel zooms around the cursor, left drag pans, End goes back to following the newest samples.
+
+class WaveformView
+{
+public:
+	struct Trace
+	{
+		const Waveform* waveform;
+		sf::Color color;
+	};
+
+private:
+	std::vector<Trace> m_Traces;
+
+	sf::FloatRect m_Rect;			// Window pixels
+	double m_Start = 0.0;			// Left edge, simulated seconds
+	double m_Duration = 1e-3;
+	bool m_Follow = true;			// Keeps the newest sample at the right edge
+
+	bool m_Dragging = false;
+	float m_DragX = 0.0f;
+	double m_DragStart = 0.0;
+
+	sf::VertexBuffer m_Buffer{ sf::LineStrip, sf::VertexBuffer::Stream };
+	std::vector<sf::Vertex> m_Vertices;
+	std::vector<size_t> m_TraceStart;	// First vertex of every trace, then the end
+	std::vector<Waveform::Extent> m_Columns;
+	sf::RectangleShape m_Background;
+
+	void AddEnvelope(const Waveform& waveform, size_t numColumns, sf::Color color);
+	void AddSamples(const Waveform& waveform, sf::Color color);
+	void BuildVertices();
+
+public:
+
+	WaveformView();
+
+	void AddTrace(const Waveform* waveform, sf::Color color) { m_Traces.push_back({ waveform, color }); }
+	void ClearTraces() { m_Traces.clear(); }
+
+	void SetRect(const sf::FloatRect& rect) { m_Rect = rect; }
+	const sf::FloatRect& GetRect() const { return m_Rect; }
+
+	// Stops following
+	void SetWindow(double start, double duration);
+	double GetStart() const { return m_Start; }
+	double GetDuration() const { return m_Duration; }
+
+	void SetFollow(bool follow) { m_Follow = follow; }
+	bool IsFollowing() const { return m_Follow; }
+
+	// Screen space, the view of the target is left as it was
+	void Draw(sf::RenderTarget& target);
+
+	// True if the event was meant for the panel
+	bool HandleEvent(const sf::Event& event);
+
+	size_t GetLastVertexCount() const { return m_Vertices.size(); }
+};
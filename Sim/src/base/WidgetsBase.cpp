@@ -1,26 +1,117 @@
 #include "SFMLRenderer.h"
 #include "WidgetsBase.h"
+#include "DrawList.h"
 
-WidgetsBase::WidgetsBase(const std::string& path)
+WidgetsBase::WidgetsBase(const std::string& path, bool genMips)
 {
-    loadImageFromFile(path);
+    loadImageFromFile(path, genMips);
 }
 
-void WidgetsBase::loadImageFromFile(const std::string& path)
+WidgetsBase::~WidgetsBase()
 {
-    SM_ASSERT(m_texture.loadFromFile(path), std::format("::WidgetsBase() Couldn't load image from the given path : {}", path));
-    m_texture.generateMipmap();
-    m_sprite.setTexture(m_texture);
+    s_index.Remove(m_handle);
+}
+
+void WidgetsBase::loadImageFromFile(const std::string& path, bool genMips)
+{
+    const TextureAsset* asset = TextureManager::LoadAsset(path, genMips);
+    SM_ASSERT(asset, std::format("::WidgetsBase() Couldn't load image from the given path : {}", path));
+
+    // Missing or broken file : the widget stays without a texture, an empty sprite as before the atlas
+    if (!asset)
+    {
+        std::cerr << std::format("::WidgetsBase() Couldn't load image from the given path : {}", path) << std::endl;
+        m_textureRef = TextureRef();
+        UpdateBounds();
+        return;
+    }
+
+    m_textureRef = asset->normal;
+    m_lodColor = asset->averageColor;
+    m_sprite.setTexture(*m_textureRef.texture);
+    m_sprite.setTextureRect(m_textureRef.rect); // Only our part of the atlas
+    UpdateBounds();
+}
+
+void WidgetsBase::UpdateBounds()
+{
+    sf::FloatRect bounds = m_sprite.getGlobalBounds();
+    if (m_handle == SpatialGrid::InvalidHandle)
+        m_handle = s_index.Insert(bounds, this);
+    else
+        s_index.Update(m_handle, bounds);
+
+    // Moved during the frame, BeginFrame() saw the old bounds
+    m_visibleFrame = bounds.intersects(s_viewRect) ? s_frame : 0;
+}
+
+void WidgetsBase::BeginFrame(const sf::FloatRect& viewRect)
+{
+    s_frame++;
+    s_viewRect = viewRect;
+    s_culling = true;
+
+    s_index.QueryRect(viewRect, [](SpatialGrid::Handle handle)
+    {
+        static_cast<WidgetsBase*>(s_index.GetUserData(handle))->m_visibleFrame = s_frame;
+    });
+}
+
+void WidgetsBase::RecordSprite(u8 layer)
+{
+    if (IsVisible())
+        dlDrawList::AddSprite(m_sprite, layer, m_lodColor);
 }
 
 bool WidgetsBase::is_hovered()
 {
-    return m_sprite.getGlobalBounds().contains(g_SFMLRenderer.GetWorldMousePos());
+    sf::Vector2f mouse = g_SFMLRenderer.GetWorldMousePos();
+
+    // One grid query per mouse position, shared by all widgets of the frame
+    if (mouse != s_hoverMousePos || s_index.GetVersion() != s_hoverVersion)
+    {
+        s_hovered.clear();
+        s_index.QueryPoint(mouse, s_hovered);
+        s_hoverMousePos = mouse;
+        s_hoverVersion = s_index.GetVersion();
+    }
+
+    return std::find(s_hovered.begin(), s_hovered.end(), m_handle) != s_hovered.end();
+}
+
+void WidgetsBase::FindInRect(const sf::FloatRect& rect, std::vector<WidgetsBase*>& out)
+{
+    s_index.QueryRect(rect, [&](SpatialGrid::Handle handle)
+    {
+        out.push_back(static_cast<WidgetsBase*>(s_index.GetUserData(handle)));
+    });
 }
 
-sf::Texture&     WidgetsBase::GetTexture()   { return m_texture; }
-sf::Sprite&      WidgetsBase::GetSprite()    { return m_sprite; }
+WidgetsBase* WidgetsBase::FindAt(sf::Vector2f point)
+{
+    // The newest widget under the point by creation order, without collecting the hits
+    WidgetsBase* top = nullptr;
+    s_index.QueryPoint(point, [&](SpatialGrid::Handle handle)
+    {
+        auto* widget = static_cast<WidgetsBase*>(s_index.GetUserData(handle));
+        if (!top || widget->m_sequence > top->m_sequence)
+            top = widget;
+    });
 
-void WidgetsBase::SetPosition(const sf::Vector2f& pos) { m_sprite.setPosition(pos); }
+    return top;
+}
 
+const sf::Texture& WidgetsBase::GetTexture()
+{
+    static const sf::Texture s_empty; // Widgets whose image didn't load
+    return m_textureRef ? *m_textureRef.texture : s_empty;
+}
 
+const TextureRef&  WidgetsBase::GetTextureRef() { return m_textureRef; }
+sf::Sprite&        WidgetsBase::GetSprite()     { return m_sprite; }
+
+void WidgetsBase::SetPosition(const sf::Vector2f& pos)
+{
+    m_sprite.setPosition(pos);
+    UpdateBounds();
+}
@@ -6,23 +6,67 @@
 
 #include "vendor/SFML/Graphics.hpp"
 #include "common/sm_assert.h"
+#include "base/TextureManager.h"
+#include "base/SpatialGrid.h"
 
 
+// Every widget is registered in a shared spatial grid by its sprite bounds,
+// hover and selection queries go through the grid instead of testing every widget.
+// BeginFrame() marks the widgets in the view with one grid query, the others skip recording
+// their draw, so the frame's draw cost follows what is on screen and not the schematic size
 class WidgetsBase
 {
+    static inline SpatialGrid s_index{ 128.f };
+
+    // Frame of the last BeginFrame() and its view, a widget in the view has the frame number
+    static inline u32 s_frame = 1;
+    static inline sf::FloatRect s_viewRect;
+    static inline bool s_culling = false;
+
+    // Widgets under the mouse, valid while the mouse and the grid stay the same
+    static inline std::vector<SpatialGrid::Handle> s_hovered;
+    static inline sf::Vector2f s_hoverMousePos;
+    static inline u32 s_hoverVersion = ~0u;
+
+    // Creation order, grid handles are reused and don't tell which widget is newer
+    static inline u64 s_nextSequence = 0;
+
 protected:
 
-    sf::Texture m_texture;
+    TextureRef  m_textureRef;   // Shared, owned by the TextureManager
+    sf::Color   m_lodColor;     // Drawn instead of the texture when zoomed out
     sf::Sprite  m_sprite;
+    SpatialGrid::Handle m_handle = SpatialGrid::InvalidHandle;
+    u32         m_visibleFrame = 0;
+    u64         m_sequence = s_nextSequence++;
+
+    // Adds the sprite to the draw list if the widget is in the view
+    void RecordSprite(u8 layer = 0);
 
 public:
 
-    WidgetsBase(const std::string& path);
-    void loadImageFromFile(const std::string& path);
+    WidgetsBase(const std::string& path, bool genMips = true);
+    ~WidgetsBase();
+
+    // The grid keeps a pointer to the widget
+    WidgetsBase(const WidgetsBase&) = delete;
+    WidgetsBase& operator=(const WidgetsBase&) = delete;
+
+    void loadImageFromFile(const std::string& path, bool genMips = true);
     bool is_hovered();
 
-    sf::Texture&    GetTexture();
-    sf::Sprite&     GetSprite();
-   
+    const sf::Texture&  GetTexture();
+    const TextureRef&   GetTextureRef();
+    sf::Sprite&         GetSprite();    // Call UpdateBounds() after moving or scaling it directly
+
     void SetPosition(const sf::Vector2f& pos);
+    void UpdateBounds();
+
+    // Before any widget of the frame draws, with the world rect the view shows
+    static void BeginFrame(const sf::FloatRect& viewRect);
+    bool IsVisible() const { return !s_culling || m_visibleFrame == s_frame; }
+
+    static void FindInRect(const sf::FloatRect& rect, std::vector<WidgetsBase*>& out);
+    static WidgetsBase* FindAt(sf::Vector2f point); // The last created widget under the point, nullptr if none
+    static SpatialGrid& GetIndex() { return s_index; }
 };
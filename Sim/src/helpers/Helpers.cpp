@@ -1,4 +1,13 @@
 #include "Helpers.h"
+#include <bit>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SM_IMAGE_SSE2 1
+#include <emmintrin.h>
+#else
+#define SM_IMAGE_SSE2 0
+#endif
 
 std::vector<std::string> Utils::split_string(const std::string& input, const std::string& delimiters, uint16_t expected_vec_size)
 {
@@ -36,3 +45,114 @@ std::string Utils::strip_string(const std::string& str)
 
     return str.substr(start_pos, end_pos - start_pos + 1);
 }
+
+void Utils::InvertRGB(u8* pixels, size_t numPixels)
+{
+    // RGBA in memory is 0xAABBGGRR as a little endian u32
+    constexpr u32 RGBMask = 0x00FFFFFF;
+    size_t i = 0;
+
+#if SM_IMAGE_SSE2
+    const __m128i mask = _mm_set1_epi32(RGBMask);
+    for (; i + 4 <= numPixels; i += 4)
+    {
+        __m128i* ptr = reinterpret_cast<__m128i*>(pixels + i * 4);
+        _mm_storeu_si128(ptr, _mm_xor_si128(_mm_loadu_si128(ptr), mask));
+    }
+#endif
+
+    for (; i < numPixels; i++)
+    {
+        u32 pixel;
+        std::memcpy(&pixel, pixels + i * 4, 4);
+        pixel ^= RGBMask;
+        std::memcpy(pixels + i * 4, &pixel, 4);
+    }
+}
+
+// Bit per pixel of a 4 pixel block, set when alpha != 0
+static inline u32 OpaqueBits4(const u8* pixels)
+{
+#if SM_IMAGE_SSE2
+    const __m128i alphaMask = _mm_set1_epi32(int(0xFF000000));
+    __m128i alpha = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels)), alphaMask);
+    u32 transparent = u32(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(alpha, _mm_setzero_si128()))));
+    return ~transparent & 0xF;
+#else
+    u32 bits = 0;
+    for (u32 k = 0; k < 4; k++)
+        bits |= (pixels[k * 4 + 3] != 0 ? 1u : 0u) << k;
+    return bits;
+#endif
+}
+
+std::optional<sf::IntRect> Utils::CalcAlphaBounds(const u8* pixels, unsigned width, unsigned height)
+{
+    unsigned left = width;
+    unsigned top = height;
+    unsigned right = 0;
+    unsigned bottom = 0;
+    unsigned blocks = width / 4;
+
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const u8* row = pixels + size_t(y) * width * 4;
+
+        // First opaque pixel from the left
+        unsigned first = width;
+        for (unsigned b = 0; b < blocks && first == width; ++b)
+        {
+            if (u32 bits = OpaqueBits4(row + b * 16))
+                first = b * 4 + std::countr_zero(bits);
+        }
+        for (unsigned x = blocks * 4; x < width && first == width; ++x)
+        {
+            if (row[x * 4 + 3] != 0)
+                first = x;
+        }
+
+        if (first == width)
+            continue;
+
+        // Last opaque pixel from the right, the row has at least one
+        unsigned last = first;
+        for (unsigned x = width; x > blocks * 4 && last == first; --x)
+        {
+            if (row[(x - 1) * 4 + 3] != 0)
+                last = x - 1;
+        }
+        for (unsigned b = blocks; b > 0 && last == first && (b - 1) * 4 + 3 > first; --b)
+        {
+            if (u32 bits = OpaqueBits4(row + (b - 1) * 16))
+                last = (b - 1) * 4 + (31 - std::countl_zero(bits));
+        }
+
+        left = std::min(left, first);
+        right = std::max(right, last);
+        top = std::min(top, y);
+        bottom = y;
+    }
+
+    if (top < height)
+        return sf::IntRect(int(left), int(top), int(right - left + 1), int(bottom - top + 1));
+
+    return std::nullopt;
+}
+
+sf::Color Utils::CalcAverageColor(const u8* pixels, size_t numPixels)
+{
+    u64 r = 0, g = 0, b = 0, a = 0;
+    for (size_t i = 0; i < numPixels; i++)
+    {
+        const u8* p = pixels + i * 4;
+        r += u64(p[0]) * p[3];
+        g += u64(p[1]) * p[3];
+        b += u64(p[2]) * p[3];
+        a += p[3];
+    }
+
+    if (a == 0)
+        return sf::Color::Transparent;
+
+    return sf::Color(u8(r / a), u8(g / a), u8(b / a));
+}
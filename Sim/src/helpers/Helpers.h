@@ -1,21 +1,28 @@
 #pragma once
 #include <cmath>
+#include <optional>
+#include <vector>
+#include <string>
 #include "vendor/SFML/Graphics.hpp"
 
 #define PI 3.14159265358979l
 
 namespace Utils
 {
-    inline void InvertColors(sf::Image& image) {
-        for (unsigned y = 0; y < image.getSize().y; ++y) {
-            for (unsigned x = 0; x < image.getSize().x; ++x) {
-                sf::Color color = image.getPixel(x, y);
-                color.r = 255 - color.r;
-                color.g = 255 - color.g;
-                color.b = 255 - color.b;
-                image.setPixel(x, y, color);
-            }
-        }
+    // Raw RGBA8 buffers, SIMD where available
+    void InvertRGB(u8* pixels, size_t numPixels); // Alpha is kept
+    std::optional<sf::IntRect> CalcAlphaBounds(const u8* pixels, unsigned width, unsigned height);
+    sf::Color CalcAverageColor(const u8* pixels, size_t numPixels); // Alpha weighted, opaque result
+
+    inline void InvertColors(sf::Image& image)
+    {
+        sf::Vector2u size = image.getSize();
+        if (size.x == 0 || size.y == 0)
+            return;
+
+        // In place : sf::Image only hands out a const pointer, but it points into its own non const
+        // storage, writing through it is defined and saves a copy and a create()
+        InvertRGB(const_cast<u8*>(image.getPixelsPtr()), size_t(size.x) * size.y);
     }
 
     inline void InvertTexture(sf::Texture& texture)
@@ -25,34 +32,17 @@ namespace Utils
         texture.update(image);
     }
 
-	inline std::optional<sf::IntRect> CalcTextureRect(const sf::Texture& texture)
+    // Bounding box of the non transparent pixels
+    inline std::optional<sf::IntRect> CalcTextureRect(const sf::Image& image)
     {
-        sf::Image image = texture.copyToImage();
         sf::Vector2u size = image.getSize();
+        return CalcAlphaBounds(image.getPixelsPtr(), size.x, size.y);
+    }
 
-        unsigned int left = size.x;
-        unsigned int top = size.y;
-        unsigned int right = 0;
-        unsigned int bottom = 0;
-
-        for (unsigned int y = 0; y < size.y; ++y) {
-            for (unsigned int x = 0; x < size.x; ++x) {
-                sf::Color pixel = image.getPixel(x, y);
-                if (pixel.a != 0) { 
-                    if (x < left) left = x;
-                    if (y < top) top = y;
-                    if (x > right) right = x;
-                    if (y > bottom) bottom = y;
-                }
-            }
-        }
-
-        if (left < right && top < bottom) {
-            sf::IntRect rect(left, top, right - left + 1, bottom - top + 1);
-			return rect;
-        } else {
-			return std::nullopt;
-        }
+    // Downloads the texture, prefer the image version or TextureManager::GetOpaqueRect
+    inline std::optional<sf::IntRect> CalcTextureRect(const sf::Texture& texture)
+    {
+        return CalcTextureRect(texture.copyToImage());
     }
 
     std::vector<std::string>    split_string    (const std::string& input, const std::string& delimiters, uint16_t expected_vec_size = 16);
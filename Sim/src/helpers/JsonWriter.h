@@ -0,0 +1,173 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cmath>
+
+// Small streaming JSON writer for the reports of the headless tools
+// 
+//	JsonWriter json;
+//	json.BeginObject();
+//	json.Key("name").Value("grid");
+//	json.Key("sizes").BeginArray().Value(4).Value(8).EndArray();
+//	json.EndObject();
+//
+// A compact writer puts the whole document on one line, for streams of JSON lines
+
+class JsonWriter
+{
+	std::string m_Out;
+	std::vector<bool> m_HasItems; // One entry per open object / array
+	bool m_AfterKey = false;
+	bool m_Pretty = true;
+
+	void NewLine()
+	{
+		if (!m_Pretty)
+			return;
+
+		m_Out += '\n';
+		m_Out.append(m_HasItems.size(), '\t');
+	}
+
+	void BeginItem()
+	{
+		if (m_AfterKey)
+		{
+			m_AfterKey = false;
+			return;
+		}
+
+		if (!m_HasItems.empty())
+		{
+			if (m_HasItems.back())
+				m_Out += ',';
+			m_HasItems.back() = true;
+			NewLine();
+		}
+	}
+
+	JsonWriter& Open(char bracket)
+	{
+		BeginItem();
+		m_Out += bracket;
+		m_HasItems.push_back(false);
+		return *this;
+	}
+
+	JsonWriter& Close(char bracket)
+	{
+		bool hasItems = m_HasItems.back();
+		m_HasItems.pop_back();
+		if (hasItems)
+			NewLine();
+		m_Out += bracket;
+		return *this;
+	}
+
+	void WriteString(std::string_view str)
+	{
+		m_Out += '"';
+		for (char c : str)
+		{
+			switch (c)
+			{
+			case '"':  m_Out += "\\\""; break;
+			case '\\': m_Out += "\\\\"; break;
+			case '\n': m_Out += "\\n"; break;
+			case '\t': m_Out += "\\t"; break;
+			default:
+				if (static_cast<unsigned char>(c) < 0x20)
+				{
+					char buffer[8];
+					std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+					m_Out += buffer;
+				}
+				else
+				{
+					m_Out += c;
+				}
+			}
+		}
+		m_Out += '"';
+	}
+
+public:
+
+	explicit JsonWriter(bool pretty = true)
+		: m_Pretty(pretty)
+	{
+	}
+
+	JsonWriter& BeginObject()	{ return Open('{'); }
+	JsonWriter& EndObject()		{ return Close('}'); }
+	JsonWriter& BeginArray()	{ return Open('['); }
+	JsonWriter& EndArray()		{ return Close(']'); }
+
+	JsonWriter& Key(std::string_view key)
+	{
+		BeginItem();
+		WriteString(key);
+		m_Out += m_Pretty ? ": " : ":";
+		m_AfterKey = true;
+		return *this;
+	}
+
+	JsonWriter& Value(std::string_view str)
+	{
+		BeginItem();
+		WriteString(str);
+		return *this;
+	}
+
+	JsonWriter& Value(const char* str) { return Value(std::string_view(str)); }
+
+	JsonWriter& Value(double value)
+	{
+		BeginItem();
+		if (!std::isfinite(value))
+		{
+			m_Out += "null"; // JSON has no inf / nan
+			return *this;
+		}
+
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+		m_Out += buffer;
+		return *this;
+	}
+
+	JsonWriter& Value(s64 value)
+	{
+		BeginItem();
+		m_Out += std::to_string(value);
+		return *this;
+	}
+
+	JsonWriter& Value(u64 value)
+	{
+		BeginItem();
+		m_Out += std::to_string(value);
+		return *this;
+	}
+
+	JsonWriter& Value(int value) { return Value(s64(value)); }
+
+	JsonWriter& Value(bool value)
+	{
+		BeginItem();
+		m_Out += value ? "true" : "false";
+		return *this;
+	}
+
+	const std::string& GetString() const { return m_Out; }
+
+	// Starts a new document, keeps the buffer
+	void Clear()
+	{
+		m_Out.clear();
+		m_HasItems.clear();
+		m_AfterKey = false;
+	}
+};
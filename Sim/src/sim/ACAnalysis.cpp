@@ -0,0 +1,204 @@
+#include "ACAnalysis.h"
+#include "base/ThreadPool.h"
+
+#include <cmath>
+#include <numbers>
+#include "vendor/Eigen/OrderingMethods"
+
+
+ACAnalysis::ACAnalysis(Circuit& circuit)
+	: m_Circuit(circuit)
+{
+}
+
+
+void ACAnalysis::Stamp(size_t numUnknowns)
+{
+	eNode* ground = m_Circuit.GetGroundNode();
+
+	m_Stamper.Clear();
+	m_Circuit.ForEachElement([&](eElement* element) { element->StampAC(m_Stamper, ground); });
+
+	m_Rhs.setZero(Eigen::Index(numUnknowns));
+	for (const auto& [row, amplitude] : m_Stamper.GetSources())
+		m_Rhs(row) += amplitude;
+}
+
+
+bool ACAnalysis::HasSamePattern() const
+{
+	const std::vector<ACStampEntry>& entries = m_Stamper.GetEntries();
+	if (m_Pattern.rows() == 0 || entries.size() != m_PatternEntries.size())
+		return false;
+
+	for (size_t k = 0; k < entries.size(); k++)
+	{
+		if (entries[k].row != m_PatternEntries[k].first || entries[k].col != m_PatternEntries[k].second)
+			return false;
+	}
+	return true;
+}
+
+
+void ACAnalysis::Analyze()
+{
+	m_NumUnknowns = m_Circuit.NumberUnknowns();
+	Stamp(m_NumUnknowns);
+	BuildPattern();
+}
+
+
+void ACAnalysis::BuildPattern()
+{
+	SM_PROFILE_SCOPE("AC::Analyze");
+
+	const std::vector<ACStampEntry>& entries = m_Stamper.GetEntries();
+	int n = int(m_NumUnknowns);
+
+	m_PatternEntries.resize(entries.size());
+	for (size_t k = 0; k < entries.size(); k++)
+		m_PatternEntries[k] = { entries[k].row, entries[k].col };
+
+	// Column ordering from the structure alone, the values change with the frequency
+	std::vector<Eigen::Triplet<double, int>> structure;
+	structure.reserve(entries.size() + m_NumUnknowns);
+	for (const ACStampEntry& entry : entries)
+		structure.emplace_back(int(entry.row), int(entry.col), 1.0);
+
+	// Explicit diagonal, so a zero pivot on a branch row still has its slot
+	for (int i = 0; i < n; i++)
+		structure.emplace_back(i, i, 1.0);
+
+	Eigen::SparseMatrix<double, Eigen::ColMajor, int> pattern(n, n);
+	pattern.setFromTriplets(structure.begin(), structure.end());
+	pattern.makeCompressed();
+
+	Eigen::PermutationMatrix<Eigen::Dynamic, Eigen::Dynamic, int> permutation;
+	Eigen::COLAMDOrdering<int> ordering;
+	ordering(pattern, permutation);
+
+	// Same convention as SparseLU : column c of the system goes to position perm(c)
+	m_ColumnPosition = permutation.indices();
+
+	std::vector<Eigen::Triplet<Complex, int>> permuted;
+	permuted.reserve(structure.size());
+	for (const auto& t : structure)
+		permuted.emplace_back(t.row(), m_ColumnPosition(t.col()), Complex(0.0, 0.0));
+
+	m_Pattern.resize(n, n);
+	m_Pattern.setFromTriplets(permuted.begin(), permuted.end());
+	m_Pattern.makeCompressed();
+
+	// Nonzero slot of every stamp entry, so a point fills values without searching
+	m_ValueSlot.resize(entries.size());
+	for (size_t k = 0; k < entries.size(); k++)
+	{
+		int col = m_ColumnPosition(int(entries[k].col));
+		const int* begin = m_Pattern.innerIndexPtr() + m_Pattern.outerIndexPtr()[col];
+		const int* end = m_Pattern.innerIndexPtr() + m_Pattern.outerIndexPtr()[col + 1];
+		const int* found = std::lower_bound(begin, end, int(entries[k].row));
+		m_ValueSlot[k] = int(found - m_Pattern.innerIndexPtr());
+	}
+
+	// Contexts hold copies of the old pattern
+	m_Contexts.clear();
+}
+
+
+void ACAnalysis::SolvePoint(size_t point, WorkerContext& context)
+{
+	if (!context.analyzed)
+	{
+		context.A = m_Pattern;
+		context.lu.analyzePattern(context.A);
+		context.analyzed = true;
+	}
+
+	double omega = 2.0 * std::numbers::pi * m_Frequencies[point];
+	const std::vector<ACStampEntry>& entries = m_Stamper.GetEntries();
+
+	Complex* values = context.A.valuePtr();
+	std::fill(values, values + context.A.nonZeros(), Complex(0.0, 0.0));
+
+	for (size_t k = 0; k < entries.size(); k++)
+	{
+		const ACStampEntry& entry = entries[k];
+		double imag = omega * entry.c - (entry.gamma != 0.0 ? entry.gamma / omega : 0.0);
+		values[m_ValueSlot[k]] += Complex(entry.g, imag);
+	}
+
+	context.lu.factorize(context.A);
+	if (context.lu.info() != Eigen::Success)
+	{
+		m_Failed[point] = 1;
+		m_Solutions.col(point).setConstant(Complex(NAN, NAN));
+		return;
+	}
+
+	context.y = context.lu.solve(m_Rhs);
+
+	// Back to the order of the unknowns
+	for (Eigen::Index c = 0; c < Eigen::Index(m_NumUnknowns); c++)
+		m_Solutions(c, point) = context.y(m_ColumnPosition(c));
+}
+
+
+void ACAnalysis::Sweep(const std::vector<double>& frequencies, ThreadPool* pool)
+{
+	SM_PROFILE_SCOPE("AC::Sweep");
+
+	// Values edited since the last sweep are only in a new stamp, the ordering holds while its pattern does
+	size_t numUnknowns = m_Circuit.NumberUnknowns();
+	Stamp(numUnknowns);
+	if (numUnknowns != m_NumUnknowns || !HasSamePattern())
+	{
+		m_NumUnknowns = numUnknowns;
+		BuildPattern();
+	}
+
+	m_Frequencies = frequencies;
+	m_Solutions.resize(m_NumUnknowns, frequencies.size());
+	m_Failed.assign(frequencies.size(), 0);
+
+	size_t numContexts = pool ? pool->GetNumThreads() + 1 : 1;
+	while (m_Contexts.size() < numContexts)
+		m_Contexts.push_back(std::make_unique<WorkerContext>());
+
+	if (!pool)
+	{
+		for (size_t point = 0; point < frequencies.size(); point++)
+			SolvePoint(point, *m_Contexts[0]);
+		return;
+	}
+
+	// Every point writes its own column, the workers share nothing else
+	pool->ParallelFor(frequencies.size(), [&](size_t point)
+	{
+		SolvePoint(point, *m_Contexts[pool->GetCurrentWorker()]);
+	});
+}
+
+
+std::vector<double> ACAnalysis::LogSweep(double startHz, double stopHz, size_t numPoints)
+{
+	std::vector<double> frequencies(numPoints);
+	if (numPoints == 1)
+	{
+		frequencies[0] = startHz;
+		return frequencies;
+	}
+
+	double logStart = std::log10(startHz);
+	double logStep = (std::log10(stopHz) - logStart) / double(numPoints - 1);
+	for (size_t i = 0; i < numPoints; i++)
+		frequencies[i] = std::pow(10.0, logStart + logStep * double(i));
+
+	return frequencies;
+}
+
+
+ACAnalysis::Complex ACAnalysis::GetNodeVoltage(size_t point, eNode* node) const
+{
+	s64 row = SystemRow(node, m_Circuit.GetGroundNode());
+	return row < 0 ? Complex(0.0, 0.0) : m_Solutions(row, point);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <complex>
+#include <memory>
+#include <vector>
+
+#include "vendor/Eigen/Sparse"
+#include "vendor/Eigen/SparseLU"
+#include "sim/Scheme.h"
+
+class ThreadPool;
+
+// Small signal frequency sweep
+//
+// The elements stamp frequency independent admittances (g + jwc + gamma / jw) on the same rows as
+// the DC system, so every frequency point is a complex solve with one sparsity pattern. Analyze()
+// builds the pattern and its column ordering (COLAMD) once, a point then only fills values and
+// factors numerically. Points are spread over a ThreadPool, every worker keeps its own SparseLU and
+// reuses its symbolic setup for all the points it runs. A sweep stamps the values again, edits since
+// the last sweep are always in it, and keeps the ordering while the stamps land on the same pattern.
+
+class ACAnalysis
+{
+public:
+	using Complex = std::complex<double>;
+	using SparseMatrix = Eigen::SparseMatrix<Complex, Eigen::ColMajor, int>;
+
+private:
+	// Solver state of one thread, the pattern is copied once and only its values change
+	struct WorkerContext
+	{
+		SparseMatrix A;
+		Eigen::SparseLU<SparseMatrix, Eigen::NaturalOrdering<int>> lu;
+		Eigen::VectorXcd y;
+		bool analyzed = false;
+	};
+
+	Circuit& m_Circuit;
+	ACStamper m_Stamper;
+
+	size_t m_NumUnknowns = 0;
+	std::vector<std::pair<s64, s64>> m_PatternEntries;	// Row, column of the stamp entries analyzed
+	SparseMatrix m_Pattern;				// Columns already in COLAMD order
+	std::vector<int> m_ValueSlot;		// Stamp entry -> nonzero of the pattern
+	Eigen::VectorXi m_ColumnPosition;	// Column of an unknown in the pattern
+	Eigen::VectorXcd m_Rhs;
+
+	std::vector<double> m_Frequencies;
+	Eigen::MatrixXcd m_Solutions;		// Unknowns x points
+	std::vector<char> m_Failed;
+	std::vector<std::unique_ptr<WorkerContext>> m_Contexts;
+
+	// Stamps the values of the current circuit and the right hand side
+	void Stamp(size_t numUnknowns);
+	bool HasSamePattern() const;
+	void BuildPattern();
+
+	void SolvePoint(size_t point, WorkerContext& context);
+
+public:
+
+	explicit ACAnalysis(Circuit& circuit);
+
+	// Pattern and ordering of the current topology
+	void Analyze();
+
+	// Solves every frequency in Hz, on the pool when given. Takes the current values, analyzes again
+	// when the pattern changed
+	void Sweep(const std::vector<double>& frequencies, ThreadPool* pool = nullptr);
+
+	static std::vector<double> LogSweep(double startHz, double stopHz, size_t numPoints);
+
+	size_t GetNumPoints() const { return m_Frequencies.size(); }
+	double GetFrequency(size_t point) const { return m_Frequencies[point]; }
+	size_t GetNumUnknowns() const { return m_NumUnknowns; }
+	size_t GetPatternNnz() const { return size_t(m_Pattern.nonZeros()); }
+
+	// False when the system was singular at that frequency
+	bool IsSolved(size_t point) const { return !m_Failed[point]; }
+
+	// Phasor of the node voltage against the ground node
+	Complex GetNodeVoltage(size_t point, eNode* node) const;
+	const Eigen::MatrixXcd& GetSolutions() const { return m_Solutions; }
+};
@@ -0,0 +1,194 @@
+#include "Checkpoint.h"
+#include "Scheme.h"
+
+#include <cstdio>
+
+
+static constexpr u32 Magic = 0x50435353;	// "SSCP"
+static constexpr u32 Version = 1;
+
+static constexpr size_t HeaderSize = sizeof(u32) * 2 + sizeof(u64);
+
+
+static u64 Fnv1a(const u8* data, size_t size)
+{
+	u64 hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+
+void Checkpoint::Capture(Simulation& simulation, std::vector<u8>& blob)
+{
+	SM_PROFILE_SCOPE("Checkpoint::Capture");
+
+	blob.clear();
+	CheckpointWriter writer(blob);
+	writer.Write(Magic);
+	writer.Write(Version);
+	writer.Write(u64(0));
+
+	simulation.SaveState(writer);
+
+	u64 payloadSize = blob.size() - HeaderSize;
+	std::memcpy(blob.data() + HeaderSize - sizeof(u64), &payloadSize, sizeof(u64));
+	writer.Write(Fnv1a(blob.data() + HeaderSize, payloadSize));
+}
+
+
+bool Checkpoint::Restore(Simulation& simulation, const std::vector<u8>& blob)
+{
+	SM_PROFILE_SCOPE("Checkpoint::Restore");
+
+	CheckpointReader header(blob.data(), blob.size());
+	u32 magic = 0;
+	u32 version = 0;
+	u64 payloadSize = 0;
+	if (!header.Read(magic) || !header.Read(version) || !header.Read(payloadSize) ||
+		magic != Magic || version != Version || blob.size() != HeaderSize + payloadSize + sizeof(u64))
+		return false;
+
+	u64 checksum = 0;
+	std::memcpy(&checksum, blob.data() + HeaderSize + payloadSize, sizeof(u64));
+	if (checksum != Fnv1a(blob.data() + HeaderSize, payloadSize))
+		return false;
+
+	CheckpointReader reader(blob.data() + HeaderSize, payloadSize);
+	return simulation.LoadState(reader);
+}
+
+
+bool Checkpoint::WriteFile(const std::string& path, const std::vector<u8>& blob)
+{
+	// Written aside and renamed, a crash while writing leaves the last checkpoint intact
+	std::string temporary = path + ".tmp";
+	std::FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = std::fwrite(blob.data(), 1, blob.size(), file) == blob.size();
+	written = std::fclose(file) == 0 && written;
+
+	if (!written)
+	{
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	std::remove(path.c_str());
+	return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
+
+
+bool Checkpoint::ReadFile(const std::string& path, std::vector<u8>& blob)
+{
+	std::FILE* file = std::fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	blob.clear();
+	u8 buffer[1 << 16];
+	size_t read;
+	while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0)
+		blob.insert(blob.end(), buffer, buffer + read);
+
+	bool ok = !std::ferror(file);
+	std::fclose(file);
+	return ok;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Thread
+
+
+
+CheckpointThread::CheckpointThread()
+{
+	m_Thread = std::thread([this]() { ThreadLoop(); });
+}
+
+
+CheckpointThread::~CheckpointThread()
+{
+	{
+		std::lock_guard guard(m_Lock);
+		m_Stop = true;
+	}
+	m_WakeUp.notify_one();
+	m_Thread.join();
+}
+
+
+bool CheckpointThread::Save(Simulation& simulation, const std::string& path)
+{
+	{
+		std::lock_guard guard(m_Lock);
+		if (m_Busy)
+		{
+			m_NumSkipped++;
+			return false;
+		}
+	}
+
+	// The thread is idle, the blob is ours until m_Busy is set
+	Checkpoint::Capture(simulation, m_Blob);
+
+	{
+		std::lock_guard guard(m_Lock);
+		m_Path = path;
+		m_Busy = true;
+	}
+	m_WakeUp.notify_one();
+	return true;
+}
+
+
+void CheckpointThread::Wait()
+{
+	std::unique_lock lock(m_Lock);
+	m_Idle.wait(lock, [this]() { return !m_Busy; });
+}
+
+
+u64 CheckpointThread::GetNumWritten()
+{
+	std::lock_guard guard(m_Lock);
+	return m_NumWritten;
+}
+
+
+u64 CheckpointThread::GetNumFailed()
+{
+	std::lock_guard guard(m_Lock);
+	return m_NumFailed;
+}
+
+
+void CheckpointThread::ThreadLoop()
+{
+	std::unique_lock lock(m_Lock);
+	while (true)
+	{
+		m_WakeUp.wait(lock, [this]() { return m_Busy || m_Stop; });
+
+		// A pending file is still written on shutdown
+		if (m_Busy)
+		{
+			lock.unlock();
+			bool written = Checkpoint::WriteFile(m_Path, m_Blob);
+			lock.lock();
+
+			(written ? m_NumWritten : m_NumFailed)++;
+			m_Busy = false;
+			m_Idle.notify_all();
+		}
+
+		if (m_Stop)
+			return;
+	}
+}
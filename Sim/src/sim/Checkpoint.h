@@ -0,0 +1,165 @@
+#pragma once
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class Simulation;
+
+// Checkpoints of a transient run
+//
+// A checkpoint holds what the circuit description doesn't : simulated time and step, node voltages,
+// the solution and right hand side of the last solve, and the history of the elements (companion
+// sources, inductor currents, logic levels), each element in a block of its own. Restoring it into a
+// circuit built the same way (same netlist, same order) continues the run bit for bit as if it never
+// stopped, to rounding with nonlinear devices (their companion models were summed into the system
+// iteration after iteration). The values of the elements are not stored, they come with the circuit.
+//
+// Blob : magic, version, payload size, payload, FNV-1a of the payload. Native byte order.
+
+class CheckpointWriter
+{
+	std::vector<u8>& m_Data;
+
+public:
+
+	explicit CheckpointWriter(std::vector<u8>& data)
+		: m_Data(data)
+	{ }
+
+	template<typename T>
+	void Write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		WriteBytes(&value, sizeof(T));
+	}
+
+	// Count first, checked when reading back
+	void WriteArray(const double* values, size_t count)
+	{
+		Write(u64(count));
+		WriteBytes(values, count * sizeof(double));
+	}
+
+	void WriteBytes(const void* bytes, size_t size)
+	{
+		size_t offset = m_Data.size();
+		m_Data.resize(offset + size);
+		if (size)
+			std::memcpy(m_Data.data() + offset, bytes, size);
+	}
+
+	size_t GetSize() const { return m_Data.size(); }
+
+	// Patches a value written earlier, for sizes known only afterwards
+	void Overwrite(size_t offset, u32 value) { std::memcpy(m_Data.data() + offset, &value, sizeof(value)); }
+};
+
+
+// Reads fail once the data runs out, and stay failed
+class CheckpointReader
+{
+	const u8* m_Pos;
+	const u8* m_End;
+	bool m_Failed = false;
+
+public:
+
+	CheckpointReader(const u8* data, size_t size)
+		: m_Pos(data)
+		, m_End(data + size)
+	{ }
+
+	template<typename T>
+	bool Read(T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		return ReadBytes(&value, sizeof(T));
+	}
+
+	// False unless exactly count values were written
+	bool ReadArray(double* values, size_t count)
+	{
+		u64 stored = 0;
+		if (!Read(stored) || stored != count)
+		{
+			m_Failed = true;
+			return false;
+		}
+		return ReadBytes(values, count * sizeof(double));
+	}
+
+	bool ReadBytes(void* bytes, size_t size)
+	{
+		if (m_Failed || size_t(m_End - m_Pos) < size)
+		{
+			m_Failed = true;
+			return false;
+		}
+
+		if (size)
+			std::memcpy(bytes, m_Pos, size);
+		m_Pos += size;
+		return true;
+	}
+
+	bool HasFailed() const { return m_Failed; }
+	const u8* GetPosition() const { return m_Pos; }
+};
+
+
+namespace Checkpoint
+{
+	// Replaces the blob, keeps its capacity. Costs a copy of the state, no solve
+	void Capture(Simulation& simulation, std::vector<u8>& blob);
+
+	// False if the blob is damaged or doesn't fit the circuit of the simulation. Factors the system
+	// once, the next step continues where the captured run was
+	bool Restore(Simulation& simulation, const std::vector<u8>& blob);
+
+	bool WriteFile(const std::string& path, const std::vector<u8>& blob);
+	bool ReadFile(const std::string& path, std::vector<u8>& blob);
+}
+
+
+// Writes checkpoints on a thread of its own, the solver only pays for the capture
+class CheckpointThread
+{
+	std::thread m_Thread;
+	std::mutex m_Lock;
+	std::condition_variable m_WakeUp;
+	std::condition_variable m_Idle;
+
+	std::vector<u8> m_Blob;			// Owned by the thread while m_Busy
+	std::string m_Path;
+	bool m_Busy = false;
+	bool m_Stop = false;
+
+	u64 m_NumWritten = 0;
+	u64 m_NumFailed = 0;
+	u64 m_NumSkipped = 0;
+
+	void ThreadLoop();
+
+public:
+
+	CheckpointThread();
+	~CheckpointThread();
+
+	CheckpointThread(const CheckpointThread&) = delete;
+	CheckpointThread& operator=(const CheckpointThread&) = delete;
+
+	// Captures now and writes the file in the background. Skipped (false) while the last one is
+	// still being written, the solver never waits on the disk
+	bool Save(Simulation& simulation, const std::string& path);
+
+	// Until the file being written is done
+	void Wait();
+
+	u64 GetNumWritten();
+	u64 GetNumFailed();
+	u64 GetNumSkipped() const { return m_NumSkipped; }
+};
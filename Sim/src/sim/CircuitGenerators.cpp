@@ -0,0 +1,385 @@
+#include "CircuitGenerators.h"
+#include <random>
+
+
+void CircuitGen::ResistorLadder(Circuit& circuit, size_t numRungs)
+{
+	eNode* gnd = circuit.CreateNode();
+	eNode* prev = circuit.CreateNode();
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), prev);
+	circuit.Connect(source->GetNegativePin(), gnd);
+
+	for (size_t i = 0; i < numRungs; i++)
+	{
+		eNode* next = circuit.CreateNode();
+
+		eResistor* series = circuit.AddResistor(1.0);
+		circuit.Connect(series->GetEpin(0), prev);
+		circuit.Connect(series->GetEpin(1), next);
+
+		eResistor* shunt = circuit.AddResistor(2.0);
+		circuit.Connect(shunt->GetEpin(0), next);
+		circuit.Connect(shunt->GetEpin(1), gnd);
+
+		prev = next;
+	}
+}
+
+
+void CircuitGen::ResistorGrid(Circuit& circuit, size_t size)
+{
+	if (size == 0)
+		return;
+
+	eNode* gnd = circuit.CreateNode();
+
+	std::vector<eNode*> grid(size * size);
+	for (eNode*& node : grid)
+		node = circuit.CreateNode();
+
+	for (size_t y = 0; y < size; y++)
+	{
+		for (size_t x = 0; x < size; x++)
+		{
+			eNode* node = grid[y * size + x];
+
+			if (x + 1 < size)
+			{
+				eResistor* r = circuit.AddResistor(1.0);
+				circuit.Connect(r->GetEpin(0), node);
+				circuit.Connect(r->GetEpin(1), grid[y * size + x + 1]);
+			}
+
+			if (y + 1 < size)
+			{
+				eResistor* r = circuit.AddResistor(1.0);
+				circuit.Connect(r->GetEpin(0), node);
+				circuit.Connect(r->GetEpin(1), grid[(y + 1) * size + x]);
+			}
+		}
+	}
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), grid.front());
+	circuit.Connect(source->GetNegativePin(), gnd);
+
+	eResistor* load = circuit.AddResistor(1.0);
+	circuit.Connect(load->GetEpin(0), grid.back());
+	circuit.Connect(load->GetEpin(1), gnd);
+}
+
+
+void CircuitGen::PowerGrid(Circuit& circuit, size_t size, size_t numLayers, size_t padPitch, u32 seed)
+{
+	if (size == 0 || numLayers == 0)
+		return;
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> spread(0.8, 1.2);
+
+	eNode* gnd = circuit.CreateNode();
+
+	std::vector<eNode*> grid(numLayers * size * size);
+	for (eNode*& node : grid)
+		node = circuit.CreateNode();
+
+	auto connect = [&](double resistance, eNode* a, eNode* b)
+	{
+		eResistor* r = circuit.AddResistor(resistance * spread(rng));
+		circuit.Connect(r->GetEpin(0), a);
+		circuit.Connect(r->GetEpin(1), b);
+	};
+
+	padPitch = std::max<size_t>(padPitch, 1);
+	for (size_t layer = 0; layer < numLayers; layer++)
+	{
+		for (size_t y = 0; y < size; y++)
+		{
+			for (size_t x = 0; x < size; x++)
+			{
+				size_t index = (layer * size + y) * size + x;
+				eNode* node = grid[index];
+
+				if (x + 1 < size)
+					connect(1.0, node, grid[index + 1]);
+				if (y + 1 < size)
+					connect(1.0, node, grid[index + size]);
+				if (layer + 1 < numLayers)
+					connect(0.5, node, grid[index + size * size]);
+
+				if (layer == 0 && x % padPitch == padPitch / 2 && y % padPitch == padPitch / 2)
+				{
+					eVoltageSource* pad = circuit.AddVoltageSource(1.0);
+					circuit.Connect(pad->GetPositivePin(), node);
+					circuit.Connect(pad->GetNegativePin(), gnd);
+				}
+
+				if (layer + 1 == numLayers)
+					connect(1000.0, node, gnd);
+			}
+		}
+	}
+}
+
+
+void CircuitGen::RcMesh(Circuit& circuit, size_t size, size_t numTaps, u32 seed)
+{
+	if (size < 2)
+		return;
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> spread(0.8, 1.2);
+
+	eNode* gnd = circuit.CreateNode();
+	eNode* supply = circuit.CreateNode();
+
+	std::vector<eNode*> grid(size * size);
+	for (eNode*& node : grid)
+		node = circuit.CreateNode();
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), supply);
+	circuit.Connect(source->GetNegativePin(), gnd);
+
+	eResistor* driver = circuit.AddResistor(10.0);
+	circuit.Connect(driver->GetEpin(0), supply);
+	circuit.Connect(driver->GetEpin(1), grid.front());
+
+	const size_t corners[] = { size * size - 1, size - 1, size * (size - 1) };
+	for (size_t k = 0; k < std::min<size_t>(numTaps, 3); k++)
+	{
+		eResistor* load = circuit.AddResistor(1000.0);
+		circuit.Connect(load->GetEpin(0), grid[corners[k]]);
+		circuit.Connect(load->GetEpin(1), gnd);
+	}
+
+	for (size_t y = 0; y < size; y++)
+	{
+		for (size_t x = 0; x < size; x++)
+		{
+			eNode* node = grid[y * size + x];
+
+			if (x + 1 < size)
+			{
+				eResistor* r = circuit.AddResistor(spread(rng));
+				circuit.Connect(r->GetEpin(0), node);
+				circuit.Connect(r->GetEpin(1), grid[y * size + x + 1]);
+			}
+
+			if (y + 1 < size)
+			{
+				eResistor* r = circuit.AddResistor(spread(rng));
+				circuit.Connect(r->GetEpin(0), node);
+				circuit.Connect(r->GetEpin(1), grid[(y + 1) * size + x]);
+			}
+
+			eCapacitor* c = circuit.AddCapacitor(1e-12);
+			circuit.Connect(c->GetEpin(0), node);
+			circuit.Connect(c->GetEpin(1), gnd);
+		}
+	}
+}
+
+
+void CircuitGen::CoupledBlocks(Circuit& circuit, size_t numBlocks, size_t size, double couplingResistance, u32 seed)
+{
+	if (numBlocks == 0 || size < 2)
+		return;
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> spread(0.8, 1.2);
+
+	eNode* gnd = circuit.CreateNode();
+
+	std::vector<eNode*> first(numBlocks);
+	std::vector<eNode*> last(numBlocks);
+
+	for (size_t b = 0; b < numBlocks; b++)
+	{
+		eNode* supply = circuit.CreateNode();
+		std::vector<eNode*> grid(size * size);
+		for (eNode*& node : grid)
+			node = circuit.CreateNode();
+
+		first[b] = grid.front();
+		last[b] = grid.back();
+
+		eVoltageSource* source = circuit.AddVoltageSource(1.0);
+		circuit.Connect(source->GetPositivePin(), supply);
+		circuit.Connect(source->GetNegativePin(), gnd);
+
+		eResistor* driver = circuit.AddResistor(10.0);
+		circuit.Connect(driver->GetEpin(0), supply);
+		circuit.Connect(driver->GetEpin(1), grid[size - 1]);
+
+		for (size_t y = 0; y < size; y++)
+		{
+			for (size_t x = 0; x < size; x++)
+			{
+				eNode* node = grid[y * size + x];
+
+				if (x + 1 < size)
+				{
+					eResistor* r = circuit.AddResistor(spread(rng));
+					circuit.Connect(r->GetEpin(0), node);
+					circuit.Connect(r->GetEpin(1), grid[y * size + x + 1]);
+				}
+
+				if (y + 1 < size)
+				{
+					eResistor* r = circuit.AddResistor(spread(rng));
+					circuit.Connect(r->GetEpin(0), node);
+					circuit.Connect(r->GetEpin(1), grid[(y + 1) * size + x]);
+				}
+
+				eCapacitor* c = circuit.AddCapacitor(1e-12);
+				circuit.Connect(c->GetEpin(0), node);
+				circuit.Connect(c->GetEpin(1), gnd);
+			}
+		}
+	}
+
+	for (size_t b = 0; b + 1 < numBlocks; b++)
+	{
+		eResistor* r = circuit.AddResistor(couplingResistance);
+		circuit.Connect(r->GetEpin(0), last[b]);
+		circuit.Connect(r->GetEpin(1), first[b + 1]);
+
+		eCapacitor* c = circuit.AddCapacitor(1e-12);
+		circuit.Connect(c->GetEpin(0), last[b]);
+		circuit.Connect(c->GetEpin(1), first[b + 1]);
+	}
+}
+
+
+void CircuitGen::RandomMesh(Circuit& circuit, size_t numNodes, size_t avgDegree, u32 seed)
+{
+	if (numNodes == 0)
+		return;
+
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> resistance(1.0, 1000.0);
+
+	eNode* gnd = circuit.CreateNode();
+
+	std::vector<eNode*> nodes(numNodes);
+	for (eNode*& node : nodes)
+		node = circuit.CreateNode();
+
+	auto connect = [&](eNode* a, eNode* b)
+		{
+			eResistor* r = circuit.AddResistor(resistance(rng));
+			circuit.Connect(r->GetEpin(0), a);
+			circuit.Connect(r->GetEpin(1), b);
+		};
+
+	// Random spanning tree keeps the mesh connected
+	for (size_t i = 1; i < numNodes; i++)
+		connect(nodes[i], nodes[std::uniform_int_distribution<size_t>(0, i - 1)(rng)]);
+
+	size_t numExtra = numNodes * avgDegree / 2;
+	numExtra = numExtra > numNodes ? numExtra - numNodes + 1 : 0;
+
+	std::uniform_int_distribution<size_t> pick(0, numNodes - 1);
+	for (size_t i = 0; i < numExtra; i++)
+	{
+		size_t a = pick(rng);
+		size_t b = pick(rng);
+		if (a != b)
+			connect(nodes[a], nodes[b]);
+	}
+
+	// Leak every 8th node to ground
+	for (size_t i = 0; i < numNodes; i += 8)
+		connect(nodes[i], gnd);
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), nodes.front());
+	circuit.Connect(source->GetNegativePin(), gnd);
+}
+
+
+void CircuitGen::RcChain(Circuit& circuit, size_t numStages)
+{
+	eNode* gnd = circuit.CreateNode();
+	eNode* prev = circuit.CreateNode();
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), prev);
+	circuit.Connect(source->GetNegativePin(), gnd);
+
+	for (size_t i = 0; i < numStages; i++)
+	{
+		eNode* next = circuit.CreateNode();
+
+		eResistor* r = circuit.AddResistor(1000.0);
+		circuit.Connect(r->GetEpin(0), prev);
+		circuit.Connect(r->GetEpin(1), next);
+
+		eCapacitor* c = circuit.AddCapacitor(1e-6);
+		circuit.Connect(c->GetEpin(0), next);
+		circuit.Connect(c->GetEpin(1), gnd);
+
+		prev = next;
+	}
+}
+
+
+void CircuitGen::RlcLadder(Circuit& circuit, size_t numSections)
+{
+	eNode* gnd = circuit.CreateNode();
+	eNode* prev = circuit.CreateNode();
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	source->SetACMagnitude(1.0);
+	circuit.Connect(source->GetPositivePin(), prev);
+	circuit.Connect(source->GetNegativePin(), gnd);
+
+	for (size_t i = 0; i < numSections; i++)
+	{
+		eNode* mid = circuit.CreateNode();
+		eNode* next = circuit.CreateNode();
+
+		eResistor* r = circuit.AddResistor(10.0);
+		circuit.Connect(r->GetEpin(0), prev);
+		circuit.Connect(r->GetEpin(1), mid);
+
+		eInductor* l = circuit.AddInductor(1e-3);
+		circuit.Connect(l->GetEpin(0), mid);
+		circuit.Connect(l->GetEpin(1), next);
+
+		eCapacitor* c = circuit.AddCapacitor(1e-6);
+		circuit.Connect(c->GetEpin(0), next);
+		circuit.Connect(c->GetEpin(1), gnd);
+
+		prev = next;
+	}
+
+	eResistor* load = circuit.AddResistor(50.0);
+	circuit.Connect(load->GetEpin(0), prev);
+	circuit.Connect(load->GetEpin(1), gnd);
+}
+
+
+void CircuitGen::SourceHeavy(Circuit& circuit, size_t numSources)
+{
+	eNode* gnd = circuit.CreateNode();
+	eNode* prev = gnd;
+
+	for (size_t i = 0; i < numSources; i++)
+	{
+		eNode* tap = circuit.CreateNode();
+
+		eVoltageSource* source = circuit.AddVoltageSource(1.0 + 0.01 * double(i % 7));
+		circuit.Connect(source->GetPositivePin(), tap);
+		circuit.Connect(source->GetNegativePin(), prev);
+
+		eResistor* load = circuit.AddResistor(100.0 + double(i));
+		circuit.Connect(load->GetEpin(0), tap);
+		circuit.Connect(load->GetEpin(1), gnd);
+
+		prev = tap;
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include "sim/Scheme.h"
+
+// Parameterized synthetic circuits for the benchmarks and tests
+// Every generator creates the ground node first, so it becomes the reference node of the matrix
+
+namespace CircuitGen
+{
+	// (v)--R--*--R--*--R-- ... --*
+	//         |     |            |
+	//         R     R            R
+	//        GND   GND          GND
+	void ResistorLadder(Circuit& circuit, size_t numRungs);
+
+	// size x size grid of 1 Ohm resistors, driven at one corner and loaded at the opposite one
+	void ResistorGrid(Circuit& circuit, size_t size);
+
+	// Random connected resistor network, every node has about avgDegree resistors attached
+	void RandomMesh(Circuit& circuit, size_t numNodes, size_t avgDegree, u32 seed = 1);
+
+	// (v)--R--*--R--*-- ... --*
+	//         |     |         |
+	//         C     C         C
+	//        GND   GND       GND
+	void RcChain(Circuit& circuit, size_t numStages);
+
+	// (v)--R--L--*--R--L--*-- ... --*--R(load)--GND
+	//            |        |
+	//            C        C
+	//           GND      GND
+	// The source has an AC amplitude of 1 V, for the AC sweep
+	void RlcLadder(Circuit& circuit, size_t numSections);
+
+	// Power distribution mesh for IR drop : numLayers stacked size x size meshes of about 1 Ohm
+	// segments (+-20 % at random), joined by vias at every node. A 1 V supply pad to the ground every
+	// padPitch nodes on the top layer, a load resistor to the ground at every node of the bottom one
+	void PowerGrid(Circuit& circuit, size_t size, size_t numLayers = 1, size_t padPitch = 64, u32 seed = 1);
+
+	// Parasitics of a net : size x size mesh of about 1 Ohm segments (+-20 % at random) with 1 pF to
+	// the ground at every node. A source drives one corner through 10 Ohm, numTaps (up to 3) loads of
+	// 1 kOhm sit on the other corners. Source, driver and loads come first, the mesh elements after
+	void RcMesh(Circuit& circuit, size_t size, size_t numTaps = 3, u32 seed = 1);
+
+	// numBlocks RC meshes as RcMesh, each driven by a 1 V source of its own through 10 Ohm, in a row.
+	// Neighbours are coupled corner to corner by a resistor and a 1 pF capacitor. Per block the
+	// source, the driver, then the mesh, the couplings last. Nodes of block b come after the ground
+	// as a supply node and the mesh nodes, b * (size * size + 1) + 1 on
+	void CoupledBlocks(Circuit& circuit, size_t numBlocks, size_t size, double couplingResistance = 100.0, u32 seed = 1);
+
+	// Stack of voltage sources in series with a load on every tap, one MNA branch row per source
+	void SourceHeavy(Circuit& circuit, size_t numSources);
+}
@@ -0,0 +1,96 @@
+#include "CurrentFlow.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Wraps into [0, 1) without floor(), truncation and a select vectorize on any SSE level. A phase
+// just below 0 rounds to 1 once 1 is added, it is kept below
+static inline float Wrap(float phase)
+{
+	static constexpr float BelowOne = 0x1.fffffep-1f;
+
+	phase -= float(int(phase));
+	return phase < 0.0f ? std::min(phase + 1.0f, BelowOne) : phase;
+}
+
+
+void CurrentFlow::Clear()
+{
+	for (std::vector<float>* field : { &m_X0, &m_Y0, &m_X1, &m_Y1, &m_DirX, &m_DirY, &m_Length, &m_Sign, &m_Speed, &m_Phase })
+		field->clear();
+
+	m_Source.clear();
+}
+
+
+void CurrentFlow::Reserve(size_t numWires)
+{
+	for (std::vector<float>* field : { &m_X0, &m_Y0, &m_X1, &m_Y1, &m_DirX, &m_DirY, &m_Length, &m_Sign, &m_Speed, &m_Phase })
+		field->reserve(numWires);
+
+	m_Source.reserve(numWires);
+}
+
+
+u32 CurrentFlow::AddWire(float x0, float y0, float x1, float y1, u32 source, float sign)
+{
+	float dx = x1 - x0;
+	float dy = y1 - y0;
+	float length = std::sqrt(dx * dx + dy * dy);
+	float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+	m_X0.push_back(x0);
+	m_Y0.push_back(y0);
+	m_X1.push_back(x1);
+	m_Y1.push_back(y1);
+	m_DirX.push_back(dx * scale);
+	m_DirY.push_back(dy * scale);
+	m_Length.push_back(length);
+	m_Source.push_back(source);
+	m_Sign.push_back(sign < 0.0f ? -1.0f : 1.0f);
+	m_Speed.push_back(0.0f);
+	m_Phase.push_back(0.0f);
+
+	return u32(m_Phase.size() - 1);
+}
+
+
+void CurrentFlow::SetViewScale(float scale)
+{
+	if (scale <= 0.0f)
+		return;
+
+	float spacing = std::exp2(std::round(std::log2(DotSpacingPixels / scale)));
+	if (spacing == m_Spacing)
+		return;
+
+	// Same distance from the start of the wire in the new spacing
+	float ratio = m_Spacing / spacing;
+	for (float& phase : m_Phase)
+		phase = Wrap(phase * ratio);
+
+	m_Spacing = spacing;
+}
+
+
+void CurrentFlow::Advance(const double* currents, size_t numCurrents, float seconds)
+{
+	size_t numWires = m_Phase.size();
+
+	// Gathered apart, the loop below is straight arithmetic over the arrays
+	for (size_t i = 0; i < numWires; i++)
+	{
+		u32 source = m_Source[i];
+		m_Speed[i] = source < numCurrents ? float(currents[source]) * m_Sign[i] : 0.0f;
+	}
+
+	seconds = std::clamp(seconds, 0.0f, MaxStepSeconds);
+	float gain = m_Gain * seconds;
+	float limit = m_MaxSpeed * seconds;
+
+	float* phase = m_Phase.data();
+	const float* speed = m_Speed.data();
+	for (size_t i = 0; i < numWires; i++)
+		phase[i] = Wrap(phase[i] + std::clamp(speed[i] * gain, -limit, limit));
+}
@@ -0,0 +1,539 @@
+#include "Digital.h"
+#include "Checkpoint.h"
+
+#include <cmath>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Engine
+
+
+
+DigitalEngine::DigitalEngine()
+	: m_Wheel(WheelSize)
+{
+}
+
+
+NetId DigitalEngine::AddNet()
+{
+	NetId net = NetId(m_NumNets++);
+	if (m_Values.size() * 64 < m_NumNets)
+	{
+		m_Values.push_back(0);
+		m_Projected.push_back(0);
+		m_Watched.push_back(0);
+	}
+	return net;
+}
+
+
+u32 DigitalEngine::AddGate(eGateType type, std::initializer_list<NetId> inputs, NetId output, u32 delay)
+{
+	Gate gate;
+	gate.type = type;
+	gate.firstInput = u32(m_GateInputs.size());
+	gate.numInputs = u32(inputs.size());
+	gate.output = output;
+	gate.delay = std::max<u32>(delay, 1); // A zero delay would land on the tick being processed
+
+	m_GateInputs.insert(m_GateInputs.end(), inputs.begin(), inputs.end());
+	m_Gates.push_back(gate);
+
+	if (m_GateState.size() * 64 < m_Gates.size())
+		m_GateState.push_back(0);
+
+	m_Finalized = false;
+	return u32(m_Gates.size() - 1);
+}
+
+
+void DigitalEngine::AddClock(NetId net, u32 halfPeriod, u64 startTick)
+{
+	AddGate(eGateType::Not, { net }, net, halfPeriod);
+	SetNet(net, true, startTick);
+}
+
+
+void DigitalEngine::Finalize()
+{
+	// Counting sort of the gate inputs by net
+	m_FanoutStart.assign(m_NumNets + 1, 0);
+	for (NetId net : m_GateInputs)
+		m_FanoutStart[net + 1]++;
+
+	for (size_t i = 0; i < m_NumNets; i++)
+		m_FanoutStart[i + 1] += m_FanoutStart[i];
+
+	m_Fanout.resize(m_GateInputs.size());
+	std::vector<u32> fill(m_FanoutStart.begin(), m_FanoutStart.end() - 1);
+	for (u32 g = 0; g < u32(m_Gates.size()); g++)
+	{
+		const Gate& gate = m_Gates[g];
+		for (u32 k = 0; k < gate.numInputs; k++)
+			m_Fanout[fill[m_GateInputs[gate.firstInput + k]]++] = g;
+	}
+
+	// A gate listing the same net twice is evaluated once per change anyway, the stamp sees to it
+	m_EvalStamp.assign(m_Gates.size(), 0);
+	m_Stamp = 0;
+	m_Finalized = true;
+
+	// Outputs of the initial all low state (inverters go high)
+	for (u32 g = 0; g < u32(m_Gates.size()); g++)
+		Evaluate(g);
+}
+
+
+void DigitalEngine::Schedule(NetId net, bool value, u64 tick)
+{
+	SetBit(m_Projected, net, value);
+
+	if (tick - m_Now < WheelSize)
+	{
+		m_Wheel[tick & (WheelSize - 1)].push_back({ tick, net, value });
+		m_WheelCount++;
+		return;
+	}
+
+	m_Overflow.push_back({ tick, net, value });
+	std::push_heap(m_Overflow.begin(), m_Overflow.end(), Later);
+}
+
+
+void DigitalEngine::SetNet(NetId net, bool value, u64 tick)
+{
+	tick = std::max(tick, m_Now + 1);
+	if (GetBit(m_Projected, net) != value)
+		Schedule(net, value, tick);
+}
+
+
+void DigitalEngine::RefillWheel()
+{
+	while (!m_Overflow.empty() && m_Overflow.front().tick - m_Now < WheelSize)
+	{
+		std::pop_heap(m_Overflow.begin(), m_Overflow.end(), Later);
+		const Event& event = m_Overflow.back();
+		m_Wheel[event.tick & (WheelSize - 1)].push_back(event);
+		m_WheelCount++;
+		m_Overflow.pop_back();
+	}
+}
+
+
+void DigitalEngine::Evaluate(u32 g)
+{
+	const Gate& gate = m_Gates[g];
+	const NetId* inputs = m_GateInputs.data() + gate.firstInput;
+	m_NumEvaluations++;
+
+	bool value = false;
+	switch (gate.type)
+	{
+	case eGateType::Buffer:
+	case eGateType::Not:
+		value = GetBit(m_Values, inputs[0]);
+		break;
+
+	case eGateType::And:
+	case eGateType::Nand:
+		value = true;
+		for (u32 k = 0; k < gate.numInputs && value; k++)
+			value = GetBit(m_Values, inputs[k]);
+		break;
+
+	case eGateType::Or:
+	case eGateType::Nor:
+		for (u32 k = 0; k < gate.numInputs && !value; k++)
+			value = GetBit(m_Values, inputs[k]);
+		break;
+
+	case eGateType::Xor:
+	case eGateType::Xnor:
+		for (u32 k = 0; k < gate.numInputs; k++)
+			value ^= GetBit(m_Values, inputs[k]);
+		break;
+
+	case eGateType::DFlipFlop:
+	{
+		bool clock = GetBit(m_Values, inputs[1]);
+		bool lastClock = GetBit(m_GateState, g);
+		SetBit(m_GateState, g, clock);
+
+		if (!clock || lastClock)
+			return; // No rising edge, Q holds
+
+		value = GetBit(m_Values, inputs[0]);
+		break;
+	}
+	}
+
+	if (gate.type == eGateType::Not || gate.type == eGateType::Nand || gate.type == eGateType::Nor || gate.type == eGateType::Xnor)
+		value = !value;
+
+	if (GetBit(m_Projected, gate.output) != value)
+		Schedule(gate.output, value, m_Now + gate.delay);
+}
+
+
+void DigitalEngine::ProcessTick()
+{
+	std::vector<Event>& slot = m_Wheel[m_Now & (WheelSize - 1)];
+	if (slot.empty())
+		return;
+
+	m_WheelCount -= slot.size();
+	m_NumEvents += slot.size();
+
+	for (const Event& event : slot)
+	{
+		if (GetBit(m_Values, event.net) == event.value)
+			continue;
+
+		SetBit(m_Values, event.net, event.value);
+		m_Changed.push_back(event.net);
+
+		if (GetBit(m_Watched, event.net))
+			m_WatchedChanges.push_back(event.net);
+	}
+	slot.clear();
+
+	// Every gate once, however many of its inputs changed on this tick
+	if (++m_Stamp == 0)
+	{
+		std::fill(m_EvalStamp.begin(), m_EvalStamp.end(), 0);
+		m_Stamp = 1;
+	}
+
+	for (NetId net : m_Changed)
+	{
+		for (u32 k = m_FanoutStart[net]; k < m_FanoutStart[net + 1]; k++)
+		{
+			u32 g = m_Fanout[k];
+			if (m_EvalStamp[g] != m_Stamp)
+			{
+				m_EvalStamp[g] = m_Stamp;
+				m_Evaluate.push_back(g);
+			}
+		}
+	}
+
+	for (u32 g : m_Evaluate)
+		Evaluate(g);
+
+	m_Changed.clear();
+	m_Evaluate.clear();
+}
+
+
+bool DigitalEngine::RunUntil(u64 tick, bool stopOnWatched)
+{
+	if (!m_Finalized)
+		Finalize();
+
+	m_WatchedChanges.clear();
+
+	while (m_Now < tick)
+	{
+		if (m_WheelCount == 0)
+		{
+			// Nothing close, jump straight to the next far event
+			if (m_Overflow.empty() || m_Overflow.front().tick > tick)
+			{
+				m_Now = tick;
+				break;
+			}
+			m_Now = m_Overflow.front().tick;
+		}
+		else
+		{
+			m_Now++;
+		}
+
+		RefillWheel();
+		ProcessTick();
+
+		if (stopOnWatched && !m_WatchedChanges.empty())
+			break;
+	}
+
+	return !m_WatchedChanges.empty();
+}
+
+
+u64 DigitalEngine::GetNextEventTime() const
+{
+	if (m_WheelCount)
+	{
+		for (u64 tick = m_Now + 1; tick <= m_Now + WheelSize; tick++)
+		{
+			if (!m_Wheel[tick & (WheelSize - 1)].empty())
+				return tick;
+		}
+	}
+
+	return m_Overflow.empty() ? ~u64(0) : m_Overflow.front().tick;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Logic output
+
+
+
+eLogicOutput::eLogicOutput(DigitalEngine* engine, NetId net, double lowVoltage, double highVoltage, double resistance)
+	: m_Engine(engine)
+	, m_Net(net)
+	, m_LowVoltage(lowVoltage)
+	, m_HighVoltage(highVoltage)
+	, m_Resistance(resistance)
+{
+	SetNumEpins(2);
+	m_Level = m_Engine->GetNet(m_Net);
+}
+
+
+void eLogicOutput::Stamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// Node out (i)                  Node ref (j)
+	// *-----+------(G = 1 / R)------+-----*
+	//       |                       |
+	//       +----(Ieq = G * V)------+
+	//
+	//       i   j             RHS
+	// i |   G  -G |         |  Ieq |
+	// j |  -G   G |         | -Ieq |
+
+	m_StampedG = 0.0;
+	m_StampedIeq = 0.0;
+
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	double G = 1.0 / m_Resistance;
+	double Ieq = G * GetOutputVoltage();
+	m_StampedG = G;
+	m_StampedIeq = Ieq;
+
+	s64 i = SystemRow(node1, GndNode);
+	s64 j = SystemRow(node2, GndNode);
+
+	if (i >= 0)
+	{
+		mtx.Add(i, i, G);
+		mtx.AddRhs(i, Ieq);
+	}
+
+	if (j >= 0)
+	{
+		mtx.Add(j, j, G);
+		mtx.AddRhs(j, -Ieq);
+	}
+
+	if (i >= 0 && j >= 0)
+	{
+		mtx.Add(i, j, -G);
+		mtx.Add(j, i, -G);
+	}
+}
+
+
+bool eLogicOutput::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return true;
+
+	double G = 1.0 / m_Resistance;
+	double Ieq = G * GetOutputVoltage();
+
+	s64 i = SystemRow(node1, GndNode);
+	s64 j = SystemRow(node2, GndNode);
+
+	if (!mtx.AddConductance(i, j, G - m_StampedG))
+		return false;
+
+	Eigen::VectorXd& b = mtx.GetVector();
+	if (i >= 0) b(i) += Ieq - m_StampedIeq;
+	if (j >= 0) b(j) -= Ieq - m_StampedIeq;
+
+	m_StampedG = G;
+	m_StampedIeq = Ieq;
+	return true;
+}
+
+
+void eLogicOutput::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_Level);
+	writer.Write(m_StampedG);
+	writer.Write(m_StampedIeq);
+}
+
+
+bool eLogicOutput::LoadState(CheckpointReader& reader)
+{
+	return reader.Read(m_Level) && reader.Read(m_StampedG) && reader.Read(m_StampedIeq);
+}
+
+
+u64 eLogicOutput::HashValues()
+{
+	u64 hash = HashDouble(HashDouble(0, m_LowVoltage), m_HighVoltage);
+	return HashCombine(HashDouble(hash, m_Resistance), u64(m_Level));
+}
+
+
+bool eLogicOutput::Sync()
+{
+	bool level = m_Engine->GetNet(m_Net);
+	if (level == m_Level)
+		return false;
+
+	m_Level = level;
+	MarkDirty(eDirty::Values);
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Logic input
+
+
+
+eLogicInput::eLogicInput(DigitalEngine* engine, NetId net, double lowThreshold, double highThreshold)
+	: m_Engine(engine)
+	, m_Net(net)
+	, m_LowThreshold(lowThreshold)
+	, m_HighThreshold(highThreshold)
+{
+	SetNumEpins(2);
+	m_Level = m_Engine->GetNet(m_Net);
+}
+
+
+void eLogicInput::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_Level);
+}
+
+
+bool eLogicInput::LoadState(CheckpointReader& reader)
+{
+	return reader.Read(m_Level);
+}
+
+
+bool eLogicInput::Sense(u64 tick)
+{
+	double voltage = GetEpin(0)->GetVoltage() - GetEpin(1)->GetVoltage();
+
+	bool level = m_Level;
+	if (voltage > m_HighThreshold)
+		level = true;
+	else if (voltage < m_LowThreshold)
+		level = false;
+
+	if (level == m_Level)
+		return false;
+
+	m_Level = level;
+	m_Engine->SetNet(m_Net, level, tick);
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Mixed signal
+
+
+
+MixedSignalSim::MixedSignalSim(Circuit& circuit, DigitalEngine& engine)
+	: m_Circuit(circuit)
+	, m_Engine(engine)
+{
+}
+
+
+eLogicOutput* MixedSignalSim::AddOutput(NetId net, double lowVoltage, double highVoltage, double resistance)
+{
+	eLogicOutput* output = m_Circuit.AddElement<eLogicOutput>(&m_Engine, net, lowVoltage, highVoltage, resistance);
+	m_Engine.Watch(net);
+	m_Outputs.push_back(output);
+	return output;
+}
+
+
+eLogicInput* MixedSignalSim::AddInput(NetId net, double lowThreshold, double highThreshold)
+{
+	eLogicInput* input = m_Circuit.AddElement<eLogicInput>(&m_Engine, net, lowThreshold, highThreshold);
+	m_Inputs.push_back(input);
+	return input;
+}
+
+
+void MixedSignalSim::SetAnalogStep(double seconds)
+{
+	m_AnalogStepTicks = seconds > 0.0 ? std::max<u64>(1, u64(std::llround(seconds / m_Engine.GetTickSeconds()))) : 0;
+	m_NextAnalogTick = m_Engine.GetTime() + m_AnalogStepTicks;
+	m_Circuit.SetStep(double(m_AnalogStepTicks) * m_Engine.GetTickSeconds());
+}
+
+
+void MixedSignalSim::SolveAnalog()
+{
+	m_NumAnalogSolves++;
+
+	// A crossing found now reaches the gates on the next tick
+	for (eLogicInput* input : m_Inputs)
+		input->Sense(m_Engine.GetTime() + 1);
+}
+
+
+void MixedSignalSim::Initialize()
+{
+	for (eLogicOutput* output : m_Outputs)
+		output->Sync();
+
+	m_Circuit.UpdateSolution();
+	SolveAnalog();
+}
+
+
+void MixedSignalSim::Advance(double seconds)
+{
+	SM_PROFILE_SCOPE("MixedSignal::Advance");
+
+	u64 target = m_Engine.GetTime() + u64(std::llround(seconds / m_Engine.GetTickSeconds()));
+	bool stepping = m_AnalogStepTicks > 0;
+
+	while (m_Engine.GetTime() < target)
+	{
+		// A resistive circuit follows every driver change right away, a stepping one on its next step
+		u64 stop = stepping ? std::min(target, m_NextAnalogTick) : target;
+		bool driversChanged = m_Engine.RunUntil(stop, !stepping);
+
+		if (driversChanged)
+		{
+			for (eLogicOutput* output : m_Outputs)
+				output->Sync();
+		}
+
+		if (stepping && m_Engine.GetTime() >= m_NextAnalogTick)
+		{
+			m_Circuit.Step();
+			m_NextAnalogTick += m_AnalogStepTicks;
+			SolveAnalog();
+		}
+		else if (!stepping && m_Circuit.UpdateSolution())
+		{
+			SolveAnalog();
+		}
+	}
+}
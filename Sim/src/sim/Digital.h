@@ -0,0 +1,233 @@
+#pragma once
+#include <vector>
+
+#include "sim/Scheme.h"
+
+// Event driven digital logic
+//
+// Gates are not part of the MNA system. Every net holds one bit, packed 64 to a word, and a gate is
+// only evaluated when one of its inputs changed. Events wait on a timing wheel with one slot per tick
+// for the next WheelSize ticks, anything further out sits in a heap and moves onto the wheel as time
+// gets close. A clock is an inverter feeding itself, with half the period as its delay.
+//
+// The analog side is reached through two elements : eLogicOutput drives a node from a net (Norton
+// source), eLogicInput turns a node voltage into a net through hysteresis thresholds. MixedSignalSim
+// runs both and only solves the Circuit when a driver changed or an analog step is due.
+
+using NetId = u32;
+
+enum class eGateType : u8
+{
+	Buffer,
+	Not,
+	And,
+	Nand,
+	Or,
+	Nor,
+	Xor,
+	Xnor,
+	DFlipFlop, // Inputs D, clock. Takes D on the rising clock edge
+};
+
+
+class DigitalEngine
+{
+public:
+	static constexpr u32 WheelBits = 10;
+	static constexpr u64 WheelSize = u64(1) << WheelBits;
+
+private:
+	struct Gate
+	{
+		eGateType type;
+		u32 firstInput;		// Into m_GateInputs
+		u32 numInputs;
+		NetId output;
+		u32 delay;			// Ticks, at least 1
+	};
+
+	struct Event
+	{
+		u64 tick;
+		NetId net;
+		bool value;
+	};
+
+	std::vector<Gate> m_Gates;
+	std::vector<NetId> m_GateInputs;
+	std::vector<u64> m_GateState;		// Bit per gate, last clock level of a flip-flop
+
+	// Bit per net
+	std::vector<u64> m_Values;
+	std::vector<u64> m_Projected;		// Value once the scheduled events are applied
+	std::vector<u64> m_Watched;			// Changes are reported by RunUntil
+	size_t m_NumNets = 0;
+
+	// Gates fed by a net, built by Finalize()
+	std::vector<u32> m_FanoutStart;
+	std::vector<u32> m_Fanout;
+
+	std::vector<std::vector<Event>> m_Wheel;
+	size_t m_WheelCount = 0;
+	std::vector<Event> m_Overflow;		// Min heap on the tick
+
+	u64 m_Now = 0;						// Every event up to this tick is applied
+	double m_TickSeconds = 1e-9;
+
+	// Scratch of the current tick
+	std::vector<NetId> m_Changed;
+	std::vector<u32> m_Evaluate;
+	std::vector<u32> m_EvalStamp;
+	u32 m_Stamp = 0;
+	std::vector<NetId> m_WatchedChanges;
+
+	u64 m_NumEvents = 0;
+	u64 m_NumEvaluations = 0;
+	bool m_Finalized = false;
+
+	static bool Later(const Event& a, const Event& b) { return a.tick > b.tick; }
+
+	static bool GetBit(const std::vector<u64>& bits, u32 index) { return (bits[index >> 6] >> (index & 63)) & 1; }
+	static void SetBit(std::vector<u64>& bits, u32 index, bool value)
+	{
+		u64 mask = u64(1) << (index & 63);
+		bits[index >> 6] = value ? bits[index >> 6] | mask : bits[index >> 6] & ~mask;
+	}
+
+	void Schedule(NetId net, bool value, u64 tick);
+	void RefillWheel();
+	void ProcessTick();
+	void Evaluate(u32 gate);
+
+public:
+
+	DigitalEngine();
+
+	NetId AddNet();
+	u32 AddGate(eGateType type, std::initializer_list<NetId> inputs, NetId output, u32 delay = 1);
+
+	// Square wave on the net, first rising edge at startTick
+	void AddClock(NetId net, u32 halfPeriod, u64 startTick = 1);
+
+	// Builds the fanout and evaluates every gate once, after the last AddGate. RunUntil calls it if needed
+	void Finalize();
+
+	// Event from outside, applied at the tick (not before the next one)
+	void SetNet(NetId net, bool value, u64 tick);
+	bool GetNet(NetId net) const { return GetBit(m_Values, net); }
+
+	void Watch(NetId net) { SetBit(m_Watched, net, true); }
+
+	// Applies the events up to and including the tick. With stopOnWatched it returns right after the
+	// first tick a watched net changed on, GetTime() tells how far it got. True if a watched net changed
+	bool RunUntil(u64 tick, bool stopOnWatched = false);
+
+	// Tick of the next event, ~0 if there is none
+	u64 GetNextEventTime() const;
+
+	u64 GetTime() const { return m_Now; }
+	double GetTickSeconds() const { return m_TickSeconds; }
+	void SetTickSeconds(double seconds) { m_TickSeconds = seconds; }
+
+	const std::vector<NetId>& GetWatchedChanges() const { return m_WatchedChanges; }
+
+	size_t GetNumNets() const { return m_NumNets; }
+	size_t GetNumGates() const { return m_Gates.size(); }
+	u64 GetNumEvents() const { return m_NumEvents; }
+	u64 GetNumEvaluations() const { return m_NumEvaluations; }
+};
+
+
+// Output stage of a logic net, pin 0 is the output, pin 1 the reference (logic supply ground)
+//
+//  ref *---(V = low / high)---(R)---* out
+//
+// Stamped as a Norton source, a level change only moves the right hand side
+class eLogicOutput : public eElement
+{
+	DigitalEngine* m_Engine;
+	NetId m_Net;
+	double m_LowVoltage;
+	double m_HighVoltage;
+	double m_Resistance;
+	bool m_Level = false;
+
+	double m_StampedG = 0.0;
+	double m_StampedIeq = 0.0;
+
+public:
+
+	eLogicOutput(DigitalEngine* engine, NetId net, double lowVoltage, double highVoltage, double resistance);
+	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual eBranchModel GetBranchModel() override { return { m_StampedG, m_StampedIeq, -1 }; }
+	virtual eCoupling GetCoupling() override { return eCoupling::Conductance; }
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+	virtual u64 HashValues() override;
+
+	// Takes the level of the net, marks the element dirty if it changed
+	bool Sync();
+
+	NetId GetNet() const { return m_Net; }
+	bool GetLevel() const { return m_Level; }
+	double GetOutputVoltage() const { return m_Level ? m_HighVoltage : m_LowVoltage; }
+};
+
+
+// Logic input sensing pin 0 against pin 1, ideal (no load on the circuit). Goes high above the high
+// threshold and low below the low one, in between it keeps its level
+class eLogicInput : public eElement
+{
+	DigitalEngine* m_Engine;
+	NetId m_Net;
+	double m_LowThreshold;
+	double m_HighThreshold;
+	bool m_Level = false;
+
+public:
+
+	eLogicInput(DigitalEngine* engine, NetId net, double lowThreshold, double highThreshold);
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+
+	// Compares the voltage of the last solution, a crossing becomes an event at the tick
+	bool Sense(u64 tick);
+
+	NetId GetNet() const { return m_Net; }
+	bool GetLevel() const { return m_Level; }
+};
+
+
+class MixedSignalSim
+{
+	Circuit& m_Circuit;
+	DigitalEngine& m_Engine;
+
+	std::vector<eLogicOutput*> m_Outputs;
+	std::vector<eLogicInput*> m_Inputs;
+
+	u64 m_AnalogStepTicks = 0;		// 0 = the circuit has no history, solved on driver changes only
+	u64 m_NextAnalogTick = 0;
+	u64 m_NumAnalogSolves = 0;
+
+	void SolveAnalog();
+
+public:
+
+	MixedSignalSim(Circuit& circuit, DigitalEngine& engine);
+
+	eLogicOutput* AddOutput(NetId net, double lowVoltage, double highVoltage, double resistance);
+	eLogicInput* AddInput(NetId net, double lowThreshold, double highThreshold);
+
+	// Transient step of the circuit in seconds, rounded to ticks. Drivers that switch between two
+	// steps are seen on the next one. 0 for circuits without capacitors or inductors
+	void SetAnalogStep(double seconds);
+
+	// Consistent state at the current time : drivers synced, circuit solved, inputs sensed
+	void Initialize();
+
+	void Advance(double seconds);
+
+	u64 GetNumAnalogSolves() const { return m_NumAnalogSolves; }
+};
@@ -0,0 +1,229 @@
+#include "History.h"
+
+
+CircuitHistory::CircuitHistory(Circuit& circuit)
+	: m_Circuit(circuit)
+{
+}
+
+
+void CircuitHistory::DropRedo()
+{
+	if (m_NumApplied == m_StepEnds.size())
+		return;
+
+	// Destroys what the undone steps held out of the circuit
+	size_t keep = m_NumApplied ? m_StepEnds[m_NumApplied - 1] : 0;
+	m_Changes.erase(m_Changes.begin() + keep, m_Changes.end());
+	m_StepEnds.resize(m_NumApplied);
+}
+
+
+CircuitHistory::Change& CircuitHistory::Record(eChangeType type)
+{
+	if (m_StepDepth == 0)
+		DropRedo();
+
+	m_Changes.emplace_back();
+	m_Changes.back().type = type;
+
+	if (m_StepDepth == 0)
+	{
+		m_StepEnds.push_back(m_Changes.size());
+		m_NumApplied++;
+	}
+
+	return m_Changes.back();
+}
+
+
+void CircuitHistory::BeginStep()
+{
+	if (m_StepDepth++ == 0)
+		DropRedo();
+}
+
+
+void CircuitHistory::EndStep()
+{
+	if (m_StepDepth == 0 || --m_StepDepth > 0)
+		return;
+
+	size_t begin = m_StepEnds.empty() ? 0 : m_StepEnds.back();
+	if (m_Changes.size() > begin)
+	{
+		m_StepEnds.push_back(m_Changes.size());
+		m_NumApplied++;
+	}
+}
+
+
+void CircuitHistory::SetValue(eElement* element, double value)
+{
+	double oldValue = element->GetValue();
+	if (oldValue == value)
+		return;
+
+	Change& change = Record(eChangeType::Value);
+	change.element = element;
+	change.oldValue = oldValue;
+	change.newValue = value;
+
+	element->SetValue(value);
+}
+
+
+void CircuitHistory::Connect(ePin* pin, eNode* node)
+{
+	eNode* from = pin->GetConnectedNode();
+	if (from == node)
+		return;
+
+	eElement* element = pin->GetParentElement();
+	Change& change = Record(eChangeType::Connect);
+	change.element = element;
+	change.pin = u32(pin - element->GetEpin(0));
+	change.from = from;
+	change.to = node;
+
+	pin->ConnectToNode(node);
+}
+
+
+eNode* CircuitHistory::CreateNode()
+{
+	eNode* node = m_Circuit.CreateNode();
+	Record(eChangeType::AddNode);
+	return node;
+}
+
+
+void CircuitHistory::RemoveElement(eElement* element)
+{
+	BeginStep();
+
+	for (int i = 0; ePin* pin = element->GetEpin(i); i++)
+		Connect(pin, nullptr);
+
+	size_t index = 0;
+	std::unique_ptr<eElement> detached = m_Circuit.DetachElement(element, &index);
+	if (detached)
+	{
+		Change& change = Record(eChangeType::RemoveElement);
+		change.element = element;
+		change.index = index;
+		change.detachedElement = std::move(detached);
+	}
+
+	EndStep();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// 											Undo / redo
+
+
+
+void CircuitHistory::Revert(Change& change)
+{
+	switch (change.type)
+	{
+	case eChangeType::Value:
+		change.element->SetValue(change.oldValue);
+		break;
+
+	case eChangeType::Connect:
+		change.element->GetEpin(int(change.pin))->ConnectToNode(change.from);
+		break;
+
+	case eChangeType::AddElement:
+		change.detachedElement = m_Circuit.DetachElement(change.element);
+		break;
+
+	case eChangeType::RemoveElement:
+		m_Circuit.InsertElement(std::move(change.detachedElement), change.index);
+		break;
+
+	case eChangeType::AddNode:
+		change.detachedNode = m_Circuit.DetachLastNode();
+		break;
+	}
+}
+
+
+void CircuitHistory::Apply(Change& change)
+{
+	switch (change.type)
+	{
+	case eChangeType::Value:
+		change.element->SetValue(change.newValue);
+		break;
+
+	case eChangeType::Connect:
+		change.element->GetEpin(int(change.pin))->ConnectToNode(change.to);
+		break;
+
+	case eChangeType::AddElement:
+		m_Circuit.InsertElement(std::move(change.detachedElement), change.index);
+		break;
+
+	case eChangeType::RemoveElement:
+		change.detachedElement = m_Circuit.DetachElement(change.element);
+		break;
+
+	case eChangeType::AddNode:
+		m_Circuit.AttachNode(std::move(change.detachedNode));
+		break;
+	}
+}
+
+
+bool CircuitHistory::Undo()
+{
+	if (m_NumApplied == 0 || m_StepDepth > 0)
+		return false;
+
+	size_t begin = m_NumApplied > 1 ? m_StepEnds[m_NumApplied - 2] : 0;
+	for (size_t i = m_StepEnds[m_NumApplied - 1]; i-- > begin; )
+		Revert(m_Changes[i]);
+
+	m_NumApplied--;
+	return true;
+}
+
+
+bool CircuitHistory::Redo()
+{
+	if (m_NumApplied == m_StepEnds.size() || m_StepDepth > 0)
+		return false;
+
+	size_t begin = m_NumApplied ? m_StepEnds[m_NumApplied - 1] : 0;
+	for (size_t i = begin; i < m_StepEnds[m_NumApplied]; i++)
+		Apply(m_Changes[i]);
+
+	m_NumApplied++;
+	return true;
+}
+
+
+void CircuitHistory::Clear()
+{
+	m_Changes.clear();
+	m_StepEnds.clear();
+	m_NumApplied = 0;
+	m_StepDepth = 0;
+}
+
+
+size_t CircuitHistory::GetMemoryBytes() const
+{
+	size_t bytes = m_Changes.capacity() * sizeof(Change) + m_StepEnds.capacity() * sizeof(size_t);
+	for (const Change& change : m_Changes)
+	{
+		if (change.detachedElement)
+			bytes += sizeof(eElement) + sizeof(ePin) * change.detachedElement->GetNumPins();
+		if (change.detachedNode)
+			bytes += sizeof(eNode);
+	}
+	return bytes;
+}
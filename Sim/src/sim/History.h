@@ -0,0 +1,102 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "Scheme.h"
+
+// Undo and redo of the edits of a circuit
+//
+// The live circuit is the one copy all versions share. A step keeps only what its edits changed :
+// the value before and after, the node a pin left and the one it went to, and the elements and nodes
+// it took out, kept alive (not copied) so a redo puts the same objects back. A step costs memory in
+// proportion to its edits and undo / redo replays one step, whatever the size of the circuit.
+//
+// Removed elements go back to the position they had, so an undone circuit hashes as it did and a
+// SolutionCache on it hands back the solution and factorization of that state.
+//
+// Edits have to go through the history for it to stay in step with the circuit. Edits between
+// BeginStep() and EndStep() undo as one, anything else is a step of its own. A new edit drops the
+// steps that were undone.
+
+class CircuitHistory
+{
+	enum class eChangeType : u8
+	{
+		Value,
+		Connect,
+		AddElement,
+		RemoveElement,
+		AddNode
+	};
+
+	struct Change
+	{
+		eChangeType type;
+		u32 pin = 0;
+		size_t index = 0;					// Position of an added or removed element
+		eElement* element = nullptr;
+		eNode* from = nullptr;				// Connect : node before and after
+		eNode* to = nullptr;
+		double oldValue = 0.0;
+		double newValue = 0.0;
+
+		// Out of the circuit while the change is not in effect (removed, or added and undone)
+		std::unique_ptr<eElement> detachedElement;
+		std::unique_ptr<eNode> detachedNode;
+	};
+
+	Circuit& m_Circuit;
+
+	std::vector<Change> m_Changes;
+	std::vector<size_t> m_StepEnds;		// End of the changes of every step
+	size_t m_NumApplied = 0;			// Steps in effect, the ones after can be redone
+	int m_StepDepth = 0;
+
+	void DropRedo();
+	Change& Record(eChangeType type);
+	void Revert(Change& change);
+	void Apply(Change& change);
+
+public:
+
+	explicit CircuitHistory(Circuit& circuit);
+
+	CircuitHistory(const CircuitHistory&) = delete;
+	CircuitHistory& operator=(const CircuitHistory&) = delete;
+
+	// Nest, the outermost pair makes the step. An empty step is not kept
+	void BeginStep();
+	void EndStep();
+
+	void SetValue(eElement* element, double value);
+	void Connect(ePin* pin, eNode* node);
+	eNode* CreateNode();
+
+	template <typename T, typename... Args>
+	T* AddElement(Args&&... args)
+	{
+		T* element = m_Circuit.AddElement<T>(std::forward<Args>(args)...);
+		Change& change = Record(eChangeType::AddElement);
+		change.element = element;
+		change.index = m_Circuit.GetNumElements() - 1;
+		return element;
+	}
+
+	// Releases the pins as changes of the same step first
+	void RemoveElement(eElement* element);
+
+	// False when there is nothing to undo / redo. The circuit is only marked dirty, the next
+	// UpdateSolution() solves it
+	bool Undo();
+	bool Redo();
+
+	// Forgets every step, the elements and nodes that were taken out with them are destroyed
+	void Clear();
+
+	size_t GetNumUndoSteps() const { return m_NumApplied; }
+	size_t GetNumRedoSteps() const { return m_StepEnds.size() - m_NumApplied; }
+
+	// Memory of the steps, elements and nodes held out of the circuit included. A held element counts
+	// as an eElement with its pins, a lower bound for the types that add members
+	size_t GetMemoryBytes() const;
+};
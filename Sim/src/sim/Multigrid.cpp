@@ -0,0 +1,545 @@
+#include "Multigrid.h"
+#include "base/Timer.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Assembly
+
+
+
+bool MultigridSolver::Assemble(const std::vector<StampBuffer::Entry>& entries, size_t numNodeRows, size_t numUnknowns, bool keepSetup)
+{
+	SM_PROFILE_SCOPE("Multigrid::Assemble");
+
+	if (!keepSetup)
+		m_HierarchyValid = false;
+
+	size_t numBranches = numUnknowns - numNodeRows;
+
+	// The one node of every branch row, -1 without, -2 with more than one
+	std::vector<s64> branchNode(numBranches, -1);
+	std::vector<double> branchSign(numBranches, 0.0);
+	std::vector<double> branchRhs(numBranches, 0.0);
+	m_FullRhs = Eigen::VectorXd::Zero(Eigen::Index(numUnknowns));
+
+	for (const StampBuffer::Entry& entry : entries)
+	{
+		if (entry.col == StampBuffer::RhsColumn)
+		{
+			m_FullRhs(entry.row) += entry.value;
+			if (entry.row >= numNodeRows)
+				branchRhs[entry.row - numNodeRows] += entry.value;
+			continue;
+		}
+
+		if (entry.row < numNodeRows)
+			continue;
+
+		// A branch current in its own equation (an inductor in a transient step, a controlled source)
+		if (entry.col >= numNodeRows)
+			return false;
+
+		size_t k = entry.row - numNodeRows;
+		if (branchNode[k] == -1 || branchNode[k] == s64(entry.col))
+		{
+			branchNode[k] = s64(entry.col);
+			branchSign[k] += entry.value;
+		}
+		else
+		{
+			branchNode[k] = -2;
+		}
+	}
+
+	// Every branch a source to the ground : its node is known, the other nodes are the unknowns
+	m_FreeIndex.assign(numNodeRows, 0);
+	m_Fixed.clear();
+	for (size_t k = 0; k < numBranches; k++)
+	{
+		if (branchNode[k] < 0 || branchSign[k] == 0.0 || m_FreeIndex[size_t(branchNode[k])] < 0)
+			return false;
+
+		u32 row = u32(branchNode[k]);
+		m_FreeIndex[row] = -1 - int(m_Fixed.size());
+		m_Fixed.push_back({ row, u32(numNodeRows + k), 0.0, branchRhs[k] / branchSign[k] });
+	}
+
+	int numFree = 0;
+	for (int& index : m_FreeIndex)
+	{
+		if (index >= 0)
+			index = numFree++;
+	}
+
+	m_Rhs = Eigen::VectorXd::Zero(numFree);
+	m_FixedRows.clear();
+	m_Triplets.clear();
+	m_Triplets.reserve(entries.size());
+	for (const StampBuffer::Entry& entry : entries)
+	{
+		if (entry.row >= numNodeRows)
+			continue;
+
+		int row = m_FreeIndex[entry.row];
+		if (row < 0)
+		{
+			// Kept for the source current, the coefficient of the current is the sign
+			FixedNode& fixed = m_Fixed[size_t(-1 - row)];
+			if (entry.col == fixed.branch)
+				fixed.sign += entry.value;
+			else if (entry.col < numNodeRows || entry.col == StampBuffer::RhsColumn)
+				m_FixedRows.push_back(entry);
+			else
+				return false;
+			continue;
+		}
+
+		if (entry.col == StampBuffer::RhsColumn)
+		{
+			m_Rhs(row) += entry.value;
+			continue;
+		}
+
+		// Current of a source that doesn't fix this node : one between two nodes
+		if (entry.col >= numNodeRows)
+			return false;
+
+		int col = m_FreeIndex[entry.col];
+		if (col < 0)
+			m_Rhs(row) -= entry.value * m_Fixed[size_t(-1 - col)].voltage;
+		else
+			m_Triplets.emplace_back(row, col, entry.value);
+	}
+
+	for (const FixedNode& fixed : m_Fixed)
+	{
+		if (fixed.sign == 0.0)
+			return false;
+	}
+
+	bool sameSize = !m_Levels.empty() && m_Levels[0].A.rows() == numFree;
+	if (!sameSize || m_NumNodeRows != numNodeRows || m_NumUnknowns != numUnknowns)
+		m_HierarchyValid = false;
+
+	m_NumNodeRows = numNodeRows;
+	m_NumUnknowns = numUnknowns;
+
+	if (m_Levels.empty())
+		m_Levels.emplace_back();
+
+	Level& fine = m_Levels[0];
+	fine.A.resize(numFree, numFree);
+	fine.A.setFromTriplets(m_Triplets.begin(), m_Triplets.end());
+	fine.invDiag = fine.A.diagonal().cwiseInverse();
+
+	if (m_X.size() != numFree || !m_HierarchyValid)
+		m_X = Eigen::VectorXd::Zero(numFree);
+
+	return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Setup
+
+
+
+static bool IsStrong(double value, double diag1, double diag2)
+{
+	constexpr double threshold = MultigridSolver::StrengthThreshold;
+	return value * value >= threshold * threshold * std::abs(diag1 * diag2);
+}
+
+
+// Greedy aggregation over the strong connections : a node with no aggregated neighbour starts an
+// aggregate of its neighbourhood, the nodes left join the neighbour they are most strongly tied to,
+// and what is still left groups with itself
+void MultigridSolver::Coarsen(const SparseMatrix& A, std::vector<int>& aggregates, int& numAggregates) const
+{
+	Eigen::Index n = A.rows();
+	Eigen::VectorXd diag = A.diagonal();
+
+	auto strong = [&](Eigen::Index i, SparseMatrix::InnerIterator& it)
+	{
+		return it.col() != i && IsStrong(it.value(), diag(i), diag(it.col()));
+	};
+
+	aggregates.assign(size_t(n), -1);
+	numAggregates = 0;
+
+	for (Eigen::Index i = 0; i < n; i++)
+	{
+		if (aggregates[i] >= 0)
+			continue;
+
+		bool free = true;
+		bool connected = false;
+		for (SparseMatrix::InnerIterator it(A, i); it && free; ++it)
+		{
+			if (strong(i, it))
+			{
+				connected = true;
+				free = aggregates[it.col()] < 0;
+			}
+		}
+
+		if (!free || !connected)
+			continue;
+
+		aggregates[i] = numAggregates;
+		for (SparseMatrix::InnerIterator it(A, i); it; ++it)
+		{
+			if (strong(i, it))
+				aggregates[it.col()] = numAggregates;
+		}
+		numAggregates++;
+	}
+
+	// The first pass only, a node joining doesn't extend an aggregate any further
+	std::vector<int> seeded = aggregates;
+	for (Eigen::Index i = 0; i < n; i++)
+	{
+		if (aggregates[i] >= 0)
+			continue;
+
+		double best = 0.0;
+		for (SparseMatrix::InnerIterator it(A, i); it; ++it)
+		{
+			if (strong(i, it) && seeded[it.col()] >= 0 && std::abs(it.value()) > best)
+			{
+				best = std::abs(it.value());
+				aggregates[i] = seeded[it.col()];
+			}
+		}
+	}
+
+	for (Eigen::Index i = 0; i < n; i++)
+	{
+		if (aggregates[i] >= 0)
+			continue;
+
+		aggregates[i] = numAggregates;
+		for (SparseMatrix::InnerIterator it(A, i); it; ++it)
+		{
+			if (strong(i, it) && aggregates[it.col()] < 0)
+				aggregates[it.col()] = numAggregates;
+		}
+		numAggregates++;
+	}
+}
+
+
+void MultigridSolver::Setup()
+{
+	SM_PROFILE_SCOPE("Multigrid::Setup");
+	Timer timer = Timer::StartNew();
+
+	m_Levels.resize(1);
+
+	std::vector<int> aggregates;
+	std::vector<int> marker;
+	std::vector<int> columns;
+	std::vector<double> values;
+	std::vector<int> order;
+	Eigen::VectorXd filteredDiag;
+
+	while (true)
+	{
+		Level& level = m_Levels.back();
+		Eigen::Index n = level.A.rows();
+		level.x.resize(n);
+		level.b.resize(n);
+		level.r.resize(n);
+		level.P.resize(0, 0);
+		level.R.resize(0, 0);
+
+		if (size_t(n) <= MaxCoarseSize || m_Levels.size() == MaxLevels)
+			break;
+
+		int numCoarse = 0;
+		Coarsen(level.A, aggregates, numCoarse);
+		// Stalled, the coarse levels would only get denser
+		if (numCoarse * 4 > n * 3 && size_t(n) <= MaxDenseSize)
+			break;
+
+		// Damped Jacobi on the piecewise constant interpolation, P = (I - w D^-1 A) P0, over A with its
+		// weak entries lumped onto the diagonal so the coarse levels don't fill in. w = 4 / (3 rho) with
+		// rho(D^-1 A) bounded by the row sums. Row by row, P0 has one 1 per row
+		Eigen::VectorXd diag = level.A.diagonal();
+		filteredDiag.resize(n);
+		double rho = 0.0;
+		for (Eigen::Index i = 0; i < n; i++)
+		{
+			double lumped = 0.0;
+			double offDiagonal = 0.0;
+			for (SparseMatrix::InnerIterator it(level.A, i); it; ++it)
+			{
+				if (it.col() == i)
+					lumped += it.value();
+				else if (IsStrong(it.value(), diag(i), diag(it.col())))
+					offDiagonal += std::abs(it.value());
+				else
+					lumped += it.value();
+			}
+
+			filteredDiag(i) = lumped > 0.0 ? lumped : diag(i);
+			rho = std::max(rho, 1.0 + offDiagonal / filteredDiag(i));
+		}
+		double omega = 4.0 / (3.0 * rho);
+
+		marker.assign(size_t(numCoarse), -1);
+		level.P.resize(n, numCoarse);
+		level.P.reserve(level.A.nonZeros());
+		for (Eigen::Index i = 0; i < n; i++)
+		{
+			columns.clear();
+			values.clear();
+			double scale = -omega / filteredDiag(i);
+			auto add = [&](int c, double value)
+			{
+				if (marker[c] < 0)
+				{
+					marker[c] = int(columns.size());
+					columns.push_back(c);
+					values.push_back(0.0);
+				}
+				values[marker[c]] += value;
+			};
+
+			add(aggregates[i], 1.0 + scale * filteredDiag(i));
+			for (SparseMatrix::InnerIterator it(level.A, i); it; ++it)
+			{
+				if (it.col() != i && IsStrong(it.value(), diag(i), diag(it.col())))
+					add(aggregates[it.col()], scale * it.value());
+			}
+
+			order.resize(columns.size());
+			for (size_t k = 0; k < order.size(); k++)
+				order[k] = int(k);
+			std::sort(order.begin(), order.end(), [&](int a, int b) { return columns[a] < columns[b]; });
+
+			level.P.startVec(i);
+			for (int k : order)
+			{
+				level.P.insertBack(i, columns[k]) = values[k];
+				marker[columns[k]] = -1;
+			}
+		}
+		level.P.finalize();
+		level.R = level.P.transpose();
+
+		Level coarse;
+		SparseMatrix AP = level.A * level.P;
+		coarse.A = level.R * AP;
+		coarse.invDiag = coarse.A.diagonal().cwiseInverse();
+		m_Levels.push_back(std::move(coarse));
+	}
+
+	const SparseMatrix& last = m_Levels.back().A;
+	if (size_t(last.rows()) <= MaxDenseSize)
+		m_Coarse.compute(Eigen::MatrixXd(last));
+
+	m_HierarchyValid = true;
+	m_NumSetups++;
+	m_SetupIterations = 0;
+
+	timer.Stop();
+	m_SetupSeconds = timer.GetElapsedSeconds();
+}
+
+
+double MultigridSolver::GetOperatorComplexity() const
+{
+	if (m_Levels.empty() || m_Levels[0].A.nonZeros() == 0)
+		return 0.0;
+
+	double total = 0.0;
+	for (const Level& level : m_Levels)
+		total += double(level.A.nonZeros());
+
+	return total / double(m_Levels[0].A.nonZeros());
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Solve
+
+
+
+// Gauss-Seidel in place, forward before the coarse correction and backward after so the cycle
+// stays symmetric for conjugate gradients
+void MultigridSolver::Smooth(Level& level, bool forward) const
+{
+	const SparseMatrix& A = level.A;
+	Eigen::Index n = A.rows();
+
+	auto relax = [&](Eigen::Index i)
+	{
+		double sum = level.b(i);
+		double diag = 0.0;
+		for (SparseMatrix::InnerIterator it(A, i); it; ++it)
+		{
+			if (it.col() == i)
+				diag = it.value();
+			else
+				sum -= it.value() * level.x(it.col());
+		}
+		level.x(i) = sum / diag;
+	};
+
+	if (forward)
+	{
+		for (Eigen::Index i = 0; i < n; i++)
+			relax(i);
+	}
+	else
+	{
+		for (Eigen::Index i = n - 1; i >= 0; i--)
+			relax(i);
+	}
+}
+
+
+void MultigridSolver::Cycle(size_t index)
+{
+	Level& level = m_Levels[index];
+
+	if (index + 1 == m_Levels.size())
+	{
+		if (size_t(level.A.rows()) <= MaxDenseSize)
+		{
+			level.x = m_Coarse.solve(level.b);
+			return;
+		}
+
+		// Coarsening stalled on a big level, smoothing alone has to do
+		level.x.setZero();
+		for (int sweep = 0; sweep < CoarseSweeps; sweep++)
+		{
+			Smooth(level, true);
+			Smooth(level, false);
+		}
+		return;
+	}
+
+	Level& coarse = m_Levels[index + 1];
+
+	level.x.setZero();
+	Smooth(level, true);
+	level.r.noalias() = level.b - level.A * level.x;
+	coarse.b.noalias() = level.R * level.r;
+	Cycle(index + 1);
+	level.x.noalias() += level.P * coarse.x;
+	Smooth(level, false);
+}
+
+
+void MultigridSolver::Precondition(const Eigen::VectorXd& r, Eigen::VectorXd& z)
+{
+	m_Levels[0].b = r;
+	Cycle(0);
+	z = m_Levels[0].x;
+}
+
+
+bool MultigridSolver::RunCG()
+{
+	const SparseMatrix& A = m_Levels[0].A;
+	double rhsNorm = m_Rhs.norm();
+	if (rhsNorm == 0.0)
+	{
+		m_X.setZero();
+		m_Iterations = 0;
+		m_Residual = 0.0;
+		return true;
+	}
+
+	m_R.noalias() = m_Rhs - A * m_X;
+	double threshold = m_Tolerance * rhsNorm;
+	double residual = m_R.norm();
+
+	Precondition(m_R, m_Z);
+	m_P = m_Z;
+	double rz = m_R.dot(m_Z);
+
+	u32 iterations = 0;
+	while (residual > threshold && iterations < m_MaxIterations)
+	{
+		m_Q.noalias() = A * m_P;
+		double alpha = rz / m_P.dot(m_Q);
+		m_X += alpha * m_P;
+		m_R -= alpha * m_Q;
+		residual = m_R.norm();
+		iterations++;
+
+		if (residual <= threshold)
+			break;
+
+		Precondition(m_R, m_Z);
+		double rzNext = m_R.dot(m_Z);
+		m_P = m_Z + (rzNext / rz) * m_P;
+		rz = rzNext;
+	}
+
+	m_Iterations = iterations;
+	m_Residual = residual / rhsNorm;
+	return residual <= threshold;
+}
+
+
+bool MultigridSolver::Solve(Eigen::VectorXd& solution, Eigen::VectorXd& rhs)
+{
+	SM_PROFILE_SCOPE("Multigrid::Solve");
+
+	if (!m_HierarchyValid)
+		Setup();
+
+	Timer timer = Timer::StartNew();
+	bool converged = RunCG();
+
+	// The first solve that iterates after a setup sets the mark. Past it, the values drifted too far
+	// from the ones the hierarchy was built on : set up again for the next solves, and go on from
+	// where this one stopped if it ran out
+	if (m_SetupIterations == 0)
+		m_SetupIterations = m_Iterations;
+	else if (m_Iterations > 2 * m_SetupIterations + 4)
+	{
+		u32 iterations = m_Iterations;
+		Setup();
+		if (!converged)
+		{
+			converged = RunCG();
+			m_Iterations += iterations;
+		}
+	}
+
+	timer.Stop();
+	m_SolveSeconds = timer.GetElapsedSeconds();
+
+	// Known nodes back in place, the currents of their sources from their rows
+	solution.resize(Eigen::Index(m_NumUnknowns));
+	for (size_t row = 0; row < m_NumNodeRows; row++)
+	{
+		int index = m_FreeIndex[row];
+		solution(Eigen::Index(row)) = index >= 0 ? m_X(index) : m_Fixed[size_t(-1 - index)].voltage;
+	}
+
+	for (const FixedNode& fixed : m_Fixed)
+		solution(fixed.branch) = 0.0;
+
+	for (const StampBuffer::Entry& entry : m_FixedRows)
+	{
+		const FixedNode& fixed = m_Fixed[size_t(-1 - m_FreeIndex[entry.row])];
+		double term = entry.col == StampBuffer::RhsColumn ? entry.value : -entry.value * solution(entry.col);
+		solution(fixed.branch) += term;
+	}
+
+	for (const FixedNode& fixed : m_Fixed)
+		solution(fixed.branch) /= fixed.sign;
+
+	rhs = m_FullRhs;
+	return converged;
+}
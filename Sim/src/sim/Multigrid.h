@@ -0,0 +1,123 @@
+#pragma once
+#include <vector>
+
+#include "vendor/Eigen/Sparse"
+#include "sim/Scheme.h"
+
+// Algebraic multigrid for resistive circuits, the solver of eSolverMode::Multigrid
+//
+// A circuit of resistors (and anything stamping like one : capacitors in a transient step, logic
+// outputs) with voltage sources to the ground is a symmetric positive definite system once the
+// source nodes are fixed to their voltages. Too big to factor densely, and conjugate gradients
+// alone need more iterations the finer the mesh.
+//
+// The system is taken from the stamps as the elements record them, there is no dense matrix. Setup
+// coarsens it by smoothed aggregation : strongly coupled nodes form aggregates, the constant over
+// every aggregate smoothed by one damped Jacobi step interpolates back, and the coarse matrix is
+// the Galerkin product P^T A P. Levels go down to about a thousand unknowns that are factored densely.
+// A V-cycle with symmetric Gauss-Seidel then preconditions conjugate gradients, which takes about
+// the same number of iterations whatever the size, so both setup and solve are linear in it.
+//
+// The hierarchy is kept across solves while the topology stays : new right hand sides and value
+// edits only rebuild the fine matrix and start from the last solution. It is set up again when the
+// iterations grow well past what they were after the last setup.
+
+class MultigridSolver
+{
+public:
+	using SparseMatrix = Eigen::SparseMatrix<double, Eigen::RowMajor, int>;
+
+	static constexpr size_t MaxCoarseSize = 1024;	// Coarsening stops below
+	static constexpr size_t MaxDenseSize = 4096;	// Coarsest level factored densely up to it, smoothed above
+	static constexpr int CoarseSweeps = 16;
+	static constexpr size_t MaxLevels = 24;
+	static constexpr double StrengthThreshold = 0.04;	// |a_ij| against sqrt(a_ii * a_jj)
+
+private:
+	struct Level
+	{
+		SparseMatrix A;
+		SparseMatrix P;			// From the next coarser level, empty on the last
+		SparseMatrix R;			// P^T
+		Eigen::VectorXd invDiag;
+		Eigen::VectorXd x;		// Scratch of the V-cycle
+		Eigen::VectorXd b;
+		Eigen::VectorXd r;
+	};
+
+	std::vector<Level> m_Levels;
+	Eigen::LLT<Eigen::MatrixXd> m_Coarse;
+	bool m_HierarchyValid = false;
+
+	// Node rows fixed by a voltage source to the ground, and the branch row of the source
+	struct FixedNode
+	{
+		u32 row;
+		u32 branch;
+		double sign;		// Of the source current in the node row
+		double voltage;
+	};
+
+	size_t m_NumNodeRows = 0;
+	size_t m_NumUnknowns = 0;
+	std::vector<int> m_FreeIndex;					// Node row -> unknown of the reduced system, -1 if fixed
+	std::vector<FixedNode> m_Fixed;
+	std::vector<StampBuffer::Entry> m_FixedRows;	// Node entries of the fixed rows, for the source currents
+	std::vector<Eigen::Triplet<double, int>> m_Triplets;
+	Eigen::VectorXd m_Rhs;							// Reduced system
+	Eigen::VectorXd m_FullRhs;						// As stamped
+
+	// Conjugate gradients
+	Eigen::VectorXd m_X;
+	Eigen::VectorXd m_R;
+	Eigen::VectorXd m_Z;
+	Eigen::VectorXd m_P;
+	Eigen::VectorXd m_Q;
+
+	double m_Tolerance = 1e-10;
+	u32 m_MaxIterations = 1000;
+
+	u32 m_Iterations = 0;
+	u32 m_SetupIterations = 0;		// Of the first solve that iterated after the last setup
+	u32 m_NumSetups = 0;
+	double m_Residual = 0.0;
+	double m_SetupSeconds = 0.0;
+	double m_SolveSeconds = 0.0;
+
+	void Setup();
+	void Coarsen(const SparseMatrix& A, std::vector<int>& aggregates, int& numAggregates) const;
+	void Smooth(Level& level, bool forward) const;
+	void Cycle(size_t level);
+	void Precondition(const Eigen::VectorXd& r, Eigen::VectorXd& z);
+	bool RunCG();
+
+public:
+
+	// The reduced system from stamps recorded for numUnknowns rows, the first numNodeRows of them
+	// nodes. False if it isn't resistive : a branch row other than a voltage source (or a DC inductor)
+	// to the ground, or two of them on a node. keepSetup when only values changed since the last call
+	bool Assemble(const std::vector<StampBuffer::Entry>& entries, size_t numNodeRows, size_t numUnknowns, bool keepSetup);
+
+	// Solution of all the rows, the currents of the sources included, and the right hand side as
+	// stamped. False if the iterations ran out before the tolerance
+	bool Solve(Eigen::VectorXd& solution, Eigen::VectorXd& rhs);
+
+	// Relative residual of the reduced system
+	void SetTolerance(double tolerance) { m_Tolerance = tolerance; }
+	void SetMaxIterations(u32 iterations) { m_MaxIterations = iterations; }
+
+	// The reduced system of the last Assemble(), to compare other solvers on
+	const SparseMatrix& GetMatrix() const { return m_Levels[0].A; }
+	const Eigen::VectorXd& GetRhs() const { return m_Rhs; }
+
+	size_t GetNumLevels() const { return m_Levels.size(); }
+	size_t GetNumFreeUnknowns() const { return size_t(m_Rhs.size()); }
+	u32 GetIterations() const { return m_Iterations; }
+	u32 GetNumSetups() const { return m_NumSetups; }
+	double GetResidual() const { return m_Residual; }
+	double GetSetupSeconds() const { return m_SetupSeconds; }
+	double GetSolveSeconds() const { return m_SolveSeconds; }
+
+	// Nonzeros of all levels over the nonzeros of the fine one, the memory of the hierarchy
+	double GetOperatorComplexity() const;
+};
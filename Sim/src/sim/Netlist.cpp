@@ -0,0 +1,324 @@
+#include "Netlist.h"
+#include "Nonlinear.h"
+
+#include <cctype>
+#include <charconv>
+#include <cmath>
+
+
+static std::string_view Trim(std::string_view text)
+{
+	while (!text.empty() && std::isspace(static_cast<unsigned char>(text.front())))
+		text.remove_prefix(1);
+	while (!text.empty() && std::isspace(static_cast<unsigned char>(text.back())))
+		text.remove_suffix(1);
+	return text;
+}
+
+
+static bool EqualsNoCase(std::string_view a, std::string_view b)
+{
+	if (a.size() != b.size())
+		return false;
+
+	for (size_t i = 0; i < a.size(); i++)
+	{
+		if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+			return false;
+	}
+	return true;
+}
+
+
+static void Tokenize(std::string_view line, std::vector<std::string_view>& tokens)
+{
+	tokens.clear();
+	size_t pos = 0;
+	while (pos < line.size())
+	{
+		while (pos < line.size() && (std::isspace(static_cast<unsigned char>(line[pos])) || line[pos] == ','))
+			pos++;
+
+		size_t start = pos;
+		while (pos < line.size() && !std::isspace(static_cast<unsigned char>(line[pos])) && line[pos] != ',')
+			pos++;
+
+		if (pos > start)
+			tokens.push_back(line.substr(start, pos - start));
+	}
+}
+
+
+bool NetlistReader::ParseValue(std::string_view text, double& value)
+{
+	const char* begin = text.data();
+	const char* end = text.data() + text.size();
+
+	auto [ptr, ec] = std::from_chars(begin, end, value);
+	if (ec != std::errc())
+		return false;
+
+	std::string_view suffix(ptr, size_t(end - ptr));
+	if (suffix.empty())
+		return true;
+
+	// Longest first, "meg" before "m"
+	static constexpr std::pair<std::string_view, double> Suffixes[] =
+	{
+		{ "meg", 1e6 }, { "f", 1e-15 }, { "p", 1e-12 }, { "n", 1e-9 }, { "u", 1e-6 },
+		{ "m", 1e-3 }, { "k", 1e3 }, { "g", 1e9 }, { "t", 1e12 },
+	};
+
+	for (const auto& [name, scale] : Suffixes)
+	{
+		// Units after the suffix are ignored, as in 10uF or 1kOhm
+		if (suffix.size() >= name.size() && EqualsNoCase(suffix.substr(0, name.size()), name))
+		{
+			value *= scale;
+			return true;
+		}
+	}
+
+	// Plain unit, 5V
+	return std::isalpha(static_cast<unsigned char>(suffix.front())) != 0;
+}
+
+
+bool NetlistReader::IsEndLine(std::string_view line)
+{
+	line = Trim(line);
+	return line.size() >= 4 && EqualsNoCase(line.substr(0, 4), ".end") &&
+		(line.size() == 4 || std::isspace(static_cast<unsigned char>(line[4])));
+}
+
+
+bool NetlistReader::Fail(size_t lineNumber, std::string_view message)
+{
+	m_Error = "line ";
+	m_Error += std::to_string(lineNumber);
+	m_Error += " : ";
+	m_Error += message;
+	return false;
+}
+
+
+// Looks up the key of the name, which is left in m_Key
+eNode* NetlistReader::FindNode(std::string_view name)
+{
+	m_Key.assign(name);
+	for (char& c : m_Key)
+		c = char(std::tolower(static_cast<unsigned char>(c)));
+
+	if (m_Key == "gnd")
+		m_Key = "0";
+
+	auto it = m_NodesByName.find(m_Key);
+	return it != m_NodesByName.end() ? it->second : nullptr;
+}
+
+
+eNode* NetlistReader::GetNode(Circuit& circuit, std::string_view name)
+{
+	if (eNode* node = FindNode(name))
+		return node;
+
+	eNode* node = circuit.CreateNode();
+	m_NodesByName.emplace(m_Key, node);
+	if (m_Key != "0")
+		m_Nodes.emplace_back(name, node);
+
+	return node;
+}
+
+
+std::string_view NetlistReader::GetNodeName(const eNode* node) const
+{
+	for (const auto& [name, candidate] : m_Nodes)
+	{
+		if (candidate == node)
+			return name;
+	}
+	return "0";
+}
+
+
+bool NetlistReader::ParseLine(Circuit& circuit, std::string_view line, size_t lineNumber)
+{
+	Tokenize(line, m_Tokens);
+	if (m_Tokens.empty())
+		return true;
+
+	std::string_view card = m_Tokens[0];
+
+	if (card[0] == '.')
+	{
+		if (EqualsNoCase(card, ".title"))
+		{
+			m_Title.assign(Trim(line.substr(size_t(card.data() + card.size() - line.data()))));
+			return true;
+		}
+
+		if (EqualsNoCase(card, ".op"))
+		{
+			m_Analysis.type = eAnalysisType::Op;
+			return true;
+		}
+
+		if (EqualsNoCase(card, ".tran"))
+		{
+			m_Analysis.type = eAnalysisType::Tran;
+			if (m_Tokens.size() < 3 || !ParseValue(m_Tokens[1], m_Analysis.step) || !ParseValue(m_Tokens[2], m_Analysis.stop) ||
+				m_Analysis.step <= 0.0 || m_Analysis.stop < m_Analysis.step)
+				return Fail(lineNumber, ".tran needs <step> <stop>, 0 < step <= stop");
+			return true;
+		}
+
+		if (EqualsNoCase(card, ".ac"))
+		{
+			double perDecade = 0.0;
+			m_Analysis.type = eAnalysisType::AC;
+			if (m_Tokens.size() < 5 || !EqualsNoCase(m_Tokens[1], "dec") || !ParseValue(m_Tokens[2], perDecade) ||
+				!ParseValue(m_Tokens[3], m_Analysis.startHz) || !ParseValue(m_Tokens[4], m_Analysis.stopHz) ||
+				perDecade < 1.0 || m_Analysis.startHz <= 0.0 || m_Analysis.stopHz < m_Analysis.startHz)
+				return Fail(lineNumber, ".ac needs dec <points per decade> <fstart> <fstop>");
+
+			double decades = std::log10(m_Analysis.stopHz / m_Analysis.startHz);
+			m_Analysis.numPoints = size_t(std::ceil(decades * perDecade)) + 1;
+			return true;
+		}
+
+		// The elements may come after the probes
+		if (EqualsNoCase(card, ".probe"))
+		{
+			for (size_t i = 1; i < m_Tokens.size(); i++)
+			{
+				m_Probes.emplace_back(m_Tokens[i], nullptr);
+				m_ProbeLines.push_back(lineNumber);
+			}
+			return true;
+		}
+
+		return Fail(lineNumber, "unknown control line");
+	}
+
+	if (m_Tokens.size() < 4)
+		return Fail(lineNumber, "element needs a name, two nodes and a value");
+
+	eNode* node1 = GetNode(circuit, m_Tokens[1]);
+	eNode* node2 = GetNode(circuit, m_Tokens[2]);
+	eElement* element = nullptr;
+	double value = 0.0;
+
+	switch (std::tolower(static_cast<unsigned char>(card[0])))
+	{
+	case 'r':
+		if (!ParseValue(m_Tokens[3], value) || value <= 0.0)
+			return Fail(lineNumber, "bad resistance");
+		element = circuit.AddResistor(value);
+		break;
+
+	case 'c':
+		if (!ParseValue(m_Tokens[3], value) || value <= 0.0)
+			return Fail(lineNumber, "bad capacitance");
+		element = circuit.AddCapacitor(value);
+		break;
+
+	case 'l':
+		if (!ParseValue(m_Tokens[3], value) || value <= 0.0)
+			return Fail(lineNumber, "bad inductance");
+		element = circuit.AddInductor(value);
+		break;
+
+	case 'd':
+	{
+		// D anode cathode <saturation current> [<emission coefficient>]
+		double emission = 1.0;
+		if (!ParseValue(m_Tokens[3], value) || value <= 0.0)
+			return Fail(lineNumber, "bad saturation current");
+		if (m_Tokens.size() > 4 && (!ParseValue(m_Tokens[4], emission) || emission <= 0.0))
+			return Fail(lineNumber, "bad emission coefficient");
+		element = circuit.AddElement<eDiode>(value, emission);
+		break;
+	}
+
+	case 'v':
+	{
+		// V n+ n- [DC] <value> [AC <magnitude>]
+		double acMagnitude = 0.0;
+		size_t i = 3;
+		if (EqualsNoCase(m_Tokens[i], "dc") && ++i >= m_Tokens.size())
+			return Fail(lineNumber, "missing DC value");
+
+		// An AC only source is 0 V in DC
+		if (!EqualsNoCase(m_Tokens[i], "ac") && !ParseValue(m_Tokens[i++], value))
+			return Fail(lineNumber, "bad voltage");
+
+		if (i < m_Tokens.size() && EqualsNoCase(m_Tokens[i], "ac"))
+		{
+			if (i + 1 >= m_Tokens.size() || !ParseValue(m_Tokens[i + 1], acMagnitude))
+				return Fail(lineNumber, "bad AC magnitude");
+		}
+
+		eVoltageSource* source = circuit.AddVoltageSource(value);
+		source->SetACMagnitude(acMagnitude);
+		element = source;
+		break;
+	}
+
+	default:
+		return Fail(lineNumber, "unknown element type");
+	}
+
+	circuit.Connect(element->GetEpin(0), node1);
+	circuit.Connect(element->GetEpin(1), node2);
+	m_ElementNames.emplace_back(card);
+	return true;
+}
+
+
+bool NetlistReader::Parse(std::string_view text, Circuit& circuit)
+{
+	m_NodesByName.clear();
+	m_Nodes.clear();
+	m_Probes.clear();
+	m_ProbeLines.clear();
+	m_ElementNames.clear();
+	m_Title.clear();
+	m_Error.clear();
+	m_Analysis = NetlistAnalysis();
+
+	// Ground first, it becomes the reference node of the matrix
+	GetNode(circuit, "0");
+
+	size_t lineNumber = 0;
+	while (!text.empty())
+	{
+		size_t end = text.find('\n');
+		std::string_view line = text.substr(0, end);
+		text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+		lineNumber++;
+
+		line = Trim(line);
+		if (line.empty() || line[0] == '*')
+			continue;
+
+		if (IsEndLine(line))
+			break;
+
+		if (!ParseLine(circuit, line, lineNumber))
+			return false;
+	}
+
+	// A misspelled probe would be a node of its own, floating
+	for (size_t p = 0; p < m_Probes.size(); p++)
+	{
+		m_Probes[p].second = FindNode(m_Probes[p].first);
+		if (!m_Probes[p].second)
+			return Fail(m_ProbeLines[p], "unknown node " + m_Probes[p].first);
+	}
+
+	if (m_Probes.empty())
+		m_Probes = m_Nodes;
+
+	return true;
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "sim/Scheme.h"
+
+// SPICE style netlist reader
+//
+//	.title divider
+//	* comment
+//	V1 in 0 DC 5 AC 1
+//	R1 in out 1k
+//	C1 out 0 100n
+//	L1 out load 2.2m
+//	D1 load 0 1e-14 1.8
+//	.op | .tran <step> <stop> | .ac dec <points per decade> <fstart> <fstop>
+//	.probe out load
+//	.end
+//
+// Node 0 (or gnd) is the ground. Values take the usual suffixes (f p n u m k meg g t), names and
+// keywords are case insensitive. Without .probe every node is reported, a probe of a node that no
+// element is on fails the netlist.
+
+enum class eAnalysisType : u8
+{
+	Op,
+	Tran,
+	AC,
+};
+
+
+struct NetlistAnalysis
+{
+	eAnalysisType type = eAnalysisType::Op;
+
+	double step = 0.0;				// Tran
+	double stop = 0.0;
+
+	double startHz = 0.0;			// AC, log spaced
+	double stopHz = 0.0;
+	size_t numPoints = 0;
+};
+
+
+// Keeps its tables between netlists, a reader per thread parses job after job without reallocating
+class NetlistReader
+{
+	std::unordered_map<std::string, eNode*> m_NodesByName;
+	std::vector<std::pair<std::string, eNode*>> m_Nodes;	// In order of appearance, ground excluded
+	std::vector<std::pair<std::string, eNode*>> m_Probes;
+	std::vector<size_t> m_ProbeLines;						// Of every probe, nodes are looked up at the end
+	std::vector<std::string> m_ElementNames;				// In circuit order
+	std::vector<std::string_view> m_Tokens;
+	std::string m_Key;
+	std::string m_Title;
+	std::string m_Error;
+	NetlistAnalysis m_Analysis;
+
+	eNode* GetNode(Circuit& circuit, std::string_view name);
+	eNode* FindNode(std::string_view name);
+	bool ParseLine(Circuit& circuit, std::string_view line, size_t lineNumber);
+	bool Fail(size_t lineNumber, std::string_view message);
+
+public:
+
+	// Builds the netlist into the circuit, which should be empty. False on the first error
+	bool Parse(std::string_view text, Circuit& circuit);
+
+	const NetlistAnalysis& GetAnalysis() const { return m_Analysis; }
+	const std::vector<std::pair<std::string, eNode*>>& GetProbes() const { return m_Probes; }
+	const std::string& GetTitle() const { return m_Title; }
+	const std::string& GetError() const { return m_Error; }
+
+	// Names from the netlist, to report the issues of a StructureCheck
+	const std::string& GetElementName(size_t index) const { return m_ElementNames[index]; }
+	std::string_view GetNodeName(const eNode* node) const;
+
+	// "4.7k" -> 4700, false if it isn't a number
+	static bool ParseValue(std::string_view text, double& value);
+
+	// True for the .end line closing a netlist, streams of several netlists are split on it
+	static bool IsEndLine(std::string_view line);
+};
@@ -0,0 +1,314 @@
+#include "Nonlinear.h"
+#include "Checkpoint.h"
+
+#include <cmath>
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Diode
+
+
+
+// Above it the current grows fast enough that the step has to be limited
+static double CriticalVoltage(double saturationCurrent, double nVt)
+{
+	return nVt * std::log(nVt / (std::sqrt(2.0) * saturationCurrent));
+}
+
+
+eDiode::eDiode(double saturationCurrent, double emissionCoefficient)
+	: m_SaturationCurrent(saturationCurrent)
+	, m_EmissionCoefficient(emissionCoefficient)
+{
+	SetNumEpins(2);
+	UpdateCriticalVoltage();
+	SetOperatingPoint(0.0);
+}
+
+
+void eDiode::UpdateCriticalVoltage()
+{
+	m_VCrit = CriticalVoltage(m_SaturationCurrent, m_EmissionCoefficient * ThermalVoltage);
+}
+
+
+void eDiode::Stamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// Companion model of the operating point Vd
+	//
+	// Anode (i)                                   Cathode (j)
+	// *-----+------(G = dI/dV at Vd)------+-----*
+	//       |                             |
+	//       +----(Ieq = G * Vd - I(Vd))---+
+	//
+	//       i   j             RHS
+	// i |   G  -G |         |  Ieq |
+	// j |  -G   G |         | -Ieq |
+
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	s64 i = SystemRow(node1, GndNode);
+	s64 j = SystemRow(node2, GndNode);
+
+	if (i >= 0)
+	{
+		mtx.Add(i, i, m_G);
+		mtx.AddRhs(i, m_Ieq);
+	}
+
+	if (j >= 0)
+	{
+		mtx.Add(j, j, m_G);
+		mtx.AddRhs(j, -m_Ieq);
+	}
+
+	if (i >= 0 && j >= 0)
+	{
+		mtx.Add(i, j, -m_G);
+		mtx.Add(j, i, -m_G);
+	}
+}
+
+
+double eDiode::LimitVoltage(double v, double vOld, double nVt, double vCrit)
+{
+	if (v <= vCrit || std::abs(v - vOld) <= 2.0 * nVt)
+		return v;
+
+	// Forward : the step in current the exp would take becomes a step in log of the current
+	if (vOld > 0.0)
+	{
+		double arg = 1.0 + (v - vOld) / nVt;
+		return arg > 0.0 ? vOld + nVt * std::log(arg) : vCrit;
+	}
+
+	return nVt * std::log(v / nVt);
+}
+
+
+void eDiode::SetOperatingPoint(double v)
+{
+	double nVt = m_EmissionCoefficient * ThermalVoltage;
+	double e = std::exp(std::min(v / nVt, MaxExponent));
+
+	// G * v - I(v), the minimum conductance cancels out
+	m_G = m_SaturationCurrent / nVt * e + MinConductance;
+	m_Ieq = m_SaturationCurrent * (e * (v / nVt - 1.0) + 1.0);
+	m_Vd = v;
+}
+
+
+bool eDiode::Linearize()
+{
+	if (!m_ePins[0].IsConnectedToNode() || !m_ePins[1].IsConnectedToNode())
+		return true;
+
+	double nVt = m_EmissionCoefficient * ThermalVoltage;
+	double v = LimitVoltage(m_ePins[0].GetVoltage() - m_ePins[1].GetVoltage(), m_Vd, nVt, m_VCrit);
+	bool converged = std::abs(v - m_Vd) <= VoltageTolerance + RelativeTolerance * std::max(std::abs(v), std::abs(m_Vd));
+
+	SetOperatingPoint(v);
+	return converged;
+}
+
+
+void eDiode::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	// Small signal conductance of the operating point
+	stamper.AddAdmittance(SystemRow(node1, GndNode), SystemRow(node2, GndNode), m_G);
+}
+
+
+void eDiode::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_Vd);
+	writer.Write(m_G);
+	writer.Write(m_Ieq);
+}
+
+
+bool eDiode::LoadState(CheckpointReader& reader)
+{
+	return reader.Read(m_Vd) && reader.Read(m_G) && reader.Read(m_Ieq);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Diode batch
+
+
+
+void DiodeBatch::Build(const std::vector<eElement*>& elements, eNode* GndNode, size_t numUnknowns)
+{
+	SM_PROFILE_SCOPE("DiodeBatch::Build");
+
+	m_Devices.clear();
+	for (eElement* element : elements)
+	{
+		eDiode* diode = dynamic_cast<eDiode*>(element);
+		if (!diode)
+			continue;
+
+		eNode* node1 = diode->GetEpin(0)->GetConnectedNode();
+		eNode* node2 = diode->GetEpin(1)->GetConnectedNode();
+		if (node1 && node2 && node1 != node2)
+			m_Devices.push_back(diode);
+	}
+
+	Eigen::Index n = Eigen::Index(m_Devices.size());
+	m_GroundRow = int(numUnknowns);
+
+	m_Anode.resize(n);
+	m_Cathode.resize(n);
+	m_Is.resize(n);
+	m_NVt.resize(n);
+	m_InvNVt.resize(n);
+	m_VCrit.resize(n);
+	m_Vd.resize(n);
+	m_G.resize(n);
+	m_Ieq.resize(n);
+	m_NextVd.resize(n);
+	m_NextG.resize(n);
+	m_NextIeq.resize(n);
+
+	auto rowOf = [&](eNode* node)
+	{
+		return node == GndNode ? m_GroundRow : int(SystemRow(node, GndNode));
+	};
+
+	for (Eigen::Index k = 0; k < n; k++)
+	{
+		eDiode* diode = m_Devices[k];
+		m_Anode(k) = rowOf(diode->GetEpin(0)->GetConnectedNode());
+		m_Cathode(k) = rowOf(diode->GetEpin(1)->GetConnectedNode());
+		m_Is(k) = diode->m_SaturationCurrent;
+		m_NVt(k) = diode->m_EmissionCoefficient * eDiode::ThermalVoltage;
+		m_InvNVt(k) = 1.0 / m_NVt(k);
+		m_VCrit(k) = diode->m_VCrit;
+		m_Vd(k) = diode->m_Vd;
+		m_G(k) = diode->m_G;
+		m_Ieq(k) = diode->m_Ieq;
+	}
+}
+
+
+// In blocks that stay in L1 through every pass. Limiting takes one log over the block and only when
+// one of its junctions needs it, which is rare once the iteration settles
+size_t DiodeBatch::Evaluate(const Eigen::VectorXd& solution)
+{
+	SM_PROFILE_SCOPE("DiodeBatch::Evaluate");
+
+	const double* x = solution.data();
+	size_t moving = 0;
+	Eigen::Index size = m_Anode.size();
+
+	for (Eigen::Index start = 0; start < size; start += BlockSize)
+	{
+		Eigen::Index n = std::min<Eigen::Index>(BlockSize, size - start);
+
+		// Gathers in a plain loop, Eigen index views evaluate into temporaries
+		for (Eigen::Index k = start; k < start + n; k++)
+			m_NextVd(k) = x[m_Anode(k)] - x[m_Cathode(k)];
+
+		auto v = m_NextVd.segment(start, n);
+		auto vOld = m_Vd.segment(start, n);
+		auto nVt = m_NVt.segment(start, n);
+		auto invNVt = m_InvNVt.segment(start, n);
+		auto vCrit = m_VCrit.segment(start, n);
+
+		// eDiode::LimitVoltage per lane : both of its logs as one, log(1 + dv / nVt) from a forward
+		// biased point and log(v / nVt) from elsewhere. A log of the lanes not limited may be NaN,
+		// the select drops it
+		auto limited = (v > vCrit) && ((v - vOld).abs() > 2.0 * nVt);
+		if (limited.any())
+		{
+			auto forward = vOld > 0.0;
+			auto arg = forward.select(1.0 + (v - vOld) * invNVt, v * invNVt);
+			v = limited.select((arg > 0.0).select(forward.select(vOld, 0.0) + nVt * arg.log(), vCrit), v);
+		}
+
+		moving += size_t(((v - vOld).abs() > eDiode::VoltageTolerance + eDiode::RelativeTolerance * v.abs().max(vOld.abs())).count());
+
+		// eDiode::SetOperatingPoint, exp(v / nVt) in the conductances first
+		auto G = m_NextG.segment(start, n);
+		auto Is = m_Is.segment(start, n);
+		G = (v * invNVt).min(eDiode::MaxExponent).exp();
+		m_NextIeq.segment(start, n) = Is * (G * (v * invNVt - 1.0) + 1.0);
+		G = Is * invNVt * G + eDiode::MinConductance;
+	}
+
+	return moving;
+}
+
+
+void DiodeBatch::Stamp(CircuitMtx& mtx)
+{
+	SM_PROFILE_SCOPE("DiodeBatch::Stamp");
+
+	Eigen::MatrixXd& A = mtx.GetMatrix();
+	Eigen::VectorXd& b = mtx.GetVector();
+
+	for (Eigen::Index k = 0; k < m_Anode.size(); k++)
+	{
+		double dG = m_NextG(k) - m_G(k);
+		double dIeq = m_NextIeq(k) - m_Ieq(k);
+		int i = m_Anode(k);
+		int j = m_Cathode(k);
+
+		if (i != m_GroundRow)
+		{
+			A(i, i) += dG;
+			b(i) += dIeq;
+		}
+
+		if (j != m_GroundRow)
+		{
+			A(j, j) += dG;
+			b(j) -= dIeq;
+		}
+
+		if (i != m_GroundRow && j != m_GroundRow)
+		{
+			A(i, j) -= dG;
+			A(j, i) -= dG;
+		}
+	}
+
+	m_Vd.swap(m_NextVd);
+	m_G.swap(m_NextG);
+	m_Ieq.swap(m_NextIeq);
+}
+
+
+void DiodeBatch::Scatter()
+{
+	for (size_t k = 0; k < m_Devices.size(); k++)
+	{
+		eDiode* diode = m_Devices[k];
+		diode->m_Vd = m_Vd(Eigen::Index(k));
+		diode->m_G = m_G(Eigen::Index(k));
+		diode->m_Ieq = m_Ieq(Eigen::Index(k));
+	}
+}
+
+
+void DiodeBatch::Gather()
+{
+	for (size_t k = 0; k < m_Devices.size(); k++)
+	{
+		const eDiode* diode = m_Devices[k];
+		m_NextVd(Eigen::Index(k)) = diode->m_Vd;
+		m_NextG(Eigen::Index(k)) = diode->m_G;
+		m_NextIeq(Eigen::Index(k)) = diode->m_Ieq;
+	}
+}
@@ -0,0 +1,140 @@
+#pragma once
+#include <vector>
+
+#include "sim/Scheme.h"
+
+// Nonlinear devices, solved by Newton iteration in Circuit::UpdateSolution
+//
+// A device stamps the companion model of its last operating point : the conductance dI/dV and the
+// current source that makes the line go through I(V). Every iteration takes the voltages of the
+// solve, moves the operating points and solves again until no junction moves by more than the
+// tolerance.
+//
+// The devices of a model type are evaluated as one batch instead of one by one : terminal rows and
+// parameters sit in contiguous arrays, the voltages are gathered in one pass, limiting and exp run
+// over the arrays with Eigen's packet math (AVX2 / AVX-512 with SCHEMESIM_NATIVE_ARCH) and the
+// changes of the companion models go straight into the assembled system through the stored rows.
+// The devices themselves only get the converged operating point.
+
+
+// Junction diode, Shockley model I = Is * (exp(V / (N * Vt)) - 1), anode on pin 0
+class eDiode : public eElement
+{
+	double m_SaturationCurrent;
+	double m_EmissionCoefficient;
+	double m_VCrit = 0.0;
+
+	// Operating point and its companion model, as stamped
+	double m_Vd = 0.0;
+	double m_G = 0.0;
+	double m_Ieq = 0.0;
+
+	friend class DiodeBatch;
+
+	void UpdateCriticalVoltage();
+
+public:
+	static constexpr double ThermalVoltage = 0.025852;	// 300 K
+	static constexpr double MinConductance = 1e-12;		// Across every junction, keeps reverse bias solvable
+	static constexpr double VoltageTolerance = 1e-6;	// Converged below abs + rel * |V|
+	static constexpr double RelativeTolerance = 1e-3;
+	static constexpr double MaxExponent = 80.0;			// V / (N * Vt) past it would overflow the factors
+
+	eDiode(double saturationCurrent = 1e-14, double emissionCoefficient = 1.0);
+	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual eBranchModel GetBranchModel() override { return { m_G, m_Ieq, -1 }; }
+	virtual eCoupling GetCoupling() override { return eCoupling::Conductance; }
+	virtual bool IsNonlinear() override { return true; }
+	virtual bool Linearize() override;
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+	virtual u64 HashValues() override { return HashDouble(HashDouble(0, m_SaturationCurrent), m_EmissionCoefficient); }
+	virtual double GetValue() override { return m_SaturationCurrent; }
+	virtual void SetValue(double value) override { SetSaturationCurrent(value); }
+
+	double GetSaturationCurrent() { return m_SaturationCurrent; }
+	void SetSaturationCurrent(double current)
+	{
+		m_SaturationCurrent = current;
+		UpdateCriticalVoltage();
+		MarkDirty(eDirty::Values);
+	}
+
+	double GetEmissionCoefficient() { return m_EmissionCoefficient; }
+	void SetEmissionCoefficient(double coefficient)
+	{
+		m_EmissionCoefficient = coefficient;
+		UpdateCriticalVoltage();
+		MarkDirty(eDirty::Values);
+	}
+
+	// Through the companion model, from the voltages of the last solve
+	double GetCurrent()
+	{
+		if (!m_ePins[0].IsConnectedToNode() || !m_ePins[1].IsConnectedToNode())
+			return 0.0;
+
+		return m_G * (m_ePins[0].GetVoltage() - m_ePins[1].GetVoltage()) - m_Ieq;
+	}
+
+	double GetOperatingPoint() const { return m_Vd; }
+
+	// Limited step from the operating point to v (SPICE pnjlim), then its companion model. The model
+	// of one device, DiodeBatch computes the same over arrays
+	static double LimitVoltage(double v, double vOld, double nVt, double vCrit);
+	void SetOperatingPoint(double v);
+};
+
+
+// The diodes of a circuit in structure of arrays form
+class DiodeBatch
+{
+	static constexpr Eigen::Index BlockSize = 256;
+
+	std::vector<eDiode*> m_Devices;
+
+	// Rows in the padded solution, its last entry is the ground
+	Eigen::ArrayXi m_Anode;
+	Eigen::ArrayXi m_Cathode;
+	int m_GroundRow = 0;
+
+	Eigen::ArrayXd m_Is;
+	Eigen::ArrayXd m_NVt;
+	Eigen::ArrayXd m_InvNVt;
+	Eigen::ArrayXd m_VCrit;
+
+	// Operating points the system holds
+	Eigen::ArrayXd m_Vd;
+	Eigen::ArrayXd m_G;
+	Eigen::ArrayXd m_Ieq;
+
+	// Next ones, from Evaluate
+	Eigen::ArrayXd m_NextVd;
+	Eigen::ArrayXd m_NextG;
+	Eigen::ArrayXd m_NextIeq;
+
+public:
+
+	// Takes the diodes among the elements, connected ones only, with what they stamped.
+	// numUnknowns is the size of the system
+	void Build(const std::vector<eElement*>& elements, eNode* GndNode, size_t numUnknowns);
+
+	// Next operating points from the padded solution. Returns the junctions that would move by more
+	// than the tolerance, 0 once converged
+	size_t Evaluate(const Eigen::VectorXd& solution);
+
+	// Adds the changes to the next operating points to the system, without going through the devices
+	void Stamp(CircuitMtx& mtx);
+
+	// Operating points the system holds to the devices. Gather takes the ones of the devices as the
+	// next ones, for a Stamp after they were set from elsewhere (a checkpoint)
+	void Scatter();
+	void Gather();
+
+	size_t GetSize() const { return m_Devices.size(); }
+
+	// Next companion models, per device in the order of Build
+	const Eigen::ArrayXd& GetNextConductances() const { return m_NextG; }
+	const Eigen::ArrayXd& GetNextCurrents() const { return m_NextIeq; }
+};
@@ -0,0 +1,457 @@
+#include "Reduction.h"
+#include "Checkpoint.h"
+#include "ACAnalysis.h"
+#include "base/Timer.h"
+
+#include "vendor/Eigen/SparseLU"
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Reduced model
+
+
+
+eReducedModel::eReducedModel(Eigen::MatrixXd G, Eigen::MatrixXd C, size_t numPorts, Eigen::VectorXd states)
+	: m_G(std::move(G))
+	, m_C(std::move(C))
+	, m_NumPorts(numPorts)
+	, m_States(std::move(states))
+{
+	SetNumEpins(int(numPorts) + 1);
+	m_StampedRhs = Eigen::VectorXd::Zero(m_G.rows());
+}
+
+
+// Row of a port node or a state in the system, -1 for the ground or an open port
+s64 eReducedModel::Row(Eigen::Index k, eNode* GndNode)
+{
+	if (size_t(k) < m_NumPorts)
+	{
+		eNode* node = m_ePins[k].GetConnectedNode();
+		return node ? SystemRow(node, GndNode) : -1;
+	}
+
+	return s64(m_FirstBranch + size_t(k) - m_NumPorts);
+}
+
+
+// C / h times the port voltages (against the reference) and states of the last solve
+void eReducedModel::ComputeHistory(Eigen::VectorXd& rhs)
+{
+	Eigen::Index n = m_G.rows();
+	rhs = Eigen::VectorXd::Zero(n);
+	if (m_step <= 0.0)
+		return;
+
+	Eigen::VectorXd previous(n);
+	double reference = m_ePins[m_NumPorts].GetVoltage();
+	for (size_t k = 0; k < m_NumPorts; k++)
+		previous(Eigen::Index(k)) = m_ePins[k].GetVoltage() - reference;
+	previous.tail(m_States.size()) = m_States;
+
+	rhs.noalias() = m_C * previous / m_step;
+}
+
+
+void eReducedModel::Stamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// (G + C / h) x = C / h * x(previous step) over the ports and states, G alone for DC
+	//
+	//            ports       states
+	// ports  | G_pp + C_pp / h   ... |
+	// states |       ...    G_ss + C_ss / h |
+
+	Eigen::Index n = m_G.rows();
+	double scale = m_step > 0.0 ? 1.0 / m_step : 0.0;
+
+	for (Eigen::Index a = 0; a < n; a++)
+	{
+		s64 row = Row(a, GndNode);
+		if (row < 0)
+			continue;
+
+		for (Eigen::Index b = 0; b < n; b++)
+		{
+			s64 col = Row(b, GndNode);
+			double value = m_G(a, b) + m_C(a, b) * scale;
+			if (col >= 0 && value != 0.0)
+				mtx.Add(u64(row), u64(col), value);
+		}
+	}
+
+	ComputeHistory(m_StampedRhs);
+	for (Eigen::Index a = 0; a < n; a++)
+	{
+		s64 row = Row(a, GndNode);
+		if (row >= 0 && m_StampedRhs(a) != 0.0)
+			mtx.AddRhs(u64(row), m_StampedRhs(a));
+	}
+
+	m_StampedStep = m_step;
+}
+
+
+// A new step changes the matrix, only the history moves in place
+bool eReducedModel::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	if (m_step != m_StampedStep)
+		return false;
+
+	Eigen::VectorXd rhs;
+	ComputeHistory(rhs);
+
+	Eigen::VectorXd& b = mtx.GetVector();
+	for (Eigen::Index a = 0; a < rhs.size(); a++)
+	{
+		s64 row = Row(a, GndNode);
+		if (row >= 0)
+			b(row) += rhs(a) - m_StampedRhs(a);
+	}
+
+	m_StampedRhs = std::move(rhs);
+	return true;
+}
+
+
+void eReducedModel::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	for (Eigen::Index a = 0; a < m_G.rows(); a++)
+	{
+		for (Eigen::Index b = 0; b < m_G.cols(); b++)
+		{
+			if (m_G(a, b) != 0.0 || m_C(a, b) != 0.0)
+				stamper.Add(Row(a, GndNode), Row(b, GndNode), m_G(a, b), m_C(a, b));
+		}
+	}
+}
+
+
+void eReducedModel::ReadbackBranches(const Eigen::VectorXd& solution)
+{
+	m_States = solution.segment(Eigen::Index(m_FirstBranch), m_States.size());
+}
+
+
+// Port voltages against the reference and the states of the last solve
+void eReducedModel::GatherUnknowns()
+{
+	m_Unknowns.resize(m_G.rows());
+	double reference = m_ePins[m_NumPorts].GetVoltage();
+	for (size_t k = 0; k < m_NumPorts; k++)
+		m_Unknowns(Eigen::Index(k)) = m_ePins[k].GetVoltage() - reference;
+	m_Unknowns.tail(m_States.size()) = m_States;
+}
+
+
+double eReducedModel::GetPortCurrent(size_t port)
+{
+	if (!m_ePins[port].IsConnectedToNode())
+		return 0.0;
+
+	GatherUnknowns();
+
+	double scale = m_StampedStep > 0.0 ? 1.0 / m_StampedStep : 0.0;
+	Eigen::Index k = Eigen::Index(port);
+	return m_G.row(k).dot(m_Unknowns) + scale * m_C.row(k).dot(m_Unknowns) - m_StampedRhs(k);
+}
+
+
+// The ports as GetPortCurrent, what flows in through them leaves through the reference pin
+void eReducedModel::GetPinCurrents(double* currents)
+{
+	GatherUnknowns();
+
+	double scale = m_StampedStep > 0.0 ? 1.0 / m_StampedStep : 0.0;
+	double total = 0.0;
+	for (size_t port = 0; port < m_NumPorts; port++)
+	{
+		Eigen::Index k = Eigen::Index(port);
+		double current = m_ePins[port].IsConnectedToNode() ?
+			m_G.row(k).dot(m_Unknowns) + scale * m_C.row(k).dot(m_Unknowns) - m_StampedRhs(k) : 0.0;
+
+		currents[port] = current;
+		total += current;
+	}
+
+	currents[m_NumPorts] = -total;
+}
+
+
+void eReducedModel::SaveState(CheckpointWriter& writer)
+{
+	writer.WriteArray(m_States.data(), size_t(m_States.size()));
+	writer.WriteArray(m_StampedRhs.data(), size_t(m_StampedRhs.size()));
+	writer.Write(m_StampedStep);
+}
+
+
+bool eReducedModel::LoadState(CheckpointReader& reader)
+{
+	return reader.ReadArray(m_States.data(), size_t(m_States.size())) &&
+		reader.ReadArray(m_StampedRhs.data(), size_t(m_StampedRhs.size())) &&
+		reader.Read(m_StampedStep);
+}
+
+
+u64 eReducedModel::HashValues()
+{
+	u64 hash = HashCombine(0, m_NumPorts);
+	for (Eigen::Index k = 0; k < m_G.size(); k++)
+		hash = HashDouble(HashDouble(hash, m_G.data()[k]), m_C.data()[k]);
+
+	return hash;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Reduction
+
+
+
+using SparseMatrix = Eigen::SparseMatrix<double, Eigen::ColMajor, int>;
+
+
+// Orthonormalizes the columns of block against the basis and themselves, twice over (modified
+// Gram-Schmidt loses orthogonality on its own). Columns left with less than tolerance of their norm
+// are dropped. Returns how many were added to the basis
+static Eigen::Index AddToBasis(Eigen::MatrixXd& basis, Eigen::Index& size, const Eigen::MatrixXd& block, double tolerance)
+{
+	Eigen::Index added = 0;
+	for (Eigen::Index c = 0; c < block.cols() && size < basis.cols(); c++)
+	{
+		Eigen::VectorXd w = block.col(c);
+		double norm = w.norm();
+		if (norm == 0.0)
+			continue;
+
+		for (int pass = 0; pass < 2; pass++)
+		{
+			for (Eigen::Index k = 0; k < size; k++)
+				w -= basis.col(k).dot(w) * basis.col(k);
+		}
+
+		double left = w.norm();
+		if (left <= tolerance * norm)
+			continue;
+
+		basis.col(size++) = w / left;
+		added++;
+	}
+
+	return added;
+}
+
+
+eReducedModel* ReduceSubnetwork(Circuit& circuit, const std::vector<eElement*>& elements, const std::vector<eNode*>& ports,
+	const ReductionOptions& options, ReductionStats* stats)
+{
+	SM_PROFILE_SCOPE("ReduceSubnetwork");
+	Timer timer = Timer::StartNew();
+
+	eNode* ground = circuit.GetGroundNode();
+	if (!ground)
+		return nullptr;
+
+	// Local numbering : ports, internal nodes, inductor currents. -1 not in the mesh, -2 the ground
+	std::vector<int> local(circuit.GetNumNodes(), -1);
+	std::vector<u32> pinsInside(circuit.GetNumNodes(), 0);
+	std::vector<eNode*> nodes;
+	size_t numInductors = 0;
+
+	for (eElement* element : elements)
+	{
+		if (!dynamic_cast<eResistor*>(element) && !dynamic_cast<eCapacitor*>(element) && !dynamic_cast<eInductor*>(element))
+			return nullptr;
+
+		eNode* node0 = element->GetEpin(0)->GetConnectedNode();
+		eNode* node1 = element->GetEpin(1)->GetConnectedNode();
+		if (!node0 || !node1)
+			continue;
+
+		numInductors += dynamic_cast<eInductor*>(element) ? 1 : 0;
+		for (eNode* node : { node0, node1 })
+		{
+			pinsInside[node->GetIndex()]++;
+			if (local[node->GetIndex()] == -1)
+			{
+				local[node->GetIndex()] = 0;
+				nodes.push_back(node);
+			}
+		}
+	}
+
+	std::vector<eNode*> portNodes;
+	for (eNode* node : ports)
+	{
+		if (node != ground && local[node->GetIndex()] == 0)
+		{
+			local[node->GetIndex()] = int(portNodes.size()) + 1;
+			portNodes.push_back(node);
+		}
+	}
+
+	for (eNode* node : nodes)
+	{
+		if (node != ground && local[node->GetIndex()] == 0 && node->GetNumPins() > pinsInside[node->GetIndex()])
+		{
+			local[node->GetIndex()] = int(portNodes.size()) + 1;
+			portNodes.push_back(node);
+		}
+	}
+
+	Eigen::Index numPorts = Eigen::Index(portNodes.size());
+	Eigen::Index numInternal = 0;
+	std::vector<eNode*> internalNodes;
+	for (eNode* node : nodes)
+	{
+		int& index = local[node->GetIndex()];
+		if (node == ground)
+			index = -2;
+		else if (index == 0)
+		{
+			index = int(numPorts + numInternal++);
+			internalNodes.push_back(node);
+		}
+		else
+			index -= 1;
+	}
+
+	Eigen::Index numNodeUnknowns = numPorts + numInternal;
+	Eigen::Index n = numNodeUnknowns + Eigen::Index(numInductors);
+	numInternal = n - numPorts;
+
+	// The mesh on its own, MNA with the inductor currents as unknowns :
+	// G = [ Gn  A ; -A^T  0 ], C = diag(Cn, L), G + G^T and C positive semidefinite
+	std::vector<Eigen::Triplet<double, int>> gEntries;
+	std::vector<Eigen::Triplet<double, int>> cEntries;
+	Eigen::VectorXd initial = Eigen::VectorXd::Zero(n);
+	Eigen::Index inductor = numNodeUnknowns;
+
+	auto stamp = [](std::vector<Eigen::Triplet<double, int>>& entries, int i, int j, double value)
+	{
+		if (i >= 0) entries.emplace_back(i, i, value);
+		if (j >= 0) entries.emplace_back(j, j, value);
+		if (i >= 0 && j >= 0)
+		{
+			entries.emplace_back(i, j, -value);
+			entries.emplace_back(j, i, -value);
+		}
+	};
+
+	for (eElement* element : elements)
+	{
+		eNode* node0 = element->GetEpin(0)->GetConnectedNode();
+		eNode* node1 = element->GetEpin(1)->GetConnectedNode();
+		if (!node0 || !node1)
+			continue;
+
+		int i = local[node0->GetIndex()];
+		int j = local[node1->GetIndex()];
+		i = i < 0 ? -1 : i;
+		j = j < 0 ? -1 : j;
+
+		if (auto* resistor = dynamic_cast<eResistor*>(element))
+		{
+			stamp(gEntries, i, j, 1.0 / resistor->GetResistance());
+		}
+		else if (auto* capacitor = dynamic_cast<eCapacitor*>(element))
+		{
+			stamp(cEntries, i, j, capacitor->GetCapacitance());
+		}
+		else if (auto* coil = dynamic_cast<eInductor*>(element))
+		{
+			int k = int(inductor++);
+			if (i >= 0) { gEntries.emplace_back(i, k, 1.0); gEntries.emplace_back(k, i, -1.0); }
+			if (j >= 0) { gEntries.emplace_back(j, k, -1.0); gEntries.emplace_back(k, j, 1.0); }
+			cEntries.emplace_back(k, k, coil->GetInductance());
+			initial(k) = coil->GetCurrent();
+		}
+	}
+
+	double groundVoltage = ground->GetVoltage();
+	for (Eigen::Index k = 0; k < numInternal - Eigen::Index(numInductors); k++)
+		initial(numPorts + k) = internalNodes[k]->GetVoltage() - groundVoltage;
+
+	SparseMatrix G(n, n);
+	SparseMatrix C(n, n);
+	G.setFromTriplets(gEntries.begin(), gEntries.end());
+	C.setFromTriplets(cEntries.begin(), cEntries.end());
+
+	SparseMatrix Gii = G.bottomRightCorner(numInternal, numInternal);
+	SparseMatrix Cii = C.bottomRightCorner(numInternal, numInternal);
+	SparseMatrix Gip = G.bottomLeftCorner(numInternal, numPorts);
+	SparseMatrix Cip = C.bottomLeftCorner(numInternal, numPorts);
+
+	// Block Arnoldi on (G_ii + s0 C_ii)^-1 C_ii from the internal response to the port voltages,
+	// both the part through G + s0 C and the one through C
+	Eigen::Index maxOrder = std::min<Eigen::Index>(Eigen::Index(options.maxOrder), numInternal);
+	Eigen::MatrixXd basis(numInternal, maxOrder);
+	Eigen::Index order = 0;
+
+	if (numInternal > 0 && maxOrder > 0)
+	{
+		Eigen::SparseLU<SparseMatrix, Eigen::COLAMDOrdering<int>> lu;
+		SparseMatrix expansion = Gii + options.expansionPoint * Cii;
+		lu.compute(expansion);
+		if (lu.info() != Eigen::Success)
+			return nullptr;
+
+		Eigen::MatrixXd start(numInternal, 2 * numPorts);
+		start.leftCols(numPorts) = Eigen::MatrixXd(Gip + options.expansionPoint * Cip);
+		start.rightCols(numPorts) = Eigen::MatrixXd(Cip);
+
+		Eigen::MatrixXd block = lu.solve(start);
+		if (!block.allFinite())
+			return nullptr;
+
+		while (order < maxOrder)
+		{
+			Eigen::Index first = order;
+			if (AddToBasis(basis, order, block, options.deflationTolerance) == 0)
+				break;
+
+			block = lu.solve(Eigen::MatrixXd(Cii * basis.middleCols(first, order - first)));
+		}
+	}
+
+	Eigen::MatrixXd V = basis.leftCols(order);
+
+	// T^T G T and T^T C T with T = diag(I, V)
+	auto project = [&](const SparseMatrix& M)
+	{
+		Eigen::MatrixXd reduced(numPorts + order, numPorts + order);
+		reduced.topLeftCorner(numPorts, numPorts) = Eigen::MatrixXd(M.topLeftCorner(numPorts, numPorts));
+		reduced.topRightCorner(numPorts, order) = SparseMatrix(M.topRightCorner(numPorts, numInternal)) * V;
+		reduced.bottomLeftCorner(order, numPorts) = V.transpose() * SparseMatrix(M.bottomLeftCorner(numInternal, numPorts));
+		reduced.bottomRightCorner(order, order) = V.transpose() * (SparseMatrix(M.bottomRightCorner(numInternal, numInternal)) * V);
+		return reduced;
+	};
+
+	Eigen::MatrixXd reducedG = project(G);
+	Eigen::MatrixXd reducedC = project(C);
+	Eigen::VectorXd states = V.transpose() * initial.tail(numInternal);
+
+	double step = elements.empty() ? 0.0 : elements.front()->GetStep();
+
+	circuit.RemoveElements(elements);
+
+	eReducedModel* model = circuit.AddElement<eReducedModel>(std::move(reducedG), std::move(reducedC), size_t(numPorts), std::move(states));
+	for (Eigen::Index k = 0; k < numPorts; k++)
+		circuit.Connect(model->GetEpin(int(k)), portNodes[k]);
+	circuit.Connect(model->GetEpin(int(numPorts)), ground);
+	model->SetStep(step);
+
+	circuit.RemoveUnusedNodes();
+
+	timer.Stop();
+	if (stats)
+	{
+		stats->numElements = elements.size();
+		stats->numPorts = size_t(numPorts);
+		stats->numInternal = size_t(numInternal);
+		stats->order = size_t(order);
+		stats->seconds = timer.GetElapsedSeconds();
+	}
+
+	return model;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+
+#include "vendor/Eigen/Sparse"
+#include "sim/Scheme.h"
+
+// Model order reduction of linear subnetworks
+//
+// A mesh of resistors, capacitors and inductors that the rest of the circuit only sees through a few
+// port nodes is replaced by a model of a few dozen states, PRIMA style. With the unknowns of the mesh
+// split into ports p and internal ones i (node voltages and inductor currents), the internal ones are
+// projected on an orthonormal basis V of the block Krylov space of (G_ii + s0 C_ii)^-1 C_ii, started
+// from how the ports drive them. That matches the first moments of the admittance seen at the ports
+// around s0. The ports are kept as they are : with T = diag(I, V) the model is T^T G T and T^T C T,
+// a congruence, so a passive mesh gives a passive model whatever the order.
+//
+// The model stamps like the elements it replaces, backward Euler on C with the states as branch rows
+// of their own, and takes part in DC, transient steps and AC sweeps like any other element.
+
+
+// Pins are the ports, then the reference (the ground node). Matrices have the ports first, then the
+// states
+class eReducedModel : public eElement
+{
+	Eigen::MatrixXd m_G;
+	Eigen::MatrixXd m_C;
+	size_t m_NumPorts;
+	size_t m_FirstBranch = 0;
+
+	Eigen::VectorXd m_States;		// Of the last solve
+	Eigen::VectorXd m_StampedRhs;	// C / h times the unknowns of the step before, as stamped
+	double m_StampedStep = 0.0;
+	Eigen::VectorXd m_Unknowns;		// Scratch of GetPinCurrents
+
+	s64 Row(Eigen::Index k, eNode* GndNode);
+	void ComputeHistory(Eigen::VectorXd& rhs);
+	void GatherUnknowns();
+
+public:
+
+	eReducedModel(Eigen::MatrixXd G, Eigen::MatrixXd C, size_t numPorts, Eigen::VectorXd states);
+	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool HasHistory() override { return true; }
+	virtual eCoupling GetCoupling() override { return eCoupling::Conductance; }
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+	virtual void ReadbackBranches(const Eigen::VectorXd& solution) override;
+	virtual void GetPinCurrents(double* currents) override;
+	virtual size_t GetNumBranches() override { return size_t(m_States.size()); }
+	virtual void SetFirstBranch(size_t index) override { m_FirstBranch = index; }
+	virtual u64 HashValues() override;
+
+	size_t GetNumPorts() const { return m_NumPorts; }
+	size_t GetOrder() const { return size_t(m_States.size()); }
+	const Eigen::MatrixXd& GetConductances() const { return m_G; }
+	const Eigen::MatrixXd& GetCapacitances() const { return m_C; }
+
+	// Into the model through the port, from the last solve
+	double GetPortCurrent(size_t port);
+};
+
+
+struct ReductionOptions
+{
+	size_t maxOrder = 24;				// States of the model at the most
+	double expansionPoint = 0.0;		// s0 in 1/s, 0 matches around DC
+	double deflationTolerance = 1e-8;	// Krylov vectors left with less of their norm are dropped
+};
+
+
+struct ReductionStats
+{
+	size_t numElements = 0;
+	size_t numPorts = 0;
+	size_t numInternal = 0;		// Unknowns projected, internal nodes and inductor currents
+	size_t order = 0;
+	double seconds = 0.0;
+};
+
+
+// Replaces the elements, resistors, capacitors and inductors, by a reduced model. Nodes the rest of
+// the circuit connects to are ports on top of the ones given (ports are never the ground). The
+// elements are destroyed and the internal nodes removed, which numbers the nodes again. The states
+// start from the projection of the present internal voltages and currents.
+// nullptr if an element isn't one of those or the mesh is singular at the expansion point (a node
+// with no DC path to a port or the ground at s0 = 0), the circuit is left as it was then
+eReducedModel* ReduceSubnetwork(Circuit& circuit, const std::vector<eElement*>& elements, const std::vector<eNode*>& ports,
+	const ReductionOptions& options = {}, ReductionStats* stats = nullptr);
@@ -0,0 +1,574 @@
+#include "Relaxation.h"
+#include "Checkpoint.h"
+#include "base/ThreadPool.h"
+#include "base/Timer.h"
+
+#include <numeric>
+#include <unordered_map>
+
+
+// Shared elements : a resistor or capacitor, whatever their partitions
+static bool IsShareable(eElement* element)
+{
+	return dynamic_cast<eResistor*>(element) || dynamic_cast<eCapacitor*>(element);
+}
+
+
+WaveformRelaxation::WaveformRelaxation(Circuit& circuit)
+	: m_Circuit(circuit)
+{ }
+
+
+WaveformRelaxation::~WaveformRelaxation()
+{
+	Join();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Partitions
+
+
+
+std::vector<u32> WaveformRelaxation::PartitionNodes(Circuit& circuit, size_t numPartitions)
+{
+	size_t numNodes = circuit.GetNumNodes();
+	eNode* ground = circuit.GetGroundNode();
+	std::vector<u32> partition(numNodes, 0);
+	if (!ground || numPartitions <= 1 || numNodes <= 2)
+		return partition;
+
+	size_t groundIndex = ground->GetIndex();
+
+	// Nodes joined by anything but a resistor or capacitor, union find
+	std::vector<u32> parent(numNodes);
+	std::iota(parent.begin(), parent.end(), 0u);
+	auto find = [&parent](u32 node)
+	{
+		while (parent[node] != node)
+		{
+			parent[node] = parent[parent[node]];
+			node = parent[node];
+		}
+		return node;
+	};
+
+	// Adjacency as a star from the first pin of every element, compressed rows
+	std::vector<std::pair<u32, u32>> edges;
+	std::vector<u32> pins;
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+	{
+		eElement* element = circuit.GetElement(k);
+		pins.clear();
+		for (int pin = 0; ePin* epin = element->GetEpin(pin); pin++)
+		{
+			eNode* node = epin->GetConnectedNode();
+			if (node && node != ground)
+				pins.push_back(u32(node->GetIndex()));
+		}
+
+		for (size_t p = 1; p < pins.size(); p++)
+		{
+			edges.emplace_back(pins[0], pins[p]);
+			if (!IsShareable(element))
+				parent[find(pins[p])] = find(pins[0]);
+		}
+	}
+
+	std::vector<u32> start(numNodes + 1, 0);
+	for (auto [a, b] : edges)
+	{
+		start[a + 1]++;
+		start[b + 1]++;
+	}
+	std::partial_sum(start.begin(), start.end(), start.begin());
+
+	std::vector<u32> adjacent(start.back());
+	std::vector<u32> fill(start.begin(), start.end() - 1);
+	for (auto [a, b] : edges)
+	{
+		adjacent[fill[a]++] = b;
+		adjacent[fill[b]++] = a;
+	}
+
+	// Breadth first from a node far from the first one, so the order runs along the circuit
+	std::vector<u32> order;
+	std::vector<u8> visited(numNodes, 0);
+	auto walk = [&](u32 first)
+	{
+		size_t head = order.size();
+		order.push_back(first);
+		visited[first] = 1;
+		while (head < order.size())
+		{
+			u32 node = order[head++];
+			for (u32 k = start[node]; k < start[node + 1]; k++)
+			{
+				if (!visited[adjacent[k]])
+				{
+					visited[adjacent[k]] = 1;
+					order.push_back(adjacent[k]);
+				}
+			}
+		}
+	};
+
+	walk(groundIndex == 0 ? 1u : 0u);
+	u32 far = order.back();
+	order.clear();
+	std::fill(visited.begin(), visited.end(), 0);
+	visited[groundIndex] = 1;
+
+	walk(far);
+	for (u32 node = 0; node < numNodes; node++)
+	{
+		if (!visited[node])
+			walk(node);
+	}
+
+	// Groups in the order of their first node, cut into partitions of about the same number of nodes
+	std::vector<u32> groupSize(numNodes, 0);
+	for (u32 node : order)
+		groupSize[find(node)]++;
+
+	constexpr u32 Unassigned = ~0u;
+	std::vector<u32> assigned(numNodes, Unassigned);
+	size_t numAssigned = 0;
+	for (u32 node : order)
+	{
+		u32 group = find(node);
+		if (assigned[group] == Unassigned)
+		{
+			assigned[group] = u32(std::min(numPartitions - 1, numAssigned * numPartitions / order.size()));
+			numAssigned += groupSize[group];
+		}
+		partition[node] = assigned[group];
+	}
+
+	return partition;
+}
+
+
+bool WaveformRelaxation::Split(const std::vector<u32>& nodePartition)
+{
+	SM_PROFILE_SCOPE("WR::Split");
+
+	Join();
+
+	eNode* ground = m_Circuit.GetGroundNode();
+	size_t numNodes = m_Circuit.GetNumNodes();
+	if (!ground || nodePartition.size() != numNodes)
+		return false;
+
+	u32 numPartitions = 0;
+	for (size_t k = 0; k < numNodes; k++)
+	{
+		if (m_Circuit.GetNode(k) != ground)
+			numPartitions = std::max(numPartitions, nodePartition[k] + 1);
+	}
+
+	if (numPartitions == 0)
+		return false;
+
+	// Partitions of the pins of every element, checked before anything moves. Owner is the one of
+	// the first pin off the ground, shared elements have a second one
+	size_t numElements = m_Circuit.GetNumElements();
+	std::vector<u32> owner(numElements, 0);
+	std::vector<u8> shared(numElements, 0);
+	m_Order.resize(numElements);
+	m_PinNodes.resize(numElements);
+
+	for (size_t k = 0; k < numElements; k++)
+	{
+		eElement* element = m_Circuit.GetElement(k);
+		m_Order[k] = element;
+		m_PinNodes[k].clear();
+
+		bool first = true;
+		for (int pin = 0; ePin* epin = element->GetEpin(pin); pin++)
+		{
+			eNode* node = epin->GetConnectedNode();
+			m_PinNodes[k].push_back(node);
+			if (!node || node == ground)
+				continue;
+
+			u32 partition = nodePartition[node->GetIndex()];
+			if (first)
+				owner[k] = partition;
+			else if (partition != owner[k])
+				shared[k] = 1;
+			first = false;
+		}
+
+		if (shared[k] && !IsShareable(element))
+		{
+			m_Order.clear();
+			m_PinNodes.clear();
+			return false;
+		}
+	}
+
+	m_Partitions.resize(numPartitions);
+	for (Partition& partition : m_Partitions)
+	{
+		partition.circuit = std::make_unique<Circuit>();
+		partition.circuit->CreateNode();	// The ground
+	}
+
+	double groundVoltage = ground->GetVoltage();
+	m_LocalNodes.assign(numNodes, nullptr);
+	for (size_t k = 0; k < numNodes; k++)
+	{
+		eNode* node = m_Circuit.GetNode(k);
+		if (node == ground)
+			continue;
+
+		m_LocalNodes[k] = m_Partitions[nodePartition[k]].circuit->CreateNode();
+		m_LocalNodes[k]->SetVoltage(node->GetVoltage() - groundVoltage);
+	}
+
+	auto localNode = [&](u32 partition, eNode* node)
+	{
+		return node == ground ? m_Partitions[partition].circuit->GetGroundNode() : m_LocalNodes[node->GetIndex()];
+	};
+
+	// Boundary nodes of every partition and exports of every node, by node index
+	std::vector<std::unordered_map<size_t, eNode*>> boundaryNodes(numPartitions);
+	std::vector<std::unordered_map<size_t, u32>> exportIndex(numPartitions);
+
+	auto boundaryNode = [&](u32 partition, eNode* node)
+	{
+		auto [it, added] = boundaryNodes[partition].try_emplace(node->GetIndex(), nullptr);
+		if (!added)
+			return it->second;
+
+		u32 farPartition = nodePartition[node->GetIndex()];
+		Partition& far = m_Partitions[farPartition];
+		auto [exported, exportAdded] = exportIndex[farPartition].try_emplace(node->GetIndex(), u32(far.exports.size()));
+		if (exportAdded)
+			far.exports.push_back(m_LocalNodes[node->GetIndex()]);
+
+		Circuit& circuit = *m_Partitions[partition].circuit;
+		double voltage = node->GetVoltage() - groundVoltage;
+		eNode* local = circuit.CreateNode();
+		local->SetVoltage(voltage);
+
+		eVoltageSource* source = circuit.AddVoltageSource(voltage);
+		circuit.Connect(source->GetPositivePin(), local);
+		circuit.Connect(source->GetNegativePin(), circuit.GetGroundNode());
+
+		m_Partitions[partition].boundaries.push_back({ source, farPartition, exported->second });
+		it->second = local;
+		return local;
+	};
+
+	std::vector<std::unique_ptr<eElement>> elements = m_Circuit.DetachElements();
+	m_NumShared = 0;
+
+	for (size_t k = 0; k < numElements; k++)
+	{
+		std::vector<eNode*>& pinNodes = m_PinNodes[k];
+		if (!shared[k])
+		{
+			Circuit& circuit = *m_Partitions[owner[k]].circuit;
+			eElement* element = circuit.InsertElement(std::move(elements[k]), numElements);
+			for (size_t pin = 0; pin < pinNodes.size(); pin++)
+			{
+				if (pinNodes[pin])
+					circuit.Connect(element->GetEpin(int(pin)), localNode(owner[k], pinNodes[pin]));
+			}
+			continue;
+		}
+
+		// A copy on both sides, from its own node to the boundary node of the other one
+		eElement* original = elements[k].get();
+		for (size_t side = 0; side < 2; side++)
+		{
+			u32 partition = nodePartition[pinNodes[side]->GetIndex()];
+			Circuit& circuit = *m_Partitions[partition].circuit;
+
+			eElement* copy = nullptr;
+			if (auto* resistor = dynamic_cast<eResistor*>(original))
+				copy = circuit.AddResistor(resistor->GetResistance());
+			else
+				copy = circuit.AddCapacitor(static_cast<eCapacitor*>(original)->GetCapacitance());
+
+			copy->SetStep(original->GetStep());
+			circuit.Connect(copy->GetEpin(int(side)), localNode(partition, pinNodes[side]));
+			circuit.Connect(copy->GetEpin(int(1 - side)), boundaryNode(partition, pinNodes[1 - side]));
+		}
+
+		m_Shared.push_back(std::move(elements[k]));
+		m_NumShared++;
+	}
+
+	// Where the first window starts over from
+	for (Partition& partition : m_Partitions)
+	{
+		Circuit& circuit = *partition.circuit;
+		partition.startVoltages.resize(circuit.GetNumNodes());
+		for (size_t k = 0; k < circuit.GetNumNodes(); k++)
+			partition.startVoltages[k] = circuit.GetNode(k)->GetVoltage();
+
+		CheckpointWriter writer(partition.startStates);
+		for (size_t k = 0; k < circuit.GetNumElements(); k++)
+			circuit.GetElement(k)->SaveState(writer);
+	}
+
+	BuildStages();
+	m_Stats = {};
+	return true;
+}
+
+
+void WaveformRelaxation::Join()
+{
+	if (!IsSplit())
+		return;
+
+	SM_PROFILE_SCOPE("WR::Join");
+
+	for (size_t k = 0; k < m_LocalNodes.size(); k++)
+		m_Circuit.GetNode(k)->SetVoltage(m_LocalNodes[k] ? m_LocalNodes[k]->GetVoltage() : 0.0);
+
+	// Copies of the shared elements and the boundary sources go with the partitions
+	std::unordered_map<eElement*, std::unique_ptr<eElement>> detached;
+	for (Partition& partition : m_Partitions)
+	{
+		for (std::unique_ptr<eElement>& element : partition.circuit->DetachElements())
+		{
+			eElement* key = element.get();
+			detached.emplace(key, std::move(element));
+		}
+	}
+
+	for (std::unique_ptr<eElement>& element : m_Shared)
+	{
+		eElement* key = element.get();
+		detached.emplace(key, std::move(element));
+	}
+
+	for (size_t k = 0; k < m_Order.size(); k++)
+	{
+		eElement* element = m_Circuit.InsertElement(std::move(detached[m_Order[k]]), k);
+		for (size_t pin = 0; pin < m_PinNodes[k].size(); pin++)
+		{
+			if (m_PinNodes[k][pin])
+				m_Circuit.Connect(element->GetEpin(int(pin)), m_PinNodes[k][pin]);
+		}
+	}
+
+	m_Partitions.clear();
+	m_Stages.clear();
+	m_Order.clear();
+	m_PinNodes.clear();
+	m_Shared.clear();
+	m_LocalNodes.clear();
+	m_NumShared = 0;
+}
+
+
+// Jacobi : everything at once. Seidel : greedy colouring of the partitions sharing elements
+void WaveformRelaxation::BuildStages()
+{
+	m_Stages.clear();
+	size_t numPartitions = m_Partitions.size();
+	if (numPartitions == 0)
+		return;
+
+	if (m_Options.scheme == eScheme::Jacobi)
+	{
+		m_Stages.emplace_back(numPartitions);
+		std::iota(m_Stages[0].begin(), m_Stages[0].end(), 0u);
+		return;
+	}
+
+	std::vector<std::vector<u32>> neighbours(numPartitions);
+	for (u32 p = 0; p < numPartitions; p++)
+	{
+		for (const Boundary& boundary : m_Partitions[p].boundaries)
+		{
+			neighbours[p].push_back(boundary.partition);
+			neighbours[boundary.partition].push_back(p);
+		}
+	}
+
+	constexpr u32 Uncoloured = ~0u;
+	std::vector<u32> colour(numPartitions, Uncoloured);
+	std::vector<u8> taken;
+	for (u32 p = 0; p < numPartitions; p++)
+	{
+		taken.assign(numPartitions, 0);
+		for (u32 neighbour : neighbours[p])
+		{
+			if (colour[neighbour] != Uncoloured)
+				taken[colour[neighbour]] = 1;
+		}
+
+		u32 c = 0;
+		while (taken[c])
+			c++;
+
+		colour[p] = c;
+		if (c >= m_Stages.size())
+			m_Stages.resize(c + 1);
+		m_Stages[c].push_back(p);
+	}
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Windows
+
+
+
+void WaveformRelaxation::RestartWindow(Partition& partition, bool firstWindow)
+{
+	Circuit& circuit = *partition.circuit;
+	if (!firstWindow)
+	{
+		CheckpointReader reader(partition.checkpoint.data(), partition.checkpoint.size());
+		circuit.LoadState(reader);
+		return;
+	}
+
+	// Nothing was factored before the first window, it is assembled again from where it started
+	for (size_t k = 0; k < circuit.GetNumNodes(); k++)
+		circuit.GetNode(k)->SetVoltage(partition.startVoltages[k]);
+
+	CheckpointReader reader(partition.startStates.data(), partition.startStates.size());
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+		circuit.GetElement(k)->LoadState(reader);
+
+	circuit.MarkDirty(nullptr, eDirty::Topology);
+}
+
+
+void WaveformRelaxation::RunPartition(Partition& partition, size_t numSteps)
+{
+	SM_PROFILE_SCOPE("WR::Partition");
+
+	size_t numExports = partition.exports.size();
+	double change = 0.0;
+
+	for (size_t step = 0; step < numSteps; step++)
+	{
+		for (const Boundary& boundary : partition.boundaries)
+		{
+			const Partition& far = m_Partitions[boundary.partition];
+			boundary.source->SetVoltage(far.waveform[step * far.exports.size() + boundary.exported]);
+		}
+
+		partition.circuit->Step();
+
+		double* next = partition.next.data() + step * numExports;
+		const double* last = partition.waveform.data() + step * numExports;
+		for (size_t k = 0; k < numExports; k++)
+		{
+			next[k] = partition.exports[k]->GetVoltage();
+			change = std::max(change, std::abs(next[k] - last[k]));
+		}
+	}
+
+	partition.change = change;
+}
+
+
+bool WaveformRelaxation::Run(size_t numSteps, ThreadPool* pool)
+{
+	if (!IsSplit())
+		return false;
+
+	SM_PROFILE_SCOPE("WR::Run");
+	Timer timer = Timer::StartNew();
+
+	size_t windowSteps = std::max<size_t>(m_Options.windowSteps, 1);
+	bool converged = true;
+
+	for (size_t done = 0; done < numSteps;)
+	{
+		size_t steps = std::min(windowSteps, numSteps - done);
+		bool firstWindow = m_Partitions[0].checkpoint.empty();
+
+		// The first iteration sees every boundary hold the voltage it starts the window with
+		for (Partition& partition : m_Partitions)
+		{
+			size_t numExports = partition.exports.size();
+			partition.waveform.resize(windowSteps * numExports);
+			partition.next.resize(windowSteps * numExports);
+			for (size_t step = 0; step < steps; step++)
+			{
+				for (size_t k = 0; k < numExports; k++)
+					partition.waveform[step * numExports + k] = partition.exports[k]->GetVoltage();
+			}
+		}
+
+		u32 iteration = 0;
+		double change = 0.0;
+		while (true)
+		{
+			for (const std::vector<u32>& stage : m_Stages)
+			{
+				auto runPartition = [&](size_t k)
+				{
+					Partition& partition = m_Partitions[stage[k]];
+					if (iteration > 0)
+						RestartWindow(partition, firstWindow);
+					RunPartition(partition, steps);
+				};
+
+				if (pool && stage.size() > 1)
+					pool->ParallelFor(stage.size(), runPartition);
+				else
+				{
+					for (size_t k = 0; k < stage.size(); k++)
+						runPartition(k);
+				}
+
+				// Later stages of the same iteration run from these
+				for (u32 index : stage)
+					std::swap(m_Partitions[index].waveform, m_Partitions[index].next);
+			}
+
+			iteration++;
+			change = 0.0;
+			for (const Partition& partition : m_Partitions)
+				change = std::max(change, partition.change);
+
+			if (change <= m_Options.tolerance || iteration >= m_Options.maxIterations)
+				break;
+		}
+
+		// The next window starts over from here
+		for (Partition& partition : m_Partitions)
+		{
+			partition.checkpoint.clear();
+			CheckpointWriter writer(partition.checkpoint);
+			partition.circuit->SaveState(writer);
+		}
+
+		if (change > m_Options.tolerance)
+		{
+			m_Stats.unconvergedWindows++;
+			converged = false;
+		}
+
+		m_Stats.windows++;
+		m_Stats.iterations += iteration;
+		m_Stats.maxWindowIterations = std::max(m_Stats.maxWindowIterations, iteration);
+		m_Stats.lastChange = change;
+		m_Stats.steps += steps;
+		done += steps;
+	}
+
+	timer.Stop();
+	m_Stats.seconds += timer.GetElapsedSeconds();
+	return converged;
+}
+
+
+double WaveformRelaxation::GetVoltage(eNode* node) const
+{
+	eNode* local = node->GetIndex() < m_LocalNodes.size() ? m_LocalNodes[node->GetIndex()] : nullptr;
+	return local ? local->GetVoltage() : 0.0;
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "sim/Scheme.h"
+
+class ThreadPool;
+
+// Waveform relaxation : transient runs of a circuit split in partitions that step on threads of their own
+//
+// The nodes are split in partitions that only share resistors and capacitors. Every partition is a
+// circuit of its own with its elements moved into it, and a copy of every resistor or capacitor it
+// shares. The far end of such a copy is a boundary node, held by a voltage source to the waveform of
+// the node it stands for in the other partition.
+//
+// Time goes by in windows of steps. Every partition runs the whole window on its own from the
+// boundary waveforms of the last iteration, records the waveforms of the nodes the others look at,
+// and starts the window over until they move by less than the tolerance. Gauss-Jacobi runs all the
+// partitions of an iteration at once. Gauss-Seidel colours the partitions so that none shares
+// elements with one of the same colour, and runs colour after colour, each one from the waveforms
+// of the colours before it. That takes fewer iterations, with fewer partitions at once.
+//
+// A window starts over from a checkpoint of every partition, the factors stay as they are (see
+// Circuit::LoadState). The first window has nothing factored yet, its partitions are assembled again
+// from the voltages and element states it started with.
+//
+// The fewer the elements shared and the weaker they couple, the fewer the iterations. Every
+// partition is solved by itself, the direct solver of a partition works on its own unknowns only.
+
+class WaveformRelaxation
+{
+public:
+	enum class eScheme : u8
+	{
+		Jacobi,
+		Seidel
+	};
+
+	struct Options
+	{
+		size_t windowSteps = 50;
+		double tolerance = 1e-6;	// In volts, on any boundary waveform
+		u32 maxIterations = 40;		// Per window, the window goes on unconverged past it
+		eScheme scheme = eScheme::Seidel;
+	};
+
+	struct Stats
+	{
+		size_t steps = 0;
+		size_t windows = 0;
+		size_t iterations = 0;			// Over all windows
+		u32 maxWindowIterations = 0;
+		size_t unconvergedWindows = 0;
+		double lastChange = 0.0;		// Of the last iteration of the last window
+		double seconds = 0.0;
+	};
+
+private:
+	// A node of another partition seen through a shared element
+	struct Boundary
+	{
+		eVoltageSource* source;
+		u32 partition;			// Where the node is
+		u32 exported;			// Its index in the exports of that partition
+	};
+
+	struct Partition
+	{
+		std::unique_ptr<Circuit> circuit;
+		std::vector<eNode*> exports;			// Nodes other partitions see
+		std::vector<Boundary> boundaries;
+		std::vector<u8> checkpoint;				// Start of the window, empty before the first one is done
+		std::vector<double> startVoltages;		// Of the first window, with the element states
+		std::vector<u8> startStates;
+
+		// Export waveforms of the window, exports x steps : the last iteration, and the one running
+		std::vector<double> waveform;
+		std::vector<double> next;
+		double change = 0.0;
+	};
+
+	Circuit& m_Circuit;
+	Options m_Options;
+
+	std::vector<Partition> m_Partitions;
+	std::vector<std::vector<u32>> m_Stages;		// Partitions run at once
+
+	// While split : every element in its circuit order with the nodes of its pins, the shared ones
+	// stay here, copies of them are in the partitions
+	std::vector<eElement*> m_Order;
+	std::vector<std::vector<eNode*>> m_PinNodes;
+	std::vector<std::unique_ptr<eElement>> m_Shared;
+
+	// Original node index -> node in its partition, nullptr for the ground
+	std::vector<eNode*> m_LocalNodes;
+	size_t m_NumShared = 0;
+
+	Stats m_Stats;
+
+	void BuildStages();
+	void RestartWindow(Partition& partition, bool firstWindow);
+	void RunPartition(Partition& partition, size_t numSteps);
+
+public:
+
+	explicit WaveformRelaxation(Circuit& circuit);
+	~WaveformRelaxation();
+
+	WaveformRelaxation(const WaveformRelaxation&) = delete;
+	WaveformRelaxation& operator=(const WaveformRelaxation&) = delete;
+
+	// Partition of every node (by index, the ground's is ignored), contiguous along a breadth first
+	// walk of the nodes. Nodes joined by anything but a resistor or a capacitor stay together
+	static std::vector<u32> PartitionNodes(Circuit& circuit, size_t numPartitions);
+
+	// Moves the elements into partitions from the partition of every node. The circuit is left
+	// without elements until Join(), its node voltages are where the partitions start. The steps
+	// of the elements have to be set before. False if an element other than a resistor or capacitor
+	// spans partitions, nothing is moved then
+	bool Split(const std::vector<u32>& nodePartition);
+	bool Split(size_t numPartitions) { return Split(PartitionNodes(m_Circuit, numPartitions)); }
+
+	// Elements back in their places and the node voltages of the last step, the next solve of the
+	// circuit assembles it again
+	void Join();
+	bool IsSplit() const { return !m_Partitions.empty(); }
+
+	void SetOptions(const Options& options) { m_Options = options; BuildStages(); }
+	const Options& GetOptions() const { return m_Options; }
+
+	// numSteps transient steps, the partitions of a stage on the pool when given. Steps short of a
+	// window run as a shorter one. False if a window ran out of iterations
+	bool Run(size_t numSteps, ThreadPool* pool = nullptr);
+
+	// Voltage of a node of the circuit while split
+	double GetVoltage(eNode* node) const;
+
+	size_t GetNumPartitions() const { return m_Partitions.size(); }
+	size_t GetNumStages() const { return m_Stages.size(); }
+	size_t GetNumShared() const { return m_NumShared; }
+	size_t GetPartitionSize(size_t partition) const { return m_Partitions[partition].circuit->GetNumNodes(); }
+	const Stats& GetStats() const { return m_Stats; }
+};
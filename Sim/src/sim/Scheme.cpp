@@ -1,4 +1,15 @@
 #include "Scheme.h"
+#include "Structure.h"
+#include "Checkpoint.h"
+#include "SolutionCache.h"
+#include "Nonlinear.h"
+#include "Multigrid.h"
+#include "base/Timer.h"
+#include "base/ThreadPool.h"
+
+#include <cmath>
+#include <typeinfo>
+#include <unordered_set>
 
 
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -18,21 +29,31 @@ eNode* ePin::GetConnectedNode() { return m_Enode; }
 
 void ePin::ConnectToNode(eNode* enode)
 {
+	if (m_Enode == enode)
+		return;
+
 	if (m_Enode)
 		m_Enode->RemoveEpin(this);
 
 	m_Enode = enode;
 	if (m_Enode)
 		m_Enode->AddEpin(this);
+
+	if (m_Element)
+		m_Element->MarkDirty(eDirty::Topology);
 }
 
 
 void ePin::ReleaseNode()
 {
-	if (m_Enode)
-		m_Enode->RemoveEpin(this);
+	if (!m_Enode)
+		return;
 
+	m_Enode->RemoveEpin(this);
 	m_Enode = nullptr;
+
+	if (m_Element)
+		m_Element->MarkDirty(eDirty::Topology);
 }
 
 
@@ -64,6 +85,54 @@ void eNode::clear()
 }
 
 
+s64 SystemRow(eNode* node, eNode* GndNode)
+{
+	if (node == GndNode)
+		return -1;
+
+	size_t idx = node->GetIndex();
+	return s64(idx > GndNode->GetIndex() ? idx - 1 : idx);
+}
+
+
+// Rows of a branch current between two nodes, the pattern of a voltage source
+//
+//         i    j   branch
+// i      |         1 |
+// j      |        -1 |
+// branch | 1  -1     |
+static void StampIncidence(CircuitMtx& mtx, size_t branch, eNode* n1, eNode* n2, eNode* GndNode)
+{
+	s64 i = SystemRow(n1, GndNode);
+	s64 j = SystemRow(n2, GndNode);
+
+	if (i >= 0)
+	{
+		mtx.Add(branch, i, 1.0);
+		mtx.Add(i, branch, 1.0);
+	}
+
+	if (j >= 0)
+	{
+		mtx.Add(branch, j, -1.0);
+		mtx.Add(j, branch, -1.0);
+	}
+}
+
+
+static void StampIncidenceAC(ACStamper& stamper, size_t branch, eNode* n1, eNode* n2, eNode* GndNode)
+{
+	s64 i = SystemRow(n1, GndNode);
+	s64 j = SystemRow(n2, GndNode);
+	s64 k = s64(branch);
+
+	stamper.Add(k, i, 1.0);
+	stamper.Add(i, k, 1.0);
+	stamper.Add(k, j, -1.0);
+	stamper.Add(j, k, -1.0);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 											Element
 
@@ -71,6 +140,8 @@ void eNode::clear()
 
 eElement::~eElement()
 {
+	m_Circuit = nullptr; // Whoever removes the element marks the circuit
+
 	for (ePin& pin : m_ePins)
 	{
 		if (pin.IsConnectedToNode())
@@ -134,7 +205,18 @@ void eElement::SetEpin(int num, ePin pin)
 
 void eElement::SetStep(double step)
 {
+	if (m_step == step)
+		return;
+
 	m_step = step;
+	MarkDirty(eDirty::Values);
+}
+
+
+void eElement::MarkDirty(eDirty level)
+{
+	if (m_Circuit)
+		m_Circuit->MarkDirty(this, level);
 }
 
 
@@ -144,6 +226,168 @@ double eElement::GetStep()
 }
 
 
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Circuit matrix
+
+
+
+// A thread per column block, each block adds the entries of the buffers in buffer order. Every slot
+// then sums the same values in the same order as a serial assembly, so the result is bit identical
+void CircuitMtx::ApplyStamps(const std::vector<StampBuffer>& buffers, size_t numBuffers, ThreadPool* pool)
+{
+	SM_PROFILE_SCOPE("ApplyStamps");
+
+	size_t size = A.rows();
+	u32 shift = buffers[0].blockShift;
+	size_t numBlocks = size ? ((size - 1) >> shift) + 1 : 0;
+
+	auto applyBlock = [&](size_t block)
+	{
+		size_t begin = block << shift;
+		size_t count = std::min(size, begin + (size_t(1) << shift)) - begin;
+		A.middleCols(begin, count).setZero();
+		b.segment(begin, count).setZero();
+
+		for (size_t i = 0; i < numBuffers; i++)
+		{
+			for (const StampBuffer::Entry& entry : buffers[i].bins[block])
+			{
+				if (entry.col == StampBuffer::RhsColumn)
+					b(entry.row) += entry.value;
+				else
+					A(entry.row, entry.col) += entry.value;
+			}
+		}
+	};
+
+	if (pool)
+		pool->ParallelFor(numBlocks, applyBlock);
+	else
+	{
+		for (size_t block = 0; block < numBlocks; block++)
+			applyBlock(block);
+	}
+
+	x.setZero();
+	m_Factored = false;
+	m_Terms.clear();
+}
+
+
+void CircuitMtx::UpdateStats()
+{
+	SM_PROFILE_SCOPE("SolverStats");
+
+	// Nothing here may allocate, it runs on every factorization
+
+	const Eigen::MatrixXd& LU = m_Factors->lu.matrixLU();
+
+	m_Stats = SolverStats();
+	m_Stats.size = A.rows();
+	if (m_Stats.size == 0)
+		return;
+
+	m_Stats.nnz = (A.array() != 0.0).count();
+	m_Stats.factorNnz = (LU.array() != 0.0).count(); // L and U share the storage
+	m_Stats.fillIn = s64(m_Stats.factorNnz) - s64(m_Stats.nnz);
+
+	double maxU = 0.0;
+	for (Eigen::Index j = 0; j < LU.cols(); j++)
+		for (Eigen::Index i = 0; i <= j; i++)
+			maxU = std::max(maxU, std::abs(LU(i, j)));
+
+	double maxA = A.cwiseAbs().maxCoeff();
+	m_Stats.pivotGrowth = maxA > 0.0 ? maxU / maxA : 0.0;
+
+	double maxPivot = LU.diagonal().cwiseAbs().maxCoeff();
+	double minPivot = LU.diagonal().cwiseAbs().minCoeff();
+	double tolerance = maxPivot * Eigen::NumTraits<double>::epsilon() * double(m_Stats.size);
+
+	m_Stats.rank = (LU.diagonal().array().abs() > tolerance).count();
+
+	// The ratio of the pivots is a lower bound of cond(A), good enough to spot near singular systems
+	m_Stats.conditionEstimate = minPivot > 0.0 ? maxPivot / minPivot : INFINITY;
+
+#if SM_PROFILE_ENABLED
+	ProfileCounter counter{ "SolverStats", Profiler::GetTimeNs(), 7,
+		{ "size", "nnz", "fill_in", "rank", "pivot_growth", "condition", "iterations" },
+		{ double(m_Stats.size), double(m_Stats.nnz), double(m_Stats.fillIn), double(m_Stats.rank),
+		  m_Stats.pivotGrowth, m_Stats.conditionEstimate, double(m_Stats.iterations) } };
+	SM_PROFILE_COUNTER(counter);
+#endif
+}
+
+
+bool CircuitMtx::AddConductance(s64 i, s64 j, double delta)
+{
+	if (delta == 0.0 || (i < 0 && j < 0))
+		return true;
+
+	if (!m_Factored || m_Terms.size() >= MaxLowRankTerms)
+		return false;
+
+	// Keep A in step, the next factorization and the stats see the current values
+	if (i >= 0) A(i, i) += delta;
+	if (j >= 0) A(j, j) += delta;
+	if (i >= 0 && j >= 0)
+	{
+		A(i, j) -= delta;
+		A(j, i) -= delta;
+	}
+
+	Eigen::Index n = A.rows();
+	if (m_Z.rows() != n)
+	{
+		m_Z.resize(n, MaxLowRankTerms);
+		m_U.resize(n);
+	}
+
+	m_U.setZero();
+	if (i >= 0) m_U(i) = 1.0;
+	if (j >= 0) m_U(j) = -1.0;
+
+	m_Z.col(m_Terms.size()).noalias() = m_Factors->lu.solve(m_U);
+	m_Terms.push_back({ i, j, delta });
+	return true;
+}
+
+
+bool CircuitMtx::SolveLowRank()
+{
+	// Woodbury : (A0 + U D U^T)^-1 b = y - Z (D^-1 + U^T Z)^-1 U^T y
+	// y = A0^-1 b is in x already, Z = A0^-1 U
+	SM_PROFILE_SCOPE("LowRankUpdate");
+
+	Eigen::Index k = Eigen::Index(m_Terms.size());
+
+	auto project = [&](const LowRankTerm& term, auto&& vec)
+	{
+		double value = 0.0;
+		if (term.i >= 0) value += vec(term.i);
+		if (term.j >= 0) value -= vec(term.j);
+		return value;
+	};
+
+	SmallMatrix S(k, k);
+	SmallVector r(k);
+	for (Eigen::Index a = 0; a < k; a++)
+	{
+		for (Eigen::Index c = 0; c < k; c++)
+			S(a, c) = project(m_Terms[a], m_Z.col(c)) + (a == c ? 1.0 / m_Terms[a].delta : 0.0);
+
+		r(a) = project(m_Terms[a], x);
+	}
+
+	Eigen::FullPivLU<SmallMatrix> lu(S);
+	if (!lu.isInvertible())
+		return false;
+
+	SmallVector t = lu.solve(r);
+	x.noalias() -= m_Z.leftCols(k) * t;
+	return true;
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 											Resistor
 
@@ -175,13 +419,13 @@ void eResistor::Stamp(CircuitMtx& mtx, eNode* GndNode)
 	eNode* node1 = GetEpin(0)->GetConnectedNode();
 	eNode* node2 = GetEpin(1)->GetConnectedNode();
 
+	m_StampedG = 0.0;
+
 	if (!node1 || !node2 || node1 == node2)
 		return;
 
 	double G = 1.0 / m_Resistance;
-
-	Eigen::MatrixXd& A = mtx.GetMatrix();
-	Eigen::VectorXd& b = mtx.GetVector();
+	m_StampedG = G;
 
 	size_t idx1 = node1->GetIndex();
 	size_t idx2 = node2->GetIndex();
@@ -192,18 +436,18 @@ void eResistor::Stamp(CircuitMtx& mtx, eNode* GndNode)
 
 	if (node1 != GndNode && node2 != GndNode)
 	{
-		A(i, i) += G;
-		A(j, j) += G;
-		A(j, i) -= G;
-		A(i, j) -= G;
+		mtx.Add(i, i, G);
+		mtx.Add(j, j, G);
+		mtx.Add(j, i, -G);
+		mtx.Add(i, j, -G);
 	}
 	else if (node1 == GndNode && node2 != GndNode)
 	{
-		A(j, j) += G;
+		mtx.Add(j, j, G);
 	}
 	else if (node2 == GndNode && node1 != GndNode)
 	{
-		A(i, i) += G;
+		mtx.Add(i, i, G);
 	}
 	else
 	{
@@ -212,6 +456,35 @@ void eResistor::Stamp(CircuitMtx& mtx, eNode* GndNode)
 }
 
 
+bool eResistor::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return true; // Not in the system
+
+	double G = 1.0 / m_Resistance;
+	if (!mtx.AddConductance(SystemRow(node1, GndNode), SystemRow(node2, GndNode), G - m_StampedG))
+		return false;
+
+	m_StampedG = G;
+	return true;
+}
+
+
+void eResistor::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	stamper.AddAdmittance(SystemRow(node1, GndNode), SystemRow(node2, GndNode), 1.0 / m_Resistance);
+}
+
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // 											Voltage Source
 
@@ -247,43 +520,1249 @@ void eVoltageSource::Stamp(CircuitMtx& mtx, eNode* GndNode)
 	if (!n1 || !n2)
 		return;
 
-	size_t numNodes = mtx.GetNumNodes();
-	size_t eqIdx = numNodes;
+	StampIncidence(mtx, m_BranchIdx, n1, n2, GndNode);
+	mtx.AddRhs(m_BranchIdx, m_Voltage);
+}
 
-	mtx.Resize(numNodes + 1);
 
-	Eigen::MatrixXd& A = mtx.GetMatrix();
-	Eigen::VectorXd& b = mtx.GetVector();
+bool eVoltageSource::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// Only the right hand side, the factorization stays valid
+	if (GetNumBranches())
+		mtx.GetVector()(m_BranchIdx) = m_Voltage;
+
+	return true;
+}
+
+
+void eVoltageSource::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	if (!GetNumBranches())
+		return;
+
+	// Same rows as the DC stamp, the source is a short unless it has an AC amplitude
+	StampIncidenceAC(stamper, m_BranchIdx, GetPositivePin()->GetConnectedNode(), GetNegativePin()->GetConnectedNode(), GndNode);
+	stamper.AddSource(s64(m_BranchIdx), m_ACMagnitude);
+}
 
-	size_t idx1 = n1->GetIndex();
-	size_t idx2 = n2->GetIndex();
-	size_t gndIdx = GndNode->GetIndex();
 
-	size_t i = (idx1 > gndIdx) ? idx1 - 1 : idx1;
-	size_t j = (idx2 > gndIdx) ? idx2 - 1 : idx2;
+eBranchModel eVoltageSource::GetBranchModel()
+{
+	eBranchModel model;
+	if (GetNumBranches())
+		model.branch = s64(m_BranchIdx);
+
+	return model;
+}
+
+
+size_t eVoltageSource::GetNumBranches()
+{
+	// Unconnected source doesn't take part in the system, so it must not add an empty row either
+	if (!GetPositivePin()->IsConnectedToNode() || !GetNegativePin()->IsConnectedToNode())
+		return 0;
+
+	return 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Capacitor
+
+
+
+eCapacitor::eCapacitor(double capacitance)
+	: m_Capacitance(capacitance)
+{
+	SetNumEpins(2);
+}
+
+
+void eCapacitor::Stamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// Backward Euler companion model
+	// 
+	// Node i                          Node j
+	// *-----+----(G = C / h)----+-----*
+	//       |                   |
+	//       +---(Ieq = G * Vn)--+
+	// 
+	//       i   j             RHS
+	// i |   G  -G |         |  Ieq |
+	// j |  -G   G |         | -Ieq |
+	//
+	// Vn is the voltage across the capacitor on the previous step
+	// With no step set (DC) the capacitor is an open circuit
+
+	m_StampedG = 0.0;
+	m_StampedIeq = 0.0;
+
+	if (m_step <= 0.0)
+		return;
+
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	double G = m_Capacitance / m_step;
+	double Ieq = G * (node1->GetVoltage() - node2->GetVoltage());
+	m_StampedG = G;
+	m_StampedIeq = Ieq;
 
-	if (n1 != GndNode && n2 != GndNode)
+	size_t idx1 = node1->GetIndex();
+	size_t idx2 = node2->GetIndex();
+	size_t GndIdx = GndNode->GetIndex();
+
+	size_t i = (idx1 > GndIdx) ? idx1 - 1 : idx1;
+	size_t j = (idx2 > GndIdx) ? idx2 - 1 : idx2;
+
+	if (node1 != GndNode)
 	{
-		A(eqIdx, i) = 1;
-		A(eqIdx, j) = -1;
-		A(i, eqIdx) = 1;
-		A(j, eqIdx) = -1;
+		mtx.Add(i, i, G);
+		mtx.AddRhs(i, Ieq);
 	}
-	else if (n1 == GndNode && n2 != GndNode)
+
+	if (node2 != GndNode)
 	{
-		A(eqIdx, j) = -1;
-		A(j, eqIdx) = -1;
+		mtx.Add(j, j, G);
+		mtx.AddRhs(j, -Ieq);
 	}
-	else if (n2 == GndNode && n1 != GndNode)
+
+	if (node1 != GndNode && node2 != GndNode)
 	{
-		A(eqIdx, i) = 1;
-		A(i, eqIdx) = 1;
+		mtx.Add(j, i, -G);
+		mtx.Add(i, j, -G);
 	}
-	else
-	{
+}
+
+
+bool eCapacitor::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
+
+	if (!node1 || !node2 || node1 == node2)
+		return true;
+
+	double G = m_step > 0.0 ? m_Capacitance / m_step : 0.0;
+	double Ieq = G * (node1->GetVoltage() - node2->GetVoltage());
+
+	s64 i = SystemRow(node1, GndNode);
+	s64 j = SystemRow(node2, GndNode);
+
+	if (!mtx.AddConductance(i, j, G - m_StampedG))
+		return false;
+
+	Eigen::VectorXd& b = mtx.GetVector();
+	if (i >= 0) b(i) += Ieq - m_StampedIeq;
+	if (j >= 0) b(j) -= Ieq - m_StampedIeq;
+
+	m_StampedG = G;
+	m_StampedIeq = Ieq;
+	return true;
+}
+
+
+void eCapacitor::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	eNode* node1 = GetEpin(0)->GetConnectedNode();
+	eNode* node2 = GetEpin(1)->GetConnectedNode();
 
+	if (!node1 || !node2 || node1 == node2)
+		return;
+
+	stamper.AddAdmittance(SystemRow(node1, GndNode), SystemRow(node2, GndNode), 0.0, m_Capacitance);
+}
+
+
+// The companion source as stamped, the next Restamp moves the right hand side from it
+void eCapacitor::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_StampedG);
+	writer.Write(m_StampedIeq);
+}
+
+
+bool eCapacitor::LoadState(CheckpointReader& reader)
+{
+	return reader.Read(m_StampedG) && reader.Read(m_StampedIeq);
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Inductor
+
+
+
+eInductor::eInductor(double inductance)
+	: m_Inductance(inductance)
+{
+	SetNumEpins(2);
+}
+
+
+void eInductor::Stamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	// Branch current unknown, backward Euler : v1 - v2 = L / h * (i - In)
+	//
+	//         i    j   branch            RHS
+	// i      |         1 |             |          |
+	// j      |        -1 |             |          |
+	// branch | 1  -1  -L/h |           | -L/h * In |
+	//
+	// In is the current of the previous step. With no step set (DC) the inductor is a short
+
+	if (!GetNumBranches())
+		return;
+
+	StampIncidence(mtx, m_BranchIdx, GetEpin(0)->GetConnectedNode(), GetEpin(1)->GetConnectedNode(), GndNode);
+
+	m_StampedR = 0.0;
+	if (m_step > 0.0)
+	{
+		double R = m_Inductance / m_step;
+		mtx.Add(m_BranchIdx, m_BranchIdx, -R);
+		mtx.AddRhs(m_BranchIdx, -R * m_Current);
+		m_StampedR = R;
 	}
+}
+
+
+bool eInductor::Restamp(CircuitMtx& mtx, eNode* GndNode)
+{
+	if (!GetNumBranches())
+		return true;
 
-	b(eqIdx) = m_Voltage;
+	// A new L / h is not a conductance update, only the history source goes in place
+	double R = m_step > 0.0 ? m_Inductance / m_step : 0.0;
+	if (R != m_StampedR)
+		return false;
+
+	mtx.GetVector()(m_BranchIdx) = -R * m_Current;
+	return true;
+}
+
+
+size_t eInductor::GetNumBranches()
+{
+	if (!GetEpin(0)->IsConnectedToNode() || !GetEpin(1)->IsConnectedToNode())
+		return 0;
+
+	return 1;
+}
+
+
+eBranchModel eInductor::GetBranchModel()
+{
+	eBranchModel model;
+	if (GetNumBranches())
+		model.branch = s64(m_BranchIdx);
+
+	return model;
+}
+
+
+void eInductor::StampAC(ACStamper& stamper, eNode* GndNode)
+{
+	if (!GetNumBranches())
+		return;
+
+	// v1 - v2 - jwL * i = 0
+	StampIncidenceAC(stamper, m_BranchIdx, GetEpin(0)->GetConnectedNode(), GetEpin(1)->GetConnectedNode(), GndNode);
+	stamper.Add(s64(m_BranchIdx), s64(m_BranchIdx), 0.0, -m_Inductance);
+}
+
+
+void eInductor::ReadbackBranches(const Eigen::VectorXd& solution)
+{
+	if (GetNumBranches())
+		m_Current = solution(m_BranchIdx);
+}
+
+
+void eInductor::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_Current);
+	writer.Write(m_StampedR);
+}
+
+
+bool eInductor::LoadState(CheckpointReader& reader)
+{
+	return reader.Read(m_Current) && reader.Read(m_StampedR);
 }
 
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Circuit
+
+
+
+// Serially every stamp goes to a single bin in element order. On the pool contiguous element chunks
+// stamp into buffers of their own, binned so that column blocks are summed in parallel after. The
+// chunks split the same way every time, either way capacity from the last recording is reused
+size_t Circuit::RecordStamps()
+{
+	SM_PROFILE_SCOPE("RecordStamps");
+
+	size_t numTotal = NumberUnknowns();
+	m_NumStampedUnknowns = numTotal;
+
+	// Multigrid reads the stamps as one list
+	bool parallel = UsesParallelAssembly() && m_SolverMode == eSolverMode::Direct && numTotal > 0;
+	if (!parallel)
+	{
+		if (m_StampBuffers.empty())
+			m_StampBuffers.resize(1);
+		m_NumStampBuffers = 1;
+
+		m_StampBuffers[0].Begin(1, 63);
+		CircuitMtx::SetRecording(&m_StampBuffers[0]);
+		for (auto& element : m_Elements)
+			element->Stamp(m_Matrix, m_GroundNode);
+		CircuitMtx::SetRecording(nullptr);
+		return numTotal;
+	}
+
+	size_t numSlots = m_Pool->GetNumThreads() + 1;
+
+	// Column blocks of a power of 2, at least 64 columns and a few per thread
+	u32 shift = 6;
+	while ((numTotal >> shift) > numSlots * 4)
+		shift++;
+	size_t numBlocks = ((numTotal - 1) >> shift) + 1;
+
+	size_t numChunks = std::min(numSlots * 4, m_Elements.size());
+	size_t chunkSize = (m_Elements.size() + numChunks - 1) / numChunks;
+	numChunks = (m_Elements.size() + chunkSize - 1) / chunkSize;
+
+	if (m_StampBuffers.size() < numChunks)
+		m_StampBuffers.resize(numChunks);
+
+	m_Pool->ParallelFor(numChunks, [&](size_t chunk)
+	{
+		StampBuffer& buffer = m_StampBuffers[chunk];
+		buffer.Begin(numBlocks, shift);
+
+		size_t end = std::min(m_Elements.size(), (chunk + 1) * chunkSize);
+		CircuitMtx::SetRecording(&buffer);
+		for (size_t i = chunk * chunkSize; i < end; i++)
+			m_Elements[i]->Stamp(m_Matrix, m_GroundNode);
+		CircuitMtx::SetRecording(nullptr);
+	});
+
+	m_NumStampBuffers = numChunks;
+	return numTotal;
+}
+
+
+// Sums what RecordStamps() recorded, bit for bit what stamping in element order writes
+void Circuit::ApplyRecordedStamps()
+{
+	m_Matrix.SetSize(m_NumStampedUnknowns);
+	m_Matrix.ApplyStamps(m_StampBuffers, m_NumStampBuffers, UsesParallelAssembly() ? m_Pool : nullptr);
+
+	m_BranchTableValid = false;
+	m_NonlinearValid = false;
+}
+
+
+Circuit::Circuit() = default;
+
+
+Circuit::~Circuit()
+{
+	Reset();
+}
+
+
+std::unique_ptr<eElement> Circuit::DetachElement(eElement* element, size_t* index)
+{
+	auto it = std::ranges::find_if(m_Elements, [element](const auto& e)
+		{
+			return e.get() == element;
+		});
+
+	if (it == m_Elements.end())
+		return nullptr;
+
+	for (ePin& pin : element->m_ePins)
+		pin.ReleaseNode();
+
+	if (index)
+		*index = size_t(it - m_Elements.begin());
+
+	std::erase(m_DirtyElements, element);
+	std::erase(m_BranchElements, element);
+	std::erase(m_HistoryElements, element);
+	std::erase(m_NonlinearElements, element);
+	m_NonlinearValid = false; // The batch holds the element too
+
+	std::unique_ptr<eElement> detached = std::move(*it);
+	m_Elements.erase(it);
+	detached->m_Circuit = nullptr;
+	detached->m_DirtyQueued = false;
+
+	MarkDirty(nullptr, eDirty::Topology);
+	return detached;
+}
+
+
+void Circuit::RemoveElements(const std::vector<eElement*>& elements)
+{
+	std::unordered_set<eElement*> removed(elements.begin(), elements.end());
+	for (eElement* element : removed)
+	{
+		for (ePin& pin : element->m_ePins)
+			pin.ReleaseNode();
+	}
+
+	auto isRemoved = [&removed](eElement* element) { return removed.contains(element); };
+	std::erase_if(m_DirtyElements, isRemoved);
+	std::erase_if(m_BranchElements, isRemoved);
+	std::erase_if(m_HistoryElements, isRemoved);
+	std::erase_if(m_NonlinearElements, isRemoved);
+	m_NonlinearValid = false;
+	std::erase_if(m_Elements, [&](const UniquePtrElementTy& element) { return isRemoved(element.get()); });
+
+	MarkDirty(nullptr, eDirty::Topology);
+}
+
+
+std::vector<std::unique_ptr<eElement>> Circuit::DetachElements()
+{
+	for (auto& element : m_Elements)
+	{
+		for (ePin& pin : element->m_ePins)
+			pin.ReleaseNode();
+
+		element->m_Circuit = nullptr;
+		element->m_DirtyQueued = false;
+	}
+
+	m_DirtyElements.clear();
+	m_BranchElements.clear();
+	m_HistoryElements.clear();
+	m_NonlinearElements.clear();
+	m_NonlinearValid = false;
+
+	std::vector<std::unique_ptr<eElement>> detached = std::move(m_Elements);
+	m_Elements.clear();
+
+	MarkDirty(nullptr, eDirty::Topology);
+	return detached;
+}
+
+
+size_t Circuit::RemoveUnusedNodes()
+{
+	size_t numKept = 0;
+	for (size_t k = 0; k < m_Nodes.size(); k++)
+	{
+		if (m_Nodes[k]->GetNumPins() == 0 && m_Nodes[k].get() != m_GroundNode)
+			continue;
+
+		m_Nodes[k]->m_NodeIndex = numKept;
+		if (k != numKept)
+			m_Nodes[numKept] = std::move(m_Nodes[k]);
+		numKept++;
+	}
+
+	size_t numRemoved = m_Nodes.size() - numKept;
+	m_Nodes.resize(numKept);
+	if (numRemoved)
+		MarkDirty(nullptr, eDirty::Topology);
+
+	return numRemoved;
+}
+
+
+eElement* Circuit::InsertElement(std::unique_ptr<eElement> element, size_t index)
+{
+	index = std::min(index, m_Elements.size());
+	element->m_Circuit = this;
+
+	eElement* inserted = m_Elements.insert(m_Elements.begin() + index, std::move(element))->get();
+	MarkDirty(nullptr, eDirty::Topology);
+	return inserted;
+}
+
+
+std::unique_ptr<eNode> Circuit::DetachLastNode()
+{
+	if (m_Nodes.empty() || m_Nodes.back()->GetNumPins() > 0)
+		return nullptr;
+
+	std::unique_ptr<eNode> node = std::move(m_Nodes.back());
+	m_Nodes.pop_back();
+	if (m_GroundNode == node.get())
+		m_GroundNode = nullptr;
+
+	MarkDirty(nullptr, eDirty::Topology);
+	return node;
+}
+
+
+eNode* Circuit::AttachNode(std::unique_ptr<eNode> node)
+{
+	// The index is its position, it only fits at the end it came from
+	if (node->GetIndex() != m_Nodes.size())
+		return nullptr;
+
+	m_Nodes.push_back(std::move(node));
+	if (!m_GroundNode)
+		m_GroundNode = m_Nodes.back().get();
+
+	MarkDirty(nullptr, eDirty::Topology);
+	return m_Nodes.back().get();
+}
+
+
+bool Circuit::CheckStructure()
+{
+	if (!m_StructureCheck)
+		m_StructureCheck = std::make_unique<StructureCheck>();
+
+	return m_StructureCheck->Run(*this);
+}
+
+
+bool Circuit::UpdateSolution()
+{
+	if (m_Dirty == eDirty::None || m_Nodes.empty())
+		return false;
+
+	SM_PROFILE_SCOPE("UpdateSolution");
+
+	// Value edits on a factored system can do without factors from the cache, anything else needs them
+	bool restampable = m_Dirty == eDirty::Values && m_Matrix.IsFactorized();
+	bool cacheable = m_SolutionCache && m_SolverMode == eSolverMode::Direct && UpdateHash();
+	const SolutionCache::Entry* cached = nullptr;
+	if (cacheable)
+	{
+		size_t numUnknowns = m_Dirty == eDirty::Topology ? NumberUnknowns() : size_t(m_Matrix.GetNumNodes());
+		cached = m_SolutionCache->Find(GetHash(), numUnknowns, !restampable);
+	}
+
+	bool solved = false;
+	if (cached && cached->factors)
+	{
+		RestoreSolution(cached->factors, cached->solution, cached->rhs);
+		solved = true;
+	}
+
+	// Value edits on a factored system : restamp the edited elements, solve against the old factors
+	if (!solved && restampable)
+	{
+		bool restamped = std::ranges::all_of(m_DirtyElements, [this](eElement* element)
+		{
+			return element->Restamp(m_Matrix, m_GroundNode);
+		});
+
+		if (restamped && cached)
+		{
+			m_Matrix.GetSolution() = cached->solution;
+			solved = true;
+		}
+		else
+		{
+			solved = restamped && m_Matrix.SolveFactorized();
+			if (solved && cacheable)
+				m_SolutionCache->Insert(GetHash(), m_Matrix.GetSolution(), m_Matrix.GetVector(), nullptr);
+		}
+	}
+
+	if (!solved)
+	{
+		// Bad connections are caught in linear time instead of by the factorization. The edits
+		// stay pending, the next call checks again
+		if (!CheckStructure())
+		{
+			m_Matrix.SetSize(NumberUnknowns());
+			m_Matrix.Clear();
+			m_BranchTableValid = false;
+			m_NonlinearValid = false;
+			ReadbackVoltages();
+			return false;
+		}
+
+		// The check recorded the stamps, the system is built from them
+		bool iterative = m_SolverMode == eSolverMode::Multigrid && SolveMultigrid();
+		if (!iterative)
+		{
+			ApplyRecordedStamps();
+			m_Matrix.Factorize();
+			m_Matrix.SolveFactorized();
+
+			if (cacheable)
+				m_SolutionCache->Insert(GetHash(), m_Matrix.GetSolution(), m_Matrix.GetVector(), m_Matrix.ShareFactorization());
+		}
+	}
+
+	// Whichever way the system was solved, nonlinear devices iterate from that solution
+	m_NewtonIterations = 0;
+	m_NewtonConverged = true;
+	if (!m_NonlinearElements.empty())
+		SolveNonlinear();
+
+	for (eElement* element : m_DirtyElements)
+		element->m_DirtyQueued = false;
+
+	m_DirtyElements.clear();
+	m_Dirty = eDirty::None;
+
+	ReadbackVoltages();
+	AdjustVoltages(LookupGroundNode());
+	return true;
+}
+
+
+// Built from the stamps CheckStructure() recorded, the dense matrix is never allocated. False if the
+// circuit isn't one multigrid solves, nothing is changed then
+bool Circuit::SolveMultigrid()
+{
+	SM_PROFILE_SCOPE("SolveMultigrid");
+
+	size_t numTotal = m_NumStampedUnknowns;
+	if (!m_NonlinearElements.empty())
+		return false;
+
+	if (!m_Multigrid)
+		m_Multigrid = std::make_unique<MultigridSolver>();
+
+	size_t numNodeRows = m_Nodes.size() - 1;
+	if (!m_Multigrid->Assemble(m_StampBuffers[0].bins[0], numNodeRows, numTotal, m_Dirty == eDirty::Values))
+		return false;
+
+	Eigen::VectorXd solution;
+	Eigen::VectorXd rhs;
+	m_Multigrid->Solve(solution, rhs);
+
+	SolverStats stats;
+	stats.size = m_Multigrid->GetNumFreeUnknowns();
+	stats.iterations = m_Multigrid->GetIterations();
+	m_Matrix.AdoptIterative(std::move(solution), std::move(rhs), stats);
+
+	m_BranchTableValid = false;
+	m_NonlinearValid = false;
+	return true;
+}
+
+
+// Share of an element : type, position, connections, step and values. The circuit hash is the sum of
+// the shares, so a value edit swaps one share without going over the others
+void Circuit::HashElement(eElement* element, size_t index)
+{
+	// The address of the type info names the type within the process, hash_code() would hash its name
+	u64 hash = HashCombine(u64(reinterpret_cast<uintptr_t>(&typeid(*element))), index);
+	for (ePin& pin : element->m_ePins)
+	{
+		eNode* node = pin.GetConnectedNode();
+		hash = HashCombine(hash, node ? u64(node->GetIndex()) : ~u64(0));
+	}
+	hash = HashDouble(hash, element->m_step);
+	hash = HashCombine(hash, element->HashValues());
+
+	bool transient = (element->HasHistory() && element->m_step > 0.0) || element->IsNonlinear();
+
+	m_Hash += hash - element->m_Hash;
+	m_NumTransient += size_t(transient) - size_t(element->m_HashTransient);
+	element->m_Hash = hash;
+	element->m_HashIndex = index;
+	element->m_HashTransient = transient;
+}
+
+
+// Everything after a topology edit, the edited elements after value edits. False while the solution
+// depends on more than the hash (a transient history)
+bool Circuit::UpdateHash()
+{
+	if (!m_HashValid)
+	{
+		m_Hash = 0;
+		m_NumTransient = 0;
+		for (size_t k = 0; k < m_Elements.size(); k++)
+		{
+			m_Elements[k]->m_Hash = 0;
+			m_Elements[k]->m_HashTransient = false;
+			HashElement(m_Elements[k].get(), k);
+		}
+		m_HashValid = true;
+	}
+	else
+	{
+		for (eElement* element : m_DirtyElements)
+			HashElement(element, element->m_HashIndex);
+	}
+
+	return m_NumTransient == 0;
+}
+
+
+// The elements stamp again into a scratch buffer, what they stamped is what Restamp and the branch
+// currents start from. The matrix itself is left alone
+void Circuit::RestoreSolution(const std::shared_ptr<CircuitMtx::Factorization>& factors, const Eigen::VectorXd& solution, const Eigen::VectorXd& rhs)
+{
+	SM_PROFILE_SCOPE("RestoreSolution");
+
+	if (m_Matrix.GetNumNodes() != u64(solution.size()))
+		m_Matrix.SetSize(u64(solution.size()));
+
+	m_Matrix.AdoptSolution(factors, solution, rhs);
+
+	m_ReplayStamps.Begin(1, 63);
+	CircuitMtx::SetRecording(&m_ReplayStamps);
+	for (auto& element : m_Elements)
+		element->Stamp(m_Matrix, m_GroundNode);
+	CircuitMtx::SetRecording(nullptr);
+
+	m_BranchTableValid = false;
+}
+
+
+void Circuit::Step()
+{
+	for (eElement* element : m_HistoryElements)
+		MarkDirty(element, eDirty::Values);
+
+	// Nothing numbered yet, the first solve assembles and stamps the history anyway
+	if (m_Dirty == eDirty::None)
+		MarkDirty(nullptr, eDirty::Values);
+
+	UpdateSolution();
+}
+
+
+// Counts, steps and voltages come first, the assembly in LoadState needs them. Every element writes
+// a block with its size in front, so a circuit built differently is caught at its first element
+void Circuit::SaveState(CheckpointWriter& writer)
+{
+	SM_PROFILE_SCOPE("Circuit::SaveState");
+
+	writer.Write(u64(m_Nodes.size()));
+	writer.Write(u64(m_Elements.size()));
+	writer.Write(u64(m_Matrix.GetNumNodes()));
+
+	for (auto& element : m_Elements)
+		writer.Write(element->m_step);
+
+	for (auto& node : m_Nodes)
+		writer.Write(node->GetVoltage());
+
+	writer.WriteArray(m_Matrix.GetSolution().data(), size_t(m_Matrix.GetSolution().size()));
+	writer.WriteArray(m_Matrix.GetVector().data(), size_t(m_Matrix.GetVector().size()));
+
+	for (auto& element : m_Elements)
+	{
+		size_t sizeOffset = writer.GetSize();
+		writer.Write(u32(0));
+		element->SaveState(writer);
+		writer.Overwrite(sizeOffset, u32(writer.GetSize() - sizeOffset - sizeof(u32)));
+	}
+}
+
+
+bool Circuit::LoadState(CheckpointReader& reader)
+{
+	SM_PROFILE_SCOPE("Circuit::LoadState");
+
+	u64 numNodes = 0;
+	u64 numElements = 0;
+	u64 numUnknowns = 0;
+	if (!reader.Read(numNodes) || !reader.Read(numElements) || !reader.Read(numUnknowns) ||
+		numNodes != m_Nodes.size() || numElements != m_Elements.size() || numUnknowns != NumberUnknowns())
+		return false;
+
+	// From here on a failure leaves a mix of states, the next solve starts over from the values
+	auto fail = [this]()
+	{
+		MarkDirty(nullptr, eDirty::Topology);
+		return false;
+	};
+
+	// Nothing to assemble or factor when the system is the one of the checkpoint already
+	bool sameSystem = m_Dirty == eDirty::None && m_Matrix.IsFactorized() && m_NonlinearElements.empty();
+	for (auto& element : m_Elements)
+	{
+		double step = 0.0;
+		if (!reader.Read(step))
+			return fail();
+
+		sameSystem = sameSystem && step == element->m_step;
+		element->m_step = step;
+	}
+
+	for (auto& node : m_Nodes)
+	{
+		double voltage = 0.0;
+		if (!reader.Read(voltage))
+			return fail();
+		node->SetVoltage(voltage);
+	}
+
+	// The matrix as the captured run had it, then the vectors and element histories on top
+	if (!sameSystem)
+		AssembleMatrix();
+	if (!m_NonlinearElements.empty())
+		BuildNonlinear();
+
+	if (!reader.ReadArray(m_Matrix.GetSolution().data(), size_t(m_Matrix.GetSolution().size())) ||
+		!reader.ReadArray(m_Matrix.GetVector().data(), size_t(m_Matrix.GetVector().size())))
+		return fail();
+
+	for (auto& element : m_Elements)
+	{
+		u32 size = 0;
+		if (!reader.Read(size))
+			return fail();
+
+		const u8* start = reader.GetPosition();
+		if (!element->LoadState(reader) || reader.GetPosition() != start + size)
+			return fail();
+	}
+
+	// The operating points read over the ones the assembly stamped, in the matrix only. The right hand
+	// side read above has them already
+	if (!m_NonlinearElements.empty())
+	{
+		Eigen::VectorXd rhs = m_Matrix.GetVector();
+		m_Diodes->Gather();
+		m_Diodes->Stamp(m_Matrix);
+		m_Matrix.GetVector() = rhs;
+	}
+
+	if (!sameSystem)
+		m_Matrix.Factorize();
+
+	for (eElement* element : m_DirtyElements)
+		element->m_DirtyQueued = false;
+
+	m_DirtyElements.clear();
+	m_Dirty = eDirty::None;
+	m_BranchTableValid = false;
+	m_HashValid = false;	// The steps were read past SetStep()
+	return true;
+}
+
+
+// Newton iteration from the solution as it is. The batches move the operating points and add the
+// changes of their companion models to the assembled system, which is factored and solved again
+// until no junction moves. The devices only get the operating points the iteration ended on
+bool Circuit::SolveNonlinear()
+{
+	SM_PROFILE_SCOPE("Newton");
+
+	if (!m_NonlinearValid)
+		BuildNonlinear();
+
+	m_NewtonConverged = false;
+	while (m_NewtonIterations < MaxNewtonIterations)
+	{
+		m_NewtonIterations++;
+
+		// Converged keeps the operating points the solution was solved with, the system, its factors
+		// and the solution stay consistent
+		PadSolution();
+		if (m_Diodes->Evaluate(m_PaddedSolution) == 0)
+		{
+			m_NewtonConverged = true;
+			break;
+		}
+
+		m_Diodes->Stamp(m_Matrix);
+		m_Matrix.Factorize();
+		m_Matrix.SolveFactorized();
+	}
+
+	m_Diodes->Scatter();
+	m_BranchTableValid = false;
+	return m_NewtonConverged;
+}
+
+
+// Right after an assembly, the devices hold what they stamped
+void Circuit::BuildNonlinear()
+{
+	if (!m_Diodes)
+		m_Diodes = std::make_unique<DiodeBatch>();
+
+	m_Diodes->Build(m_NonlinearElements, m_GroundNode, size_t(m_Matrix.GetNumNodes()));
+	m_NonlinearValid = true;
+}
+
+
+// Solution with a 0 V ground slot at the end, so open pins and the ground need no branches
+void Circuit::PadSolution()
+{
+	const Eigen::VectorXd& x = m_Matrix.GetSolution();
+	m_PaddedSolution.resize(x.size() + 1);
+	m_PaddedSolution.head(x.size()) = x;
+	m_PaddedSolution(x.size()) = 0.0;
+}
+
+
+// The only per element virtual calls of the post-solve pass, done once per stamp
+void Circuit::BuildBranchTable()
+{
+	Eigen::Index numElements = Eigen::Index(m_Elements.size());
+	int groundRow = int(m_Matrix.GetNumNodes());
+
+	m_BranchFrom.resize(numElements);
+	m_BranchTo.resize(numElements);
+	m_BranchRow.resize(numElements);
+	m_BranchG.resize(numElements);
+	m_BranchIeq.resize(numElements);
+	m_BranchNodes.resize(size_t(numElements) * 2);
+	m_MultiportElements.clear();
+
+	auto rowOf = [&](eNode* node)
+	{
+		return (!node || node == m_GroundNode) ? groundRow : int(SystemRow(node, m_GroundNode));
+	};
+
+	for (Eigen::Index k = 0; k < numElements; k++)
+	{
+		eElement* element = m_Elements[k].get();
+		ePin* pin0 = element->GetEpin(0);
+		ePin* pin1 = element->GetEpin(1);
+		eNode* node0 = pin0 ? pin0->GetConnectedNode() : nullptr;
+		eNode* node1 = pin1 ? pin1->GetConnectedNode() : nullptr;
+
+		// No two terminal model, the row stays at zero until the multiport pass fills it
+		bool multiport = element->GetNumPins() > 2;
+		if (multiport)
+			m_MultiportElements.push_back(size_t(k));
+
+		eBranchModel model = multiport ? eBranchModel() : element->GetBranchModel();
+		bool connected = node0 && node1 && !multiport;
+
+		m_BranchFrom(k) = connected ? rowOf(node0) : groundRow;
+		m_BranchTo(k) = connected ? rowOf(node1) : groundRow;
+		m_BranchRow(k) = model.branch >= 0 ? int(model.branch) : groundRow;
+		m_BranchG(k) = connected ? model.G : 0.0;
+		m_BranchIeq(k) = connected ? model.Ieq : 0.0;
+
+		m_BranchNodes[k * 2] = connected ? int(node0->GetIndex()) : -1;
+		m_BranchNodes[k * 2 + 1] = connected ? int(node1->GetIndex()) : -1;
+	}
+
+	m_BranchTableValid = true;
+}
+
+
+void Circuit::ComputeBranchCurrents()
+{
+	SM_PROFILE_SCOPE("BranchCurrents");
+
+	if (!m_BranchTableValid)
+		BuildBranchTable();
+
+	PadSolution();
+
+	// Gathers in a plain loop, Eigen index views evaluate into temporaries
+	Eigen::Index numElements = m_BranchG.size();
+	m_Branches.voltage.resize(numElements);
+	m_Branches.current.resize(numElements);
+	m_Branches.power.resize(numElements);
+
+	const double* solution = m_PaddedSolution.data();
+	for (Eigen::Index k = 0; k < numElements; k++)
+	{
+		m_Branches.voltage(k) = solution[m_BranchFrom(k)] - solution[m_BranchTo(k)];
+		m_Branches.current(k) = solution[m_BranchRow(k)];
+	}
+
+	// Element wise math over the contiguous arrays, vectorized by Eigen
+	m_Branches.current += m_BranchG * m_Branches.voltage - m_BranchIeq;
+	m_Branches.power = m_Branches.voltage * m_Branches.current;
+
+	// Scatter to the nodes
+	m_Branches.nodeResidual.setZero(Eigen::Index(m_Nodes.size()));
+	for (auto& node : m_Nodes)
+		node->SetTotalCurrent(0.0);
+
+	for (size_t k = 0; k < m_Elements.size(); k++)
+	{
+		int from = m_BranchNodes[k * 2];
+		int to = m_BranchNodes[k * 2 + 1];
+		if (from < 0)
+			continue;
+
+		double current = m_Branches.current(k);
+		m_Branches.nodeResidual(from) += current;
+		m_Branches.nodeResidual(to) -= current;
+
+		// Total is what flows in
+		eNode* into = current >= 0.0 ? m_Nodes[to].get() : m_Nodes[from].get();
+		into->SetTotalCurrent(into->GetTotalCurrent() + std::abs(current));
+	}
+
+	// Every pin of the multiport elements, a virtual call each
+	for (size_t k : m_MultiportElements)
+	{
+		eElement* element = m_Elements[k].get();
+		size_t numPins = element->GetNumPins();
+		if (m_PinCurrents.size() < numPins)
+			m_PinCurrents.resize(numPins);
+
+		std::fill_n(m_PinCurrents.begin(), numPins, 0.0);
+		element->GetPinCurrents(m_PinCurrents.data());
+
+		double power = 0.0;
+		for (size_t pin = 0; pin < numPins; pin++)
+		{
+			eNode* node = element->GetEpin(int(pin))->GetConnectedNode();
+			double current = m_PinCurrents[pin];
+			if (!node)
+				continue;
+
+			power += node->GetVoltage() * current;
+			m_Branches.nodeResidual(Eigen::Index(node->GetIndex())) += current;
+			if (current < 0.0)
+				node->SetTotalCurrent(node->GetTotalCurrent() - current);
+		}
+
+		m_Branches.voltage(Eigen::Index(k)) = element->GetEpin(0)->GetVoltage() - element->GetEpin(1)->GetVoltage();
+		m_Branches.current(Eigen::Index(k)) = m_PinCurrents[0];
+		m_Branches.power(Eigen::Index(k)) = power;
+	}
+
+	m_Branches.maxResidual = m_Nodes.empty() ? 0.0 : m_Branches.nodeResidual.abs().maxCoeff();
+}
+
+
+//////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// 											Simulation
+
+
+
+static constexpr double CostSmoothing = 0.2;	// Weight of the newest measurement
+static constexpr double RateSmoothing = 0.1;
+static constexpr int SlackFramesToRecover = 30;	// Updates on pace before publishing more often again
+
+
+static double Smooth(double average, double sample, double weight)
+{
+	return average <= 0.0 ? sample : average + (sample - average) * weight;
+}
+
+
+Simulation::Simulation(Circuit& circuit)
+	: m_Circuit(circuit)
+{
+}
+
+
+void Simulation::StartSim()
+{
+	m_Circuit.SetStep(m_Step);
+	m_Owed = 0.0;
+	m_Running = true;
+}
+
+
+void Simulation::StopSim()
+{
+	m_Running = false;
+	m_RealTimeFactor = 0.0;
+}
+
+
+void Simulation::Reset()
+{
+	StopSim();
+	m_Time = 0.0;
+	m_Owed = 0.0;
+	m_DroppedTime = 0.0;
+	m_StepsSinceOutput = 0;
+	m_OutputInterval = 1;
+	m_SlackFrames = 0;
+
+	m_Circuit.SetStep(0.0);
+	m_Circuit.UpdateSolution();
+	Publish();
+}
+
+
+void Simulation::RunSteps(size_t numSteps)
+{
+	m_Circuit.SetStep(m_Step);
+	for (size_t i = 0; i < numSteps; i++)
+	{
+		m_Circuit.Step();
+		m_Time += m_Step;
+	}
+}
+
+
+void Simulation::SaveState(CheckpointWriter& writer)
+{
+	writer.Write(m_Time);
+	writer.Write(m_Step);
+	m_Circuit.SaveState(writer);
+}
+
+
+bool Simulation::LoadState(CheckpointReader& reader)
+{
+	double time = 0.0;
+	double step = 0.0;
+	if (!reader.Read(time) || !reader.Read(step) || !m_Circuit.LoadState(reader))
+		return false;
+
+	m_Time = time;
+	m_Step = step;
+	m_Owed = 0.0;
+	m_StepsSinceOutput = 0;
+	Publish();
+	return true;
+}
+
+
+void Simulation::SetStep(double step)
+{
+	m_Step = step;
+	if (m_Running)
+		m_Circuit.SetStep(step);
+}
+
+
+// Steps that fit the budget with the outputs they bring along, at least one to keep measuring
+size_t Simulation::PlanSteps() const
+{
+	if (m_StepCost <= 0.0)
+		return 1;
+
+	double costPerStep = m_StepCost + m_OutputCost / double(m_OutputInterval);
+	return std::max<size_t>(1, size_t(m_FrameBudget / costPerStep));
+}
+
+
+void Simulation::Publish()
+{
+	m_Circuit.ComputeBranchCurrents();
+	if (m_Output)
+		m_Output(m_Time);
+}
+
+
+void Simulation::AdaptOutputRate(bool behind)
+{
+	if (behind)
+	{
+		m_SlackFrames = 0;
+		if (m_OutputCost > 0.0)
+			m_OutputInterval = std::min(m_OutputInterval * 2, MaxOutputInterval);
+		return;
+	}
+
+	if (m_OutputInterval > 1 && ++m_SlackFrames >= SlackFramesToRecover)
+	{
+		m_OutputInterval /= 2;
+		m_SlackFrames = 0;
+	}
+}
+
+
+void Simulation::SolveCircuit()
+{
+	m_Circuit.Step();
+	m_Time += m_Step;
+	m_Owed -= m_Step;
+}
+
+
+size_t Simulation::RunCircuit(size_t planned)
+{
+	Timer budget = Timer::StartNew();
+	double stepTime = 0.0;
+	double outputTime = 0.0;
+	size_t numOutputs = 0;
+	size_t steps = 0;
+
+	while (steps < planned)
+	{
+		Timer timer = Timer::StartNew();
+		SolveCircuit();
+		timer.Stop();
+		stepTime += timer.GetElapsedSeconds();
+		steps++;
+
+		if (++m_StepsSinceOutput >= m_OutputInterval)
+		{
+			timer.Restart();
+			Publish();
+			timer.Stop();
+			outputTime += timer.GetElapsedSeconds();
+			numOutputs++;
+			m_StepsSinceOutput = 0;
+		}
+
+		// The estimate is only a plan, a reassembly can cost far more than a step
+		budget.Update();
+		if (budget.GetElapsedSeconds() > m_FrameBudget)
+			break;
+	}
+
+	if (steps)
+		m_StepCost = Smooth(m_StepCost, stepTime / double(steps), CostSmoothing);
+
+	if (numOutputs)
+		m_OutputCost = Smooth(m_OutputCost, outputTime / double(numOutputs), CostSmoothing);
+
+	return steps;
+}
+
+
+void Simulation::Update(double frameTime)
+{
+	if (!m_Running || m_Step <= 0.0)
+	{
+		// Stopped, edits still show up
+		if (m_Circuit.UpdateSolution())
+			Publish();
+
+		m_LastSteps = 0;
+		return;
+	}
+
+	SM_PROFILE_SCOPE("Simulation::Update");
+
+	// A long stall (window dragged, breakpoint) is not worth catching up, what is given up is counted
+	frameTime = std::max(frameTime, 0.0);
+	if (frameTime > m_MaxLag)
+	{
+		m_DroppedTime += (frameTime - m_MaxLag) * m_TargetRate;
+		frameTime = m_MaxLag;
+	}
+
+	m_Owed += frameTime * m_TargetRate;
+
+	double maxOwed = m_MaxLag * m_TargetRate;
+	if (m_Owed > maxOwed)
+	{
+		m_DroppedTime += m_Owed - maxOwed;
+		m_Owed = maxOwed;
+	}
+
+	size_t wanted = size_t(std::floor(m_Owed / m_Step + 1e-9));
+	size_t planned = std::min(wanted, PlanSteps());
+
+	// No step owed this frame, the edits of the frame are solved where the time stands, as when stopped
+	if (wanted == 0 && m_Circuit.UpdateSolution())
+		Publish();
+	bool measured = m_StepCost > 0.0;
+
+	size_t steps = RunCircuit(planned);
+
+	// The first Update runs a single step to measure, that is not falling behind
+	if (measured)
+		AdaptOutputRate(steps < wanted);
+
+	if (frameTime > 0.0)
+		m_RealTimeFactor = Smooth(m_RealTimeFactor, double(steps) * m_Step / frameTime, RateSmoothing);
+
+	m_LastSteps = steps;
+}
@@ -2,7 +2,15 @@
 #include <iostream>
 #include <vector>
 #include <set>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <utility>
+#include <functional>
+#include <bit>
 #include "vendor/Eigen/Dense"
+#include "base/Profiler.h"
 
 
 
@@ -10,16 +18,53 @@ class ePin;
 class eNode;
 class eElement;
 class CircuitMtx;
+class Circuit;
+class ThreadPool;
+class StructureCheck;
+class CheckpointWriter;
+class CheckpointReader;
+class SolutionCache;
+class DiodeBatch;
+class MultigridSolver;
+
+
+// What an edit invalidated, a higher level includes the lower ones
+enum class eDirty : u8
+{
+	None,
+	Values,		// Element values, the elements restamp themselves into the assembled system
+	Topology	// Connections or elements, the system is assembled and factored again
+};
+
+
+// How Circuit::UpdateSolution solves the assembled system
+enum class eSolverMode : u8
+{
+	Direct,		// Dense LU, restamps and the solution cache
+	Multigrid	// Algebraic multigrid for big resistive meshes, the direct solver for anything else
+};
+
+
+// How an element ties its two pins together, for the structural checks before a solve
+enum class eCoupling : u8
+{
+	None,			// No path between the pins in the system (open, or a sensing input)
+	Conductance,	// Current flows in proportion to the voltage
+	Voltage			// The voltage across the pins is fixed, a source or an inductor in DC
+};
 
 
 class eNode
 {
 	std::set<ePin*> m_ePins;
 	
-	double m_TotalCurr = 0.0;
+	double m_TotalCurr = 0.0;	// Current flowing through, filled by Circuit::ComputeBranchCurrents
 	double m_Voltage = 0.0;
 	
 	size_t m_NodeIndex;
+
+	friend class Circuit;	// Numbers the nodes again, see Circuit::RemoveUnusedNodes
+
 public:
 
 	eNode(size_t index)
@@ -32,8 +77,12 @@ public:
 
 	double GetVoltage() const { return m_Voltage; }
 	void   SetVoltage(double Volt) { m_Voltage = Volt; }
+
+	double GetTotalCurrent() const { return m_TotalCurr; }
+	void   SetTotalCurrent(double current) { m_TotalCurr = current; }
 	
 	size_t GetIndex() const { return m_NodeIndex; }
+	size_t GetNumPins() const { return m_ePins.size(); }
 };
 
 
@@ -61,11 +110,103 @@ public:
 };
 
 
+// Row of a node in the system, -1 for the ground
+s64 SystemRow(eNode* node, eNode* GndNode);
+
+
+// Mixes a value into a hash, for the key of the solution cache
+inline u64 HashCombine(u64 seed, u64 value)
+{
+	// SplitMix64 finalizer
+	u64 hash = seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+	return hash ^ (hash >> 31);
+}
+
+inline u64 HashDouble(u64 seed, double value)
+{
+	return HashCombine(seed, std::bit_cast<u64>(value));
+}
+
+
+// Entry of the small signal system, admittance y(w) = g + jw * c + gamma / (jw)
+struct ACStampEntry
+{
+	s64 row;
+	s64 col;
+	double g;
+	double c;
+	double gamma;
+};
+
+
+// Collects the frequency independent description of the AC system, see ACAnalysis
+class ACStamper
+{
+	std::vector<ACStampEntry> m_Entries;
+	std::vector<std::pair<s64, double>> m_Sources; // Row, amplitude of the right hand side
+
+public:
+
+	void Clear()
+	{
+		m_Entries.clear();
+		m_Sources.clear();
+	}
+
+	// Entries on a ground row or column are dropped
+	void Add(s64 row, s64 col, double g, double c = 0.0, double gamma = 0.0)
+	{
+		if (row >= 0 && col >= 0)
+			m_Entries.push_back({ row, col, g, c, gamma });
+	}
+
+	// Two terminal admittance between the rows i and j, the pattern of a resistor stamp
+	void AddAdmittance(s64 i, s64 j, double g, double c = 0.0, double gamma = 0.0)
+	{
+		Add(i, i, g, c, gamma);
+		Add(j, j, g, c, gamma);
+		Add(i, j, -g, -c, -gamma);
+		Add(j, i, -g, -c, -gamma);
+	}
+
+	void AddSource(s64 row, double amplitude)
+	{
+		if (row >= 0 && amplitude != 0.0)
+			m_Sources.push_back({ row, amplitude });
+	}
+
+	const std::vector<ACStampEntry>& GetEntries() const { return m_Entries; }
+	const std::vector<std::pair<s64, double>>& GetSources() const { return m_Sources; }
+};
+
+
+// Two terminal view of an element for the post-solve pass, the current from pin 0 to pin 1 is
+// I = G * (v0 - v1) - Ieq + x(branch), with the values of the last stamp
+struct eBranchModel
+{
+	double G = 0.0;
+	double Ieq = 0.0;
+	s64 branch = -1; // Row of a branch current in the solution, -1 if none
+};
+
+
 class eElement
 {
+	Circuit* m_Circuit = nullptr; // Gets the dirty notifications
+	bool m_DirtyQueued = false;
+
+	// Share of the circuit hash, see Circuit::UpdateHash
+	u64 m_Hash = 0;
+	size_t m_HashIndex = 0;
+	bool m_HashTransient = false;
+
+	friend class Circuit;
+
 protected:
 	std::vector<ePin> m_ePins;
-	double m_step;
+	double m_step = 0.0;
 
 	virtual void SetNumEpins(int n);
 	void SetEpin(int num, ePin pin);
@@ -77,8 +218,54 @@ public:
 	virtual void Initialize() { }
 	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) { }
 
+	// Applies a value change to the assembled system in place, false if the element can't
+	// and the system has to be assembled again
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) { return false; }
+	void MarkDirty(eDirty level);
+
+	virtual eBranchModel GetBranchModel() { return {}; }
+
+	// Elements of more than two pins : the current into the element through every pin, from the last
+	// solve. The post-solve pass takes two pin elements from GetBranchModel() instead
+	virtual void GetPinCurrents(double* currents) { }
+
+	// Companion sources from the previous solution, restamped on every transient step
+	virtual bool HasHistory() { return false; }
+
+	// Path between the pins with the current step, see StructureCheck
+	virtual eCoupling GetCoupling() { return eCoupling::None; }
+
+	// Stamps the companion model of an operating point, see Nonlinear.h. Linearize moves the operating
+	// point to the voltages of the pins, false while it moved by more than the tolerance
+	virtual bool IsNonlinear() { return false; }
+	virtual bool Linearize() { return true; }
+
+	// Internal state a transient run depends on, see Checkpoint.h. LoadState runs after the
+	// system was assembled again and overrides what the assembly stamped
+	virtual void SaveState(CheckpointWriter& writer) { }
+	virtual bool LoadState(CheckpointReader& reader) { return true; }
+
+	// Small signal model, uses the rows numbered by the last AssembleMatrix or NumberUnknowns
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) { }
+
+	// Hash of the values the stamps depend on (not the history), see SolutionCache
+	virtual u64 HashValues() { return 0; }
+
+	// Main value as a netlist gives it (ohms, volts, farads, henries), for editors and CircuitHistory.
+	// Elements without one ignore SetValue
+	virtual double GetValue() { return 0.0; }
+	virtual void SetValue(double value) { }
+
+	// Reads the element's own unknowns (branch currents) after a solve
+	virtual void ReadbackBranches(const Eigen::VectorXd& solution) { }
+
+	// Extra MNA rows (branch currents) this element needs, placed after the node rows
+	virtual size_t GetNumBranches() { return 0; }
+	virtual void SetFirstBranch(size_t index) { }
+
 	virtual ePin* GetNextPin(ePin* pin);
 	ePin* GetEpin(int num);
+	size_t GetNumPins() const { return m_ePins.size(); }
 	void ReleaseConnectedNodes();
 
 	void SetStep(double step);
@@ -93,11 +280,19 @@ class eResistor : public eElement
 {
 	double m_Resistance;
 	double m_Current = 0.0;
+	double m_StampedG = 0.0; // Conductance in the assembled system
 
 public:
 
 	eResistor(double resistance);
 	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual eBranchModel GetBranchModel() override { return { m_StampedG, 0.0, -1 }; }
+	virtual eCoupling GetCoupling() override { return eCoupling::Conductance; }
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual u64 HashValues() override { return HashDouble(0, m_Resistance); }
+	virtual double GetValue() override { return m_Resistance; }
+	virtual void SetValue(double value) override { SetResistance(value); }
 
 	double GetCurrent()
 	{
@@ -125,43 +320,276 @@ public:
 
 	double GetResistance() { return m_Resistance; }
 
-	void SetResistance(double resistance) { m_Resistance = resistance; }
+	void SetResistance(double resistance)
+	{
+		m_Resistance = resistance;
+		MarkDirty(eDirty::Values);
+	}
 };
 
 
 class eVoltageSource : public eElement
 {
 	double m_Voltage;
+	double m_ACMagnitude = 0.0; // Small signal amplitude, 0 = shorted in AC analysis
+	size_t m_BranchIdx = 0;
 
 public:
 
 	eVoltageSource(double voltage);
 	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual size_t GetNumBranches() override;
+	virtual void SetFirstBranch(size_t index) override { m_BranchIdx = index; }
+	virtual eBranchModel GetBranchModel() override;
+	virtual eCoupling GetCoupling() override { return eCoupling::Voltage; }
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual u64 HashValues() override { return HashDouble(0, m_Voltage); }
+	virtual double GetValue() override { return m_Voltage; }
+	virtual void SetValue(double value) override { SetVoltage(value); }
+
+	double GetACMagnitude() { return m_ACMagnitude; }
+	void SetACMagnitude(double magnitude) { m_ACMagnitude = magnitude; }
+
+	double GetVoltage() { return m_Voltage; }
+	void SetVoltage(double voltage)
+	{
+		m_Voltage = voltage;
+		MarkDirty(eDirty::Values);
+	}
+
 	ePin* GetPositivePin() { return &m_ePins[0]; }
 	ePin* GetNegativePin() { return &m_ePins[1]; }
 };
 
 
+class eCapacitor : public eElement
+{
+	double m_Capacitance;
+	double m_StampedG = 0.0;
+	double m_StampedIeq = 0.0;
+
+public:
+
+	eCapacitor(double capacitance);
+	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual eBranchModel GetBranchModel() override { return { m_StampedG, m_StampedIeq, -1 }; }
+	virtual bool HasHistory() override { return true; }
+	virtual eCoupling GetCoupling() override { return m_step > 0.0 ? eCoupling::Conductance : eCoupling::None; }
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+	virtual u64 HashValues() override { return HashDouble(0, m_Capacitance); }
+	virtual double GetValue() override { return m_Capacitance; }
+	virtual void SetValue(double value) override { SetCapacitance(value); }
+
+	double GetCapacitance() { return m_Capacitance; }
+	void SetCapacitance(double capacitance)
+	{
+		m_Capacitance = capacitance;
+		MarkDirty(eDirty::Values);
+	}
+};
+
+
+class eInductor : public eElement
+{
+	double m_Inductance;
+	double m_Current = 0.0; // Branch current of the last solve
+	double m_StampedR = 0.0; // L / h in the assembled system
+	size_t m_BranchIdx = 0;
+
+public:
+
+	eInductor(double inductance);
+	virtual void Stamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual bool Restamp(CircuitMtx& mtx, eNode* GndNode) override;
+	virtual size_t GetNumBranches() override;
+	virtual void SetFirstBranch(size_t index) override { m_BranchIdx = index; }
+	virtual eBranchModel GetBranchModel() override;
+	virtual bool HasHistory() override { return true; }
+	virtual eCoupling GetCoupling() override { return m_step > 0.0 ? eCoupling::Conductance : eCoupling::Voltage; }
+	virtual void StampAC(ACStamper& stamper, eNode* GndNode) override;
+	virtual void SaveState(CheckpointWriter& writer) override;
+	virtual bool LoadState(CheckpointReader& reader) override;
+	virtual void ReadbackBranches(const Eigen::VectorXd& solution) override;
+	virtual u64 HashValues() override { return HashDouble(0, m_Inductance); }
+	virtual double GetValue() override { return m_Inductance; }
+	virtual void SetValue(double value) override { SetInductance(value); }
+
+	double GetCurrent() { return m_Current; }
+	double GetInductance() { return m_Inductance; }
+	void SetInductance(double inductance)
+	{
+		m_Inductance = inductance;
+		MarkDirty(eDirty::Values);
+	}
+};
+
+
+
+struct SolverStats
+{
+	u64 size = 0;					// Unknowns
+	u64 nnz = 0;					// Nonzeros of the system matrix
+	u64 factorNnz = 0;				// Nonzeros of the factorization
+	s64 fillIn = 0;					// factorNnz - nnz
+	u64 rank = 0;					// Pivots above the rounding level
+	double pivotGrowth = 0.0;		// max |U| / max |A|
+	double conditionEstimate = 0.0;	// max |U(k,k)| / min |U(k,k)|, cheap lower bound
+	u32 iterations = 0;				// Iterations of the solve, 0 for the direct solver
+};
+
+
+// Stamps of a range of elements recorded instead of written, binned by the column block they land in
+// (right hand side entries by row), see Circuit::RecordStamps
+struct StampBuffer
+{
+	struct Entry
+	{
+		u32 row;
+		u32 col;	// RhsColumn for b
+		double value;
+	};
+
+	static constexpr u32 RhsColumn = ~0u;
+
+	std::vector<std::vector<Entry>> bins;
+	u32 blockShift = 0;
+
+	// Keeps the capacity of the bins
+	void Begin(size_t numBlocks, u32 shift)
+	{
+		if (bins.size() < numBlocks)
+			bins.resize(numBlocks);
+		for (auto& bin : bins)
+			bin.clear();
+		blockShift = shift;
+	}
+
+	void Add(u64 row, u64 col, double value) { bins[col >> blockShift].push_back({ u32(row), u32(col), value }); }
+	void AddRhs(u64 row, double value) { bins[row >> blockShift].push_back({ u32(row), RhsColumn, value }); }
+};
+
 
 class CircuitMtx
 {
+public:
+	static constexpr int MaxLowRankTerms = 16;
+
+	// Factors of an assembled system, shared with the SolutionCache. A shared one is never written
+	// again, the next Factorize() starts a new one
+	struct Factorization
+	{
+		Eigen::PartialPivLU<Eigen::MatrixXd> lu;
+		SolverStats stats;
+	};
+
+private:
+	// A = A0 + delta * u * u^T, u = e(i) - e(j), an index of -1 is the ground
+	struct LowRankTerm
+	{
+		s64 i;
+		s64 j;
+		double delta;
+	};
+
+	using SmallMatrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, MaxLowRankTerms, MaxLowRankTerms>;
+	using SmallVector = Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MaxLowRankTerms, 1>;
+
 	u64 m_NumNodes = 0;
 
 	Eigen::MatrixXd A; // Circuit matrix
 	Eigen::VectorXd x; // Solution
-	Eigen::VectorXd b; // urrents
+	Eigen::VectorXd b; // Currents
+
+	// Partial pivoting LU factors and solves in its own storage, so it doesn't allocate
+	// while the size stays the same and nothing else holds it
+	std::shared_ptr<Factorization> m_Factors;
+	SolverStats m_Stats;
+	bool m_Factored = false;
+
+	// Conductance changes since the last factorization, solved with the Woodbury identity
+	// against the old factors instead of factoring again
+	std::vector<LowRankTerm> m_Terms;
+	Eigen::MatrixXd m_Z;	// A0^-1 * u per term
+	Eigen::VectorXd m_U;
+
+	void UpdateStats();
+	bool SolveLowRank();
+
+	// Set while a pool thread stamps its share of the elements
+	static inline thread_local StampBuffer* t_Recording = nullptr;
 
 public:
 	
 	CircuitMtx()
 	{
+		m_Terms.reserve(MaxLowRankTerms); // The first edits of a session don't grow it
 		Reset();
 	}
 
+	void Factorize()
+	{
+		if (!m_Factors || m_Factors.use_count() > 1)
+			m_Factors = std::make_shared<Factorization>();
+
+		{
+			SM_PROFILE_SCOPE("Factorize");
+			m_Factors->lu.compute(A);
+		}
+
+		m_Factored = true;
+		m_Terms.clear();
+		UpdateStats();
+		m_Factors->stats = m_Stats;
+	}
+
+	// Uses the factorization from the last Factorize() call and the conductance changes since.
+	// False if the changes made the system singular, it needs a Factorize() then
+	bool SolveFactorized()
+	{
+		SM_PROFILE_SCOPE("CircuitMtx::Solve");
+		x.noalias() = m_Factors->lu.solve(b);
+
+		return m_Terms.empty() || SolveLowRank();
+	}
+
+	bool IsFactorized() const { return m_Factored; }
+
+	// The factors of the assembled system as it is, nullptr if there are none or changes since
+	std::shared_ptr<Factorization> ShareFactorization() const
+	{
+		return m_Factored && m_Terms.empty() ? m_Factors : nullptr;
+	}
+
+	// Takes over a solution computed before, with the factors it was solved with (nullptr leaves the
+	// system unfactored). A stays as it is, only the next assembly brings it up to date
+	void AdoptSolution(std::shared_ptr<Factorization> factors, const Eigen::VectorXd& solution, const Eigen::VectorXd& rhs)
+	{
+		x = solution;
+		b = rhs;
+		m_Terms.clear();
+		m_Factored = factors != nullptr;
+		if (factors)
+			m_Factors = std::move(factors);
+
+		m_Stats = m_Factored ? m_Factors->stats : SolverStats();
+	}
+
+	// Adds delta between rows i and j (-1 for the ground) to the assembled matrix, the way a resistor
+	// stamps. False when there is no factorization to update or too many changes piled up
+	bool AddConductance(s64 i, s64 j, double delta);
+
+	// Statistics of the last factorization
+	const SolverStats& GetStats() const { return m_Stats; }
+
 	// Ax = b
 	void Solve() 
 	{
-		x = A.colPivHouseholderQr().solve(b);
+		Factorize();
+		SolveFactorized();
 	}
 
 	double GetVoltage(int node) {
@@ -172,16 +600,70 @@ public:
 	Eigen::VectorXd& GetVector() { return b; }
 	Eigen::VectorXd& GetSolution() { return x; }
 
+	// What the elements stamp through, A(row, col) += value and b(row) += value. Recorded instead
+	// when the calling thread assembles in parallel
+	void Add(u64 row, u64 col, double value)
+	{
+		if (t_Recording)
+			t_Recording->Add(row, col, value);
+		else
+			A(row, col) += value;
+	}
+
+	void AddRhs(u64 row, double value)
+	{
+		if (t_Recording)
+			t_Recording->AddRhs(row, value);
+		else
+			b(row) += value;
+	}
+
+	// Routes the Add() calls of the calling thread into buffer, nullptr writes again
+	static void SetRecording(StampBuffer* buffer) { t_Recording = buffer; }
+
+	// Sums the buffers into the zeroed system, a column block per task on the pool when given. See
+	// Circuit::RecordStamps
+	void ApplyStamps(const std::vector<StampBuffer>& buffers, size_t numBuffers, ThreadPool* pool);
+
+	// Takes a solution computed without the matrix (see MultigridSolver), A is released and nothing
+	// is factored
+	void AdoptIterative(Eigen::VectorXd&& solution, Eigen::VectorXd&& rhs, const SolverStats& stats)
+	{
+		A.resize(0, 0);
+		x = std::move(solution);
+		b = std::move(rhs);
+		m_NumNodes = u64(x.size());
+		m_Factored = false;
+		m_Terms.clear();
+		m_Stats = stats;
+	}
+
+	// Zeroes the system in place
 	void Clear()
 	{
-		A = Eigen::MatrixXd::Zero(m_NumNodes, m_NumNodes);
-		x = Eigen::VectorXd::Zero(m_NumNodes);
-		b = Eigen::VectorXd::Zero(m_NumNodes);
+		A.setZero();
+		x.setZero();
+		b.setZero();
+		m_Factored = false;
+		m_Terms.clear();
+	}
+
+	// Resize for a new assembly, old values are not kept
+	// No allocation when the size doesn't change
+	void SetSize(u64 numTotal)
+	{
+		A.resize(numTotal, numTotal);
+		x.resize(numTotal);
+		b.resize(numTotal);
+		m_NumNodes = numTotal;
+		m_Factored = false;
 	}
 	
 	void Reset()
 	{
 		m_NumNodes = 0;
+		m_Factored = false;
+		m_Terms.clear();
 		A = Eigen::MatrixXd::Zero(m_NumNodes, m_NumNodes);
 		x = Eigen::VectorXd::Zero(m_NumNodes);
 		b = Eigen::VectorXd::Zero(m_NumNodes);
@@ -206,22 +688,26 @@ public:
 		b = std::move(newB);
 
 		m_NumNodes = numTotal;
+		m_Factored = false;
+		m_Terms.clear();
 	}
 
 	u64 GetNumNodes() { return m_NumNodes; }
 
 	void PrintMatrix()
 	{
+		char buffer[64];
 		for (int i = 0; i < A.rows(); i++)
 		{
 			std::string row = "";
 			for (int j = 0; j < A.cols(); j++)
 			{
-				row += std::format("{:.3f}\t", (A(i, j)));
+				std::snprintf(buffer, sizeof(buffer), "%.3f\t", A(i, j));
+				row += buffer;
 			}
 
-			row += " | " + std::format("{:.3f}", x(i));
-			row += " | " + std::format("{:.3f}",b(i));
+			std::snprintf(buffer, sizeof(buffer), " | %.3f | %.3f", x(i), b(i));
+			row += buffer;
 			std::cout << row << std::endl;
 		}
 	}
@@ -229,6 +715,19 @@ public:
 
 
 
+// Post-solve quantities, one entry per element in the order they were added. An element of more
+// than two pins has the current into its pin 0 and the power over all its pins, every pin counts in
+// the residuals
+struct BranchResults
+{
+	Eigen::ArrayXd voltage;		// v(pin 0) - v(pin 1)
+	Eigen::ArrayXd current;		// From pin 0 to pin 1 through the element
+	Eigen::ArrayXd power;		// Absorbed, negative for a source delivering power
+	Eigen::ArrayXd nodeResidual;	// KCL sum of the currents leaving every node, should be ~0
+	double maxResidual = 0.0;
+};
+
+
 class Circuit
 {
 	using UniquePtrNodeTy = std::unique_ptr<eNode>;
@@ -244,18 +743,160 @@ class Circuit
 	CircuitMtx m_Matrix;
 	eNode* m_GroundNode = nullptr;
 
+	// Edits since the last UpdateSolution()
+	eDirty m_Dirty = eDirty::None;
+	std::vector<eElement*> m_DirtyElements;
+
+	// Flat copy of the element models for ComputeBranchCurrents, rebuilt after a stamp or an edit
+	// Rows index the padded solution, its last entry is the ground (0 V)
+	Eigen::ArrayXi m_BranchFrom;
+	Eigen::ArrayXi m_BranchTo;
+	Eigen::ArrayXi m_BranchRow;
+	Eigen::ArrayXd m_BranchG;
+	Eigen::ArrayXd m_BranchIeq;
+	std::vector<int> m_BranchNodes;	// Node index of pin 0 and pin 1 per element, -1 if open
+	std::vector<size_t> m_MultiportElements;	// Out of the table, they give their pin currents
+	std::vector<double> m_PinCurrents;
+	bool m_BranchTableValid = false;
+
+	Eigen::VectorXd m_PaddedSolution;
+	BranchResults m_Branches;
+
+	std::vector<eElement*> m_BranchElements; // Elements with rows of their own, numbered by NumberUnknowns
+	std::vector<eElement*> m_HistoryElements; // Restamped every transient step, also from NumberUnknowns
+	std::vector<eElement*> m_NonlinearElements; // Newton iteration after every solve, also from NumberUnknowns
+
+	// Nonlinear devices by model type, built from the assembled system
+	std::unique_ptr<DiodeBatch> m_Diodes;
+	bool m_NonlinearValid = false;
+	u32 m_NewtonIterations = 0;
+	bool m_NewtonConverged = true;
+
+	// Parallel assembly, only for circuits big enough to pay for the merge
+	ThreadPool* m_Pool = nullptr;
+	size_t m_ParallelMinElements = 0;
+	std::vector<StampBuffer> m_StampBuffers;	// One per element chunk, kept for their capacity
+	size_t m_NumStampBuffers = 0;				// Filled by the last RecordStamps()
+	size_t m_NumStampedUnknowns = 0;
+
+	std::unique_ptr<StructureCheck> m_StructureCheck;
+
+	// Solutions of states seen before, the hash is only kept while a cache is set
+	SolutionCache* m_SolutionCache = nullptr;
+	u64 m_Hash = 0;					// Sum of the element shares
+	size_t m_NumTransient = 0;		// Elements stamping a history or an operating point, the solution isn't theirs alone
+	bool m_HashValid = false;		// Rebuilt on the next UpdateHash() after a topology edit
+	StampBuffer m_ReplayStamps;
+
+	eSolverMode m_SolverMode = eSolverMode::Direct;
+	std::unique_ptr<MultigridSolver> m_Multigrid;
+
+	void BuildBranchTable();
+	void ApplyRecordedStamps();
+	void PadSolution();
+
+	void BuildNonlinear();
+	bool SolveNonlinear();
+	bool SolveMultigrid();
+
+	void HashElement(eElement* element, size_t index);
+	bool UpdateHash();
+	void RestoreSolution(const std::shared_ptr<CircuitMtx::Factorization>& factors, const Eigen::VectorXd& solution, const Eigen::VectorXd& rhs);
+
 public:
 
-	Circuit() = default;
+	Circuit();
+	~Circuit();
+
+	Circuit(const Circuit&) = delete;
+	Circuit& operator=(const Circuit&) = delete;
 
 	void Reset()
+	{
+		Clear();
+		m_Matrix.Reset();
+	}
+
+	// Reset that keeps the matrix storage, a next circuit of the same size assembles without allocating
+	void Clear()
 	{
 		m_Elements.clear();
 		m_Nodes.clear();
-		m_Matrix.Reset();
+		m_Matrix.Clear();
 		m_GroundNode = nullptr;
+		m_Dirty = eDirty::None;
+		m_DirtyElements.clear();
+		m_BranchElements.clear();
+		m_HistoryElements.clear();
+		m_NonlinearElements.clear();
+		m_NonlinearValid = false;
+		m_HashValid = false;
 	}
 
+	// Called by the elements, edits only accumulate here until UpdateSolution()
+	void MarkDirty(eElement* element, eDirty level)
+	{
+		if (level == eDirty::Values && element && !element->m_DirtyQueued)
+		{
+			element->m_DirtyQueued = true;
+			m_DirtyElements.push_back(element);
+		}
+
+		if (level == eDirty::Topology)
+			m_HashValid = false;
+
+		m_Dirty = std::max(m_Dirty, level);
+		m_BranchTableValid = false;
+	}
+
+	eDirty GetDirty() const { return m_Dirty; }
+
+	// Brings the node voltages up to date with the edits since the last call, doing the least work
+	// the edits allow. Meant to run once per frame, so all edits of the frame cost one solve.
+	// False if there was nothing to do, or if CheckStructure() failed (all voltages are 0 then)
+	bool UpdateSolution();
+
+	// Graph checks of the connections before any numeric work : floating subnets, loops of voltage
+	// sources and inductors, structural rank of the system. False if the system can't be solved,
+	// GetStructureCheck() has the offending elements and nodes
+	bool CheckStructure();
+	const StructureCheck* GetStructureCheck() const { return m_StructureCheck.get(); }
+
+	// One transient step of the step set with SetStep(), the reactive elements take their history
+	// from the last solution. Pending edits are applied in the same solve
+	void Step();
+
+	// State of the last solve for a checkpoint, pending edits are not part of it. LoadState needs
+	// a circuit built the same way, it assembles and factors and leaves nothing pending. A linear
+	// circuit factored with nothing pending and the same steps keeps its factors, only the vectors
+	// and histories are read
+	void SaveState(CheckpointWriter& writer);
+	bool LoadState(CheckpointReader& reader);
+
+	// Newton iterations of the last UpdateSolution() (0 without nonlinear devices), and whether the
+	// operating points settled within MaxNewtonIterations. A solve that didn't keeps the last iterate
+	static constexpr u32 MaxNewtonIterations = 100;
+	u32 GetNewtonIterations() const { return m_NewtonIterations; }
+	bool IsConverged() const { return m_NewtonConverged; }
+
+	// Multigrid takes the circuits it can solve from the next UpdateSolution() on : resistive ones
+	// (capacitors in a transient step too) with every voltage source or DC inductor to the ground.
+	// Anything else, nonlinear devices included, goes to the direct solver. No restamps or solution
+	// cache, a value edit solves again on the multigrid setup of the last topology
+	void SetSolverMode(eSolverMode mode)
+	{
+		m_SolverMode = mode;
+		MarkDirty(nullptr, eDirty::Topology);
+	}
+
+	eSolverMode GetSolverMode() const { return m_SolverMode; }
+	const MultigridSolver* GetMultigrid() const { return m_Multigrid.get(); }
+
+	// Currents, power and KCL residuals of every element from the last solution in one pass,
+	// also sets the total current of the nodes
+	void ComputeBranchCurrents();
+	const BranchResults& GetBranchResults() const { return m_Branches; }
+
 	eNode* CreateNode()
 	{
 		size_t index = m_Nodes.size();
@@ -263,14 +904,15 @@ public:
 		if (!m_GroundNode)
 			m_GroundNode = m_Nodes.back().get(); // Assume the first node is the ground
 
-		m_Matrix.Resize(m_Nodes.size() - 1); // Resize without the ground node
-		return m_Nodes.back().get();
+		return m_Nodes.back().get(); // Matrix is sized in AssembleMatrix
 	}
 
 	template <typename T, typename... Args>
 	T* AddElement(Args&&... args)
 	{
 		m_Elements.emplace_back(std::make_unique<T>(std::forward<Args>(args)...));
+		m_Elements.back()->m_Circuit = this;
+		MarkDirty(nullptr, eDirty::Topology);
 		return static_cast<T*>(m_Elements.back().get());
 	}
 
@@ -284,6 +926,16 @@ public:
 		return AddElement<eResistor>(resistance);
 	}
 
+	eCapacitor* AddCapacitor(double capacitance)
+	{
+		return AddElement<eCapacitor>(capacitance);
+	}
+
+	eInductor* AddInductor(double inductance)
+	{
+		return AddElement<eInductor>(inductance);
+	}
+
 	void CreateNodeBetween(eElement* element1, eElement* element2, int pinElement_1, int pinElement_2)
 	{
 		ePin* pin1 = element1->GetEpin(pinElement_1);
@@ -298,28 +950,114 @@ public:
 
 	void RemoveElement(eElement* element)
 	{
-		auto it = std::ranges::find_if(m_Elements, [element](const auto& e)
-			{ 
-				return e.get() == element; 
-			});
-
-		if (it != m_Elements.end())
-			m_Elements.erase(it); // Pins will be released from connected nodes in destruct
+		DetachElement(element); // Destroyed here
 	}
 
+	// Takes the element out of the circuit without destroying it, its pins released from their nodes.
+	// nullptr if it isn't in the circuit. index gets its position
+	std::unique_ptr<eElement> DetachElement(eElement* element, size_t* index = nullptr);
+
+	// Destroys the elements in one pass over the circuit, DetachElement one by one would take a pass
+	// per element
+	void RemoveElements(const std::vector<eElement*>& elements);
+
+	// Takes every element out in order, pins released, as DetachElement. The nodes stay
+	std::vector<std::unique_ptr<eElement>> DetachElements();
+
+	// Nodes without pins out (not the ground), the others numbered again in order. Node indices held
+	// elsewhere, a CircuitHistory's included, don't survive it. Returns the nodes removed
+	size_t RemoveUnusedNodes();
+
+	// Puts a detached element back at index (the end if past it), the pins are connected after
+	eElement* InsertElement(std::unique_ptr<eElement> element, size_t index);
+
+	// The last node out and back in, for undoing CreateNode(). Only a node without pins comes out
+	std::unique_ptr<eNode> DetachLastNode();
+	eNode* AttachNode(std::unique_ptr<eNode> node);
+
 	void Connect(ePin* pin, eNode* node)
 	{
 		if (pin && node)
 			pin->ConnectToNode(node);
 	}
 
-	void AssembleMatrix()
+	// Node rows without the ground node, followed by the branch rows of the elements
+	size_t NumberUnknowns()
 	{
-		m_Matrix.Clear();
+		size_t numTotal = m_Nodes.empty() ? 0 : m_Nodes.size() - 1;
+
+		m_BranchElements.clear();
+		m_HistoryElements.clear();
+		m_NonlinearElements.clear();
 		for (auto& element : m_Elements)
 		{
-			element->Stamp(m_Matrix, m_GroundNode);
+			if (element->HasHistory())
+				m_HistoryElements.push_back(element.get());
+
+			if (element->IsNonlinear())
+				m_NonlinearElements.push_back(element.get());
+
+			if (size_t numBranches = element->GetNumBranches())
+			{
+				element->SetFirstBranch(numTotal);
+				numTotal += numBranches;
+				m_BranchElements.push_back(element.get());
+			}
 		}
+
+		return numTotal;
+	}
+
+	void AssembleMatrix()
+	{
+		SM_PROFILE_SCOPE("AssembleMatrix");
+
+		RecordStamps();
+		ApplyRecordedStamps();
+	}
+
+	// Numbers the unknowns and records what every element stamps, without touching the system. The
+	// structure check reads the recording, the assembly sums it, so a full solve stamps once. Returns
+	// the number of unknowns
+	size_t RecordStamps();
+	const std::vector<StampBuffer>& GetStampBuffers() const { return m_StampBuffers; }
+	size_t GetNumStampBuffers() const { return m_NumStampBuffers; }
+
+	// Smaller circuits stamp serially even with a pool : below it, waking the workers and summing
+	// their buffers in element order costs more than the stamping the workers take over
+	static constexpr size_t ParallelAssemblyMinElements = 4096;
+
+	// Stamps on the pool from then on, nullptr for serial. The result is bit for bit the serial one.
+	// minElements lowers the size the pool is used from, tests force the parallel path with 0
+	void SetThreadPool(ThreadPool* pool, size_t minElements = ParallelAssemblyMinElements)
+	{
+		m_Pool = pool;
+		m_ParallelMinElements = minElements;
+	}
+	ThreadPool* GetThreadPool() const { return m_Pool; }
+	bool UsesParallelAssembly() const { return m_Pool && m_Elements.size() >= m_ParallelMinElements; }
+
+	// UpdateSolution() looks every state up in the cache first and adds what it solves, nullptr to
+	// stop. Only used while no element stamps a transient history or an operating point. The cache
+	// can be shared by circuits built the same way
+	void SetSolutionCache(SolutionCache* cache)
+	{
+		m_SolutionCache = cache;
+		m_HashValid = false;
+	}
+
+	SolutionCache* GetSolutionCache() const { return m_SolutionCache; }
+
+	// Canonical hash of the circuit : element types, values, time steps and connections, in element
+	// order (it numbers the unknowns). The same circuit hashes the same however it got there.
+	// Up to date after UpdateSolution() while a cache is set
+	u64 GetHash() const { return HashCombine(HashCombine(m_Hash, m_Nodes.size()), m_GroundNode ? m_GroundNode->GetIndex() : 0); }
+
+	// Time step for the reactive elements, 0 means DC
+	void SetStep(double step)
+	{
+		for (auto& element : m_Elements)
+			element->SetStep(step);
 	}
 
 	eNode* LookupGroundNode()
@@ -337,21 +1075,8 @@ public:
 			}
 		}
 
-		// AC case
-		eNode* minVoltNode = m_Nodes[0].get();
-		double minVoltage = std::abs(minVoltNode->GetVoltage());
-
-		for (auto& node : m_Nodes)
-		{
-			double nodeVoltage = std::abs(node->GetVoltage());
-			if (nodeVoltage < minVoltage)
-			{
-				minVoltage = nodeVoltage;
-				minVoltNode = node.get();
-			}
-		}
-
-		return minVoltNode;
+		// No source to reference, CheckStructure() makes sure every node is tied to the matrix ground
+		return m_GroundNode;
 	}
 
 	void AdjustVoltages(eNode* ToDesiredGround)
@@ -359,6 +1084,8 @@ public:
 		if (!ToDesiredGround)
 			return;
 
+		SM_PROFILE_SCOPE("AdjustVoltages");
+
 		double offset = ToDesiredGround->GetVoltage();
 		offset = -offset;
 
@@ -374,9 +1101,26 @@ public:
 		return node->GetIndex() > m_GroundNode->GetIndex() ? node->GetIndex() - 1 : node->GetIndex();
 	}
 
+	void FactorMatrix()
+	{
+		m_Matrix.Factorize();
+	}
+
+	void SolveMatrix()
+	{
+		m_Matrix.SolveFactorized();
+	}
+
 	void Solve()
 	{
 		m_Matrix.Solve();
+		ReadbackVoltages();
+	}
+
+	void ReadbackVoltages()
+	{
+		SM_PROFILE_SCOPE("Readback");
+
 		for (auto& node : m_Nodes)
 		{
 			if (node.get() == m_GroundNode)
@@ -389,6 +1133,23 @@ public:
 				node->SetVoltage(m_Matrix.GetVoltage(idx));
 			}
 		}
+
+		for (eElement* element : m_BranchElements)
+			element->ReadbackBranches(m_Matrix.GetSolution());
+	}
+
+	CircuitMtx& GetMatrix() { return m_Matrix; }
+	size_t GetNumNodes() const { return m_Nodes.size(); }
+	size_t GetNumElements() const { return m_Elements.size(); }
+	eNode* GetNode(size_t index) const { return m_Nodes[index].get(); }
+	eElement* GetElement(size_t index) const { return m_Elements[index].get(); }
+	eNode* GetGroundNode() const { return m_GroundNode; }
+
+	template<typename Fn>
+	void ForEachElement(Fn&& fn)
+	{
+		for (auto& element : m_Elements)
+			fn(element.get());
 	}
 
 	void Test1()
@@ -471,15 +1232,95 @@ public:
 };
 
 
+// Real time transient driver
+//
+// Holds simulated time to wall time at a target rate. Every Update() owes rate * frame time of
+// simulated time and runs the steps for it within a wall clock budget, sized from the measured cost
+// of a step. A backlog is paid back in bounded bursts and what is older than MaxLag is dropped, so a
+// slow circuit never stalls the frame. Under load the results are published less often first, the
+// stepping only gives way when that is not enough.
+
 class Simulation
 {
+public:
+	// Called with the simulated time whenever results are published
+	using OutputFn = std::function<void(double time)>;
+
+	static constexpr size_t MaxOutputInterval = 64;	// Steps per output at the most degraded
+
+private:
+	Circuit& m_Circuit;
+	OutputFn m_Output;
+
+	double m_Time = 0.0;
+	double m_Step = 1e-5;
+	double m_TargetRate = 1e-3;		// Simulated seconds per wall second
+	double m_FrameBudget = 0.008;	// Wall seconds of stepping per Update
+	double m_MaxLag = 0.25;			// Wall seconds of backlog worth catching up
+	bool m_Running = false;
+
+	double m_Owed = 0.0;			// Simulated seconds not stepped yet
+	double m_StepCost = 0.0;		// Wall seconds per step, moving average
+	double m_OutputCost = 0.0;		// Wall seconds per output, moving average
+	size_t m_OutputInterval = 1;	// Steps per output
+	size_t m_StepsSinceOutput = 0;
+	int m_SlackFrames = 0;			// Updates in a row that kept up
+
+	double m_RealTimeFactor = 0.0;	// Achieved simulated seconds per wall second, moving average
+	double m_DroppedTime = 0.0;		// Simulated seconds given up
+	size_t m_LastSteps = 0;
+
+	size_t PlanSteps() const;
+	void Publish();
+	void AdaptOutputRate(bool behind);
+
+	// Steps up to the planned count or the budget, whichever ends first. Returns the steps done
+	size_t RunCircuit(size_t planned);
+	void SolveCircuit();
+
+public:
+
+	explicit Simulation(Circuit& circuit);
+
+	// Once per frame with the wall time since the last call. Applies pending edits when stopped, or
+	// running without a step owed this frame
+	void Update(double frameTime);
+
 	void StartSim();
 	void StopSim();
+
+	// Back to t = 0 and the DC operating point
 	void Reset();
-	void Update();
 
-	void RunCircuit();
-	void SolveCircuit();
-	void SolveMatrix();
+	// Steps without pacing or outputs, for headless runs
+	void RunSteps(size_t numSteps);
+
+	// Time, step and circuit state, see Checkpoint.h. Restoring publishes the restored state
+	void SaveState(CheckpointWriter& writer);
+	bool LoadState(CheckpointReader& reader);
+
+	bool IsRunning() const { return m_Running; }
+
+	void SetOutput(OutputFn output) { m_Output = std::move(output); }
+
+	void SetStep(double step);
+	double GetStep() const { return m_Step; }
+
+	void SetTargetRate(double rate) { m_TargetRate = rate; }
+	double GetTargetRate() const { return m_TargetRate; }
+
+	void SetFrameBudget(double seconds) { m_FrameBudget = seconds; }
+	void SetMaxLag(double seconds) { m_MaxLag = seconds; }
+
+	double GetTime() const { return m_Time; }
+
+	// Achieved simulated seconds per wall second, and the same against the target (1 = on pace)
+	double GetRealTimeFactor() const { return m_RealTimeFactor; }
+	double GetPaceRatio() const { return m_TargetRate > 0.0 ? m_RealTimeFactor / m_TargetRate : 0.0; }
+
+	double GetStepCost() const { return m_StepCost; }
+	size_t GetOutputInterval() const { return m_OutputInterval; }
+	size_t GetLastSteps() const { return m_LastSteps; }
+	double GetDroppedTime() const { return m_DroppedTime; }
 };
 
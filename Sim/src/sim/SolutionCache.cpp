@@ -0,0 +1,73 @@
+#include "SolutionCache.h"
+
+
+SolutionCache::SolutionCache(size_t maxEntries, size_t maxBytes)
+	: m_MaxEntries(std::max<size_t>(maxEntries, 1))
+	, m_MaxBytes(maxBytes)
+{
+}
+
+
+const SolutionCache::Entry* SolutionCache::Find(u64 key, size_t numUnknowns, bool needFactors)
+{
+	auto found = m_Index.find(key);
+	if (found == m_Index.end() || size_t(found->second->solution.size()) != numUnknowns ||
+		(needFactors && !found->second->factors))
+	{
+		m_NumMisses++;
+		return nullptr;
+	}
+
+	m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+	m_NumHits++;
+	return &m_Entries.front();
+}
+
+
+void SolutionCache::Insert(u64 key, const Eigen::VectorXd& solution, const Eigen::VectorXd& rhs, std::shared_ptr<CircuitMtx::Factorization> factors)
+{
+	size_t n = size_t(solution.size());
+	size_t bytes = sizeof(Entry) + 2 * n * sizeof(double);
+	size_t factorBytes = n * n * sizeof(double) + 2 * n * sizeof(int);
+	if (factors && bytes + factorBytes > m_MaxBytes)
+		factors = nullptr;
+	if (factors)
+		bytes += factorBytes;
+
+	if (bytes > m_MaxBytes)
+		return;
+
+	auto found = m_Index.find(key);
+	if (found != m_Index.end())
+	{
+		m_Bytes -= found->second->bytes;
+		m_Entries.erase(found->second);
+		m_Index.erase(found);
+	}
+
+	m_Entries.push_front({ key, solution, rhs, std::move(factors), bytes });
+	m_Index[key] = m_Entries.begin();
+	m_Bytes += bytes;
+
+	Evict();
+}
+
+
+void SolutionCache::Evict()
+{
+	while (m_Entries.size() > m_MaxEntries || m_Bytes > m_MaxBytes)
+	{
+		m_Bytes -= m_Entries.back().bytes;
+		m_Index.erase(m_Entries.back().key);
+		m_Entries.pop_back();
+		m_NumEvictions++;
+	}
+}
+
+
+void SolutionCache::Clear()
+{
+	m_Entries.clear();
+	m_Index.clear();
+	m_Bytes = 0;
+}
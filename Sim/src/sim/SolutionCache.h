@@ -0,0 +1,70 @@
+#pragma once
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "Scheme.h"
+
+// Solutions of circuit states solved before, by Circuit::GetHash()
+//
+// Interactive editing keeps coming back to states it had (undo, a value toggled back, a sweep over
+// the same points). A hit hands the circuit the solution and the factorization it was solved with :
+// no assembly, no structure check, no factorization, only the elements going over their stamps
+// again to know what they stamped. Solutions found by a low rank update are kept without factors,
+// they only save the solve of the next update of the same kind.
+//
+// Least recently used entries go first, past the entry count or the byte budget. A factorization
+// takes n^2 doubles, one that doesn't fit the budget alone is not kept.
+
+class SolutionCache
+{
+public:
+	struct Entry
+	{
+		u64 key;
+		Eigen::VectorXd solution;
+		Eigen::VectorXd rhs;
+		std::shared_ptr<CircuitMtx::Factorization> factors;	// nullptr if solved by a low rank update
+		size_t bytes;
+	};
+
+private:
+	std::list<Entry> m_Entries;		// Most recently used first
+	std::unordered_map<u64, std::list<Entry>::iterator> m_Index;
+
+	size_t m_MaxEntries;
+	size_t m_MaxBytes;
+	size_t m_Bytes = 0;
+
+	u64 m_NumHits = 0;
+	u64 m_NumMisses = 0;
+	u64 m_NumEvictions = 0;
+
+	void Evict();
+
+public:
+
+	explicit SolutionCache(size_t maxEntries = 64, size_t maxBytes = size_t(256) << 20);
+
+	SolutionCache(const SolutionCache&) = delete;
+	SolutionCache& operator=(const SolutionCache&) = delete;
+
+	// nullptr on a miss, also when the entry has no factors and they are needed, or its size
+	// doesn't match (a hash collision). Makes the entry the most recent
+	const Entry* Find(u64 key, size_t numUnknowns, bool needFactors);
+
+	// Replaces an entry with the same key
+	void Insert(u64 key, const Eigen::VectorXd& solution, const Eigen::VectorXd& rhs, std::shared_ptr<CircuitMtx::Factorization> factors);
+
+	// Keeps the counters
+	void Clear();
+
+	size_t GetNumEntries() const { return m_Entries.size(); }
+	size_t GetBytes() const { return m_Bytes; }
+
+	u64 GetNumHits() const { return m_NumHits; }
+	u64 GetNumMisses() const { return m_NumMisses; }
+	u64 GetNumEvictions() const { return m_NumEvictions; }
+	double GetHitRate() const { return m_NumHits + m_NumMisses ? double(m_NumHits) / double(m_NumHits + m_NumMisses) : 0.0; }
+	void ResetCounters() { m_NumHits = m_NumMisses = m_NumEvictions = 0; }
+};
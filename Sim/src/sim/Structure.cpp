@@ -0,0 +1,395 @@
+#include "Structure.h"
+
+#include <algorithm>
+#include <numeric>
+
+
+// Entries of the matrix that can't be zero whatever the other values
+static bool IsStructural(const StampBuffer::Entry& entry)
+{
+	return entry.col != StampBuffer::RhsColumn && entry.value != 0.0;
+}
+
+
+static bool GetPinNodes(eElement* element, eNode*& node0, eNode*& node1)
+{
+	ePin* pin0 = element->GetEpin(0);
+	ePin* pin1 = element->GetEpin(1);
+	node0 = pin0 ? pin0->GetConnectedNode() : nullptr;
+	node1 = pin1 ? pin1->GetConnectedNode() : nullptr;
+	return node0 && node1;
+}
+
+
+u32 StructureCheck::Find(std::vector<u32>& parent, u32 node)
+{
+	// Path halving
+	while (parent[node] != node)
+	{
+		parent[node] = parent[parent[node]];
+		node = parent[node];
+	}
+	return node;
+}
+
+
+const char* StructureCheck::GetIssueName(eStructureIssue type)
+{
+	switch (type)
+	{
+	case eStructureIssue::FloatingSubnet:	return "floating_subnet";
+	case eStructureIssue::VoltageLoop:		return "voltage_loop";
+	case eStructureIssue::SingularRows:		return "singular_rows";
+	}
+	return "";
+}
+
+
+bool StructureCheck::Run(Circuit& circuit)
+{
+	SM_PROFILE_SCOPE("StructureCheck");
+
+	m_Issues.clear();
+	m_NumUnknowns = 0;
+	m_StructuralRank = 0;
+
+	if (circuit.GetNumNodes() == 0)
+		return true;
+
+	CheckConnectivity(circuit);
+
+	// Anything found so far also shows up as singular rows, named less helpfully
+	if (m_Issues.empty())
+		CheckRank(circuit);
+
+	return m_Issues.empty();
+}
+
+
+void StructureCheck::CheckConnectivity(Circuit& circuit)
+{
+	u32 numNodes = u32(circuit.GetNumNodes());
+	m_Parent.resize(numNodes);
+	m_VoltageParent.resize(numNodes);
+	std::iota(m_Parent.begin(), m_Parent.end(), 0u);
+	std::iota(m_VoltageParent.begin(), m_VoltageParent.end(), 0u);
+	m_TreeElements.clear();
+
+	eNode* node0;
+	eNode* node1;
+
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+	{
+		eElement* element = circuit.GetElement(k);
+		eCoupling coupling = element->GetCoupling();
+		if (coupling == eCoupling::None)
+			continue;
+
+		// Every connected pin joins the first one, multiport elements (a reduced model) tie all
+		// their pins together
+		s64 first = -1;
+		for (size_t pin = 0; pin < element->GetNumPins(); pin++)
+		{
+			eNode* node = element->GetEpin(int(pin))->GetConnectedNode();
+			if (!node)
+				continue;
+
+			if (first < 0)
+				first = s64(node->GetIndex());
+			else
+				m_Parent[Find(m_Parent, u32(node->GetIndex()))] = Find(m_Parent, u32(first));
+		}
+
+		if (coupling == eCoupling::Voltage && GetPinNodes(element, node0, node1))
+		{
+			u32 a = u32(node0->GetIndex());
+			u32 b = u32(node1->GetIndex());
+			u32 rootA = Find(m_VoltageParent, a);
+			u32 rootB = Find(m_VoltageParent, b);
+			if (rootA == rootB)
+			{
+				ReportLoop(circuit, k, a, b);
+			}
+			else
+			{
+				m_VoltageParent[rootA] = rootB;
+				m_TreeElements.push_back(k);
+			}
+		}
+	}
+
+	// Every set apart from the one of the ground floats, the unused nodes included
+	u32 groundRoot = Find(m_Parent, u32(circuit.GetGroundNode()->GetIndex()));
+	size_t firstFloating = m_Issues.size();
+	m_IssueOfRoot.assign(numNodes, -1);
+
+	for (u32 i = 0; i < numNodes; i++)
+	{
+		u32 root = Find(m_Parent, i);
+		if (root == groundRoot)
+			continue;
+
+		if (m_IssueOfRoot[root] < 0)
+		{
+			m_IssueOfRoot[root] = s64(m_Issues.size());
+			m_Issues.push_back({ eStructureIssue::FloatingSubnet, {}, {} });
+		}
+		m_Issues[m_IssueOfRoot[root]].nodes.push_back(i);
+	}
+
+	if (m_Issues.size() == firstFloating)
+		return;
+
+	// Elements with a pin on a floating set, once per set
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+	{
+		eElement* element = circuit.GetElement(k);
+		for (size_t pin = 0; pin < element->GetNumPins(); pin++)
+		{
+			eNode* node = element->GetEpin(int(pin))->GetConnectedNode();
+			if (!node)
+				continue;
+
+			s64 issue = m_IssueOfRoot[Find(m_Parent, u32(node->GetIndex()))];
+			if (issue >= 0 && (m_Issues[issue].elements.empty() || m_Issues[issue].elements.back() != k))
+				m_Issues[issue].elements.push_back(k);
+		}
+	}
+}
+
+
+// The closing element and the path of the forest between its pins
+void StructureCheck::ReportLoop(Circuit& circuit, size_t closing, u32 from, u32 to)
+{
+	StructureIssue issue{ eStructureIssue::VoltageLoop, { closing }, { from } };
+
+	if (from != to)
+	{
+		// Only walked when there is a loop to report, allocating is fine here
+		size_t numNodes = circuit.GetNumNodes();
+		std::vector<std::vector<std::pair<u32, size_t>>> adjacency(numNodes);
+		eNode* node0;
+		eNode* node1;
+		for (size_t k : m_TreeElements)
+		{
+			GetPinNodes(circuit.GetElement(k), node0, node1);
+			adjacency[node0->GetIndex()].push_back({ u32(node1->GetIndex()), k });
+			adjacency[node1->GetIndex()].push_back({ u32(node0->GetIndex()), k });
+		}
+
+		std::vector<s64> viaElement(numNodes, -1);
+		std::vector<u32> previous(numNodes, ~0u);
+		std::vector<u32> queue = { from };
+		previous[from] = from;
+
+		for (size_t head = 0; head < queue.size() && previous[to] == ~0u; head++)
+		{
+			for (const auto& [next, k] : adjacency[queue[head]])
+			{
+				if (previous[next] != ~0u)
+					continue;
+
+				previous[next] = queue[head];
+				viaElement[next] = s64(k);
+				queue.push_back(next);
+			}
+		}
+
+		for (u32 node = to; node != from && previous[node] != ~0u; node = previous[node])
+		{
+			issue.elements.push_back(size_t(viaElement[node]));
+			issue.nodes.push_back(node);
+		}
+	}
+
+	m_Issues.push_back(std::move(issue));
+}
+
+
+void StructureCheck::CheckRank(Circuit& circuit)
+{
+	eNode* ground = circuit.GetGroundNode();
+
+	// The pattern exactly as the elements stamp it, from the recording the assembly sums after the
+	// check. The order of the entries doesn't matter here, every bin of every buffer is read
+	size_t n = circuit.RecordStamps();
+	m_NumUnknowns = n;
+	if (n == 0)
+		return;
+
+	const std::vector<StampBuffer>& buffers = circuit.GetStampBuffers();
+	size_t numBuffers = circuit.GetNumStampBuffers();
+	auto forEachStructural = [&](auto&& fn)
+	{
+		for (size_t i = 0; i < numBuffers; i++)
+		{
+			for (const std::vector<StampBuffer::Entry>& bin : buffers[i].bins)
+			{
+				for (const StampBuffer::Entry& entry : bin)
+				{
+					if (IsStructural(entry))
+						fn(entry);
+				}
+			}
+		}
+	};
+
+	m_RowStart.assign(n + 1, 0);
+	forEachStructural([this](const StampBuffer::Entry& entry) { m_RowStart[entry.row + 1]++; });
+	std::partial_sum(m_RowStart.begin(), m_RowStart.end(), m_RowStart.begin());
+
+	// Filled through the stack as a cursor per row, it is free until the matching
+	m_Columns.resize(m_RowStart[n]);
+	m_StackEdges.assign(m_RowStart.begin(), m_RowStart.end() - 1);
+	forEachStructural([this](const StampBuffer::Entry& entry) { m_Columns[m_StackEdges[entry.row]++] = entry.col; });
+
+	m_RowMatch.assign(n, -1);
+	m_ColumnMatch.assign(n, -1);
+	m_Visited.assign(n, 0);
+	m_VisitStamp = 0;
+
+	// Cheap passes first : the diagonal, then any free column. Node rows all have their diagonal,
+	// so only the branch rows are left to search for
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (u32 row = 0; row < n; row++)
+		{
+			if (m_RowMatch[row] >= 0)
+				continue;
+
+			for (u32 p = m_RowStart[row]; p < m_RowStart[row + 1]; p++)
+			{
+				u32 column = m_Columns[p];
+				if (m_ColumnMatch[column] < 0 && (pass == 1 || column == row))
+				{
+					m_RowMatch[row] = column;
+					m_ColumnMatch[column] = row;
+					break;
+				}
+			}
+		}
+	}
+
+	size_t numUnmatched = 0;
+	for (u32 row = 0; row < n; row++)
+	{
+		if (m_RowMatch[row] < 0 && !Augment(row))
+			numUnmatched++;
+	}
+
+	m_StructuralRank = n - numUnmatched;
+	if (numUnmatched == 0)
+		return;
+
+	StructureIssue issue{ eStructureIssue::SingularRows, {}, {} };
+
+	size_t numNodeRows = circuit.GetNumNodes() - 1;
+	size_t groundIndex = ground->GetIndex();
+	for (size_t row = 0; row < numNodeRows; row++)
+	{
+		if (m_RowMatch[row] < 0)
+			issue.nodes.push_back(row >= groundIndex ? row + 1 : row);
+	}
+
+	// The recording doesn't tell the elements apart, they stamp once more one by one. Only done when
+	// there is something to report, allocating is fine here
+	StampBuffer stamps;
+	stamps.Begin(1, 63);
+	CircuitMtx::SetRecording(&stamps);
+	for (size_t k = 0; k < circuit.GetNumElements(); k++)
+	{
+		stamps.bins[0].clear();
+		circuit.GetElement(k)->Stamp(circuit.GetMatrix(), ground);
+
+		// Zeros count here, an open element (R = inf) is on the row all the same
+		if (std::ranges::any_of(stamps.bins[0], [this](const StampBuffer::Entry& entry) { return entry.col != StampBuffer::RhsColumn && m_RowMatch[entry.row] < 0; }))
+			issue.elements.push_back(k);
+	}
+	CircuitMtx::SetRecording(nullptr);
+
+	m_Issues.push_back(std::move(issue));
+}
+
+
+// Augmenting path from a free row by depth first search, on explicit stacks so deep chains can't
+// overflow the call stack. m_StackColumns[level] leads from m_StackRows[level] to the next level.
+// A row entered is first looked over for a free column, otherwise the search would wander down the
+// whole mesh before coming back to the branch column next to where it started
+bool StructureCheck::Augment(u32 root)
+{
+	m_VisitStamp++;
+	m_StackRows.assign(1, root);
+	m_StackEdges.assign(1, m_RowStart[root]);
+	m_StackColumns.clear();
+
+	// Shift every row on the path to the column after it
+	auto apply = [this]()
+	{
+		for (size_t level = 0; level < m_StackRows.size(); level++)
+		{
+			m_RowMatch[m_StackRows[level]] = m_StackColumns[level];
+			m_ColumnMatch[m_StackColumns[level]] = m_StackRows[level];
+		}
+	};
+
+	auto lookahead = [this](u32 row)
+	{
+		for (u32 p = m_RowStart[row]; p < m_RowStart[row + 1]; p++)
+		{
+			u32 column = m_Columns[p];
+			if (m_ColumnMatch[column] < 0 && m_Visited[column] != m_VisitStamp)
+			{
+				m_Visited[column] = m_VisitStamp;
+				m_StackColumns.push_back(column);
+				return true;
+			}
+		}
+		return false;
+	};
+
+	if (lookahead(root))
+	{
+		apply();
+		return true;
+	}
+
+	while (!m_StackRows.empty())
+	{
+		size_t top = m_StackRows.size() - 1;
+		u32 row = m_StackRows[top];
+
+		if (m_StackEdges[top] == m_RowStart[row + 1])
+		{
+			m_StackRows.pop_back();
+			m_StackEdges.pop_back();
+			if (top > 0)
+				m_StackColumns.pop_back();
+			continue;
+		}
+
+		u32 column = m_Columns[m_StackEdges[top]++];
+		if (m_Visited[column] == m_VisitStamp)
+			continue;
+
+		m_Visited[column] = m_VisitStamp;
+		m_StackColumns.push_back(column);
+
+		if (m_ColumnMatch[column] < 0)
+		{
+			apply();
+			return true;
+		}
+
+		u32 next = u32(m_ColumnMatch[column]);
+		m_StackRows.push_back(next);
+		m_StackEdges.push_back(m_RowStart[next]);
+
+		if (lookahead(next))
+		{
+			apply();
+			return true;
+		}
+	}
+
+	return false;
+}
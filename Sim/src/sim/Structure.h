@@ -0,0 +1,80 @@
+#pragma once
+#include <vector>
+
+#include "sim/Scheme.h"
+
+// Structural checks of a circuit, before anything is factored
+//
+// Works on the connections alone, in time linear in the size of the circuit :
+//  - Floating subnets : union-find over the nodes along every element that couples its pins
+//    (eElement::GetCoupling), any set without the ground node has no defined potential.
+//  - Voltage loops : a spanning forest of the voltage defined branches (sources, inductors in DC),
+//    a branch closing a cycle in it fixes a loop voltage twice.
+//  - Structural rank : maximum bipartite matching of rows and columns over the stamped pattern,
+//    rows left unmatched are structurally singular whatever the values. The pattern comes from
+//    Circuit::RecordStamps(), the same recording the assembly then sums.
+// The first two explain most bad netlists in terms of elements, the rank check runs only when they
+// pass and catches the rest. Scratch is kept between runs, a passing check doesn't allocate.
+
+enum class eStructureIssue : u8
+{
+	FloatingSubnet,		// Nodes without a path to the ground
+	VoltageLoop,		// Loop of voltage defined branches, the elements of the loop
+	SingularRows,		// Rows no matching reaches, the nodes and elements on them
+};
+
+
+struct StructureIssue
+{
+	eStructureIssue type;
+	std::vector<size_t> elements;	// Positions in the circuit, in the order they were added
+	std::vector<size_t> nodes;		// Node indices
+};
+
+
+class StructureCheck
+{
+	// Union-find, by node index
+	std::vector<u32> m_Parent;
+	std::vector<u32> m_VoltageParent;	// Forest of the voltage defined branches only
+	std::vector<size_t> m_TreeElements;	// Branches of that forest
+	std::vector<s64> m_IssueOfRoot;		// Floating set -> its issue
+
+	// Stamped pattern, rows in CSR
+	std::vector<u32> m_RowStart;
+	std::vector<u32> m_Columns;
+
+	// Matching
+	std::vector<s64> m_RowMatch;
+	std::vector<s64> m_ColumnMatch;
+	std::vector<u32> m_Visited;
+	u32 m_VisitStamp = 0;
+	std::vector<u32> m_StackRows;
+	std::vector<u32> m_StackEdges;
+	std::vector<u32> m_StackColumns;
+
+	std::vector<StructureIssue> m_Issues;
+	size_t m_NumUnknowns = 0;
+	size_t m_StructuralRank = 0;
+
+	static u32 Find(std::vector<u32>& parent, u32 node);
+
+	void CheckConnectivity(Circuit& circuit);
+	void ReportLoop(Circuit& circuit, size_t closing, u32 from, u32 to);
+	void CheckRank(Circuit& circuit);
+	bool Augment(u32 row);
+
+public:
+
+	// False if the circuit can't be solved, the issues tell why. Numbers the unknowns of the circuit
+	bool Run(Circuit& circuit);
+
+	const std::vector<StructureIssue>& GetIssues() const { return m_Issues; }
+
+	// Of the last run that got to the rank check, both 0 otherwise
+	size_t GetNumUnknowns() const { return m_NumUnknowns; }
+	size_t GetStructuralRank() const { return m_StructuralRank; }
+
+	// "floating_subnet", "voltage_loop", "singular_rows"
+	static const char* GetIssueName(eStructureIssue type);
+};
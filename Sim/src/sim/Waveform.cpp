@@ -0,0 +1,141 @@
+#include "Waveform.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+static Waveform::Extent Merge(Waveform::Extent a, Waveform::Extent b)
+{
+	return { std::min(a.min, b.min), std::max(a.max, b.max) };
+}
+
+
+Waveform::Waveform(double sampleInterval, double startTime)
+	: m_SampleInterval(sampleInterval)
+	, m_StartTime(startTime)
+{
+}
+
+
+void Waveform::Append(float value)
+{
+	m_Samples.push_back(value);
+
+	// A complete block carries into the level above, a level appears with its first block
+	Extent carry = { value, value };
+	for (size_t level = 0; ; level++)
+	{
+		if (level == m_Partial.size())
+		{
+			m_Levels.emplace_back();
+			m_Partial.push_back(carry);
+			m_PartialCount.push_back(1);
+			return;
+		}
+
+		m_Partial[level] = m_PartialCount[level] ? Merge(m_Partial[level], carry) : carry;
+		if (++m_PartialCount[level] < BranchFactor)
+			return;
+
+		carry = m_Partial[level];
+		m_Levels[level].push_back(carry);
+		m_PartialCount[level] = 0;
+	}
+}
+
+
+void Waveform::AppendUntil(double time, float value)
+{
+	double end = (time - m_StartTime) / m_SampleInterval;
+	while (double(m_Samples.size()) <= end + 1e-9)
+		Append(value);
+}
+
+
+void Waveform::Clear()
+{
+	m_Samples.clear();
+	for (auto& level : m_Levels)
+		level.clear();
+	std::fill(m_PartialCount.begin(), m_PartialCount.end(), 0u);
+}
+
+
+u64 Waveform::GetNumCompleteBlocks(size_t level) const
+{
+	if (level == 0)
+		return m_Samples.size();
+	return level <= m_Levels.size() ? m_Levels[level - 1].size() : 0;
+}
+
+
+Waveform::Extent Waveform::GetBlock(size_t level, u64 index) const
+{
+	if (level == 0)
+		return { m_Samples[index], m_Samples[index] };
+	return m_Levels[level - 1][index];
+}
+
+
+Waveform::Extent Waveform::GetRange(u64 begin, u64 end) const
+{
+	end = std::min<u64>(end, m_Samples.size());
+
+	Extent extent = EmptyExtent;
+	constexpr u64 Mask = BranchFactor - 1;
+
+	// Ragged ends at this level, the aligned middle from the level above. Blocks past the complete
+	// ones of the level above (at most BranchFactor - 1 of them) stay at this level too
+	for (size_t level = 0; begin < end; level++)
+	{
+		while (begin < end && (begin & Mask))
+			extent = Merge(extent, GetBlock(level, begin++));
+
+		u64 alignedEnd = std::max(begin, std::min(end & ~Mask, GetNumCompleteBlocks(level + 1) << BranchBits));
+		for (u64 i = alignedEnd; i < end; i++)
+			extent = Merge(extent, GetBlock(level, i));
+
+		begin >>= BranchBits;
+		end = alignedEnd >> BranchBits;
+	}
+
+	return extent;
+}
+
+
+// Column edges are rounded down to blocks of at most EdgeBlocks-th of a column, a fraction of a pixel,
+// so every column is a short run of blocks of a single level and adjacent columns never overlap
+void Waveform::GetEnvelope(double startTime, double duration, size_t numColumns, Extent* columns) const
+{
+	constexpr double EdgeBlocks = 8.0;
+
+	double samplesPerColumn = duration / (m_SampleInterval * double(numColumns));
+	double first = (startTime - m_StartTime) / m_SampleInterval;
+	u64 numSamples = m_Samples.size();
+
+	size_t level = 0;
+	while (level + 1 < GetNumLevels() && double(u64(1) << ((level + 1) * BranchBits)) * EdgeBlocks <= samplesPerColumn)
+		level++;
+
+	u32 shift = u32(level * BranchBits);
+	u64 numBlocks = GetNumCompleteBlocks(level);
+
+	for (size_t c = 0; c < numColumns; c++)
+	{
+		double from = std::ceil(first + double(c) * samplesPerColumn);
+		double to = std::ceil(first + double(c + 1) * samplesPerColumn);
+
+		u64 begin = u64(std::clamp(from, 0.0, double(numSamples))) >> shift;
+		u64 end = u64(std::clamp(to, 0.0, double(numSamples))) >> shift;
+
+		Extent extent = EmptyExtent;
+		for (u64 i = begin; i < std::min(end, numBlocks); i++)
+			extent = Merge(extent, GetBlock(level, i));
+
+		// The newest samples, not in a complete block yet
+		if (to >= double(numSamples) && from < double(numSamples))
+			extent = Merge(extent, GetRange(std::max(begin, numBlocks) << shift, numSamples));
+
+		columns[c] = extent;
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Uniformly sampled signal with a min/max pyramid for drawing
+//
+// Level 0 holds the samples, every level above holds the min and max of BranchFactor blocks of the
+// level below, plus the block still being filled. The exact min/max of a sample range takes the
+// aligned blocks from the coarsest level that fits and only the ragged ends from finer ones.
+// An envelope reads a single level with blocks a fraction of a column wide, a few blocks per column
+// whatever the length of the trace : a window of a hundred million samples draws as fast as one of
+// a thousand.
+// Appending is amortized O(1), the pyramid adds 2 / (BranchFactor - 1) of the sample storage.
+
+class Waveform
+{
+public:
+	static constexpr u32 BranchBits = 2;
+	static constexpr u64 BranchFactor = u64(1) << BranchBits;
+
+	struct Extent
+	{
+		float min;
+		float max;
+
+		bool IsEmpty() const { return min > max; }
+	};
+
+	static constexpr Extent EmptyExtent = { 3.4e38f, -3.4e38f };
+
+private:
+	double m_SampleInterval;
+	double m_StartTime;
+
+	std::vector<float> m_Samples;
+	std::vector<std::vector<Extent>> m_Levels;	// Complete blocks, m_Levels[0] is level 1
+	std::vector<Extent> m_Partial;				// Block being filled per level
+	std::vector<u32> m_PartialCount;			// Blocks of the level below in it, 0 = none
+
+	u64 GetNumCompleteBlocks(size_t level) const;
+	Extent GetBlock(size_t level, u64 index) const;
+
+public:
+
+	explicit Waveform(double sampleInterval, double startTime = 0.0);
+
+	void Append(float value);
+
+	// Holds the value up to the time (zero-order hold), for outputs that come every few samples
+	void AppendUntil(double time, float value);
+
+	// Keeps the storage
+	void Clear();
+
+	u64 GetNumSamples() const { return m_Samples.size(); }
+	float GetSample(u64 index) const { return m_Samples[index]; }
+	size_t GetNumLevels() const { return m_Levels.size() + 1; }
+
+	double GetSampleInterval() const { return m_SampleInterval; }
+	double GetStartTime() const { return m_StartTime; }
+	double GetEndTime() const { return m_StartTime + double(m_Samples.size()) * m_SampleInterval; }
+	double GetSampleTime(u64 index) const { return m_StartTime + double(index) * m_SampleInterval; }
+
+	// Exact min and max of the samples [begin, end), empty if there are none
+	Extent GetRange(u64 begin, u64 end) const;
+
+	// Range of every one of numColumns equal slices of [startTime, startTime + duration), the edges of
+	// the slices rounded to an eighth of a slice at the most. Empty slices come out empty
+	void GetEnvelope(double startTime, double duration, size_t numColumns, Extent* columns) const;
+};
@@ -0,0 +1,205 @@
+// The AC sweep gives the transfer functions of textbook filters
+//
+// An RC low-pass and a series RLC, the output across the capacitor, are swept against their closed
+// form magnitude and phase. The pooled sweep has to give the serial one bit for bit, every point is
+// the same solve on another thread. Values and parallel elements edited between two sweeps have to
+// show in the second one.
+
+#include <cmath>
+#include <complex>
+#include <numbers>
+#include <string>
+#include <vector>
+
+#include "base/ThreadPool.h"
+#include "sim/Scheme.h"
+#include "sim/ACAnalysis.h"
+#include "TestCheck.h"
+
+
+using Complex = std::complex<double>;
+
+static constexpr double Tolerance = 1e-9;	// Relative to the magnitude, radians for the phase
+
+
+struct LowPass
+{
+	Circuit circuit;
+	eNode* gnd;
+	eNode* out;
+	eResistor* r;
+	eCapacitor* c;
+
+	// Source -> R -> out -> C -> ground, with an inductor in series with R when given
+	LowPass(double resistance, double capacitance, double inductance = 0.0)
+	{
+		gnd = circuit.CreateNode();
+		eNode* in = circuit.CreateNode();
+		out = circuit.CreateNode();
+
+		eVoltageSource* source = circuit.AddVoltageSource(0.0);
+		source->SetACMagnitude(1.0);
+		circuit.Connect(source->GetPositivePin(), in);
+		circuit.Connect(source->GetNegativePin(), gnd);
+
+		r = circuit.AddResistor(resistance);
+		circuit.Connect(r->GetEpin(0), in);
+		if (inductance > 0.0)
+		{
+			eNode* mid = circuit.CreateNode();
+			circuit.Connect(r->GetEpin(1), mid);
+
+			eInductor* l = circuit.AddInductor(inductance);
+			circuit.Connect(l->GetEpin(0), mid);
+			circuit.Connect(l->GetEpin(1), out);
+		}
+		else
+			circuit.Connect(r->GetEpin(1), out);
+
+		c = circuit.AddCapacitor(capacitance);
+		circuit.Connect(c->GetEpin(0), out);
+		circuit.Connect(c->GetEpin(1), gnd);
+	}
+};
+
+
+// 1 / (1 - w^2 LC + jwRC), L = 0 for the RC
+static Complex Transfer(double frequency, double resistance, double capacitance, double inductance = 0.0)
+{
+	double omega = 2.0 * std::numbers::pi * frequency;
+	return 1.0 / Complex(1.0 - omega * omega * inductance * capacitance, omega * resistance * capacitance);
+}
+
+
+static void ExpectTransfer(TestCase& test, const ACAnalysis& ac, eNode* out, double resistance, double capacitance, double inductance, const std::string& when)
+{
+	for (size_t point = 0; point < ac.GetNumPoints(); point++)
+	{
+		double frequency = ac.GetFrequency(point);
+		std::string at = "at " + std::to_string(frequency) + " Hz " + when;
+		if (!test.Expect(ac.IsSolved(point), "singular " + at))
+			return;
+
+		Complex value = ac.GetNodeVoltage(point, out);
+		Complex expected = Transfer(frequency, resistance, capacitance, inductance);
+		test.ExpectNear(std::abs(value) / std::abs(expected), 1.0, Tolerance, "magnitude " + at);
+		test.ExpectNear(std::arg(value), std::arg(expected), Tolerance, "phase " + at);
+	}
+}
+
+
+static bool CheckLowPass()
+{
+	TestCase test("rc_low_pass");
+
+	LowPass filter(1e3, 1e-6);
+	ACAnalysis ac(filter.circuit);
+	ac.Sweep(ACAnalysis::LogSweep(1.0, 1e6, 61));
+	ExpectTransfer(test, ac, filter.out, 1e3, 1e-6, 0.0, "");
+
+	// Corner at 1 / (2 pi RC), -3 dB and 45 degrees behind
+	double corner = 1.0 / (2.0 * std::numbers::pi * 1e3 * 1e-6);
+	ac.Sweep({ corner });
+	test.ExpectNear(std::abs(ac.GetNodeVoltage(0, filter.out)), std::sqrt(0.5), Tolerance, "magnitude at the corner");
+	test.ExpectNear(std::arg(ac.GetNodeVoltage(0, filter.out)), -std::numbers::pi / 4.0, Tolerance, "phase at the corner");
+
+	return test.Finish();
+}
+
+
+// Damped below 1 / (2 sqrt(L / C)) ohms, peaking above the source at resonance with a small R
+static bool CheckRlc()
+{
+	TestCase test("rlc_low_pass");
+
+	for (double resistance : { 5.0, 100.0, 1e4 })
+	{
+		LowPass filter(resistance, 1e-6, 1e-3);
+		ACAnalysis ac(filter.circuit);
+		ac.Sweep(ACAnalysis::LogSweep(10.0, 1e6, 81));
+		ExpectTransfer(test, ac, filter.out, resistance, 1e-6, 1e-3, "with R = " + std::to_string(resistance));
+	}
+
+	return test.Finish();
+}
+
+
+static bool CheckPooled(size_t numWorkers)
+{
+	TestCase test("pooled_" + std::to_string(numWorkers + 1) + "_threads");
+	ThreadPool pool(numWorkers);
+
+	LowPass filter(50.0, 1e-6, 1e-3);
+	std::vector<double> frequencies = ACAnalysis::LogSweep(10.0, 1e6, 200);
+
+	ACAnalysis serial(filter.circuit);
+	ACAnalysis pooled(filter.circuit);
+	serial.Sweep(frequencies);
+	pooled.Sweep(frequencies, &pool);
+
+	const Eigen::MatrixXcd& a = serial.GetSolutions();
+	const Eigen::MatrixXcd& b = pooled.GetSolutions();
+	if (test.Expect(a.rows() == b.rows() && a.cols() == b.cols(), "solution sizes differ"))
+	{
+		// A complex is an array of two doubles
+		size_t count = 2 * size_t(a.size());
+		test.ExpectSameBits(reinterpret_cast<const double*>(b.data()), reinterpret_cast<const double*>(a.data()), count, "pooled solutions");
+	}
+
+	// Sweeping again on the same pool reuses the contexts
+	pooled.Sweep(frequencies, &pool);
+	test.ExpectSameBits(reinterpret_cast<const double*>(pooled.GetSolutions().data()), reinterpret_cast<const double*>(a.data()), 2 * size_t(a.size()), "second pooled sweep");
+
+	return test.Finish();
+}
+
+
+// Edits between sweeps, on the same analysis : a value, then a capacitor in parallel, which changes
+// the pattern but not the number of unknowns
+static bool CheckEdits()
+{
+	TestCase test("sweep_after_edit");
+
+	LowPass filter(1e3, 1e-6);
+	ACAnalysis ac(filter.circuit);
+	std::vector<double> frequencies = ACAnalysis::LogSweep(1.0, 1e5, 41);
+
+	ac.Sweep(frequencies);
+	ExpectTransfer(test, ac, filter.out, 1e3, 1e-6, 0.0, "before the edits");
+
+	filter.r->SetResistance(2e3);
+	ac.Sweep(frequencies);
+	ExpectTransfer(test, ac, filter.out, 2e3, 1e-6, 0.0, "after the resistance edit");
+
+	size_t numUnknowns = ac.GetNumUnknowns();
+	eCapacitor* extra = filter.circuit.AddCapacitor(3e-6);
+	filter.circuit.Connect(extra->GetEpin(0), filter.out);
+	filter.circuit.Connect(extra->GetEpin(1), filter.gnd);
+
+	ac.Sweep(frequencies);
+	test.Expect(ac.GetNumUnknowns() == numUnknowns, "parallel capacitor added unknowns");
+	ExpectTransfer(test, ac, filter.out, 2e3, 4e-6, 0.0, "after the parallel capacitor");
+
+	// And back, the same analysis on the pool
+	ThreadPool pool(2);
+	filter.circuit.RemoveElement(extra);
+	filter.c->SetValue(0.5e-6);
+	ac.Sweep(frequencies, &pool);
+	ExpectTransfer(test, ac, filter.out, 2e3, 0.5e-6, 0.0, "after the removal");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckLowPass();
+	numFailed += !CheckRlc();
+	numFailed += !CheckPooled(1);
+	numFailed += !CheckPooled(3);
+	numFailed += !CheckEdits();
+
+	return numFailed;
+}
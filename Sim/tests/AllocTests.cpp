@@ -0,0 +1,202 @@
+// Steady state simulation steps must not touch the heap
+//
+// Built with SM_ALLOC_TRACKING, every step after the warm-up is checked against the allocation
+// counters of the test thread. Steps go through Circuit::Step() as the application runs them, so the
+// restamps and low rank updates, the solution cache, the structure check and the Newton iteration are
+// covered along with the plain solve. An edit before a step is the caller's and is not counted, the
+// solve it causes is. With a thread pool attached the counters of every thread are checked, the
+// workers stamp and sum too. Exit code is the number of failed cases.
+
+#include <iostream>
+#include <functional>
+
+#include "base/AllocTracker.h"
+#include "base/ThreadPool.h"
+#include "sim/Scheme.h"
+#include "sim/CircuitGenerators.h"
+#include "sim/Nonlinear.h"
+#include "sim/SolutionCache.h"
+
+static_assert(SM_ALLOC_TRACKING, "AllocTests needs SM_ALLOC_TRACKING");
+
+
+static constexpr int NumWarmupSteps = 4;
+static constexpr int NumSteadySteps = 40;	// Past MaxLowRankTerms, a refactorization is among them
+
+using EditFn = std::function<void(Circuit&, int step)>;
+
+
+// What Simulation runs per step : the pending edits and the step in one UpdateSolution(), then the
+// published results
+static void Step(Circuit& circuit)
+{
+	circuit.Step();
+	circuit.ComputeBranchCurrents();
+}
+
+
+// The counters of the test thread, of all threads once the pool's workers take part
+static AllocStats GetStats(const ThreadPool* pool)
+{
+	return pool ? AllocTracker::GetTotalStats() : AllocTracker::GetThreadStats();
+}
+
+
+static bool CheckSteadyState(const char* name, const std::function<void(Circuit&)>& generate, double step = 0.0, const EditFn& edit = nullptr, ThreadPool* pool = nullptr)
+{
+	Circuit circuit;
+	generate(circuit);
+	circuit.SetStep(step);
+	if (pool)
+		circuit.SetThreadPool(pool, 0);
+
+	int stepIndex = 0;
+	for (; stepIndex < NumWarmupSteps; stepIndex++)
+	{
+		if (edit)
+			edit(circuit, stepIndex);
+		Step(circuit);
+	}
+
+	AllocTracker::Reset();
+	u64 numAllocs = 0;
+	u64 numBytes = 0;
+
+	for (; stepIndex < NumWarmupSteps + NumSteadySteps; stepIndex++)
+	{
+		if (edit)
+			edit(circuit, stepIndex);
+
+		AllocStats before = GetStats(pool);
+		Step(circuit);
+		AllocStats after = GetStats(pool);
+
+		numAllocs += after.count - before.count;
+		numBytes += after.bytes - before.bytes;
+	}
+
+	if (numAllocs == 0)
+	{
+		std::cout << "[ OK ]   " << name << std::endl;
+		return true;
+	}
+
+	std::cout << "[ FAIL ] " << name << " : " << numAllocs << " allocations, "
+		<< numBytes << " bytes in " << NumSteadySteps << " steady steps" << std::endl;
+	AllocTracker::PrintSummary(std::cout);
+	return false;
+}
+
+
+// Guards against a tracker that doesn't see anything
+static bool CheckTrackerCounts()
+{
+	AllocStats before = AllocTracker::GetThreadStats();
+
+	int* volatile value = new int(42);
+	Eigen::VectorXd vector(64);
+	vector.setZero();
+	delete value;
+
+	AllocStats after = AllocTracker::GetThreadStats();
+
+	u64 expected = 2;
+	if (after.count - before.count >= expected)
+	{
+		std::cout << "[ OK ]   tracker" << std::endl;
+		return true;
+	}
+
+	std::cout << "[ FAIL ] tracker : saw " << after.count - before.count << " of " << expected << " allocations" << std::endl;
+	return false;
+}
+
+
+// (v)--R--*--D--GND
+static void DiodeCircuit(Circuit& circuit)
+{
+	eNode* ground = circuit.CreateNode();
+	eNode* supply = circuit.CreateNode();
+	eNode* anode = circuit.CreateNode();
+
+	eVoltageSource* source = circuit.AddVoltageSource(1.0);
+	circuit.Connect(source->GetPositivePin(), supply);
+	circuit.Connect(source->GetNegativePin(), ground);
+
+	eResistor* resistor = circuit.AddResistor(1000.0);
+	circuit.Connect(resistor->GetEpin(0), supply);
+	circuit.Connect(resistor->GetEpin(1), anode);
+
+	eDiode* diode = circuit.AddElement<eDiode>();
+	circuit.Connect(diode->GetEpin(0), anode);
+	circuit.Connect(diode->GetEpin(1), ground);
+}
+
+
+// A different resistor of the ladder every step, so the changes pile up as low rank terms until the
+// system is factored again
+static void EditResistors(Circuit& circuit, int step)
+{
+	for (size_t k = 1 + size_t(step) % 4; k < circuit.GetNumElements(); k++)
+	{
+		if (auto* resistor = dynamic_cast<eResistor*>(circuit.GetElement(k)))
+		{
+			resistor->SetResistance(step % 8 < 4 ? 2.0 : 1.0);
+			break;
+		}
+	}
+}
+
+
+// The same resistor between two values, the states alternate in the cache
+static void ToggleResistor(Circuit& circuit, int step)
+{
+	if (auto* resistor = dynamic_cast<eResistor*>(circuit.GetElement(1)))
+		resistor->SetResistance(step % 2 ? 2.0 : 1.0);
+}
+
+
+// Moves the source of the diode circuit, every step iterates
+static void ToggleSource(Circuit& circuit, int step)
+{
+	if (auto* source = dynamic_cast<eVoltageSource*>(circuit.GetElement(0)))
+		source->SetVoltage(step % 2 ? 2.0 : 1.0);
+}
+
+
+// Reconnects the last resistor between two nodes, every step is a topology edit
+static void MoveResistor(Circuit& circuit, int step)
+{
+	eElement* resistor = circuit.GetElement(circuit.GetNumElements() - 1);
+	circuit.Connect(resistor->GetEpin(1), circuit.GetNode(step % 2 ? 2 : 3));
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckTrackerCounts();
+
+	numFailed += !CheckSteadyState("ladder", [](Circuit& c) { CircuitGen::ResistorLadder(c, 64); });
+	numFailed += !CheckSteadyState("grid", [](Circuit& c) { CircuitGen::ResistorGrid(c, 12); });
+	numFailed += !CheckSteadyState("random_mesh", [](Circuit& c) { CircuitGen::RandomMesh(c, 128, 4); });
+	numFailed += !CheckSteadyState("rc_chain", [](Circuit& c) { CircuitGen::RcChain(c, 64); }, 1e-6);
+	numFailed += !CheckSteadyState("source_heavy", [](Circuit& c) { CircuitGen::SourceHeavy(c, 64); });
+
+	numFailed += !CheckSteadyState("low_rank_updates", [](Circuit& c) { CircuitGen::ResistorLadder(c, 64); }, 0.0, EditResistors);
+	numFailed += !CheckSteadyState("rc_chain_edits", [](Circuit& c) { CircuitGen::RcChain(c, 64); }, 1e-6, EditResistors);
+
+	SolutionCache cache;
+	numFailed += !CheckSteadyState("solution_cache", [&](Circuit& c) { CircuitGen::ResistorLadder(c, 64); c.SetSolutionCache(&cache); }, 0.0, ToggleResistor);
+
+	numFailed += !CheckSteadyState("newton", DiodeCircuit, 0.0, ToggleSource);
+	numFailed += !CheckSteadyState("topology_edits", [](Circuit& c) { CircuitGen::ResistorLadder(c, 16); }, 0.0, MoveResistor);
+
+	// Every step assembles on the pool
+	ThreadPool pool(3);
+	numFailed += !CheckSteadyState("pooled_topology_edits", [](Circuit& c) { CircuitGen::ResistorLadder(c, 64); }, 0.0, MoveResistor, &pool);
+	numFailed += !CheckSteadyState("pooled_random_mesh", [](Circuit& c) { CircuitGen::RandomMesh(c, 128, 4); }, 0.0, MoveResistor, &pool);
+
+	return numFailed;
+}
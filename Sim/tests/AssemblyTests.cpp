@@ -0,0 +1,96 @@
+// Pooled assembly must reproduce the serial system bit for bit
+//
+// The threshold is lowered to 0 so that small circuits take the parallel path on any machine, with
+// pools smaller and larger than the hardware. The assembled matrix and right hand side are compared
+// right after assembly, the node voltages after a few steps through Circuit::Step().
+
+#include <functional>
+#include <string>
+
+#include "base/ThreadPool.h"
+#include "sim/Scheme.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr int NumSteps = 8;
+
+
+static bool CheckAssembly(const char* name, const std::function<void(Circuit&)>& generate, size_t numWorkers, double step = 0.0)
+{
+	TestCase test(std::string(name) + "_" + std::to_string(numWorkers + 1) + "_threads");
+	ThreadPool pool(numWorkers);
+
+	Circuit serial;
+	Circuit pooled;
+	generate(serial);
+	generate(pooled);
+	pooled.SetThreadPool(&pool, 0);
+	test.Expect(pooled.UsesParallelAssembly(), "parallel path not taken");
+
+	serial.AssembleMatrix();
+	pooled.AssembleMatrix();
+
+	CircuitMtx& a = serial.GetMatrix();
+	CircuitMtx& b = pooled.GetMatrix();
+	if (test.Expect(a.GetMatrix().size() == b.GetMatrix().size(), "matrix sizes differ"))
+	{
+		test.ExpectSameBits(b.GetMatrix().data(), a.GetMatrix().data(), size_t(a.GetMatrix().size()), "matrix");
+		test.ExpectSameBits(b.GetVector().data(), a.GetVector().data(), size_t(a.GetVector().size()), "right hand side");
+	}
+
+	serial.SetStep(step);
+	pooled.SetStep(step);
+	for (int i = 0; i < NumSteps; i++)
+	{
+		serial.Step();
+		pooled.Step();
+	}
+
+	if (test.Expect(serial.GetNumNodes() == pooled.GetNumNodes(), "node counts differ"))
+	{
+		for (size_t k = 0; k < serial.GetNumNodes(); k++)
+			test.ExpectSameBits(pooled.GetNode(k)->GetVoltage(), serial.GetNode(k)->GetVoltage(), "voltage of node " + std::to_string(k) + " after " + std::to_string(NumSteps) + " steps");
+	}
+
+	return test.Finish();
+}
+
+
+// Below the default threshold a pool alone doesn't switch the path
+static bool CheckThreshold()
+{
+	TestCase test("threshold");
+	ThreadPool pool(1);
+
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, 16);
+	circuit.SetThreadPool(&pool);
+	test.Expect(!circuit.UsesParallelAssembly(), "small circuit assembles on the pool");
+
+	circuit.SetThreadPool(&pool, circuit.GetNumElements());
+	test.Expect(circuit.UsesParallelAssembly(), "pool unused at the threshold");
+
+	circuit.SetThreadPool(nullptr, 0);
+	test.Expect(!circuit.UsesParallelAssembly(), "parallel path without a pool");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckThreshold();
+
+	for (size_t numWorkers : { 1, 3, 7 })
+	{
+		numFailed += !CheckAssembly("random_mesh", [](Circuit& c) { CircuitGen::RandomMesh(c, 600, 4); }, numWorkers);
+		numFailed += !CheckAssembly("grid", [](Circuit& c) { CircuitGen::ResistorGrid(c, 20); }, numWorkers);
+		numFailed += !CheckAssembly("source_heavy", [](Circuit& c) { CircuitGen::SourceHeavy(c, 64); }, numWorkers);
+		numFailed += !CheckAssembly("rlc_ladder", [](Circuit& c) { CircuitGen::RlcLadder(c, 100); }, numWorkers, 1e-6);
+	}
+
+	return numFailed;
+}
@@ -0,0 +1,180 @@
+// A transient run resumed from a checkpoint continues bit for bit
+//
+// Every case runs a circuit, captures it, runs on, and resumes a second circuit built the same way
+// from the capture. The resumed run is checked right after the restore (its own capture is the blob
+// it came from) and after the same number of steps as the original : time, node voltages and the
+// state of every element, companion sources and inductor currents included, compared bit for bit.
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/Checkpoint.h"
+#include "sim/CircuitGenerators.h"
+#include "sim/Reduction.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t NumSteps = 50;
+
+using GenerateFn = std::function<void(Circuit&)>;
+
+
+static std::vector<u8> ElementState(eElement* element)
+{
+	std::vector<u8> state;
+	CheckpointWriter writer(state);
+	element->SaveState(writer);
+	return state;
+}
+
+
+static void ExpectSameRun(TestCase& test, Simulation& a, Circuit& circuitA, Simulation& b, Circuit& circuitB, const std::string& when)
+{
+	test.ExpectSameBits(b.GetTime(), a.GetTime(), "time " + when);
+
+	for (size_t i = 0; i < circuitA.GetNumNodes(); i++)
+		test.ExpectSameBits(circuitB.GetNode(i)->GetVoltage(), circuitA.GetNode(i)->GetVoltage(), "voltage of node " + std::to_string(i) + " " + when);
+
+	size_t differentElements = 0;
+	for (size_t k = 0; k < circuitA.GetNumElements(); k++)
+		differentElements += ElementState(circuitA.GetElement(k)) != ElementState(circuitB.GetElement(k));
+	test.Expect(differentElements == 0, std::to_string(differentElements) + " element states differ " + when);
+}
+
+
+static bool CheckResume(const char* name, const GenerateFn& generate, double step, bool throughFile = false)
+{
+	TestCase test(name);
+
+	Circuit original;
+	Circuit resumed;
+	generate(original);
+	generate(resumed);
+
+	size_t numHistory = 0;
+	for (size_t k = 0; k < original.GetNumElements(); k++)
+		numHistory += original.GetElement(k)->HasHistory();
+	test.Expect(numHistory > 0, "no element with a history");
+
+	Simulation simulation(original);
+	simulation.SetStep(step);
+	simulation.RunSteps(NumSteps);
+
+	std::vector<u8> blob;
+	Checkpoint::Capture(simulation, blob);
+
+	if (throughFile)
+	{
+		std::string path = (std::filesystem::temp_directory_path() / (std::string("checkpoint_test_") + name + ".ckpt")).string();
+		CheckpointThread writer;
+		writer.Save(simulation, path);
+		writer.Wait();
+
+		std::vector<u8> fromFile;
+		test.Expect(writer.GetNumWritten() == 1, "checkpoint not written");
+		test.Expect(Checkpoint::ReadFile(path, fromFile), "checkpoint not read back");
+		test.Expect(fromFile == blob, "file differs from the capture");
+		std::filesystem::remove(path);
+		blob = std::move(fromFile);
+	}
+
+	Simulation restarted(resumed);
+	if (!test.Expect(Checkpoint::Restore(restarted, blob), "restore failed"))
+		return test.Finish();
+
+	std::vector<u8> recaptured;
+	Checkpoint::Capture(restarted, recaptured);
+	test.Expect(recaptured == blob, "capture after the restore differs from the blob");
+	ExpectSameRun(test, simulation, original, restarted, resumed, "after the restore");
+
+	std::vector<double> captured(original.GetNumNodes());
+	for (size_t i = 0; i < captured.size(); i++)
+		captured[i] = original.GetNode(i)->GetVoltage();
+
+	simulation.RunSteps(NumSteps);
+	restarted.RunSteps(NumSteps);
+
+	// A run at rest would pass whatever the checkpoint holds
+	double maxChange = 0.0;
+	for (size_t i = 0; i < captured.size(); i++)
+		maxChange = std::max(maxChange, std::abs(original.GetNode(i)->GetVoltage() - captured[i]));
+	test.Expect(maxChange > 1e-6, "the run is at rest after the capture");
+
+	ExpectSameRun(test, simulation, original, restarted, resumed, "after " + std::to_string(NumSteps) + " more steps");
+
+	return test.Finish();
+}
+
+
+// Damaged blobs and blobs of another circuit are refused
+static bool CheckRejects()
+{
+	TestCase test("rejects");
+
+	Circuit original;
+	CircuitGen::RcChain(original, 16);
+	Simulation simulation(original);
+	simulation.SetStep(1e-6);
+	simulation.RunSteps(10);
+
+	std::vector<u8> blob;
+	Checkpoint::Capture(simulation, blob);
+
+	Circuit same;
+	CircuitGen::RcChain(same, 16);
+	Simulation restarted(same);
+
+	std::vector<u8> damaged = blob;
+	damaged[damaged.size() / 2] ^= 0x10;
+	test.Expect(!Checkpoint::Restore(restarted, damaged), "damaged blob restored");
+
+	std::vector<u8> truncated(blob.begin(), blob.end() - 8);
+	test.Expect(!Checkpoint::Restore(restarted, truncated), "truncated blob restored");
+
+	Circuit other;
+	CircuitGen::RcChain(other, 17);
+	Simulation otherSimulation(other);
+	test.Expect(!Checkpoint::Restore(otherSimulation, blob), "blob of another circuit restored");
+
+	test.Expect(Checkpoint::Restore(restarted, blob), "intact blob refused after the failed ones");
+
+	return test.Finish();
+}
+
+
+// RC mesh with its inner part reduced : the model keeps states of its own. Reduced at rest, the run
+// is the step response of the source
+static void ReducedMesh(Circuit& circuit)
+{
+	CircuitGen::RcMesh(circuit, 12);
+	circuit.GetElement(0)->SetValue(0.0);
+	circuit.UpdateSolution();
+
+	std::vector<eElement*> elements;
+	for (size_t k = 5; k < circuit.GetNumElements(); k++)
+		elements.push_back(circuit.GetElement(k));
+
+	ReductionOptions options;
+	options.maxOrder = 8;
+	ReduceSubnetwork(circuit, elements, {}, options);
+	circuit.GetElement(0)->SetValue(1.0);
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckResume("rc_chain", [](Circuit& c) { CircuitGen::RcChain(c, 64); }, 1e-6);
+	numFailed += !CheckResume("rlc_ladder", [](Circuit& c) { CircuitGen::RlcLadder(c, 64); }, 1e-6);
+	numFailed += !CheckResume("rlc_ladder_file", [](Circuit& c) { CircuitGen::RlcLadder(c, 32); }, 1e-6, true);
+	numFailed += !CheckResume("reduced_model", ReducedMesh, 1e-10);
+	numFailed += !CheckRejects();
+
+	return numFailed;
+}
@@ -0,0 +1,241 @@
+// Current flow dots move with the current and stay in place when the view zooms
+//
+// Wires are read back through ForEachDot(), the first dot of a wire sits phase * spacing from its
+// start. Gain and speed are picked so the phases land on values a float holds exactly, the dots are
+// then compared to the position they must have.
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "sim/CurrentFlow.h"
+#include "TestCheck.h"
+
+
+static constexpr float Length = 1000.0f;
+static constexpr float Tolerance = 1e-3f;	// World units
+
+
+// Along the x axis from 0 to Length, or from y when the wire is elsewhere
+static std::vector<float> GetDots(const CurrentFlow& flow, float left = -1e9f, float top = -1e9f, float right = 1e9f, float bottom = 1e9f)
+{
+	std::vector<float> dots;
+	flow.ForEachDot(left, top, right, bottom, [&](float x, float y) { dots.push_back(x + y); });
+	return dots;
+}
+
+
+// One wire of Length at a view scale of 1, spacing 32
+static CurrentFlow MakeFlow(float gain, float maxSpeed)
+{
+	CurrentFlow flow;
+	flow.SetViewScale(1.0f);
+	flow.SetGain(gain);
+	flow.SetMaxSpeed(maxSpeed);
+	flow.AddWire(0.0f, 0.0f, Length, 0.0f, 0);
+	return flow;
+}
+
+
+static void ExpectFirstDot(TestCase& test, const CurrentFlow& flow, float expected, const std::string& when)
+{
+	std::vector<float> dots = GetDots(flow);
+	if (test.Expect(!dots.empty(), "no dots " + when))
+		test.ExpectNear(dots.front(), expected, Tolerance, "first dot " + when);
+
+	size_t numDots = size_t(std::ceil((Length - expected) / flow.GetSpacing()));
+	test.Expect(dots.size() == numDots, std::to_string(dots.size()) + " dots " + when + ", expected " + std::to_string(numDots));
+}
+
+
+// A quarter spacing per quarter second and ampere, forward and back through the ends of the phase
+static bool CheckWrap()
+{
+	TestCase test("wrap");
+
+	CurrentFlow flow = MakeFlow(1.0f, 100.0f);
+	float spacing = flow.GetSpacing();
+	test.Expect(spacing == 32.0f, "spacing " + std::to_string(spacing) + " at a scale of 1, expected 32");
+
+	double current = 1.0;
+	for (int i = 0; i < 5; i++)
+		flow.Advance(&current, 1, 0.25f);
+	ExpectFirstDot(test, flow, 0.25f * spacing, "after 1.25 spacings forward");
+
+	current = -1.0;
+	for (int i = 0; i < 2; i++)
+		flow.Advance(&current, 1, 0.25f);
+	ExpectFirstDot(test, flow, 0.75f * spacing, "after 0.5 spacings back");
+
+	// A wire against the current runs backwards
+	flow.AddWire(0.0f, 0.0f, 0.0f, Length, 0, -1.0f);
+	current = 1.0;
+	flow.Advance(&current, 1, 0.25f);
+	std::vector<float> along;
+	flow.ForEachDot(-1.0f, 1.0f, 1.0f, Length, [&](float x, float y) { if (x == 0.0f) along.push_back(y); });
+	test.Expect(!along.empty() && std::abs(along.front() - 0.75f * spacing) < Tolerance, "wire against the current didn't move back");
+
+	// Just below 0 wraps to just below 1, not to 1 : the first dot stays within the first spacing
+	CurrentFlow tiny = MakeFlow(1.0f, 100.0f);
+	current = -4e-9;
+	tiny.Advance(&current, 1, 0.25f);
+	std::vector<float> dots = GetDots(tiny);
+	test.Expect(!dots.empty() && dots.front() < spacing, "phase wrapped to 1 after a step just below 0");
+	ExpectFirstDot(test, tiny, spacing, "after a step just below 0");
+
+	return test.Finish();
+}
+
+
+static bool CheckSpeedClamp()
+{
+	TestCase test("speed_clamp");
+
+	// 1000 A at a gain of 1 is far past 2 spacings per second
+	CurrentFlow flow = MakeFlow(1.0f, 2.0f);
+	double current = 1000.0;
+	flow.Advance(&current, 1, 0.125f);
+	ExpectFirstDot(test, flow, 0.25f * flow.GetSpacing(), "after a clamped step");
+
+	current = -1000.0;
+	flow.Advance(&current, 1, 0.125f);
+	ExpectFirstDot(test, flow, 0.0f, "after a clamped step back");
+
+	// A long frame moves as much as MaxStepSeconds
+	flow.Advance(&current, 1, 10.0f);
+	ExpectFirstDot(test, flow, (1.0f - CurrentFlow::MaxStepSeconds * 2.0f) * flow.GetSpacing(), "after a long frame");
+
+	// Negative frame times don't move anything
+	flow.Advance(&current, 1, -1.0f);
+	ExpectFirstDot(test, flow, (1.0f - CurrentFlow::MaxStepSeconds * 2.0f) * flow.GetSpacing(), "after a negative frame time");
+
+	return test.Finish();
+}
+
+
+// Every dot before the zoom is still there after it, zooming in adds dots between them
+static bool CheckViewScale()
+{
+	TestCase test("view_scale");
+
+	CurrentFlow flow = MakeFlow(1.0f, 100.0f);
+	double current = 3.0;
+	flow.Advance(&current, 1, 0.25f);	// 0.75 spacings in
+
+	std::vector<float> before = GetDots(flow);
+	for (float scale : { 2.0f, 4.0f, 0.5f, 0.25f })
+	{
+		std::string when = "at a scale of " + std::to_string(scale);
+
+		flow.SetViewScale(scale);
+		float expected = std::exp2(std::round(std::log2(CurrentFlow::DotSpacingPixels / scale)));
+		test.Expect(flow.GetSpacing() == expected, "spacing " + std::to_string(flow.GetSpacing()) + " " + when);
+
+		std::vector<float> after = GetDots(flow);
+		const std::vector<float>& fewer = after.size() < before.size() ? after : before;
+		const std::vector<float>& more = after.size() < before.size() ? before : after;
+		for (float dot : fewer)
+		{
+			bool found = false;
+			for (float other : more)
+				found |= std::abs(dot - other) < Tolerance;
+			test.Expect(found, "dot at " + std::to_string(dot) + " moved " + when);
+		}
+		before = after;
+	}
+
+	// Nothing changes for a scale that rounds to the same spacing, or none at all
+	flow.SetViewScale(0.25f);
+	std::vector<float> dots = GetDots(flow);
+	flow.SetViewScale(0.26f);
+	flow.SetViewScale(0.0f);
+	test.Expect(GetDots(flow) == dots, "dots moved for the same spacing");
+
+	return test.Finish();
+}
+
+
+static bool CheckForEachDot()
+{
+	TestCase test("for_each_dot");
+
+	CurrentFlow flow;
+	flow.SetViewScale(1.0f);
+	flow.AddWire(0.0f, 0.0f, 100.0f, 0.0f, 0);			// 4 dots at 0, 32, 64, 96
+	flow.AddWire(0.0f, 500.0f, 100.0f, 500.0f, 0);		// Below the rect
+	flow.AddWire(200.0f, 0.0f, 231.0f, 0.0f, 0);		// Shorter than the spacing
+	flow.AddWire(300.0f, 0.0f, 332.0f, 0.0f, 0);		// As long as the spacing, one dot
+
+	size_t numDots = 0;
+	bool inside = true;
+	flow.ForEachDot(-10.0f, -10.0f, 400.0f, 100.0f, [&](float, float y)
+	{
+		numDots++;
+		inside &= y == 0.0f;
+	});
+	test.Expect(inside, "dots of a wire outside the rect");
+	test.Expect(numDots == 5, std::to_string(numDots) + " dots, expected 4 and 1");
+
+	// The rect takes whole wires, crossing it is enough
+	numDots = 0;
+	flow.ForEachDot(50.0f, -1.0f, 60.0f, 1.0f, [&](float, float) { numDots++; });
+	test.Expect(numDots == 4, std::to_string(numDots) + " dots of a wire crossing the rect, expected all 4");
+
+	numDots = 0;
+	flow.ForEachDot(101.0f, -1.0f, 199.0f, 1.0f, [&](float, float) { numDots++; });
+	test.Expect(numDots == 0, "dots between the wires");
+
+	// Zoomed out the spacing grows past the wire, it shows nothing
+	flow.SetViewScale(0.2f);
+	numDots = 0;
+	flow.ForEachDot(-10.0f, -10.0f, 400.0f, 100.0f, [&](float, float) { numDots++; });
+	test.Expect(numDots == 0, std::to_string(numDots) + " dots on wires shorter than a spacing of " + std::to_string(flow.GetSpacing()));
+
+	return test.Finish();
+}
+
+
+// A wire of a source past the currents given stands still, the others move
+static bool CheckMissingSources()
+{
+	TestCase test("missing_sources");
+
+	CurrentFlow flow;
+	flow.SetViewScale(1.0f);
+	flow.SetGain(1.0f);
+	flow.SetMaxSpeed(100.0f);
+	flow.AddWire(0.0f, 0.0f, Length, 0.0f, 1);
+	flow.AddWire(0.0f, 10.0f, Length, 10.0f, 7);
+
+	double currents[] = { 2.0, 1.0 };
+	flow.Advance(currents, 2, 0.25f);
+
+	std::vector<float> moved;
+	std::vector<float> still;
+	flow.ForEachDot(-1.0f, -1.0f, Length, 1.0f, [&](float x, float) { moved.push_back(x); });
+	flow.ForEachDot(-1.0f, 9.0f, Length, 11.0f, [&](float x, float) { still.push_back(x); });
+
+	test.Expect(!moved.empty() && std::abs(moved.front() - 0.25f * flow.GetSpacing()) < Tolerance, "wire of source 1 didn't take its current");
+	test.Expect(!still.empty() && still.front() == 0.0f, "wire of a missing source moved");
+
+	flow.Advance(nullptr, 0, 0.25f);
+	still.clear();
+	flow.ForEachDot(-1.0f, 9.0f, Length, 11.0f, [&](float x, float) { still.push_back(x); });
+	test.Expect(!still.empty() && still.front() == 0.0f, "wire moved without currents");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckWrap();
+	numFailed += !CheckSpeedClamp();
+	numFailed += !CheckViewScale();
+	numFailed += !CheckForEachDot();
+	numFailed += !CheckMissingSources();
+
+	return numFailed;
+}
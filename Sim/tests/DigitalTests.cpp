@@ -0,0 +1,219 @@
+// The digital engine applies every event on its tick, near or far
+//
+// A ripple counter driven by a clock is read at chosen ticks against the count of clock edges. Single
+// events are placed around the end of the timing wheel, so they go through the overflow heap and are
+// handed to the wheel either while it runs or by a jump over empty ticks.
+
+#include <string>
+
+#include "sim/Digital.h"
+#include "TestCheck.h"
+
+
+static constexpr u64 NoEvent = ~u64(0);
+
+
+// Flip-flops each taking its inverted output, every stage clocked by the output of the one before.
+// A stage toggles when the one before goes high, so the bits count down from 0 on every clock edge
+struct RippleCounter
+{
+	static constexpr u32 NumBits = 4;
+	static constexpr u32 FlipFlopDelay = 2;
+
+	NetId q[NumBits];
+
+	RippleCounter(DigitalEngine& engine, NetId clock)
+	{
+		for (u32 k = 0; k < NumBits; k++)
+		{
+			q[k] = engine.AddNet();
+			NetId notQ = engine.AddNet();
+			engine.AddGate(eGateType::Not, { q[k] }, notQ);
+			engine.AddGate(eGateType::DFlipFlop, { notQ, k ? q[k - 1] : clock }, q[k], FlipFlopDelay);
+		}
+	}
+
+	u32 GetCount(const DigitalEngine& engine) const
+	{
+		u32 count = 0;
+		for (u32 k = 0; k < NumBits; k++)
+			count |= u32(engine.GetNet(q[k])) << k;
+		return count;
+	}
+};
+
+
+// The clock rises at 1, 1 + 2 * halfPeriod ... The count is read half a period after an edge, once
+// the ripple through the stages has settled
+static bool CheckRippleCounter()
+{
+	TestCase test("ripple_counter");
+
+	static constexpr u32 HalfPeriod = 50;
+	static constexpr u64 StartTick = 1;
+	static constexpr u32 CountMask = (1u << RippleCounter::NumBits) - 1;
+
+	DigitalEngine engine;
+	NetId clock = engine.AddNet();
+	engine.AddClock(clock, HalfPeriod, StartTick);
+	RippleCounter counter(engine, clock);
+
+	for (u32 edges = 1; edges <= 40; edges++)
+	{
+		u64 tick = StartTick + u64(edges - 1) * 2 * HalfPeriod + HalfPeriod - 1;
+		engine.RunUntil(tick);
+
+		std::string when = "after " + std::to_string(edges) + " edges";
+		test.Expect(engine.GetTime() == tick, "engine stopped before the tick " + when);
+		test.Expect(engine.GetNet(clock), "clock low " + when);
+		test.Expect(counter.GetCount(engine) == ((0u - edges) & CountMask), "count is " + std::to_string(counter.GetCount(engine)) + " " + when);
+		test.Expect(engine.GetNextEventTime() == tick + 1, "next event is not the falling clock " + when);
+	}
+
+	// Only the clock moves on its falling edge
+	u64 falling = StartTick + 39 * 2 * HalfPeriod + HalfPeriod;
+	engine.RunUntil(falling);
+	test.Expect(!engine.GetNet(clock) && counter.GetCount(engine) == ((0u - 40u) & CountMask), "falling edge changed the count");
+
+	return test.Finish();
+}
+
+
+// The rising edge is the one the flip-flop takes, a clock held high takes no more
+static bool CheckFlipFlopEdges()
+{
+	TestCase test("flip_flop_edges");
+
+	DigitalEngine engine;
+	NetId d = engine.AddNet();
+	NetId clock = engine.AddNet();
+	NetId q = engine.AddNet();
+	engine.AddGate(eGateType::DFlipFlop, { d, clock }, q, 1);
+
+	engine.SetNet(d, true, 5);
+	engine.RunUntil(20);
+	test.Expect(!engine.GetNet(q), "q taken without a clock edge");
+
+	engine.SetNet(clock, true, 21);
+	engine.RunUntil(22);
+	test.Expect(engine.GetNet(q), "q not taken on the rising edge");
+
+	// D moves while the clock stays high, then the clock falls
+	engine.SetNet(d, false, 30);
+	engine.SetNet(clock, false, 40);
+	engine.RunUntil(50);
+	test.Expect(engine.GetNet(q), "q taken without a rising edge");
+
+	engine.SetNet(clock, true, 60);
+	engine.RunUntil(60);
+	test.Expect(engine.GetNet(q), "q before its delay");
+	engine.RunUntil(61);
+	test.Expect(!engine.GetNet(q), "q not taken on the second rising edge");
+
+	return test.Finish();
+}
+
+
+// A zero gate delay is one tick, an event for a tick gone by lands on the next one
+static bool CheckDelayClamp()
+{
+	TestCase test("delay_clamp");
+
+	DigitalEngine engine;
+	NetId a = engine.AddNet();
+	NetId b = engine.AddNet();
+	engine.AddGate(eGateType::Buffer, { a }, b, 0);
+
+	engine.SetNet(a, true, 10);
+	engine.RunUntil(10);
+	test.Expect(engine.GetNet(a) && !engine.GetNet(b), "zero delay applied on the tick of the input");
+	test.Expect(engine.GetNextEventTime() == 11, "output not due on the next tick");
+	engine.RunUntil(11);
+	test.Expect(engine.GetNet(b), "output not applied on the next tick");
+
+	engine.RunUntil(20);
+	engine.SetNet(a, false, 5);
+	test.Expect(engine.GetNextEventTime() == 21, "event in the past not moved to the next tick");
+	engine.RunUntil(21);
+	test.Expect(!engine.GetNet(a) && engine.GetNet(b), "late event not applied on the next tick");
+	engine.RunUntil(22);
+	test.Expect(!engine.GetNet(b), "output of the late event missing");
+
+	return test.Finish();
+}
+
+
+// Events past the wheel wait in the heap. With nothing on the wheel RunUntil jumps to them, with a
+// clock on it they are handed over while the ticks go by
+static bool CheckOverflow()
+{
+	TestCase test("overflow");
+
+	static constexpr u64 WheelSize = DigitalEngine::WheelSize;
+
+	DigitalEngine engine;
+	NetId near = engine.AddNet();
+	NetId edge = engine.AddNet();
+	NetId far = engine.AddNet();
+	NetId farOut = engine.AddNet();
+	engine.AddGate(eGateType::Buffer, { far }, farOut, 3);
+	engine.Finalize();
+
+	test.Expect(engine.GetNextEventTime() == NoEvent, "event in an idle engine");
+
+	engine.SetNet(near, true, WheelSize - 1);		// Last slot of the wheel
+	engine.SetNet(edge, true, WheelSize);			// First tick past it
+	engine.SetNet(far, true, 3 * WheelSize + 7);
+	test.Expect(engine.GetNextEventTime() == WheelSize - 1, "next event is not the one on the wheel");
+
+	engine.RunUntil(WheelSize - 2);
+	test.Expect(!engine.GetNet(near) && !engine.GetNet(edge), "event applied early");
+
+	engine.RunUntil(WheelSize - 1);
+	test.Expect(engine.GetNet(near) && !engine.GetNet(edge), "wheel event not on its tick");
+	test.Expect(engine.GetNextEventTime() == WheelSize, "next event is not the first one past the wheel");
+
+	engine.RunUntil(WheelSize);
+	test.Expect(engine.GetNet(edge), "event past the wheel not on its tick");
+	test.Expect(engine.GetNextEventTime() == 3 * WheelSize + 7, "next event is not the far one");
+
+	// Nothing in between, the run jumps and stops on the tick asked for
+	engine.RunUntil(2 * WheelSize);
+	test.Expect(engine.GetTime() == 2 * WheelSize && !engine.GetNet(far), "jump went past the tick");
+
+	engine.RunUntil(3 * WheelSize + 6);
+	test.Expect(!engine.GetNet(far), "far event applied early");
+	engine.RunUntil(3 * WheelSize + 7);
+	test.Expect(engine.GetNet(far) && !engine.GetNet(farOut), "far event not on its tick");
+	test.Expect(engine.GetNextEventTime() == 3 * WheelSize + 10, "gate output not next");
+	engine.RunUntil(10 * WheelSize);
+	test.Expect(engine.GetNet(farOut), "gate output of the far event missing");
+	test.Expect(engine.GetTime() == 10 * WheelSize && engine.GetNextEventTime() == NoEvent, "engine not idle at the end");
+
+	// A clock keeps the wheel busy, the far event moves over from the heap on the way
+	DigitalEngine clocked;
+	NetId clock = clocked.AddNet();
+	NetId late = clocked.AddNet();
+	clocked.AddClock(clock, 7);
+	clocked.SetNet(late, true, 2 * WheelSize + 3);
+
+	clocked.RunUntil(2 * WheelSize + 2);
+	test.Expect(!clocked.GetNet(late), "far event applied early with a clock");
+	clocked.RunUntil(2 * WheelSize + 3);
+	test.Expect(clocked.GetNet(late), "far event not on its tick with a clock");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckRippleCounter();
+	numFailed += !CheckFlipFlopEdges();
+	numFailed += !CheckDelayClamp();
+	numFailed += !CheckOverflow();
+
+	return numFailed;
+}
@@ -0,0 +1,356 @@
+// Undo and redo give back the circuits the edits came from
+//
+// A ladder is edited through a CircuitHistory. After every undo and redo the circuit is compared
+// with one built from scratch in the state it should be in : the same voltages and the same hash, so
+// a SolutionCache can't tell them apart. Elements the history holds out of the circuit are counted
+// to check that dropped steps destroy them.
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/History.h"
+#include "sim/SolutionCache.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t NumRungs = 8;
+static constexpr double Tolerance = 1e-12;	// Volts, undone value edits are solved by low rank updates
+
+using EditFn = std::function<void(Circuit&)>;
+
+
+// A resistor counting the instances alive
+class CountedResistor : public eResistor
+{
+public:
+	static inline int s_NumAlive = 0;
+
+	explicit CountedResistor(double resistance) : eResistor(resistance) { s_NumAlive++; }
+	~CountedResistor() override { s_NumAlive--; }
+};
+
+
+// A ladder with a cache, the one the history edits
+struct EditedLadder
+{
+	SolutionCache cache;
+	Circuit circuit;
+	CircuitHistory history;
+
+	EditedLadder()
+		: history(circuit)
+	{
+		CircuitGen::ResistorLadder(circuit, NumRungs);
+		circuit.SetSolutionCache(&cache);
+		circuit.UpdateSolution();
+	}
+
+	// 1 on a hit, 0 on a miss, -1 if the cache wasn't asked
+	int Update()
+	{
+		u64 hits = cache.GetNumHits();
+		u64 misses = cache.GetNumMisses();
+		circuit.UpdateSolution();
+		return cache.GetNumHits() > hits ? 1 : cache.GetNumMisses() > misses ? 0 : -1;
+	}
+};
+
+
+// The ladder built from scratch and edited directly, solved with a cache of its own so it hashes
+static void ExpectLikeFresh(TestCase& test, EditedLadder& ladder, const std::vector<EditFn>& edits, const std::string& when, bool sameBits)
+{
+	SolutionCache cache;
+	Circuit fresh;
+	CircuitGen::ResistorLadder(fresh, NumRungs);
+	for (const EditFn& edit : edits)
+		edit(fresh);
+	fresh.SetSolutionCache(&cache);
+	fresh.UpdateSolution();
+
+	test.Expect(ladder.circuit.GetNumElements() == fresh.GetNumElements(), "element count " + when);
+	test.Expect(ladder.circuit.GetHash() == fresh.GetHash(), "hash against a fresh circuit " + when);
+
+	std::vector<double> voltages = GetVoltages(ladder.circuit);
+	std::vector<double> expected = GetVoltages(fresh);
+	if (sameBits)
+		test.ExpectSameBits(voltages, expected, "voltages against a fresh circuit " + when);
+	else if (test.Expect(voltages.size() == expected.size(), "node count " + when))
+	{
+		for (size_t i = 0; i < voltages.size(); i++)
+			test.ExpectNear(voltages[i], expected[i], Tolerance, "voltage of node " + std::to_string(i) + " " + when);
+	}
+}
+
+
+static EditFn SetValue(size_t element, double value)
+{
+	return [=](Circuit& circuit) { circuit.GetElement(element)->SetValue(value); };
+}
+
+
+static EditFn RemoveElement(size_t element)
+{
+	return [=](Circuit& circuit) { circuit.RemoveElement(circuit.GetElement(element)); };
+}
+
+
+// A new node between the end of the ladder and a resistor to the ground
+static EditFn AddTail()
+{
+	return [](Circuit& circuit)
+	{
+		eNode* end = circuit.GetNode(circuit.GetNumNodes() - 1);
+		eNode* tail = circuit.CreateNode();
+
+		eResistor* series = circuit.AddResistor(3.0);
+		circuit.Connect(series->GetEpin(0), end);
+		circuit.Connect(series->GetEpin(1), tail);
+
+		eResistor* shunt = circuit.AddResistor(4.0);
+		circuit.Connect(shunt->GetEpin(0), tail);
+		circuit.Connect(shunt->GetEpin(1), circuit.GetGroundNode());
+	};
+}
+
+
+static void AddTail(CircuitHistory& history, Circuit& circuit)
+{
+	history.BeginStep();
+
+	eNode* end = circuit.GetNode(circuit.GetNumNodes() - 1);
+	eNode* tail = history.CreateNode();
+
+	eResistor* series = history.AddElement<eResistor>(3.0);
+	history.Connect(series->GetEpin(0), end);
+	history.Connect(series->GetEpin(1), tail);
+
+	eResistor* shunt = history.AddElement<eResistor>(4.0);
+	history.Connect(shunt->GetEpin(0), tail);
+	history.Connect(shunt->GetEpin(1), circuit.GetGroundNode());
+
+	history.EndStep();
+}
+
+
+static bool CheckValueUndoRedo()
+{
+	TestCase test("value_undo_redo");
+	EditedLadder ladder;
+
+	ladder.history.SetValue(ladder.circuit.GetElement(3), 5.0);
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { SetValue(3, 5.0) }, "after the edit", false);
+
+	test.Expect(ladder.history.Undo(), "nothing to undo");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, {}, "after the undo", false);
+
+	test.Expect(ladder.history.Redo(), "nothing to redo");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { SetValue(3, 5.0) }, "after the redo", false);
+
+	test.Expect(!ladder.history.Redo(), "redo past the last step");
+
+	return test.Finish();
+}
+
+
+// The pins are released as changes of the step, the undo puts the element back first and then
+// connects its pins to the nodes they left
+static bool CheckRemoveUndoRedo()
+{
+	TestCase test("remove_undo_redo");
+	EditedLadder ladder;
+
+	eElement* shunt = ladder.circuit.GetElement(4);
+	eNode* node0 = shunt->GetEpin(0)->GetConnectedNode();
+	eNode* node1 = shunt->GetEpin(1)->GetConnectedNode();
+
+	ladder.history.RemoveElement(shunt);
+	test.Expect(ladder.history.GetNumUndoSteps() == 1, "removal not a single step");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { RemoveElement(4) }, "after the removal", true);
+
+	for (int i = 0; i < 2; i++)
+	{
+		std::string round = " (round " + std::to_string(i) + ")";
+
+		test.Expect(ladder.history.Undo(), "nothing to undo" + round);
+		test.Expect(ladder.circuit.GetElement(4) == shunt, "element not back at its position" + round);
+		test.Expect(shunt->GetEpin(0)->GetConnectedNode() == node0 && shunt->GetEpin(1)->GetConnectedNode() == node1, "pins not back on their nodes" + round);
+		ladder.Update();
+		ExpectLikeFresh(test, ladder, {}, "after the undo" + round, true);
+
+		test.Expect(ladder.history.Redo(), "nothing to redo" + round);
+		test.Expect(!shunt->GetEpin(0)->IsConnectedToNode() && !shunt->GetEpin(1)->IsConnectedToNode(), "pins still connected" + round);
+		ladder.Update();
+		ExpectLikeFresh(test, ladder, { RemoveElement(4) }, "after the redo" + round, true);
+	}
+
+	return test.Finish();
+}
+
+
+// CreateNode is undone by DetachLastNode and redone by AttachNode with the same node
+static bool CheckAddNodeUndoRedo()
+{
+	TestCase test("add_node_undo_redo");
+	EditedLadder ladder;
+
+	size_t numNodes = ladder.circuit.GetNumNodes();
+	AddTail(ladder.history, ladder.circuit);
+	eNode* tail = ladder.circuit.GetNode(numNodes);
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { AddTail() }, "after the edit", true);
+
+	test.Expect(ladder.history.Undo(), "nothing to undo");
+	test.Expect(ladder.circuit.GetNumNodes() == numNodes, "node not taken out");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, {}, "after the undo", true);
+
+	test.Expect(ladder.history.Redo(), "nothing to redo");
+	test.Expect(ladder.circuit.GetNumNodes() == numNodes + 1 && ladder.circuit.GetNode(numNodes) == tail, "node not put back");
+	test.Expect(tail->GetNumPins() == 2, std::to_string(tail->GetNumPins()) + " pins on the node, expected 2");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { AddTail() }, "after the redo", true);
+
+	return test.Finish();
+}
+
+
+// Only the outermost pair makes a step, an empty one is not kept
+static bool CheckNestedSteps()
+{
+	TestCase test("nested_steps");
+	EditedLadder ladder;
+
+	ladder.history.BeginStep();
+	ladder.history.SetValue(ladder.circuit.GetElement(1), 5.0);
+	AddTail(ladder.history, ladder.circuit);
+	ladder.history.RemoveElement(ladder.circuit.GetElement(4));
+	test.Expect(!ladder.history.Undo(), "undo inside a step");
+	ladder.history.EndStep();
+
+	test.Expect(ladder.history.GetNumUndoSteps() == 1, std::to_string(ladder.history.GetNumUndoSteps()) + " steps, expected 1");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { SetValue(1, 5.0), AddTail(), RemoveElement(4) }, "after the step", true);
+
+	ladder.history.BeginStep();
+	ladder.history.BeginStep();
+	ladder.history.EndStep();
+	ladder.history.EndStep();
+	test.Expect(ladder.history.GetNumUndoSteps() == 1, "empty step kept");
+
+	test.Expect(ladder.history.Undo(), "nothing to undo");
+	test.Expect(ladder.history.GetNumUndoSteps() == 0, "the step undid in parts");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, {}, "after the undo", true);
+
+	test.Expect(ladder.history.Redo(), "nothing to redo");
+	ladder.Update();
+	ExpectLikeFresh(test, ladder, { SetValue(1, 5.0), AddTail(), RemoveElement(4) }, "after the redo", true);
+
+	return test.Finish();
+}
+
+
+// An undone addition and a removal are held out of the circuit until their steps are dropped
+static bool CheckDropRedo()
+{
+	TestCase test("drop_redo");
+
+	{
+		EditedLadder ladder;
+
+		CountedResistor* added = ladder.history.AddElement<CountedResistor>(3.0);
+		ladder.history.Connect(added->GetEpin(0), ladder.circuit.GetNode(2));
+		ladder.history.Connect(added->GetEpin(1), ladder.circuit.GetGroundNode());
+		ladder.Update();
+
+		test.Expect(ladder.history.Undo() && ladder.history.Undo() && ladder.history.Undo(), "steps missing");
+		test.Expect(CountedResistor::s_NumAlive == 1, "undone addition not held");
+
+		// A new edit drops the undone steps
+		ladder.history.SetValue(ladder.circuit.GetElement(1), 5.0);
+		test.Expect(ladder.history.GetNumRedoSteps() == 0, "redo steps left after an edit");
+		test.Expect(CountedResistor::s_NumAlive == 0, "dropped addition not destroyed");
+		ladder.Update();
+		ExpectLikeFresh(test, ladder, { SetValue(1, 5.0) }, "after the drop", false);
+
+		CountedResistor* removed = ladder.history.AddElement<CountedResistor>(3.0);
+		ladder.history.RemoveElement(removed);
+		test.Expect(CountedResistor::s_NumAlive == 1, "removed element not held");
+
+		ladder.history.Clear();
+		test.Expect(CountedResistor::s_NumAlive == 0, "cleared removal not destroyed");
+	}
+
+	test.Expect(CountedResistor::s_NumAlive == 0, "elements left after the circuit");
+
+	return test.Finish();
+}
+
+
+// An undone state was solved before, the cache has its solution
+static bool CheckCacheHitAfterUndo()
+{
+	TestCase test("cache_hit_after_undo");
+	EditedLadder ladder;
+
+	std::vector<double> original = GetVoltages(ladder.circuit);
+	u64 originalHash = ladder.circuit.GetHash();
+
+	ladder.history.RemoveElement(ladder.circuit.GetElement(4));
+	test.Expect(ladder.Update() == 0, "removal not a miss");
+	std::vector<double> removed = GetVoltages(ladder.circuit);
+
+	AddTail(ladder.history, ladder.circuit);
+	test.Expect(ladder.Update() == 0, "addition not a miss");
+
+	test.Expect(ladder.history.Undo(), "nothing to undo");
+	test.Expect(ladder.Update() == 1, "first undo not a hit");
+	test.ExpectSameBits(GetVoltages(ladder.circuit), removed, "first undo against the solve of the state");
+
+	test.Expect(ladder.history.Undo(), "nothing to undo");
+	test.Expect(ladder.Update() == 1, "second undo not a hit");
+	test.Expect(ladder.circuit.GetHash() == originalHash, "hash differs from the original");
+	test.ExpectSameBits(GetVoltages(ladder.circuit), original, "second undo against the original solve");
+
+	test.Expect(ladder.history.Redo(), "nothing to redo");
+	test.Expect(ladder.Update() == 1, "redo not a hit");
+	test.ExpectSameBits(GetVoltages(ladder.circuit), removed, "redo against the solve of the state");
+
+	return test.Finish();
+}
+
+
+static bool CheckMemory()
+{
+	TestCase test("memory");
+	EditedLadder ladder;
+
+	size_t empty = ladder.history.GetMemoryBytes();
+	ladder.history.RemoveElement(ladder.circuit.GetElement(4));
+	test.Expect(ladder.history.GetMemoryBytes() >= empty + sizeof(eElement) + 2 * sizeof(ePin), "held element not counted");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckValueUndoRedo();
+	numFailed += !CheckRemoveUndoRedo();
+	numFailed += !CheckAddNodeUndoRedo();
+	numFailed += !CheckNestedSteps();
+	numFailed += !CheckDropRedo();
+	numFailed += !CheckCacheHitAfterUndo();
+	numFailed += !CheckMemory();
+
+	return numFailed;
+}
@@ -0,0 +1,113 @@
+// Multigrid solves what the direct solver solves
+//
+// Power grids just past the size of the coarsest level, so the hierarchy has a coarse level, are
+// solved both ways, once from scratch and again after value edits on the same setup. An RC mesh is
+// stepped both ways, capacitors stamp as conductances in a transient step.
+
+#include <string>
+
+#include "sim/Scheme.h"
+#include "sim/Multigrid.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr double VoltageTolerance = 1e-8;	// Volts, the iteration stops at a relative residual of 1e-10
+
+
+// Every stride-th resistor of both circuits to a new value
+static void EditResistors(Circuit& a, Circuit& b, size_t stride, double factor)
+{
+	for (size_t k = 0; k < a.GetNumElements(); k += stride)
+	{
+		if (auto* resistor = dynamic_cast<eResistor*>(a.GetElement(k)))
+		{
+			resistor->SetValue(resistor->GetValue() * factor);
+			b.GetElement(k)->SetValue(resistor->GetValue());
+		}
+	}
+}
+
+
+static bool CheckPowerGrid(size_t size, size_t numLayers)
+{
+	TestCase test("power_grid_" + std::to_string(size) + "x" + std::to_string(size) + "x" + std::to_string(numLayers));
+
+	Circuit direct;
+	Circuit iterative;
+	CircuitGen::PowerGrid(direct, size, numLayers, 16);
+	CircuitGen::PowerGrid(iterative, size, numLayers, 16);
+	iterative.SetSolverMode(eSolverMode::Multigrid);
+
+	direct.UpdateSolution();
+	iterative.UpdateSolution();
+
+	const MultigridSolver* multigrid = iterative.GetMultigrid();
+	if (!test.Expect(multigrid != nullptr, "multigrid not used"))
+		return test.Finish();
+
+	test.Expect(multigrid->GetNumLevels() > 1, "no coarse level");
+	test.ExpectNear(MaxDifference(iterative, direct), 0.0, VoltageTolerance, "voltages against the direct solve");
+
+	// The same hierarchy takes the edited values
+	u32 numSetups = multigrid->GetNumSetups();
+	for (int edit = 0; edit < 3; edit++)
+	{
+		EditResistors(iterative, direct, 7 + size_t(edit), edit % 2 ? 0.5 : 1.5);
+		direct.UpdateSolution();
+		iterative.UpdateSolution();
+
+		std::string when = "after edit " + std::to_string(edit);
+		test.ExpectNear(MaxDifference(iterative, direct), 0.0, VoltageTolerance, "voltages against the direct solve " + when);
+	}
+	test.Expect(multigrid->GetNumSetups() == numSetups, "value edits set the hierarchy up again");
+
+	return test.Finish();
+}
+
+
+// Step response of an RC mesh, both solvers step by step
+static bool CheckTransient()
+{
+	TestCase test("rc_mesh_transient");
+
+	static constexpr double Step = 1e-10;
+	static constexpr int NumSteps = 20;
+
+	Circuit direct;
+	Circuit iterative;
+	CircuitGen::RcMesh(direct, 34);
+	CircuitGen::RcMesh(iterative, 34);
+	iterative.SetSolverMode(eSolverMode::Multigrid);
+
+	for (Circuit* circuit : { &direct, &iterative })
+	{
+		circuit->GetElement(0)->SetValue(0.0);
+		circuit->UpdateSolution();
+		circuit->SetStep(Step);
+		circuit->GetElement(0)->SetValue(1.0);
+	}
+
+	for (int step = 0; step < NumSteps; step++)
+	{
+		direct.Step();
+		iterative.Step();
+		test.ExpectNear(MaxDifference(iterative, direct), 0.0, VoltageTolerance, "voltages against the direct solve at step " + std::to_string(step));
+	}
+
+	test.Expect(iterative.GetMultigrid() != nullptr && iterative.GetMultigrid()->GetNumLevels() > 1, "multigrid not used with a hierarchy");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckPowerGrid(24, 2);
+	numFailed += !CheckPowerGrid(36, 1);
+	numFailed += !CheckTransient();
+
+	return numFailed;
+}
@@ -0,0 +1,227 @@
+// The netlist reader builds what the netlist says, and fails on the line that is wrong
+//
+// Values with every suffix and with units after them, the forms of a voltage source, the analyses
+// and probes. Bad lines have to fail with their line number, and a stream of netlists splits on
+// .end lines only. One reader parses netlist after netlist, as a batch worker does.
+
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/Netlist.h"
+#include "TestCheck.h"
+
+
+static constexpr double Tolerance = 1e-12;	// Relative, the suffix is a multiplication
+
+
+static bool CheckValues()
+{
+	TestCase test("values");
+
+	struct Case
+	{
+		const char* text;
+		double value;
+	};
+
+	static const Case Cases[] =
+	{
+		{ "4.7", 4.7 }, { "-2", -2.0 }, { "1e3", 1e3 }, { "2.5E-3", 2.5e-3 },
+		{ "3f", 3e-15 }, { "3p", 3e-12 }, { "3n", 3e-9 }, { "3u", 3e-6 }, { "3m", 3e-3 },
+		{ "4.7k", 4.7e3 }, { "2meg", 2e6 }, { "2MEG", 2e6 }, { "2g", 2e9 }, { "2t", 2e12 },
+		{ "10uF", 10e-6 }, { "1kOhm", 1e3 }, { "1K", 1e3 }, { "2Meg", 2e6 }, { "5V", 5.0 }, { "100mA", 0.1 },
+	};
+
+	for (const Case& c : Cases)
+	{
+		double value = 0.0;
+		if (test.Expect(NetlistReader::ParseValue(c.text, value), std::string("\"") + c.text + "\" not read"))
+			test.ExpectNear(value / c.value, 1.0, Tolerance, std::string("\"") + c.text + "\"");
+	}
+
+	for (const char* text : { "", "k", "abc", "1.2.3x", "1%", "1-", ".", "e3" })
+	{
+		double value = 0.0;
+		test.Expect(!NetlistReader::ParseValue(text, value), std::string("\"") + text + "\" read as " + std::to_string(value));
+	}
+
+	return test.Finish();
+}
+
+
+// V n+ n- [DC] <value> [AC <magnitude>]
+static bool CheckSources()
+{
+	TestCase test("sources");
+	NetlistReader reader;
+
+	struct Case
+	{
+		const char* line;
+		double voltage;
+		double acMagnitude;
+	};
+
+	static const Case Cases[] =
+	{
+		{ "V1 in 0 5", 5.0, 0.0 },
+		{ "V1 in 0 DC 5", 5.0, 0.0 },
+		{ "V1 in 0 dc 2.5 ac 1", 2.5, 1.0 },
+		{ "V1 in 0 3 AC 0.5", 3.0, 0.5 },
+		{ "V1 in 0 AC 1", 0.0, 1.0 },
+		{ "V1 in 0 DC 1m AC 10m", 1e-3, 10e-3 },
+	};
+
+	for (const Case& c : Cases)
+	{
+		Circuit circuit;
+		std::string text = std::string(c.line) + "\nR1 in 0 1k\n";
+		if (!test.Expect(reader.Parse(text, circuit), std::string(c.line) + " : " + reader.GetError()))
+			continue;
+
+		auto* source = dynamic_cast<eVoltageSource*>(circuit.GetElement(0));
+		if (!test.Expect(source != nullptr, std::string(c.line) + " not a voltage source"))
+			continue;
+
+		test.ExpectNear(source->GetVoltage(), c.voltage, Tolerance, std::string(c.line) + " : voltage");
+		test.ExpectNear(source->GetACMagnitude(), c.acMagnitude, Tolerance, std::string(c.line) + " : AC magnitude");
+	}
+
+	return test.Finish();
+}
+
+
+static bool CheckCircuit()
+{
+	TestCase test("circuit");
+	NetlistReader reader;
+	Circuit circuit;
+
+	const char* text =
+		".title divider\n"
+		"* comment\n"
+		"V1 in GND DC 10\n"
+		"  R1 IN mid 1k\n"
+		"R2 mid 0 4k   \n"
+		"\n"
+		"C1 mid 0 1n\n"
+		".tran 1u 1m\n"
+		".probe mid In\n"
+		".end\n"
+		"R3 mid 0 1\n";
+
+	if (!test.Expect(reader.Parse(text, circuit), "not parsed : " + reader.GetError()))
+		return test.Finish();
+
+	test.Expect(reader.GetTitle() == "divider", "title is \"" + reader.GetTitle() + "\"");
+	test.Expect(circuit.GetNumElements() == 4, std::to_string(circuit.GetNumElements()) + " elements, the line after .end read");
+	test.Expect(circuit.GetNumNodes() == 3, std::to_string(circuit.GetNumNodes()) + " nodes, expected ground, in and mid");
+	test.Expect(reader.GetElementName(1) == "R1" && reader.GetElementName(3) == "C1", "element names");
+
+	const NetlistAnalysis& analysis = reader.GetAnalysis();
+	test.Expect(analysis.type == eAnalysisType::Tran, "not a transient");
+	test.ExpectNear(analysis.step, 1e-6, 1e-18, "step");
+	test.ExpectNear(analysis.stop, 1e-3, 1e-15, "stop");
+
+	const auto& probes = reader.GetProbes();
+	if (test.Expect(probes.size() == 2, std::to_string(probes.size()) + " probes"))
+	{
+		test.Expect(probes[0].first == "mid" && probes[1].first == "In", "probe names");
+		test.Expect(probes[1].second == circuit.GetElement(0)->GetEpin(0)->GetConnectedNode(), "probe names aren't case insensitive");
+		test.Expect(reader.GetNodeName(probes[0].second) == "mid", "name of the probed node");
+	}
+
+	circuit.UpdateSolution();
+	test.ExpectNear(probes[0].second->GetVoltage(), 8.0, 1e-9, "divider voltage");
+
+	// Ground by either name, every node reported without .probe
+	Circuit other;
+	if (test.Expect(reader.Parse("V1 a gnd AC 1\nR1 a b 1\nR2 b 0 1\n.ac dec 10 1 1k\n", other), "second netlist : " + reader.GetError()))
+	{
+		test.Expect(other.GetNumNodes() == 3, "gnd and 0 are different nodes");
+		test.Expect(reader.GetTitle().empty(), "title of the first netlist kept");
+		test.Expect(reader.GetProbes().size() == 2, "not every node probed without .probe");
+		test.Expect(reader.GetAnalysis().type == eAnalysisType::AC && reader.GetAnalysis().numPoints == 31, std::to_string(reader.GetAnalysis().numPoints) + " AC points over 3 decades at 10");
+	}
+
+	return test.Finish();
+}
+
+
+// Every bad line fails the netlist with its number
+static bool CheckErrors()
+{
+	TestCase test("errors");
+	NetlistReader reader;
+
+	struct Case
+	{
+		const char* text;
+		const char* error;
+	};
+
+	static const Case Cases[] =
+	{
+		{ "R1 a 0 1k\nR2 a 0\n", "line 2 : element needs a name, two nodes and a value" },
+		{ "R1 a 0 -1\n", "line 1 : bad resistance" },
+		{ "R1 a 0 0\n", "line 1 : bad resistance" },
+		{ "C1 a 0 x\n", "line 1 : bad capacitance" },
+		{ "L1 a 0 0\n", "line 1 : bad inductance" },
+		{ "D1 a 0 0\n", "line 1 : bad saturation current" },
+		{ "D1 a 0 1e-14 -1\n", "line 1 : bad emission coefficient" },
+		{ "V1 a 0 DC\n", "line 1 : missing DC value" },
+		{ "V1 a 0 five\n", "line 1 : bad voltage" },
+		{ "V1 a 0 5 AC\n", "line 1 : bad AC magnitude" },
+		{ "Q1 a 0 b 1\n", "line 1 : unknown element type" },
+		{ "* first\nR1 a 0 1\n.foo\n", "line 3 : unknown control line" },
+		{ "R1 a 0 1\n.tran 1m\n", "line 2 : .tran needs <step> <stop>, 0 < step <= stop" },
+		{ "R1 a 0 1\n.tran 1m 1u\n", "line 2 : .tran needs <step> <stop>, 0 < step <= stop" },
+		{ "R1 a 0 1\n.ac lin 10 1 1k\n", "line 2 : .ac needs dec <points per decade> <fstart> <fstop>" },
+		{ "R1 a 0 1\n.ac dec 10 1k 1\n", "line 2 : .ac needs dec <points per decade> <fstart> <fstop>" },
+		{ ".probe a b\nR1 a 0 1\n.probe c\n", "line 1 : unknown node b" },
+		{ "R1 a 0 1\n.probe A\n\n.probe aa\n", "line 4 : unknown node aa" },
+	};
+
+	for (const Case& c : Cases)
+	{
+		Circuit circuit;
+		test.Expect(!reader.Parse(c.text, circuit), std::string("\"") + c.text + "\" parsed");
+		test.Expect(reader.GetError() == c.error, "error is \"" + reader.GetError() + "\", expected \"" + c.error + "\"");
+	}
+
+	// The reader is fine for the next netlist
+	Circuit circuit;
+	test.Expect(reader.Parse("R1 a 0 1\n.probe a\n", circuit) && reader.GetError().empty(), "error left after a good netlist");
+
+	return test.Finish();
+}
+
+
+// A stream of netlists is split on the lines that are .end and nothing else
+static bool CheckEndLines()
+{
+	TestCase test("end_lines");
+
+	for (const char* line : { ".end", ".END", "  .End  ", ".end\r", "\t.end comment" })
+		test.Expect(NetlistReader::IsEndLine(line), std::string("\"") + line + "\" not an end line");
+
+	for (const char* line : { ".ends", ".endl", "end", "* .end", "R1 .end 0 1", ".en", "" })
+		test.Expect(!NetlistReader::IsEndLine(line), std::string("\"") + line + "\" an end line");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckValues();
+	numFailed += !CheckSources();
+	numFailed += !CheckCircuit();
+	numFailed += !CheckErrors();
+	numFailed += !CheckEndLines();
+
+	return numFailed;
+}
@@ -0,0 +1,188 @@
+// Diodes solved by Newton iteration, through edits of the circuit around them
+//
+// Operating points are checked against the Shockley equation and Kirchhoff's current law. A diode
+// taken out of a running circuit (as an undo does) must leave nothing behind : the steps after it
+// solve what is left, as a circuit built without it would.
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/Nonlinear.h"
+#include "TestCheck.h"
+
+
+static constexpr double Step = 1e-6;
+static constexpr int NumSteps = 20;
+static constexpr double VoltageTolerance = 1e-5;	// Two Newton runs from other starting points
+static constexpr double Resistance = 1000.0;
+
+
+// (v)--R--*--D1--GND, numDiodes junctions in parallel from the anode and a capacitor across them
+struct DiodeCircuit
+{
+	Circuit circuit;
+	eNode* anode;
+	eResistor* resistor;
+	std::vector<eDiode*> diodes;
+
+	explicit DiodeCircuit(int numDiodes, double voltage = 2.0)
+	{
+		eNode* ground = circuit.CreateNode();
+		eNode* supply = circuit.CreateNode();
+		anode = circuit.CreateNode();
+
+		eVoltageSource* source = circuit.AddVoltageSource(voltage);
+		circuit.Connect(source->GetPositivePin(), supply);
+		circuit.Connect(source->GetNegativePin(), ground);
+
+		resistor = circuit.AddResistor(Resistance);
+		circuit.Connect(resistor->GetEpin(0), supply);
+		circuit.Connect(resistor->GetEpin(1), anode);
+
+		eCapacitor* capacitor = circuit.AddCapacitor(1e-9);
+		circuit.Connect(capacitor->GetEpin(0), anode);
+		circuit.Connect(capacitor->GetEpin(1), ground);
+
+		for (int i = 0; i < numDiodes; i++)
+		{
+			eDiode* diode = circuit.AddElement<eDiode>();
+			circuit.Connect(diode->GetEpin(0), anode);
+			circuit.Connect(diode->GetEpin(1), ground);
+			diodes.push_back(diode);
+		}
+
+		circuit.SetStep(Step);
+	}
+
+	void Run(int numSteps)
+	{
+		for (int i = 0; i < numSteps; i++)
+			circuit.Step();
+	}
+};
+
+
+// The junctions at the converged point follow the Shockley equation, and the resistor feeds what
+// they and the settled capacitor take
+static void ExpectOperatingPoint(TestCase& test, DiodeCircuit& d, const std::string& when)
+{
+	test.Expect(d.circuit.IsConverged(), "Newton didn't converge " + when);
+
+	double vd = d.anode->GetVoltage();
+	double diodeCurrent = 0.0;
+	for (eDiode* diode : d.diodes)
+	{
+		double expected = diode->GetSaturationCurrent() * (std::exp(vd / (diode->GetEmissionCoefficient() * eDiode::ThermalVoltage)) - 1.0);
+		test.ExpectNear(diode->GetCurrent(), expected, 1e-3 * std::abs(expected) + 1e-12, "diode current " + when);
+		diodeCurrent += diode->GetCurrent();
+	}
+
+	double resistorCurrent = d.resistor->GetCurrent();
+	test.ExpectNear(resistorCurrent, diodeCurrent, 1e-3 * std::abs(resistorCurrent) + 1e-9, "resistor against diode current " + when);
+}
+
+
+// Voltages of the circuit against one built with the same number of diodes from the start, both
+// stepped until the capacitor has settled
+static void ExpectLikeFresh(TestCase& test, DiodeCircuit& d, const std::string& when)
+{
+	DiodeCircuit fresh(int(d.diodes.size()));
+	fresh.Run(NumSteps * 50);
+
+	double difference = 0.0;
+	for (size_t i = 0; i < d.circuit.GetNumNodes(); i++)
+		difference = std::max(difference, std::abs(d.circuit.GetNode(i)->GetVoltage() - fresh.circuit.GetNode(i)->GetVoltage()));
+	test.ExpectNear(difference, 0.0, VoltageTolerance, "voltages against a fresh circuit " + when);
+}
+
+
+static bool CheckOperatingPoint()
+{
+	TestCase test("operating_point");
+
+	for (int numDiodes : { 1, 2, 4 })
+	{
+		DiodeCircuit d(numDiodes);
+		d.Run(NumSteps * 50);
+		std::string when = "with " + std::to_string(numDiodes) + " diodes";
+		ExpectOperatingPoint(test, d, when);
+		test.ExpectNear(d.anode->GetVoltage(), 0.7, 0.15, "forward voltage " + when);
+	}
+
+	return test.Finish();
+}
+
+
+// Diodes removed one by one between steps, each time the circuit goes on as one built without them
+static bool CheckDetachThenStep()
+{
+	TestCase test("detach_then_step");
+
+	DiodeCircuit d(3);
+	d.Run(NumSteps);
+
+	while (!d.diodes.empty())
+	{
+		eDiode* diode = d.diodes.back();
+		d.diodes.pop_back();
+
+		// Destroyed here, like a removal that no history keeps
+		test.Expect(d.circuit.DetachElement(diode) != nullptr, "diode not in the circuit");
+
+		d.Run(NumSteps * 50);
+		std::string when = "with " + std::to_string(d.diodes.size()) + " diodes left";
+
+		if (d.diodes.empty())
+		{
+			test.Expect(d.circuit.GetNewtonIterations() == 0, "Newton iterations without a diode");
+			test.ExpectNear(d.anode->GetVoltage(), 2.0, 1e-9, "anode without a diode");
+		}
+		else
+		{
+			ExpectOperatingPoint(test, d, when);
+			ExpectLikeFresh(test, d, when);
+		}
+	}
+
+	return test.Finish();
+}
+
+
+// Taken out and put back, as undo and redo do : the diode is solved again like it never left
+static bool CheckDetachReinsert()
+{
+	TestCase test("detach_reinsert");
+
+	DiodeCircuit d(2);
+	d.Run(NumSteps);
+
+	size_t index = 0;
+	std::unique_ptr<eElement> detached = d.circuit.DetachElement(d.diodes[1], &index);
+	test.Expect(detached != nullptr, "diode not in the circuit");
+	d.Run(NumSteps);
+
+	eElement* reinserted = d.circuit.InsertElement(std::move(detached), index);
+	d.circuit.Connect(reinserted->GetEpin(0), d.anode);
+	d.circuit.Connect(reinserted->GetEpin(1), d.circuit.GetGroundNode());
+	d.Run(NumSteps * 50);
+
+	ExpectOperatingPoint(test, d, "after the reinsert");
+	ExpectLikeFresh(test, d, "after the reinsert");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckOperatingPoint();
+	numFailed += !CheckDetachThenStep();
+	numFailed += !CheckDetachReinsert();
+
+	return numFailed;
+}
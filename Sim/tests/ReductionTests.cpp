@@ -0,0 +1,129 @@
+// A reduced model behaves like the mesh it replaced, seen from its ports
+//
+// The inner mesh of an RC net is reduced at rest, then the source steps from 0 to 1 V. The loads on
+// the ports follow the full mesh step by step. The model matches the moments around DC, so the
+// operating point it settles to is the one of the full mesh.
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/Reduction.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t MeshSize = 16;
+static constexpr double Step = 1e-10;
+static constexpr int NumSteps = 200;
+static constexpr size_t FirstLoad = 2;		// Loads of CircuitGen::RcMesh, the ports of the model
+static constexpr size_t NumLoads = 3;
+static constexpr size_t FirstMeshElement = 5;
+
+
+// RC mesh at rest with the source about to step, reduced to order if not 0
+static eReducedModel* BuildMesh(Circuit& circuit, size_t order)
+{
+	CircuitGen::RcMesh(circuit, MeshSize);
+	circuit.GetElement(0)->SetValue(0.0);
+	circuit.UpdateSolution();
+
+	eReducedModel* model = nullptr;
+	if (order)
+	{
+		std::vector<eElement*> elements;
+		for (size_t k = FirstMeshElement; k < circuit.GetNumElements(); k++)
+			elements.push_back(circuit.GetElement(k));
+
+		ReductionOptions options;
+		options.maxOrder = order;
+		model = ReduceSubnetwork(circuit, elements, {}, options);
+	}
+
+	circuit.SetStep(Step);
+	circuit.GetElement(0)->SetValue(1.0);
+	return model;
+}
+
+
+static double GetLoadVoltage(Circuit& circuit, size_t load)
+{
+	return circuit.GetElement(FirstLoad + load)->GetEpin(0)->GetVoltage();
+}
+
+
+static bool CheckStepResponse(size_t order, double tolerance)
+{
+	TestCase test("step_response_order_" + std::to_string(order));
+
+	Circuit full;
+	Circuit reduced;
+	BuildMesh(full, 0);
+	eReducedModel* model = BuildMesh(reduced, order);
+	if (!test.Expect(model != nullptr, "mesh not reduced"))
+		return test.Finish();
+
+	test.Expect(model->GetOrder() <= order, "order " + std::to_string(model->GetOrder()) + " past the limit");
+	test.Expect(reduced.GetNumElements() == FirstMeshElement + 1, "mesh elements left in the circuit");
+
+	double maxDifference = 0.0;
+	double maxVoltage = 0.0;
+	for (int step = 0; step < NumSteps; step++)
+	{
+		full.Step();
+		reduced.Step();
+		for (size_t load = 0; load < NumLoads; load++)
+		{
+			maxDifference = std::max(maxDifference, std::abs(GetLoadVoltage(reduced, load) - GetLoadVoltage(full, load)));
+			maxVoltage = std::max(maxVoltage, GetLoadVoltage(full, load));
+		}
+	}
+	test.Expect(maxVoltage > 0.1, "the loads didn't move");
+	test.ExpectNear(maxDifference, 0.0, tolerance, "load voltages against the full mesh");
+
+	// Settled, the DC moment decides
+	full.SetStep(0.0);
+	reduced.SetStep(0.0);
+	full.UpdateSolution();
+	reduced.UpdateSolution();
+	for (size_t load = 0; load < NumLoads; load++)
+		test.ExpectNear(GetLoadVoltage(reduced, load), GetLoadVoltage(full, load), 1e-9, "operating point of load " + std::to_string(load));
+
+	return test.Finish();
+}
+
+
+// An element the reduction doesn't take leaves the circuit as it was
+static bool CheckRejected()
+{
+	TestCase test("rejected");
+
+	Circuit circuit;
+	CircuitGen::RcMesh(circuit, 8);
+	circuit.UpdateSolution();
+	size_t numElements = circuit.GetNumElements();
+	size_t numNodes = circuit.GetNumNodes();
+
+	std::vector<eElement*> elements = { circuit.GetElement(0) };	// The source
+	for (size_t k = FirstMeshElement; k < circuit.GetNumElements(); k++)
+		elements.push_back(circuit.GetElement(k));
+
+	test.Expect(ReduceSubnetwork(circuit, elements, {}) == nullptr, "source reduced");
+	test.Expect(circuit.GetNumElements() == numElements && circuit.GetNumNodes() == numNodes, "circuit changed");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckStepResponse(8, 1e-4);
+	numFailed += !CheckStepResponse(24, 1e-9);
+	numFailed += !CheckRejected();
+
+	return numFailed;
+}
@@ -0,0 +1,179 @@
+// Waveform relaxation follows the monolithic transient, and Join() gives the circuit back
+//
+// Coupled RC blocks step from rest with their sources switched on, monolithic and split in one
+// partition per block, with both schemes, serial and on a pool. The split run is read against the
+// monolithic one at the end of the run. Joined again, the circuit has its elements in their order on
+// their nodes and the voltages of the last step, and steps on with the monolithic one.
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/ThreadPool.h"
+#include "sim/Scheme.h"
+#include "sim/Relaxation.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t NumBlocks = 4;
+static constexpr size_t BlockSize = 6;
+static constexpr double Step = 1e-10;
+static constexpr size_t NumSteps = 120;			// Two full windows and a short one
+static constexpr size_t NumStepsJoined = 10;
+static constexpr double VoltageTolerance = 1e-7;	// Volts, iterations stop at a change of 1e-6 on a boundary
+
+
+// Sources of CircuitGen::CoupledBlocks : all off, or on at levels that differ from block to block
+static void SetBlockSources(Circuit& circuit, bool on)
+{
+	size_t block = 0;
+	for (size_t i = 0; i < circuit.GetNumElements(); i++)
+	{
+		if (auto* source = dynamic_cast<eVoltageSource*>(circuit.GetElement(i)))
+			source->SetVoltage(on ? (block++ % 2 ? 1.0 : 0.3) : 0.0);
+	}
+}
+
+
+// At rest with the sources about to switch on
+static void BuildBlocks(Circuit& circuit)
+{
+	CircuitGen::CoupledBlocks(circuit, NumBlocks, BlockSize);
+	SetBlockSources(circuit, false);
+	circuit.UpdateSolution();
+	circuit.SetStep(Step);
+	SetBlockSources(circuit, true);
+}
+
+
+static bool CheckScheme(WaveformRelaxation::eScheme scheme, size_t numWorkers)
+{
+	const char* name = scheme == WaveformRelaxation::eScheme::Jacobi ? "jacobi" : "seidel";
+	TestCase test(std::string(name) + (numWorkers ? "_pooled_" + std::to_string(numWorkers + 1) + "_threads" : "_serial"));
+	std::unique_ptr<ThreadPool> pool = numWorkers ? std::make_unique<ThreadPool>(numWorkers) : nullptr;
+
+	Circuit monolithic;
+	Circuit circuit;
+	BuildBlocks(monolithic);
+	BuildBlocks(circuit);
+
+	// Where every element is and what its pins are on, to compare after the join
+	std::vector<eElement*> elements;
+	std::vector<eNode*> pinNodes;
+	for (size_t i = 0; i < circuit.GetNumElements(); i++)
+	{
+		eElement* element = circuit.GetElement(i);
+		elements.push_back(element);
+		for (size_t p = 0; p < element->GetNumPins(); p++)
+			pinNodes.push_back(element->GetEpin(p)->GetConnectedNode());
+	}
+
+	WaveformRelaxation relaxation(circuit);
+	WaveformRelaxation::Options options;
+	options.scheme = scheme;
+	relaxation.SetOptions(options);
+
+	if (!test.Expect(relaxation.Split(NumBlocks), "split rejected"))
+		return test.Finish();
+
+	test.Expect(relaxation.GetNumPartitions() == NumBlocks, std::to_string(relaxation.GetNumPartitions()) + " partitions, expected one per block");
+	test.Expect(relaxation.GetNumShared() == 2 * (NumBlocks - 1), std::to_string(relaxation.GetNumShared()) + " shared elements, expected the couplings");
+	test.Expect(circuit.GetNumElements() == 0, "elements left in the split circuit");
+	if (scheme == WaveformRelaxation::eScheme::Seidel)
+		test.Expect(relaxation.GetNumStages() == 2, "blocks in a row don't colour in 2 stages");
+
+	test.Expect(relaxation.Run(NumSteps, pool.get()), "window out of iterations");
+	for (size_t step = 0; step < NumSteps; step++)
+		monolithic.Step();
+
+	const WaveformRelaxation::Stats& stats = relaxation.GetStats();
+	test.Expect(stats.steps == NumSteps && stats.windows == 3, std::to_string(stats.windows) + " windows over " + std::to_string(stats.steps) + " steps");
+
+	double maxDifference = 0.0;
+	double maxVoltage = 0.0;
+	for (size_t i = 0; i < circuit.GetNumNodes(); i++)
+	{
+		maxDifference = std::max(maxDifference, std::abs(relaxation.GetVoltage(circuit.GetNode(i)) - monolithic.GetNode(i)->GetVoltage()));
+		maxVoltage = std::max(maxVoltage, monolithic.GetNode(i)->GetVoltage());
+	}
+	test.Expect(maxVoltage > 0.1, "the blocks didn't move");
+	test.ExpectNear(maxDifference, 0.0, VoltageTolerance, "voltages against the monolithic run");
+
+	std::vector<double> splitVoltages(circuit.GetNumNodes());
+	for (size_t i = 0; i < splitVoltages.size(); i++)
+		splitVoltages[i] = relaxation.GetVoltage(circuit.GetNode(i));
+
+	relaxation.Join();
+	test.Expect(!relaxation.IsSplit(), "still split after the join");
+
+	if (test.Expect(circuit.GetNumElements() == elements.size(), "element count after the join"))
+	{
+		size_t pin = 0;
+		bool samePins = true;
+		for (size_t i = 0; i < elements.size(); i++)
+		{
+			test.Expect(circuit.GetElement(i) == elements[i], "element " + std::to_string(i) + " not back at its position");
+			for (size_t p = 0; p < elements[i]->GetNumPins(); p++)
+				samePins &= elements[i]->GetEpin(p)->GetConnectedNode() == pinNodes[pin++];
+		}
+		test.Expect(samePins, "pins not back on their nodes");
+	}
+
+	test.ExpectSameBits(GetVoltages(circuit), splitVoltages, "voltages after the join");
+
+	// The joined circuit picks up from the last step
+	for (size_t step = 0; step < NumStepsJoined; step++)
+	{
+		circuit.Step();
+		monolithic.Step();
+	}
+
+	test.ExpectNear(MaxDifference(circuit, monolithic), 0.0, VoltageTolerance, "voltages stepped on after the join");
+
+	return test.Finish();
+}
+
+
+// An inductor across two partitions is refused, and the circuit keeps its elements
+static bool CheckRejected()
+{
+	TestCase test("rejected");
+
+	Circuit circuit;
+	CircuitGen::RlcLadder(circuit, 4);
+	circuit.UpdateSolution();
+	circuit.SetStep(Step);
+	size_t numElements = circuit.GetNumElements();
+
+	// Ground, source node, then mid and next of every section : the first inductor goes from 2 to 3
+	std::vector<u32> nodePartition(circuit.GetNumNodes(), 0);
+	for (size_t i = 3; i < nodePartition.size(); i++)
+		nodePartition[i] = 1;
+
+	WaveformRelaxation relaxation(circuit);
+	test.Expect(!relaxation.Split(nodePartition), "split across an inductor");
+	test.Expect(!relaxation.IsSplit() && circuit.GetNumElements() == numElements, "elements moved by a refused split");
+
+	// Nodes tied by an inductor stay together when the partitions are found
+	std::vector<u32> found = WaveformRelaxation::PartitionNodes(circuit, 2);
+	test.Expect(found[2] == found[3], "inductor nodes in different partitions");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckScheme(WaveformRelaxation::eScheme::Jacobi, 0);
+	numFailed += !CheckScheme(WaveformRelaxation::eScheme::Jacobi, 3);
+	numFailed += !CheckScheme(WaveformRelaxation::eScheme::Seidel, 0);
+	numFailed += !CheckScheme(WaveformRelaxation::eScheme::Seidel, 3);
+	numFailed += !CheckRejected();
+
+	return numFailed;
+}
@@ -0,0 +1,266 @@
+// Simulation::Update paces the steps against the frame times it is given
+//
+// The frame times are made up, only the cost of the steps is real : a small resistor ladder steps in
+// microseconds, an output that spins makes publishing cost something. Checks are on what the pacing
+// decides, the steps of a frame against the budget, the time given up after a stall, the output
+// interval backing off and recovering, the achieved rate against the target. Bounds on wall time are
+// loose, the machine may be busy with other tests.
+
+#include <cmath>
+#include <string>
+
+#include "base/Timer.h"
+#include "sim/Scheme.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t NumRungs = 16;
+static constexpr double Frame = 0.016;
+static constexpr int NumWarmupFrames = 100;
+static constexpr int NumFrames = 20;
+
+
+static void Spin(double seconds)
+{
+	Timer timer = Timer::StartNew();
+	do
+		timer.Update();
+	while (timer.GetElapsedSeconds() < seconds);
+}
+
+
+// Far behind : the steps of a frame are what fits the budget, a larger budget takes more
+static bool CheckStepBudget()
+{
+	TestCase test("step_budget");
+
+	double averageSteps[2] = {};
+	const double budgets[2] = { 0.001, 0.004 };
+	for (int b = 0; b < 2; b++)
+	{
+		Circuit circuit;
+		CircuitGen::ResistorLadder(circuit, NumRungs);
+		Simulation sim(circuit);
+		sim.SetStep(1e-6);
+		sim.SetTargetRate(1.0);		// 16000 steps a frame
+		sim.SetFrameBudget(budgets[b]);
+		sim.StartSim();
+
+		sim.Update(Frame);
+		test.Expect(sim.GetLastSteps() == 1, "first frame doesn't step once to measure");
+
+		// The first step factors, the cost estimate takes a few dozen frames to come down from it
+		for (int i = 0; i < NumWarmupFrames; i++)
+			sim.Update(Frame);
+
+		size_t totalSteps = 0;
+		double totalSeconds = 0.0;
+		double maxSeconds = 0.0;
+		for (int i = 0; i < NumFrames; i++)
+		{
+			Timer timer = Timer::StartNew();
+			sim.Update(Frame);
+			timer.Stop();
+			totalSeconds += timer.GetElapsedSeconds();
+			maxSeconds = std::max(maxSeconds, timer.GetElapsedSeconds());
+			totalSteps += sim.GetLastSteps();
+			test.Expect(sim.GetLastSteps() < 16000, "caught up within a budget of " + std::to_string(budgets[b]));
+		}
+		averageSteps[b] = double(totalSteps) / NumFrames;
+
+		// The loop stops on the first step past the budget, the plan fills most of it
+		std::string with = " with a budget of " + std::to_string(budgets[b]);
+		test.ExpectNear(maxSeconds, 0.0, budgets[b] + 0.01, "longest frame" + with);
+		test.Expect(totalSeconds / NumFrames > 0.5 * budgets[b], "frames of " + std::to_string(totalSeconds / NumFrames) + " s" + with);
+		test.Expect(sim.GetPaceRatio() < 0.5, "on pace while far behind");
+	}
+
+	test.Expect(averageSteps[0] > 1.0, "a single step a frame within 1 ms");
+	test.Expect(averageSteps[1] > 2.0 * averageSteps[0], std::to_string(averageSteps[1]) + " steps a frame in 4 ms against " + std::to_string(averageSteps[0]) + " in 1 ms");
+
+	return test.Finish();
+}
+
+
+// A stall is cut to the lag, the rest is counted as dropped. The backlog never grows past the lag
+static bool CheckLag()
+{
+	TestCase test("lag");
+
+	static constexpr double Step = 1e-3;
+	static constexpr double MaxLag = 0.25;
+
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, NumRungs);
+	Simulation sim(circuit);
+	sim.SetStep(Step);
+	sim.SetTargetRate(1.0);
+	sim.SetMaxLag(MaxLag);
+	sim.SetFrameBudget(1.0);
+	sim.StartSim();
+
+	double fed = Step;
+	sim.Update(Step);		// Measures
+	fed += 10.0;
+	sim.Update(10.0);
+
+	test.ExpectNear(sim.GetDroppedTime(), 10.0 - MaxLag, 1e-9, "time dropped by a stall");
+	test.ExpectNear(sim.GetTime(), Step + MaxLag, Step * 1e-3, "time stepped after a stall");
+
+	// A budget no step fits : one step a frame, the backlog fills up to the lag and is dropped past it
+	sim.SetFrameBudget(1e-12);
+	for (int i = 0; i < 100; i++)
+	{
+		sim.Update(0.1);
+		fed += 0.1;
+		test.Expect(sim.GetLastSteps() == 1, "not one step a frame without a budget");
+
+		double owed = fed - sim.GetTime() - sim.GetDroppedTime();
+		if (!test.Expect(owed > -1e-9 && owed < MaxLag + Step, "backlog of " + std::to_string(owed) + " s after frame " + std::to_string(i)))
+			break;
+	}
+	test.Expect(sim.GetDroppedTime() > 10.0 - MaxLag + 9.0, "backlog past the lag not dropped");
+
+	// Negative frame times count as none
+	double time = sim.GetTime();
+	double dropped = sim.GetDroppedTime();
+	sim.SetFrameBudget(1.0);
+	sim.Update(-1.0);
+	test.Expect(sim.GetDroppedTime() == dropped, "negative frame time dropped time");
+	test.Expect(sim.GetTime() >= time, "negative frame time went back");
+
+	return test.Finish();
+}
+
+
+// Behind with outputs that cost, the interval doubles up to the limit. On pace it halves again after
+// enough frames in a row
+static bool CheckOutputRate()
+{
+	TestCase test("output_rate");
+
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, NumRungs);
+	Simulation sim(circuit);
+
+	size_t numOutputs = 0;
+	sim.SetOutput([&](double) { numOutputs++; Spin(1e-4); });
+	sim.SetStep(1e-6);
+	sim.SetTargetRate(1.0);
+	sim.SetFrameBudget(0.002);
+	sim.StartSim();
+
+	for (int i = 0; i < 12 && sim.GetOutputInterval() < Simulation::MaxOutputInterval; i++)
+		sim.Update(Frame);
+	test.Expect(sim.GetOutputInterval() == Simulation::MaxOutputInterval, "interval " + std::to_string(sim.GetOutputInterval()) + " after 12 frames behind");
+
+	// One step a frame, owed from a fresh start
+	sim.StopSim();
+	sim.SetTargetRate(1e-6 / Frame);
+	sim.SetFrameBudget(1.0);
+	sim.StartSim();
+
+	size_t interval = sim.GetOutputInterval();
+	int frames = 0;
+	int firstHalving = 0;
+	while (interval > 1 && frames < 1000)
+	{
+		sim.Update(Frame);
+		frames++;
+		if (sim.GetOutputInterval() != interval)
+		{
+			test.Expect(sim.GetOutputInterval() == interval / 2, "interval not halved");
+			interval = sim.GetOutputInterval();
+			if (!firstHalving)
+				firstHalving = frames;
+		}
+	}
+
+	test.Expect(interval == 1, "interval " + std::to_string(interval) + " after 1000 frames on pace");
+	test.Expect(firstHalving >= 29, "interval halved after " + std::to_string(firstHalving) + " frames on pace");
+	test.Expect(numOutputs > 0, "no outputs");
+
+	return test.Finish();
+}
+
+
+// Steps that divide the owed time of a frame : the achieved rate settles on the target
+static bool CheckRealTimeFactor()
+{
+	TestCase test("real_time_factor");
+
+	static constexpr double Rate = 0.01;
+	static constexpr double FrameTime = 0.01;	// 10 steps of 1e-5 a frame
+
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, NumRungs);
+	Simulation sim(circuit);
+	sim.SetStep(1e-5);
+	sim.SetTargetRate(Rate);
+	sim.SetFrameBudget(1.0);
+	sim.StartSim();
+
+	for (int i = 0; i < 300; i++)
+		sim.Update(FrameTime);
+
+	test.Expect(sim.GetLastSteps() == 10, std::to_string(sim.GetLastSteps()) + " steps a frame, expected 10");
+	test.ExpectNear(sim.GetRealTimeFactor(), Rate, Rate * 1e-6, "real time factor");
+	test.ExpectNear(sim.GetPaceRatio(), 1.0, 1e-6, "pace ratio");
+	test.ExpectNear(sim.GetTime(), 300 * FrameTime * Rate, 1e-5, "simulated time");
+	test.Expect(sim.GetDroppedTime() == 0.0, "time dropped on pace");
+
+	return test.Finish();
+}
+
+
+// A frame that owes no step still shows the edits of the frame
+static bool CheckEditsWithoutSteps()
+{
+	TestCase test("edits_without_steps");
+
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, NumRungs);
+	Simulation sim(circuit);
+
+	size_t numOutputs = 0;
+	sim.SetOutput([&](double) { numOutputs++; });
+	sim.SetStep(1e-3);
+	sim.SetTargetRate(1e-2);	// A step every 6 frames
+	sim.StartSim();
+	sim.Update(0.1);			// Steps once
+	test.Expect(sim.GetLastSteps() == 1, "first frame didn't step");
+
+	circuit.GetElement(3)->SetValue(7.0);
+	size_t outputs = numOutputs;
+	sim.Update(Frame);
+	test.Expect(sim.GetLastSteps() == 0, "stepped with less than a step owed");
+	test.Expect(numOutputs == outputs + 1, "edit not published");
+
+	Circuit fresh;
+	CircuitGen::ResistorLadder(fresh, NumRungs);
+	fresh.GetElement(3)->SetValue(7.0);
+	fresh.UpdateSolution();
+	for (size_t i = 0; i < circuit.GetNumNodes(); i++)
+		test.ExpectNear(circuit.GetNode(i)->GetVoltage(), fresh.GetNode(i)->GetVoltage(), 1e-12, "voltage of node " + std::to_string(i) + " after the edit");
+
+	// Nothing edited, nothing published
+	sim.Update(Frame);
+	test.Expect(numOutputs == outputs + 1, "published without an edit or a step");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckStepBudget();
+	numFailed += !CheckLag();
+	numFailed += !CheckOutputRate();
+	numFailed += !CheckRealTimeFactor();
+	numFailed += !CheckEditsWithoutSteps();
+
+	return numFailed;
+}
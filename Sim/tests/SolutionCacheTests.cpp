@@ -0,0 +1,244 @@
+// The solution cache serves revisited states, and only those
+//
+// A ladder with a cache is edited back and forth, the hit and miss counters tell how every state
+// was solved. A hit has to give the solution of a full solve of the same state, built from scratch :
+// bit for bit when the entry came from a full solve (topology edits), to rounding when it came from a
+// low rank update (value edits). States that differ in any value must never share an entry.
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/SolutionCache.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static constexpr size_t NumRungs = 16;
+static constexpr double Tolerance = 1e-12;	// Volts, low rank update against a full solve
+
+using EditFn = std::function<void(Circuit&)>;
+
+
+// The state after the edits, solved from scratch without a cache
+static std::vector<double> FullSolve(const std::vector<EditFn>& edits)
+{
+	Circuit circuit;
+	CircuitGen::ResistorLadder(circuit, NumRungs);
+	for (const EditFn& edit : edits)
+		edit(circuit);
+	circuit.UpdateSolution();
+	return GetVoltages(circuit);
+}
+
+
+static EditFn SetResistance(size_t element, double resistance)
+{
+	return [=](Circuit& circuit) { circuit.GetElement(element)->SetValue(resistance); };
+}
+
+
+// Reconnects the last resistor of the ladder
+static EditFn MoveLastResistor(size_t node)
+{
+	return [=](Circuit& circuit)
+	{
+		eElement* resistor = circuit.GetElement(circuit.GetNumElements() - 1);
+		circuit.Connect(resistor->GetEpin(1), circuit.GetNode(node));
+	};
+}
+
+
+// A ladder with a cache, counting how its solves went
+struct CachedLadder
+{
+	SolutionCache cache;
+	Circuit circuit;
+	size_t originalNode;	// Where the last resistor starts out
+
+	explicit CachedLadder(size_t maxEntries = 64)
+		: cache(maxEntries)
+	{
+		CircuitGen::ResistorLadder(circuit, NumRungs);
+		circuit.SetSolutionCache(&cache);
+		originalNode = circuit.GetElement(circuit.GetNumElements() - 1)->GetEpin(1)->GetConnectedNode()->GetIndex();
+	}
+
+	// 1 on a hit, 0 on a miss, -1 if the cache wasn't asked
+	int Update(const EditFn& edit = nullptr)
+	{
+		if (edit)
+			edit(circuit);
+
+		u64 hits = cache.GetNumHits();
+		u64 misses = cache.GetNumMisses();
+		circuit.UpdateSolution();
+		return cache.GetNumHits() > hits ? 1 : cache.GetNumMisses() > misses ? 0 : -1;
+	}
+};
+
+
+// Two topologies in turn : each one misses once, then hits with the voltages of a full solve
+static bool CheckTopologyHits()
+{
+	TestCase test("topology_hit_miss");
+	CachedLadder ladder;
+
+	test.Expect(ladder.Update() == 0, "first solve not a miss");
+	std::vector<double> stateA = GetVoltages(ladder.circuit);
+
+	test.Expect(ladder.Update(MoveLastResistor(2)) == 0, "new topology not a miss");
+	std::vector<double> stateB = GetVoltages(ladder.circuit);
+	test.Expect(!SameBits(stateA, stateB), "both topologies give the same voltages");
+
+	for (int i = 0; i < 3; i++)
+	{
+		test.Expect(ladder.Update(MoveLastResistor(ladder.originalNode)) == 1, "first topology revisited without a hit");
+		test.ExpectSameBits(GetVoltages(ladder.circuit), stateA, "hit against the first solve");
+
+		test.Expect(ladder.Update(MoveLastResistor(2)) == 1, "second topology revisited without a hit");
+		test.ExpectSameBits(GetVoltages(ladder.circuit), stateB, "hit against the first solve");
+	}
+
+	test.ExpectSameBits(stateA, FullSolve({}), "first topology against a full solve");
+	test.ExpectSameBits(stateB, FullSolve({ MoveLastResistor(2) }), "second topology against a full solve");
+	test.Expect(ladder.cache.GetNumEntries() == 2, std::to_string(ladder.cache.GetNumEntries()) + " entries, expected 2");
+
+	return test.Finish();
+}
+
+
+// A value edit is a new state : a miss, and a hit again once the value is back
+static bool CheckInvalidation()
+{
+	TestCase test("invalidation");
+	CachedLadder ladder;
+
+	ladder.Update();
+	std::vector<double> original = GetVoltages(ladder.circuit);
+	u64 hash = ladder.circuit.GetHash();
+
+	test.Expect(ladder.Update(SetResistance(1, 2.0)) == 0, "edited value served from the cache");
+	test.Expect(ladder.circuit.GetHash() != hash, "hash unchanged by the edit");
+
+	std::vector<double> edited = GetVoltages(ladder.circuit);
+	test.Expect(MaxDifference(edited, original) > 1e-3, "edit didn't change the solution");
+	test.ExpectNear(MaxDifference(edited, FullSolve({ SetResistance(1, 2.0) })), 0.0, Tolerance, "edited state against a full solve");
+
+	test.Expect(ladder.Update(SetResistance(1, 1.0)) == 1, "value set back without a hit");
+	test.Expect(ladder.circuit.GetHash() == hash, "hash not back to the original");
+	test.ExpectSameBits(GetVoltages(ladder.circuit), original, "hit against the original solve");
+
+	// The same value again leaves nothing to solve
+	test.Expect(ladder.Update(SetResistance(1, 1.0)) <= 1, "unchanged value missed");
+
+	return test.Finish();
+}
+
+
+// The same values on other elements, and values an ulp apart, are other states
+static bool CheckNoAliasing()
+{
+	TestCase test("no_aliasing");
+
+	const std::vector<EditFn> stateA = { SetResistance(1, 2.0), SetResistance(3, 3.0) };
+	const std::vector<EditFn> stateB = { SetResistance(1, 3.0), SetResistance(3, 2.0) };
+	const std::vector<EditFn> stateC = { SetResistance(1, std::nextafter(2.0, 3.0)), SetResistance(3, 3.0) };
+
+	CachedLadder ladder;
+	ladder.Update();
+
+	auto visit = [&](const std::vector<EditFn>& state)
+	{
+		for (const EditFn& edit : state)
+			edit(ladder.circuit);
+		return ladder.Update();
+	};
+
+	u64 hashes[3];
+	const std::vector<EditFn>* states[3] = { &stateA, &stateB, &stateC };
+	for (int i = 0; i < 3; i++)
+	{
+		test.Expect(visit(*states[i]) == 0, "state " + std::to_string(i) + " hit on its first visit");
+		hashes[i] = ladder.circuit.GetHash();
+	}
+
+	test.Expect(hashes[0] != hashes[1] && hashes[0] != hashes[2] && hashes[1] != hashes[2], "states share a hash");
+
+	std::vector<double> solutions[3];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			test.Expect(visit(*states[i]) == 1, "state " + std::to_string(i) + " revisited without a hit");
+			solutions[i] = GetVoltages(ladder.circuit);
+			test.ExpectNear(MaxDifference(solutions[i], FullSolve(*states[i])), 0.0, Tolerance, "state " + std::to_string(i) + " against a full solve");
+		}
+	}
+
+	test.Expect(MaxDifference(solutions[0], solutions[1]) > 1e-3, "swapped values give the same solution");
+	test.Expect(!SameBits(solutions[0], solutions[2]), "values an ulp apart give the same bits");
+
+	return test.Finish();
+}
+
+
+// A sweep of values : the first pass solves, the ones after only hit, every hit as good as a full solve
+static bool CheckSweep()
+{
+	TestCase test("sweep_hits_match_full_solves");
+	CachedLadder ladder;
+	ladder.Update();
+
+	const double sweep[] = { 10.0, 20.0, 50.0, 100.0, 200.0, 500.0 };
+	std::vector<double> fullSolves[std::size(sweep)];
+	for (size_t i = 0; i < std::size(sweep); i++)
+		fullSolves[i] = FullSolve({ SetResistance(2, sweep[i]) });
+
+	for (int pass = 0; pass < 3; pass++)
+	{
+		for (size_t i = 0; i < std::size(sweep); i++)
+		{
+			int result = ladder.Update(SetResistance(2, sweep[i]));
+			test.Expect(result == (pass > 0 ? 1 : 0), "pass " + std::to_string(pass) + " value " + std::to_string(sweep[i]) + (result == 1 ? " hit" : " missed"));
+			test.ExpectNear(MaxDifference(GetVoltages(ladder.circuit), fullSolves[i]), 0.0, Tolerance, "value " + std::to_string(sweep[i]) + " against a full solve");
+		}
+	}
+
+	return test.Finish();
+}
+
+
+// Past the entry count the least recently used state goes
+static bool CheckEviction()
+{
+	TestCase test("eviction");
+	CachedLadder ladder(2);
+
+	ladder.Update();
+	ladder.Update(MoveLastResistor(2));
+	ladder.Update(MoveLastResistor(3));
+	test.Expect(ladder.cache.GetNumEntries() == 2, std::to_string(ladder.cache.GetNumEntries()) + " entries, expected 2");
+	test.Expect(ladder.cache.GetNumEvictions() == 1, std::to_string(ladder.cache.GetNumEvictions()) + " evictions, expected 1");
+
+	test.Expect(ladder.Update(MoveLastResistor(2)) == 1, "recent state evicted");
+	test.Expect(ladder.Update(MoveLastResistor(ladder.originalNode)) == 0, "oldest state still cached");
+	test.ExpectSameBits(GetVoltages(ladder.circuit), FullSolve({}), "solved again against a full solve");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckTopologyHits();
+	numFailed += !CheckInvalidation();
+	numFailed += !CheckNoAliasing();
+	numFailed += !CheckSweep();
+	numFailed += !CheckEviction();
+
+	return numFailed;
+}
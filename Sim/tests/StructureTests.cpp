@@ -0,0 +1,245 @@
+// Structural checks name the elements and nodes of a bad circuit
+//
+// One circuit per issue the check knows, built by hand so the expected elements (by position) and
+// nodes (by index) are known, and clean circuits that must pass without a report.
+
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+#include "sim/Structure.h"
+#include "sim/Reduction.h"
+#include "sim/CircuitGenerators.h"
+#include "TestCheck.h"
+
+
+static std::string Describe(const std::vector<size_t>& list)
+{
+	std::ostringstream text;
+	text << "{";
+	for (size_t i = 0; i < list.size(); i++)
+		text << (i ? ", " : " ") << list[i];
+	text << " }";
+	return text.str();
+}
+
+
+static void ExpectList(TestCase& test, const std::vector<size_t>& list, const std::vector<size_t>& expected, const char* what)
+{
+	test.Expect(list == expected, std::string(what) + " are " + Describe(list) + ", expected " + Describe(expected));
+}
+
+
+// Runs the check of the circuit, expects a single issue of the type and returns it
+static const StructureIssue* ExpectSingleIssue(TestCase& test, Circuit& circuit, eStructureIssue type)
+{
+	test.Expect(!circuit.CheckStructure(), "check passed");
+
+	const std::vector<StructureIssue>& issues = circuit.GetStructureCheck()->GetIssues();
+	if (!test.Expect(issues.size() == 1, std::to_string(issues.size()) + " issues, expected 1"))
+		return nullptr;
+
+	if (!test.Expect(issues[0].type == type, std::string("issue is ") + StructureCheck::GetIssueName(issues[0].type)))
+		return nullptr;
+
+	return &issues[0];
+}
+
+
+static void Connect(Circuit& circuit, eElement* element, eNode* node0, eNode* node1)
+{
+	circuit.Connect(element->GetEpin(0), node0);
+	circuit.Connect(element->GetEpin(1), node1);
+}
+
+
+// V1 in 0, R1 in out, R2 a b, C1 out a : a and b only hang on the capacitor, open in DC
+static bool CheckFloatingSubnet()
+{
+	TestCase test("floating_subnet");
+
+	Circuit circuit;
+	eNode* ground = circuit.CreateNode();
+	eNode* in = circuit.CreateNode();
+	eNode* out = circuit.CreateNode();
+	eNode* a = circuit.CreateNode();
+	eNode* b = circuit.CreateNode();
+
+	Connect(circuit, circuit.AddVoltageSource(5.0), in, ground);
+	Connect(circuit, circuit.AddResistor(1000.0), in, out);
+	Connect(circuit, circuit.AddResistor(1000.0), a, b);
+	Connect(circuit, circuit.AddCapacitor(1e-6), out, a);
+
+	if (const StructureIssue* issue = ExpectSingleIssue(test, circuit, eStructureIssue::FloatingSubnet))
+	{
+		ExpectList(test, issue->nodes, { a->GetIndex(), b->GetIndex() }, "nodes");
+		ExpectList(test, issue->elements, { 2, 3 }, "elements");
+	}
+
+	test.Expect(!circuit.UpdateSolution(), "solved a floating circuit");
+
+	// With a step the capacitor conducts, nothing floats any more
+	circuit.SetStep(1e-6);
+	test.Expect(circuit.CheckStructure(), "floating with the capacitor conducting");
+
+	return test.Finish();
+}
+
+
+// A reduced model with its first two ports open, on two nodes nothing else reaches. Every pin counts :
+// the nodes are one floating set, the model is on it
+static bool CheckFloatingMultiport()
+{
+	TestCase test("floating_multiport");
+
+	Circuit circuit;
+	eNode* ground = circuit.CreateNode();
+	eNode* in = circuit.CreateNode();
+	eNode* a = circuit.CreateNode();
+	eNode* b = circuit.CreateNode();
+
+	Connect(circuit, circuit.AddVoltageSource(1.0), in, ground);
+	Connect(circuit, circuit.AddResistor(1000.0), in, ground);
+
+	// 3 ports and the reference, no states
+	Eigen::MatrixXd G = Eigen::MatrixXd::Identity(3, 3);
+	Eigen::MatrixXd C = Eigen::MatrixXd::Zero(3, 3);
+	eReducedModel* model = circuit.AddElement<eReducedModel>(G, C, 3, Eigen::VectorXd());
+	circuit.Connect(model->GetEpin(2), a);
+	circuit.Connect(model->GetEpin(3), b);
+
+	if (const StructureIssue* issue = ExpectSingleIssue(test, circuit, eStructureIssue::FloatingSubnet))
+	{
+		ExpectList(test, issue->nodes, { a->GetIndex(), b->GetIndex() }, "nodes");
+		ExpectList(test, issue->elements, { 2 }, "elements");
+	}
+
+	return test.Finish();
+}
+
+
+// V1 in 0, V2 in mid, L1 mid 0 : the inductor is a short in DC and closes a loop of sources
+static bool CheckVoltageLoop()
+{
+	TestCase test("voltage_loop");
+
+	Circuit circuit;
+	eNode* ground = circuit.CreateNode();
+	eNode* in = circuit.CreateNode();
+	eNode* mid = circuit.CreateNode();
+
+	Connect(circuit, circuit.AddVoltageSource(5.0), in, ground);
+	Connect(circuit, circuit.AddVoltageSource(2.0), in, mid);
+	Connect(circuit, circuit.AddInductor(1e-3), mid, ground);
+	Connect(circuit, circuit.AddResistor(1000.0), in, ground);
+
+	// The closing element first, then the path of the forest back from its second pin
+	if (const StructureIssue* issue = ExpectSingleIssue(test, circuit, eStructureIssue::VoltageLoop))
+	{
+		ExpectList(test, issue->elements, { 2, 0, 1 }, "elements");
+		ExpectList(test, issue->nodes, { mid->GetIndex(), ground->GetIndex(), in->GetIndex() }, "nodes");
+	}
+
+	// In a transient the inductor is a conductance, the loop is gone
+	circuit.SetStep(1e-6);
+	test.Expect(circuit.CheckStructure(), "loop with the inductor conducting");
+
+	return test.Finish();
+}
+
+
+// V1 a a : a source across a single node is a loop of its own
+static bool CheckSelfLoop()
+{
+	TestCase test("voltage_self_loop");
+
+	Circuit circuit;
+	eNode* ground = circuit.CreateNode();
+	eNode* a = circuit.CreateNode();
+
+	Connect(circuit, circuit.AddResistor(1.0), a, ground);
+	Connect(circuit, circuit.AddVoltageSource(1.0), a, a);
+
+	if (const StructureIssue* issue = ExpectSingleIssue(test, circuit, eStructureIssue::VoltageLoop))
+	{
+		ExpectList(test, issue->elements, { 1 }, "elements");
+		ExpectList(test, issue->nodes, { a->GetIndex() }, "nodes");
+	}
+
+	return test.Finish();
+}
+
+
+// V1 in 0, R1 in 0, R2 in out with R2 open : out is connected, but its row is all zeros. Only the
+// rank check sees it
+static bool CheckSingularRow()
+{
+	TestCase test("singular_rows");
+
+	Circuit circuit;
+	eNode* ground = circuit.CreateNode();
+	eNode* in = circuit.CreateNode();
+	eNode* out = circuit.CreateNode();
+
+	Connect(circuit, circuit.AddVoltageSource(1.0), in, ground);
+	Connect(circuit, circuit.AddResistor(1000.0), in, ground);
+	Connect(circuit, circuit.AddResistor(std::numeric_limits<double>::infinity()), in, out);
+
+	if (const StructureIssue* issue = ExpectSingleIssue(test, circuit, eStructureIssue::SingularRows))
+	{
+		ExpectList(test, issue->nodes, { out->GetIndex() }, "nodes");
+		ExpectList(test, issue->elements, { 2 }, "elements");
+	}
+
+	const StructureCheck* check = circuit.GetStructureCheck();
+	test.Expect(check->GetNumUnknowns() == 3, "unknowns " + std::to_string(check->GetNumUnknowns()));
+	test.Expect(check->GetStructuralRank() == 2, "structural rank " + std::to_string(check->GetStructuralRank()));
+
+	// Closing the resistor fixes it
+	static_cast<eResistor*>(circuit.GetElement(2))->SetResistance(1000.0);
+	test.Expect(circuit.CheckStructure(), "singular with the resistor closed");
+
+	return test.Finish();
+}
+
+
+static bool CheckClean(const char* name, void (*generate)(Circuit&), double step = 0.0)
+{
+	TestCase test(name);
+
+	Circuit circuit;
+	generate(circuit);
+	circuit.SetStep(step);
+
+	test.Expect(circuit.CheckStructure(), "check failed");
+
+	const StructureCheck* check = circuit.GetStructureCheck();
+	test.Expect(check->GetIssues().empty(), std::to_string(check->GetIssues().size()) + " issues");
+	test.Expect(check->GetNumUnknowns() > 0, "no unknowns");
+	test.Expect(check->GetStructuralRank() == check->GetNumUnknowns(), "structural rank " + std::to_string(check->GetStructuralRank())
+		+ " of " + std::to_string(check->GetNumUnknowns()));
+	test.Expect(circuit.UpdateSolution(), "not solved");
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckFloatingSubnet();
+	numFailed += !CheckFloatingMultiport();
+	numFailed += !CheckVoltageLoop();
+	numFailed += !CheckSelfLoop();
+	numFailed += !CheckSingularRow();
+
+	numFailed += !CheckClean("clean_ladder", [](Circuit& c) { CircuitGen::ResistorLadder(c, 32); });
+	numFailed += !CheckClean("clean_source_heavy", [](Circuit& c) { CircuitGen::SourceHeavy(c, 32); });
+	numFailed += !CheckClean("clean_rlc_dc", [](Circuit& c) { CircuitGen::RlcLadder(c, 16); });
+	numFailed += !CheckClean("clean_rlc_transient", [](Circuit& c) { CircuitGen::RlcLadder(c, 16); }, 1e-6);
+
+	return numFailed;
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "sim/Scheme.h"
+
+// Checks and helpers shared by the core tests
+//
+// A case collects its checks and prints one line when it finishes, [ OK ] or [ FAIL ] with the first
+// check that failed. A test's exit code is the number of failed cases.
+
+
+// Bit for bit, not within rounding : -0.0 and 0.0 differ
+inline bool SameBits(const double* a, const double* b, size_t count)
+{
+	return count == 0 || !std::memcmp(a, b, sizeof(double) * count);
+}
+
+inline bool SameBits(const std::vector<double>& a, const std::vector<double>& b)
+{
+	return a.size() == b.size() && SameBits(a.data(), b.data(), a.size());
+}
+
+
+// Node voltages in node order
+inline std::vector<double> GetVoltages(Circuit& circuit)
+{
+	std::vector<double> voltages(circuit.GetNumNodes());
+	for (size_t i = 0; i < voltages.size(); i++)
+		voltages[i] = circuit.GetNode(i)->GetVoltage();
+	return voltages;
+}
+
+
+// Largest difference of two solutions, infinite if their sizes differ
+inline double MaxDifference(const std::vector<double>& a, const std::vector<double>& b)
+{
+	if (a.size() != b.size())
+		return std::numeric_limits<double>::infinity();
+
+	double difference = 0.0;
+	for (size_t i = 0; i < a.size(); i++)
+		difference = std::max(difference, std::abs(a[i] - b[i]));
+	return difference;
+}
+
+
+inline double MaxDifference(Circuit& a, Circuit& b)
+{
+	return MaxDifference(GetVoltages(a), GetVoltages(b));
+}
+
+
+class TestCase
+{
+	std::string m_Name;
+	std::string m_Failure;
+	size_t m_NumFailed = 0;
+
+public:
+
+	explicit TestCase(std::string name) : m_Name(std::move(name)) { }
+
+	bool Expect(bool condition, const std::string& what)
+	{
+		if (!condition && m_NumFailed++ == 0)
+			m_Failure = what;
+		return condition;
+	}
+
+	bool ExpectNear(double value, double expected, double tolerance, const std::string& what)
+	{
+		if (std::abs(value - expected) <= tolerance)
+			return true;
+
+		std::ostringstream message;
+		message << what << " is " << value << ", expected " << expected << " within " << tolerance;
+		return Expect(false, message.str());
+	}
+
+	bool ExpectSameBits(const double* values, const double* expected, size_t count, const std::string& what)
+	{
+		size_t numDifferent = 0;
+		for (size_t i = 0; i < count; i++)
+			numDifferent += !SameBits(values + i, expected + i, 1);
+		if (numDifferent == 0)
+			return true;
+
+		std::ostringstream message;
+		message << what << " : " << numDifferent << " of " << count << " values differ in their bits";
+		return Expect(false, message.str());
+	}
+
+	bool ExpectSameBits(const std::vector<double>& values, const std::vector<double>& expected, const std::string& what)
+	{
+		if (!Expect(values.size() == expected.size(), what + " : sizes differ"))
+			return false;
+		return ExpectSameBits(values.data(), expected.data(), values.size(), what);
+	}
+
+	bool ExpectSameBits(double value, double expected, const std::string& what)
+	{
+		if (SameBits(&value, &expected, 1))
+			return true;
+
+		std::ostringstream message;
+		message.precision(17);
+		message << what << " is " << value << ", expected the bits of " << expected;
+		return Expect(false, message.str());
+	}
+
+	// Prints the result, true if every check passed
+	bool Finish() const
+	{
+		if (m_NumFailed == 0)
+		{
+			std::cout << "[ OK ]   " << m_Name << std::endl;
+			return true;
+		}
+
+		std::cout << "[ FAIL ] " << m_Name << " : " << m_Failure;
+		if (m_NumFailed > 1)
+			std::cout << " (" << m_NumFailed << " failed checks)";
+		std::cout << std::endl;
+		return false;
+	}
+};
@@ -0,0 +1,172 @@
+// The min/max pyramid gives what a scan of the samples gives
+//
+// Random signals of lengths that are not multiples of the branch factor, so the top of the pyramid
+// is a partial block and the complete blocks of a level end short of the samples. Ranges with ragged
+// ends at random against a brute force min/max, envelopes against the samples their columns cover.
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sim/Waveform.h"
+#include "TestCheck.h"
+
+
+static constexpr int NumRanges = 2000;
+
+
+static Waveform::Extent BruteRange(const Waveform& waveform, u64 begin, u64 end)
+{
+	Waveform::Extent extent = Waveform::EmptyExtent;
+	for (u64 i = begin; i < std::min(end, waveform.GetNumSamples()); i++)
+	{
+		extent.min = std::min(extent.min, waveform.GetSample(i));
+		extent.max = std::max(extent.max, waveform.GetSample(i));
+	}
+	return extent;
+}
+
+
+static bool SameExtent(Waveform::Extent a, Waveform::Extent b)
+{
+	return (a.IsEmpty() && b.IsEmpty()) || (a.min == b.min && a.max == b.max);
+}
+
+
+// Within means every sample of the inner range is inside, and nothing outside the outer one is taken
+static bool Contains(Waveform::Extent outer, Waveform::Extent inner)
+{
+	return inner.IsEmpty() || (outer.min <= inner.min && outer.max >= inner.max);
+}
+
+
+static void Fill(Waveform& waveform, u64 numSamples, std::mt19937& random)
+{
+	std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+	for (u64 i = 0; i < numSamples; i++)
+		waveform.Append(value(random));
+}
+
+
+static void ExpectRanges(TestCase& test, const Waveform& waveform, std::mt19937& random, const std::string& when)
+{
+	u64 numSamples = waveform.GetNumSamples();
+	std::uniform_int_distribution<u64> position(0, numSamples + Waveform::BranchFactor);
+
+	for (int i = 0; i < NumRanges; i++)
+	{
+		u64 begin = position(random);
+		u64 end = position(random);
+		if (i % 4 == 0)
+			end = numSamples;	// Into the partial blocks
+
+		Waveform::Extent extent = waveform.GetRange(begin, end);
+		if (!test.Expect(SameExtent(extent, BruteRange(waveform, begin, end)), "range [" + std::to_string(begin) + ", " + std::to_string(end) + ") " + when))
+			return;
+	}
+
+	test.Expect(SameExtent(waveform.GetRange(0, numSamples), BruteRange(waveform, 0, numSamples)), "whole range " + when);
+}
+
+
+static bool CheckRanges()
+{
+	TestCase test("ranges");
+	std::mt19937 random(1234);
+
+	for (u64 numSamples : { 1, 2, 3, 5, 17, 63, 65, 255, 1023, 1025, 4097, 10007 })
+	{
+		Waveform waveform(1e-3);
+		Fill(waveform, numSamples, random);
+		ExpectRanges(test, waveform, random, "of " + std::to_string(numSamples) + " samples");
+	}
+
+	test.Expect(Waveform(1e-3).GetRange(0, 10).IsEmpty(), "range of an empty waveform");
+
+	return test.Finish();
+}
+
+
+// Cleared and filled again to another length, the blocks of the first fill must not show
+static bool CheckClear()
+{
+	TestCase test("clear");
+	std::mt19937 random(99);
+
+	Waveform waveform(1e-3);
+	Fill(waveform, 5000, random);
+	waveform.Clear();
+	test.Expect(waveform.GetRange(0, 5000).IsEmpty(), "samples left after the clear");
+
+	Fill(waveform, 1234, random);
+	ExpectRanges(test, waveform, random, "after the clear");
+
+	return test.Finish();
+}
+
+
+// A column covers the samples from ceil(start) to ceil(end) of its slice, both edges rounded down
+// by less than an eighth of a column. Below eight samples a column it reads the samples themselves
+static bool CheckEnvelope()
+{
+	TestCase test("envelope");
+	std::mt19937 random(7);
+
+	for (u64 numSamples : { 7, 1001, 4099, 65537 })
+	{
+		Waveform waveform(1.0);
+		Fill(waveform, numSamples, random);
+
+		for (size_t numColumns : { 1, 13, 100, 640 })
+		{
+			for (double window : { 0.5, 1.0, 1.3 })
+			{
+				std::string when = std::to_string(numSamples) + " samples, " + std::to_string(numColumns) + " columns, window " + std::to_string(window);
+
+				double start = -0.1 * double(numSamples);
+				double duration = window * double(numSamples);
+				double samplesPerColumn = duration / double(numColumns);
+				double slack = samplesPerColumn / 8.0;
+
+				std::vector<Waveform::Extent> columns(numColumns);
+				waveform.GetEnvelope(start, duration, numColumns, columns.data());
+
+				for (size_t c = 0; c < numColumns; c++)
+				{
+					double from = std::ceil(start + double(c) * samplesPerColumn);
+					double to = std::ceil(start + double(c + 1) * samplesPerColumn);
+					auto toIndex = [&](double position) { return u64(std::clamp(position, 0.0, double(numSamples))); };
+
+					std::string column = "column " + std::to_string(c) + ", " + when;
+					if (samplesPerColumn < 8.0)
+					{
+						test.Expect(SameExtent(columns[c], BruteRange(waveform, toIndex(from), toIndex(to))), column);
+						continue;
+					}
+
+					// The newest samples are in the last column reaching them, whatever the rounding
+					Waveform::Extent inner = BruteRange(waveform, toIndex(from), toIndex(to >= double(numSamples) ? to : to - slack));
+					Waveform::Extent outer = BruteRange(waveform, toIndex(from - slack), toIndex(to));
+					test.Expect(Contains(columns[c], inner), "misses samples of " + column);
+					test.Expect(Contains(outer, columns[c]), "takes samples outside of " + column);
+				}
+			}
+		}
+	}
+
+	return test.Finish();
+}
+
+
+int main()
+{
+	int numFailed = 0;
+
+	numFailed += !CheckRanges();
+	numFailed += !CheckClear();
+	numFailed += !CheckEnvelope();
+
+	return numFailed;
+}